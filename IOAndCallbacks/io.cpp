@@ -15,78 +15,959 @@
 #endif // IO_DISABLE_WRITES_TO_DRIVE_WITH_PARTITIONS
 
 #include "io.h"
+#include "io_checksum_table.h"
+#include "io_simulated_device.h"
 
 #include <algorithm>
+#include <thread>
+
+// max IOs per trip to the OS in drainSubmissionQueue()
+#define SUBMISSION_QUEUE_DRAIN_BATCH_SIZE 256
+
+// pollSimulated() sleeps until this close to the next completion then yields the rest, since sleeps overshoot
+#define SIMULATED_POLL_SPIN_NANOSECONDS 50000
+
+#ifdef IO_WIN32
+#define GET_LAST_OS_ERROR() GetLastError()
+#define IO_ERROR_ACCESS_DENIED ERROR_ACCESS_DENIED
+#define IO_ERROR_NOT_QUEUED ERROR_NOT_READY
+#define IO_ERROR_NO_DEVICE ERROR_FILE_NOT_FOUND
+#define SET_LAST_OS_ERROR(error) SetLastError(error)
+#else
+#include <errno.h>
+#define GET_LAST_OS_ERROR() errno
+#define IO_ERROR_ACCESS_DENIED EACCES
+#define IO_ERROR_NOT_QUEUED EAGAIN
+#define IO_ERROR_NO_DEVICE ENODEV
+#define SET_LAST_OS_ERROR(error) (errno = (error))
+#endif
+
+// records the checksums of everything a write is about to write, buffer by buffer if it is vectored
+static void updateChecksums(IOChecksumTable* checksumTable, const IO_CALLBACK_STRUCT* ioCallbackStruct, uint32_t blockSize)
+{
+	if (!ioCallbackStruct->ioVecs)
+	{
+		checksumTable->update(ioCallbackStruct->xferBuffer, ioCallbackStruct->lba, ioCallbackStruct->numBlocksRequested);
+		return;
+	}
+
+	uint64_t lba = ioCallbackStruct->lba;
+	for (size_t i = 0; i < ioCallbackStruct->numIoVecs; i++)
+	{
+		uint64_t numBlocks = ioCallbackStruct->ioVecs[i].iov_len / blockSize;
+		checksumTable->update(ioCallbackStruct->ioVecs[i].iov_base, lba, numBlocks);
+		lba += numBlocks;
+	}
+}
+
+// returns true if everything a read brought back matches its checksums
+static bool checkChecksums(const IOChecksumTable* checksumTable, const IO_CALLBACK_STRUCT* ioCallbackStruct, uint32_t blockSize)
+{
+	if (!ioCallbackStruct->ioVecs)
+	{
+		return checksumTable->check(ioCallbackStruct->xferBuffer, ioCallbackStruct->lba,
+			ioCallbackStruct->numBlocksRequested) == ioCallbackStruct->numBlocksRequested;
+	}
+
+	uint64_t lba = ioCallbackStruct->lba;
+	for (size_t i = 0; i < ioCallbackStruct->numIoVecs; i++)
+	{
+		uint64_t numBlocks = ioCallbackStruct->ioVecs[i].iov_len / blockSize;
+		if (checksumTable->check(ioCallbackStruct->ioVecs[i].iov_base, lba, numBlocks) != numBlocks)
+		{
+			return false;
+		}
+		lba += numBlocks;
+	}
+	return true;
+}
 
 bool IO::read(uint64_t lba, uint64_t blockCount, IO_CALLBACK_FUNCTION* callback, void* userCallbackData)
 {
+	// given back to the pool later
+	IO_CALLBACK_STRUCT* ioCallbackStruct = allocateIoCallbackStruct();
+	if (!ioCallbackStruct)
+	{
+		return false;
+	}
+
+	// small enough reads get a recycled buffer of about their size
 	auto bytesRequested = blockCount * getBlockSize();
+	size_t sizeClass = getReadBufferSizeClass(blockCount);
+	bool fromPool = sizeClass < READ_BUFFER_POOL_SIZE_CLASSES;
+	void* xferBuffer = fromPool ? allocateReadBuffer(sizeClass) : getAlignedBuffer((size_t)bytesRequested);
+	if (!xferBuffer)
+	{
+		freeRequests.push_back(ioCallbackStruct);
+		return false;
+	}
 
-	// free later
-	IO_CALLBACK_STRUCT* ioCallbackStruct = new IO_CALLBACK_STRUCT(lba, blockCount, bytesRequested,
-		getAlignedBuffer((size_t)bytesRequested), IO_OPERATION_READ, callback, userCallbackData);
+	*ioCallbackStruct = IO_CALLBACK_STRUCT(lba, blockCount, bytesRequested,
+		xferBuffer, IO_OPERATION_READ, callback, userCallbackData);
+	ioCallbackStruct->xferBufferFromPool = fromPool;
+
+	return submitIo(ioCallbackStruct);
+}
+
+bool IO::read(uint64_t lba, uint64_t blockCount, void* xferData, IO_CALLBACK_FUNCTION* callback, void* userCallbackData)
+{
+	// given back to the pool later
+	IO_CALLBACK_STRUCT* ioCallbackStruct = allocateIoCallbackStruct();
+	if (!ioCallbackStruct)
+	{
+		return false;
+	}
+
+	*ioCallbackStruct = IO_CALLBACK_STRUCT(lba, blockCount, blockCount * getBlockSize(),
+		xferData, IO_OPERATION_READ, callback, userCallbackData);
+
+	// the user owns this buffer
+	ioCallbackStruct->freeXferBufferAfterCallback = false;
 
 	return submitIo(ioCallbackStruct);
 }
 
 bool IO::write(uint64_t lba, uint64_t blockCount, void* xferData, IO_CALLBACK_FUNCTION* callback, void* userCallbackData)
 {
-	// free later
-	IO_CALLBACK_STRUCT* ioCallbackStruct = new IO_CALLBACK_STRUCT(lba, blockCount, blockCount * getBlockSize(),
+	// given back to the pool later
+	IO_CALLBACK_STRUCT* ioCallbackStruct = allocateIoCallbackStruct();
+	if (!ioCallbackStruct)
+	{
+		return false;
+	}
+
+	*ioCallbackStruct = IO_CALLBACK_STRUCT(lba, blockCount, blockCount * getBlockSize(),
 		xferData, IO_OPERATION_WRITE, callback, userCallbackData);
 
 	return submitIo(ioCallbackStruct);
 }
 
-bool IO::submitIo(IO_CALLBACK_STRUCT* ioCallbackStruct)
+bool IO::readv(uint64_t lba, uint64_t blockCount, const IO_IOVEC* ioVecs, size_t numIoVecs, IO_CALLBACK_FUNCTION* callback, void* userCallbackData)
+{
+	return submitVectoredIo(lba, blockCount, ioVecs, numIoVecs, IO_OPERATION_READ, callback, userCallbackData);
+}
+
+bool IO::writev(uint64_t lba, uint64_t blockCount, const IO_IOVEC* ioVecs, size_t numIoVecs, IO_CALLBACK_FUNCTION* callback, void* userCallbackData)
+{
+	return submitVectoredIo(lba, blockCount, ioVecs, numIoVecs, IO_OPERATION_WRITE, callback, userCallbackData);
+}
+
+bool IO::submitVectoredIo(uint64_t lba, uint64_t blockCount, const IO_IOVEC* ioVecs, size_t numIoVecs,
+	IO_OPERATION_ENUM operation, IO_CALLBACK_FUNCTION* callback, void* userCallbackData)
 {
-	bool result = true;
+	if (!ioVecs || numIoVecs == 0 || numIoVecs > IO_MAX_IOVECS)
+	{
+		fprintf(stderr, "Vectored IOs need between 1 and %d buffers, not %zu\n", IO_MAX_IOVECS, numIoVecs);
+		return false;
+	}
 
+	uint64_t bytesRequested = blockCount * getBlockSize();
+	uint64_t totalLength = 0;
+	for (size_t i = 0; i < numIoVecs; i++)
+	{
+		if (ioVecs[i].iov_len == 0 || ioVecs[i].iov_len % getBlockSize())
+		{
+			fprintf(stderr, "Vectored IO buffer %zu is %zu bytes, not a multiple of the block size\n", i, (size_t)ioVecs[i].iov_len);
+			return false;
+		}
+		totalLength += ioVecs[i].iov_len;
+	}
+
+	if (totalLength != bytesRequested)
+	{
+		fprintf(stderr, "Vectored IO buffers add up to %llu bytes, not %llu\n", (unsigned long long)totalLength, (unsigned long long)bytesRequested);
+		return false;
+	}
+
+	// given back to the pool later
+	IO_CALLBACK_STRUCT* ioCallbackStruct = allocateIoCallbackStruct();
+	if (!ioCallbackStruct)
+	{
+		return false;
+	}
+
+	*ioCallbackStruct = IO_CALLBACK_STRUCT(lba, blockCount, bytesRequested,
+		NULL, operation, callback, userCallbackData);
+	ioCallbackStruct->ioVecs = ioVecs;
+	ioCallbackStruct->numIoVecs = numIoVecs;
+
+	// the user owns these buffers
+	ioCallbackStruct->freeXferBufferAfterCallback = false;
+
+	return submitIo(ioCallbackStruct);
+}
+
+IO_CALLBACK_STRUCT* IO::allocateIoCallbackStruct()
+{
+	if (freeRequests.empty())
+	{
+		// back-pressure: the caller needs to poll() before queueing more
 #if IO_ENABLE_STATS
-	if (ioCallbackStruct->operation == IO_OPERATION_READ)
+		IO_STATS_SHARD* shard = ioStats.acquireShard();
+		shard->stats.NumberOfRequestPoolExhaustions++;
+		shard->release();
+#endif // IO_ENABLE_STATS
+		return NULL;
+	}
+
+	IO_CALLBACK_STRUCT* ioCallbackStruct = freeRequests.back();
+	freeRequests.pop_back();
+	return ioCallbackStruct;
+}
+
+size_t IO::getFreeRequestCount() const
+{
+	return freeRequests.size();
+}
+
+void* IO::allocateReadBuffer(size_t sizeClass)
+{
+	std::vector<void*>& freeBuffers = freeReadBuffers[sizeClass];
+	if (freeBuffers.empty())
 	{
-		ioStatsStruct.NumberOfQueuedReads++;
-		ioStatsStruct.LargestQueuedReadInSectors = std::max(ioCallbackStruct->numBlocksRequested, ioStatsStruct.LargestQueuedReadInSectors);
-		ioStatsStruct.LowestQueuedReadLba = std::max(ioCallbackStruct->lba, ioStatsStruct.LowestQueuedReadLba);
-		ioStatsStruct.HighestQueuedReadLba = std::max(ioCallbackStruct->lba, ioStatsStruct.HighestQueuedReadLba);
+		void* buffer = getAlignedBuffer(getReadBufferPoolBufferSize(sizeClass));
+		if (buffer)
+		{
+			readBufferPool.push_back(buffer);
+		}
+		return buffer;
 	}
-	else if (ioCallbackStruct->operation == IO_OPERATION_WRITE)
+
+	void* buffer = freeBuffers.back();
+	freeBuffers.pop_back();
+	return buffer;
+}
+
+size_t IO::getReadBufferPoolBufferSize(size_t sizeClass)
+{
+	return (size_t)getBlockSize() << sizeClass;
+}
+
+size_t IO::getReadBufferSizeClass(uint64_t blockCount)
+{
+	size_t sizeClass = 0;
+	while (sizeClass < READ_BUFFER_POOL_SIZE_CLASSES && ((uint64_t)1 << sizeClass) < blockCount)
 	{
-		ioStatsStruct.NumberOfQueuedWrites++;
-		ioStatsStruct.LargestQueuedWriteInSectors = std::max(ioCallbackStruct->numBlocksRequested, ioStatsStruct.LargestQueuedWriteInSectors);
-		ioStatsStruct.LowestQueuedWriteLba = std::max(ioCallbackStruct->lba, ioStatsStruct.LowestQueuedWriteLba);
-		ioStatsStruct.HighestQueuedWriteLba = std::max(ioCallbackStruct->lba, ioStatsStruct.HighestQueuedWriteLba);
+		sizeClass++;
 	}
+	return sizeClass;
+}
+
+void IO::freeReadBufferPool()
+{
+	for (void* buffer : readBufferPool)
+	{
+		freeAlignedBuffer(buffer);
+	}
+
+	readBufferPool.clear();
+	for (std::vector<void*>& freeBuffers : freeReadBuffers)
+	{
+		freeBuffers.clear();
+	}
+}
+
+void IO::initRequestPool(size_t requestPoolSize)
+{
+	requestPool.resize(requestPoolSize);
+
+	// hand out the front of the pool first
+	freeRequests.reserve(requestPoolSize);
+	for (size_t i = requestPoolSize; i > 0; i--)
+	{
+		freeRequests.push_back(&requestPool[i - 1]);
+	}
+}
+
+bool IO::submitIo(IO_CALLBACK_STRUCT* ioCallbackStruct)
+{
+	if (plugged)
+	{
+		// queued later by flush()
+		pluggedIos.push_back(ioCallbackStruct);
+		return true;
+	}
+
+	return submitIoBatch(&ioCallbackStruct, 1, false) == 1;
+}
+
+size_t IO::submitIoBatch(IO_CALLBACK_STRUCT** ioCallbackStructs, size_t count)
+{
+	return submitIoBatch(ioCallbackStructs, count, false);
+}
+
+size_t IO::submitIoBatch(IO_CALLBACK_STRUCT** ioCallbackStructs, size_t count, bool callbackOnFailure)
+{
+	batchIos.clear();
+
+#if IO_ENABLE_STATS
+	// held for the whole batch so it is one lock instead of one per IO
+	IO_STATS_SHARD* shard = ioStats.acquireShard();
+	IO_STATS_STRUCT& stats = shard->stats;
+#endif // IO_ENABLE_STATS
+
+	for (size_t i = 0; i < count; i++)
+	{
+		IO_CALLBACK_STRUCT* ioCallbackStruct = ioCallbackStructs[i];
+
+#if IO_ENABLE_STATS
+		if (ioCallbackStruct->operation == IO_OPERATION_READ)
+		{
+			stats.LowestQueuedReadLba = stats.NumberOfQueuedReads ? std::min(ioCallbackStruct->lba, stats.LowestQueuedReadLba) : ioCallbackStruct->lba;
+			stats.NumberOfQueuedReads++;
+			stats.LargestQueuedReadInSectors = std::max(ioCallbackStruct->numBlocksRequested, stats.LargestQueuedReadInSectors);
+			stats.HighestQueuedReadLba = std::max(ioCallbackStruct->lba, stats.HighestQueuedReadLba);
+		}
+		else if (ioCallbackStruct->operation == IO_OPERATION_WRITE)
+		{
+			stats.LowestQueuedWriteLba = stats.NumberOfQueuedWrites ? std::min(ioCallbackStruct->lba, stats.LowestQueuedWriteLba) : ioCallbackStruct->lba;
+			stats.NumberOfQueuedWrites++;
+			stats.LargestQueuedWriteInSectors = std::max(ioCallbackStruct->numBlocksRequested, stats.LargestQueuedWriteInSectors);
+			stats.HighestQueuedWriteLba = std::max(ioCallbackStruct->lba, stats.HighestQueuedWriteLba);
+		}
 #endif // IO_ENABLE_STATS
 
 #if IO_DISABLE_WRITES_TO_DRIVE_WITH_PARTITIONS
-	if (ioCallbackStruct->operation == IO_OPERATION_WRITE && !allowWrites)
+		if (ioCallbackStruct->operation == IO_OPERATION_WRITE && !allowWrites)
+		{
+			fprintf(stderr, "Writes are not currently allowed via this IO object\n");
+
+			// don't send to the OS. Handled with the other failures below
+			ioCallbackStruct->errorCode = IO_ERROR_ACCESS_DENIED;
+			continue;
+		}
+#endif
+
+		// set again if it doesn't make it to the OS
+		ioCallbackStruct->errorCode = 0;
+		batchIos.push_back(ioCallbackStruct);
+	}
+
+#if IO_ENABLE_STATS
+	// don't hold the lock over checksumming or the syscall
+	shard->release();
+#endif // IO_ENABLE_STATS
+
+	// before the OS has the buffer, so a read racing this write is checked against the new data
+	if (checksumTable)
 	{
-		fprintf(stderr, "Writes are not currently allowed via this IO object\n");
-		result = false;
+		for (IO_CALLBACK_STRUCT* ioCallbackStruct : batchIos)
+		{
+			if (ioCallbackStruct->operation == IO_OPERATION_WRITE)
+			{
+				updateChecksums(checksumTable.get(), ioCallbackStruct, getBlockSize());
+			}
+		}
 	}
-#endif
 
-	result = result && doSubmitIo(ioCallbackStruct);
+#if IO_ENABLE_STATS
+	// one clock read covers the whole batch
+	uint64_t submitTime = getTimestampNanoseconds();
+	for (IO_CALLBACK_STRUCT* ioCallbackStruct : batchIos)
+	{
+		ioCallbackStruct->submitTimeNanoseconds = submitTime;
+	}
+#endif // IO_ENABLE_STATS
+
+	size_t numQueued = submitBatchToOs();
+
+	// everything that didn't make it to the OS has an errorCode by now
+	for (size_t i = 0; i < count; i++)
+	{
+		IO_CALLBACK_STRUCT* ioCallbackStruct = ioCallbackStructs[i];
+		if (ioCallbackStruct->errorCode == 0)
+		{
+			continue;
+		}
+
+#if IO_ENABLE_STATS
+		shard = ioStats.acquireShard();
+		if (ioCallbackStruct->operation == IO_OPERATION_READ)
+		{
+			shard->stats.NumberOfReadQueueFailures++;
+		}
+		else if (ioCallbackStruct->operation == IO_OPERATION_WRITE)
+		{
+			shard->stats.NumberOfWriteQueueFailures++;
+		}
+		shard->release();
+#endif // IO_ENABLE_STATS
+
+		if (callbackOnFailure)
+		{
+			ioCallbackStruct->numBytesXferred = 0;
+			ioCallbackStruct->submitTimeNanoseconds = 0;
+			completeIo(ioCallbackStruct);
+		}
+		else
+		{
+			releaseIo(ioCallbackStruct);
+			ioCallbackStructs[i] = NULL;
+		}
+	}
+
+	return numQueued;
+}
+
+size_t IO::submitBatchToOs()
+{
+	if (batchIos.empty())
+	{
+		return 0;
+	}
+
+	osIos.clear();
+	if (maxMergeBytes && batchIos.size() > 1)
+	{
+		mergeBatch();
+	}
+	else
+	{
+		osIos.insert(osIos.end(), batchIos.begin(), batchIos.end());
+	}
+
+	size_t numOsQueued = doSubmitIoBatch(osIos.data(), osIos.size());
+	uint32_t lastError = (uint32_t)GET_LAST_OS_ERROR();
+
+	// the OS queues a prefix of osIos
+	size_t numQueued = 0;
+	for (size_t i = 0; i < osIos.size(); i++)
+	{
+		IO_MERGED_REQUEST* mergedRequest = osIos[i]->mergedRequest;
+		IO_CALLBACK_STRUCT** ios = mergedRequest ? mergedRequest->ios.data() : &osIos[i];
+		size_t numIos = mergedRequest ? mergedRequest->ios.size() : 1;
+		if (i < numOsQueued)
+		{
+			numQueued += numIos;
+			continue;
+		}
+
+		for (size_t j = 0; j < numIos; j++)
+		{
+			ios[j]->errorCode = lastError ? lastError : IO_ERROR_NOT_QUEUED;
+			if (checksumTable && ios[j]->operation == IO_OPERATION_WRITE)
+			{
+				checksumTable->forget(ios[j]->lba, ios[j]->numBlocksRequested);
+			}
+		}
+
+		if (mergedRequest)
+		{
+			freeMergedRequests.push_back(mergedRequest);
+		}
+	}
+
+	numIosInFlight += numQueued;
+	return numQueued;
+}
+
+void IO::mergeBatch()
+{
+	// reads then writes, each by lba. Stable so IOs to the same lba keep their order
+	sortedIos.assign(batchIos.begin(), batchIos.end());
+	std::stable_sort(sortedIos.begin(), sortedIos.end(), [](const IO_CALLBACK_STRUCT* a, const IO_CALLBACK_STRUCT* b) {
+		return a->operation != b->operation ? a->operation < b->operation : a->lba < b->lba;
+	});
+
+	size_t runStart = 0;
+	while (runStart < sortedIos.size())
+	{
+		// grow the run while the next IO starts where it ends and fits
+		IO_CALLBACK_STRUCT* first = sortedIos[runStart];
+		uint64_t runBytes = first->numBytesRequested;
+		size_t runIoVecs = first->ioVecs ? first->numIoVecs : 1;
+		uint64_t nextLba = first->lba + first->numBlocksRequested;
+		size_t runEnd = runStart + 1;
+		for (; runEnd < sortedIos.size(); runEnd++)
+		{
+			IO_CALLBACK_STRUCT* next = sortedIos[runEnd];
+			size_t nextIoVecs = next->ioVecs ? next->numIoVecs : 1;
+			if (next->operation != first->operation || next->lba != nextLba ||
+				runBytes + next->numBytesRequested > maxMergeBytes || runIoVecs + nextIoVecs > IO_MAX_IOVECS)
+			{
+				break;
+			}
+
+			runBytes += next->numBytesRequested;
+			runIoVecs += nextIoVecs;
+			nextLba += next->numBlocksRequested;
+		}
+
+		if (runEnd - runStart == 1)
+		{
+			osIos.push_back(first);
+			runStart = runEnd;
+			continue;
+		}
+
+		IO_MERGED_REQUEST* mergedRequest;
+		if (freeMergedRequests.empty())
+		{
+			mergedRequests.emplace_back(new IO_MERGED_REQUEST());
+			mergedRequest = mergedRequests.back().get();
+		}
+		else
+		{
+			mergedRequest = freeMergedRequests.back();
+			freeMergedRequests.pop_back();
+		}
+
+		mergedRequest->ios.assign(sortedIos.begin() + runStart, sortedIos.begin() + runEnd);
+		mergedRequest->ioVecs.clear();
+		for (IO_CALLBACK_STRUCT* ioCallbackStruct : mergedRequest->ios)
+		{
+			if (ioCallbackStruct->ioVecs)
+			{
+				mergedRequest->ioVecs.insert(mergedRequest->ioVecs.end(), ioCallbackStruct->ioVecs, ioCallbackStruct->ioVecs + ioCallbackStruct->numIoVecs);
+			}
+			else
+			{
+				IO_IOVEC ioVec;
+				ioVec.iov_base = ioCallbackStruct->xferBuffer;
+				ioVec.iov_len = (size_t)ioCallbackStruct->numBytesRequested;
+				mergedRequest->ioVecs.push_back(ioVec);
+			}
+		}
+
+		IO_CALLBACK_STRUCT& merged = mergedRequest->ioCallbackStruct;
+		merged = IO_CALLBACK_STRUCT(first->lba, nextLba - first->lba, runBytes, NULL, first->operation, NULL, NULL);
+		merged.freeXferBufferAfterCallback = false;
+		merged.ioVecs = mergedRequest->ioVecs.data();
+		merged.numIoVecs = mergedRequest->ioVecs.size();
+		merged.mergedRequest = mergedRequest;
+		merged.submitTimeNanoseconds = first->submitTimeNanoseconds;
+		osIos.push_back(&merged);
+
+		runStart = runEnd;
+	}
 
 #if IO_ENABLE_STATS
-	if (!result && ioCallbackStruct->operation == IO_OPERATION_READ)
+	IO_STATS_SHARD* shard = ioStats.acquireShard();
+	shard->stats.NumberOfMergedIos += batchIos.size() - osIos.size();
+	shard->release();
+#endif // IO_ENABLE_STATS
+}
+
+bool IO::setMaxMergeBytes(size_t maxMergeBytes)
+{
+#ifdef IO_WIN32
+	if (maxMergeBytes && backend != IO_BACKEND_SIMULATED)
 	{
-		ioStatsStruct.NumberOfReadQueueFailures++;
+		fprintf(stderr, "Merging needs vectored IO, which only the simulated backend has on Windows\n");
+		return false;
 	}
-	else if (!result && ioCallbackStruct->operation == IO_OPERATION_WRITE)
+#endif // IO_WIN32
+
+	this->maxMergeBytes = maxMergeBytes;
+	return true;
+}
+
+size_t IO::getMaxMergeBytes() const
+{
+	return maxMergeBytes;
+}
+
+bool IO::enqueueIo(IO_CALLBACK_STRUCT* ioCallbackStruct)
+{
+	return submissionQueue.tryPush(ioCallbackStruct);
+}
+
+size_t IO::drainSubmissionQueue()
+{
+	if (drainedIos.size() < SUBMISSION_QUEUE_DRAIN_BATCH_SIZE)
+	{
+		drainedIos.resize(SUBMISSION_QUEUE_DRAIN_BATCH_SIZE);
+	}
+
+	size_t numQueued = 0;
+	while (numIosInFlight < maxIosInFlight)
+	{
+		// held IOs go first, topped up from the queue
+		numHeldIos += submissionQueue.tryPopBulk(drainedIos.data() + numHeldIos, drainedIos.size() - numHeldIos);
+		if (numHeldIos == 0)
+		{
+			break;
+		}
+
+		// Past the OS's limit it would turn them away. Hold the rest until some complete.
+		//  The producers were already told these were queued, so failures go through their callbacks
+		size_t numToSubmit = std::min(numHeldIos, maxIosInFlight - numIosInFlight);
+		numQueued += submitIoBatch(drainedIos.data(), numToSubmit, true);
+
+		std::copy(drainedIos.begin() + numToSubmit, drainedIos.begin() + numHeldIos, drainedIos.begin());
+		numHeldIos -= numToSubmit;
+	}
+
+	return numQueued;
+}
+
+size_t IO::getNumHeldIos() const
+{
+	return numHeldIos;
+}
+
+size_t IO::getMaxIosInFlight() const
+{
+	return maxIosInFlight;
+}
+
+bool IO::poll()
+{
+	return poll(0, DEFAULT_POLL_MAX_EVENTS, 0) > 0;
+}
+
+size_t IO::poll(size_t minEvents, size_t maxEvents, int64_t timeoutMicroseconds)
+{
+	minEvents = std::min(minEvents, maxEvents);
+
+	// without merged IOs in flight each OS completion is one IO called back
+	if (freeMergedRequests.size() == mergedRequests.size())
+	{
+		return doPoll(minEvents, maxEvents, timeoutMicroseconds);
+	}
+
+	// A merged IO calls back several at once. Wait for one OS completion at a time, since asking for minEvents
+	//  of them could wait on more than are in flight
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(std::max(timeoutMicroseconds, (int64_t)0));
+	uint64_t startExtraMergedCompletions = numExtraMergedCompletions;
+	size_t numEventsCompleted = 0;
+	while (numEventsCompleted < maxEvents)
+	{
+		bool wait = numEventsCompleted < minEvents;
+		int64_t waitMicroseconds = 0;
+		if (wait && timeoutMicroseconds < 0)
+		{
+			waitMicroseconds = IO_POLL_WAIT_FOREVER;
+		}
+		else if (wait)
+		{
+			auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+			waitMicroseconds = std::max((int64_t)remaining.count(), (int64_t)0);
+		}
+
+		size_t numOsEvents = doPoll(wait ? 1 : 0, maxEvents - numEventsCompleted, waitMicroseconds);
+		numEventsCompleted += numOsEvents + (size_t)(numExtraMergedCompletions - startExtraMergedCompletions);
+		startExtraMergedCompletions = numExtraMergedCompletions;
+
+		if (numOsEvents == 0 && (!wait || waitMicroseconds == 0))
+		{
+			break;
+		}
+	}
+
+	return numEventsCompleted;
+}
+
+void IO::plug()
+{
+	plugged = true;
+}
+
+size_t IO::flush()
+{
+	if (pluggedIos.empty())
+	{
+		return 0;
+	}
+
+	// swap out so callbacks on failure can stage more IO without messing up our list
+	std::vector<IO_CALLBACK_STRUCT*> ios;
+	ios.swap(pluggedIos);
+
+	size_t numQueued = submitIoBatch(ios.data(), ios.size(), true);
+
+	// hand back the storage to avoid reallocating next time
+	if (pluggedIos.empty())
+	{
+		ios.clear();
+		pluggedIos.swap(ios);
+	}
+
+	return numQueued;
+}
+
+size_t IO::unplug()
+{
+	plugged = false;
+	return flush();
+}
+
+bool IO::isPlugged() const
+{
+	return plugged;
+}
+
+size_t IO::getNumIosInFlight() const
+{
+	return numIosInFlight;
+}
+
+bool IO::openSimulatedDevice(std::string path)
+{
+	backend = IO_BACKEND_SIMULATED;
+	simulatedSequence = 0;
+
+	simulatedDevice = IOSimulatedDevice::open(path);
+	if (!simulatedDevice)
+	{
+		fprintf(stderr, "Unable to open simulated device: %s\n", path.c_str());
+		return false;
+	}
+
+	// nothing to ask the OS for
+	blockSize = simulatedDevice->getBlockSize();
+	blockCount = simulatedDevice->getBlockCount();
+	return true;
+}
+
+size_t IO::doSubmitIoBatchSimulated(IO_CALLBACK_STRUCT** ioCallbackStructs, size_t count)
+{
+	if (!simulatedDevice)
 	{
-		ioStatsStruct.NumberOfWriteQueueFailures++;
+		SET_LAST_OS_ERROR(IO_ERROR_NO_DEVICE);
+		return 0;
+	}
+
+	uint64_t now = getTimestampNanoseconds();
+	size_t numQueued = 0;
+	for (; numQueued < count; numQueued++)
+	{
+		IO_CALLBACK_STRUCT* ioCallbackStruct = ioCallbackStructs[numQueued];
+		if (ioCallbackStruct->operation != IO_OPERATION_READ && ioCallbackStruct->operation != IO_OPERATION_WRITE)
+		{
+			fprintf(stderr, "Invalid IO Operation: %d\n", (int)ioCallbackStruct->operation);
+
+			// only queue up to the bad one
+			break;
+		}
+
+		IO_SIMULATED_COMPLETION completion;
+		completion.ioCallbackStruct = ioCallbackStruct;
+		completion.sequence = simulatedSequence++;
+		completion.completionTimeNanoseconds = simulatedDevice->scheduleIo(ioCallbackStruct, now, numIosInFlight + numQueued + 1, &completion.errorCode);
+
+		simulatedCompletions.push_back(completion);
+		std::push_heap(simulatedCompletions.begin(), simulatedCompletions.end());
+	}
+
+#ifdef IO_LINUX
+	armSimulatedCompletionFd();
+#endif // IO_LINUX
+
+	return numQueued;
+}
+
+size_t IO::pollSimulated(size_t minEvents, size_t maxEvents, int64_t timeoutMicroseconds)
+{
+	uint64_t deadline = getTimestampNanoseconds() + (uint64_t)std::max(timeoutMicroseconds, (int64_t)0) * 1000;
+	size_t numEventsCompleted = 0;
+	while (numEventsCompleted < maxEvents)
+	{
+		if (simulatedCompletions.empty() && (numEventsCompleted >= minEvents || timeoutMicroseconds < 0))
+		{
+			// nothing could ever complete, so don't wait forever
+			break;
+		}
+
+		uint64_t now = getTimestampNanoseconds();
+		uint64_t completionTime = simulatedCompletions.empty() ? UINT64_MAX : simulatedCompletions.front().completionTimeNanoseconds;
+		if (completionTime > now)
+		{
+			// like the OS, wait out the timeout even if nothing is in flight
+			if (numEventsCompleted >= minEvents || (timeoutMicroseconds >= 0 && now >= deadline))
+			{
+				break;
+			}
+
+			uint64_t wakeTime = timeoutMicroseconds >= 0 ? std::min(completionTime, deadline) : completionTime;
+			if (wakeTime - now > SIMULATED_POLL_SPIN_NANOSECONDS)
+			{
+				std::this_thread::sleep_for(std::chrono::nanoseconds(wakeTime - now - SIMULATED_POLL_SPIN_NANOSECONDS));
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+			continue;
+		}
+
+		// off the heap before the callback in case it queues more IO
+		std::pop_heap(simulatedCompletions.begin(), simulatedCompletions.end());
+		IO_SIMULATED_COMPLETION completion = simulatedCompletions.back();
+		simulatedCompletions.pop_back();
+
+		IO_CALLBACK_STRUCT* ioCallbackStruct = completion.ioCallbackStruct;
+		ioCallbackStruct->errorCode = completion.errorCode;
+		ioCallbackStruct->numBytesXferred = completion.errorCode ? 0 : simulatedDevice->transfer(ioCallbackStruct);
+
+		numIosInFlight--;
+		completeIo(ioCallbackStruct);
+		numEventsCompleted++;
+	}
+
+#ifdef IO_LINUX
+	// the timer went off for something we may have just reaped. Point it at whatever is next
+	clearCompletionFd();
+	armSimulatedCompletionFd();
+#endif // IO_LINUX
+
+	return numEventsCompleted;
+}
+
+void IO::closeSimulatedDevice()
+{
+	// like closing a real device, whatever was in flight is never called back
+	for (IO_SIMULATED_COMPLETION& completion : simulatedCompletions)
+	{
+		IO_MERGED_REQUEST* mergedRequest = completion.ioCallbackStruct->mergedRequest;
+		numIosInFlight -= mergedRequest ? mergedRequest->ios.size() : 1;
+		releaseIo(completion.ioCallbackStruct);
+	}
+
+	simulatedCompletions.clear();
+	simulatedDevice.reset();
+}
+
+void IO::completeMergedIo(IO_MERGED_REQUEST* mergedRequest)
+{
+	IO_CALLBACK_STRUCT& merged = mergedRequest->ioCallbackStruct;
+
+	// the OS completed one IO, but each merged one was counted
+	numIosInFlight -= mergedRequest->ios.size() - 1;
+	numExtraMergedCompletions += mergedRequest->ios.size() - 1;
+
+	// a short transfer is handed out in lba order, so only the IOs past where it stopped come up short
+	uint64_t bytesLeft = merged.numBytesXferred;
+	for (IO_CALLBACK_STRUCT* ioCallbackStruct : mergedRequest->ios)
+	{
+		ioCallbackStruct->errorCode = merged.errorCode;
+		ioCallbackStruct->numBytesXferred = std::min(bytesLeft, ioCallbackStruct->numBytesRequested);
+		bytesLeft -= ioCallbackStruct->numBytesXferred;
+		completeIo(ioCallbackStruct);
+	}
+
+	freeMergedRequests.push_back(mergedRequest);
+}
+
+void IO::completeIo(IO_CALLBACK_STRUCT* ioCallbackStruct)
+{
+	if (ioCallbackStruct->mergedRequest)
+	{
+		completeMergedIo(ioCallbackStruct->mergedRequest);
+		return;
+	}
+
+	bool checksumMismatch = false;
+	if (checksumTable && ioCallbackStruct->operation == IO_OPERATION_READ && ioCallbackStruct->succeeded())
+	{
+		checksumMismatch = !checkChecksums(checksumTable.get(), ioCallbackStruct, getBlockSize());
+		if (checksumMismatch)
+		{
+			ioCallbackStruct->errorCode = IO_ERROR_CHECKSUM_MISMATCH;
+		}
+	}
+	else if (checksumTable && ioCallbackStruct->operation == IO_OPERATION_WRITE && ioCallbackStruct->failed())
+	{
+		// some, all or none of it may be on the device now
+		checksumTable->forget(ioCallbackStruct->lba, ioCallbackStruct->numBlocksRequested);
+	}
+
+#if IO_ENABLE_STATS
+	// IOs that never made it to the OS have no submit time. They are already counted as queue failures
+	if (ioCallbackStruct->submitTimeNanoseconds)
+	{
+		ioCallbackStruct->latencyNanoseconds = getTimestampNanoseconds() - ioCallbackStruct->submitTimeNanoseconds;
+
+		IO_STATS_SHARD* shard = ioStats.acquireShard();
+		IO_STATS_STRUCT& stats = shard->stats;
+		if (ioCallbackStruct->operation == IO_OPERATION_READ)
+		{
+			stats.NumberOfCompletedReads++;
+			stats.NumberOfReadBytesCompleted += ioCallbackStruct->numBytesXferred;
+			stats.NumberOfReadErrors += ioCallbackStruct->errorCode != 0;
+			stats.NumberOfChecksumMismatches += checksumMismatch;
+			stats.ReadLatencyHistogram.record(ioCallbackStruct->latencyNanoseconds);
+		}
+		else if (ioCallbackStruct->operation == IO_OPERATION_WRITE)
+		{
+			stats.NumberOfCompletedWrites++;
+			stats.NumberOfWriteBytesCompleted += ioCallbackStruct->numBytesXferred;
+			stats.NumberOfWriteErrors += ioCallbackStruct->errorCode != 0;
+			stats.WriteLatencyHistogram.record(ioCallbackStruct->latencyNanoseconds);
+		}
+		shard->release();
 	}
 #endif // IO_ENABLE_STATS
 
-	return result;
+	if (ioCallbackStruct->userCallbackFunction)
+	{
+		ioCallbackStruct->userCallbackFunction(ioCallbackStruct);
+	}
+
+	releaseIo(ioCallbackStruct);
+}
+
+void IO::releaseIo(IO_CALLBACK_STRUCT* ioCallbackStruct)
+{
+	if (ioCallbackStruct->mergedRequest)
+	{
+		// lives in its IO_MERGED_REQUEST. The IOs merged into it go back one by one
+		for (IO_CALLBACK_STRUCT* mergedIo : ioCallbackStruct->mergedRequest->ios)
+		{
+			releaseIo(mergedIo);
+		}
+		freeMergedRequests.push_back(ioCallbackStruct->mergedRequest);
+		return;
+	}
+
+	if (ioCallbackStruct->xferBufferFromPool)
+	{
+		freeReadBuffers[getReadBufferSizeClass(ioCallbackStruct->numBlocksRequested)].push_back(ioCallbackStruct->xferBuffer);
+		ioCallbackStruct->xferBuffer = NULL;
+	}
+	else if (ioCallbackStruct->freeXferBufferAfterCallback)
+	{
+		// otherwise the user owns the buffer. Let them free it.
+		IO::freeAlignedBuffer(ioCallbackStruct->xferBuffer);
+		ioCallbackStruct->xferBuffer = NULL;
+	}
+
+	if (!requestPool.empty() && ioCallbackStruct >= &requestPool.front() && ioCallbackStruct <= &requestPool.back())
+	{
+		freeRequests.push_back(ioCallbackStruct);
+	}
+	else
+	{
+		delete ioCallbackStruct;
+	}
+}
+
+bool IO::setChecksumTable(std::shared_ptr<IOChecksumTable> table)
+{
+	if (table && table->getBlockSize() != getBlockSize())
+	{
+		fprintf(stderr, "Checksum table is for %u byte blocks, not %u\n", table->getBlockSize(), getBlockSize());
+		return false;
+	}
+
+	checksumTable = table;
+	return true;
+}
+
+std::shared_ptr<IOChecksumTable> IO::getChecksumTable() const
+{
+	return checksumTable;
 }
 
 #if IO_ENABLE_STATS
-IO_STATS_STRUCT& IO::getIoStatsStruct()
+IO_STATS_STRUCT IO::snapshotIoStats()
+{
+	return ioStats.snapshot();
+}
+
+void IO::resetIoStats()
 {
-	return ioStatsStruct;
+	ioStats.reset();
 }
 #endif // IO_ENABLE_STATS
 
@@ -114,9 +995,9 @@ void IO::checkAndSetIfWeShouldAllowWrites()
 		}
 	}, (void*)&allowWrites))
 	{
-		while (!poll())
+		while (!poll(1, 1, IO_POLL_WAIT_FOREVER))
 		{
-			// busy wait poll. after poll gets true, the callback had happened
+			// only get here if the wait was interrupted. after poll gets 1, the callback had happened
 		}
 	}
 	else
@@ -3,13 +3,17 @@
 
 #pragma once
 #include "switches.h"
+#include "io_ring_queue.h"
+#include "io_stats.h"
 
+#include <chrono>
 #include <cstdint>
 #include <list>
 #include <memory>
 #include <string>
 #include <string.h>
 #include <unordered_map>
+#include <vector>
 
 #ifdef IO_WIN32
 #define NOMINMAX
@@ -19,10 +23,54 @@
 #ifdef IO_LINUX
 // for aio_context_t
 #include <linux/aio_abi.h>
+#include <sys/uio.h>
+#include "io_linux_uring.h"
 #endif
 
+// monotonic timestamp used for latency tracking
+inline uint64_t getTimestampNanoseconds()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 // forward declare
+class IO;
 class IO_CALLBACK_STRUCT;
+class IOSimulatedDevice;
+class IOChecksumTable;
+struct IO_MERGED_REQUEST;
+
+// Number of IO_CALLBACK_STRUCTs preallocated by each IO object for read()/write()
+#define DEFAULT_REQUEST_POOL_SIZE 1024
+
+// Max IOs that can wait in the submission queue (see enqueueIo()) between drains
+#define DEFAULT_SUBMISSION_QUEUE_SIZE 4096
+
+// Most completions poll() will reap at once
+#define DEFAULT_POLL_MAX_EVENTS 1024
+
+// Pass as the timeout to poll() to wait until minEvents have completed
+#define IO_POLL_WAIT_FOREVER -1
+
+// Recycled read buffers come in power of two sizes (in blocks) up to this. Larger reads get a one-off buffer
+#define READ_BUFFER_POOL_MAX_BLOCKS 256
+
+// number of recycled read buffer sizes: 1, 2, 4 ... READ_BUFFER_POOL_MAX_BLOCKS blocks
+#define READ_BUFFER_POOL_SIZE_CLASSES 9
+
+// Most buffers a vectored IO (readv()/writev()) can take. The same as Linux's UIO_MAXIOV
+#define IO_MAX_IOVECS 1024
+
+// one buffer of a vectored IO. The same layout as struct iovec so Linux can take a list of them as is
+#ifdef IO_LINUX
+typedef struct iovec IO_IOVEC;
+#else
+struct IO_IOVEC
+{
+	void* iov_base;
+	size_t iov_len;
+};
+#endif
 
 // All IO callbacks follow this format
 typedef void(IO_CALLBACK_FUNCTION)(IO_CALLBACK_STRUCT* ioInfo);
@@ -33,6 +81,15 @@ typedef enum _IO_OPERATION_ENUM
 	IO_OPERATION_WRITE
 } IO_OPERATION_ENUM, *PIO_OPERATION_ENUM;
 
+// the OS interface used by an IO object to queue and complete IO
+typedef enum _IO_BACKEND_ENUM
+{
+	IO_BACKEND_DEFAULT,     // Linux AIO on Linux, Overlapped IO on Windows
+	IO_BACKEND_LINUX_AIO,   // io_setup/io_submit/io_getevents
+	IO_BACKEND_IO_URING,    // shared submission/completion rings. Falls back to IO_BACKEND_LINUX_AIO if unavailable
+	IO_BACKEND_SIMULATED    // an in-memory IOSimulatedDevice. Used automatically for "sim:" paths
+} IO_BACKEND_ENUM, *PIO_BACKEND_ENUM;
+
 // structure passed to the callback function
 // this is a class since GCC doesn't seem to like constructors in structs
 class IO_CALLBACK_STRUCT
@@ -41,6 +98,11 @@ public:
 	IO_CALLBACK_STRUCT()
 	{
 		//memset(this, 0, sizeof(IO_CALLBACK_STRUCT));
+
+		// so structs filled in by hand are plain IOs
+		this->ioVecs = NULL;
+		this->numIoVecs = 0;
+		this->mergedRequest = NULL;
 	}
 
 	IO_CALLBACK_STRUCT(uint64_t lba, uint64_t blockcount, uint64_t bytesRequested,
@@ -54,6 +116,12 @@ public:
 		this->operation = operation;
 		this->userCallbackFunction = userCallbackFunction;
 		this->userCallbackData = userCallbackData;
+		this->numBytesXferred = 0;
+		this->errorCode = 0;
+		this->latencyNanoseconds = 0;
+		this->submitTimeNanoseconds = 0;
+		this->freeXferBufferAfterCallback = operation == IO_OPERATION_READ;
+		this->xferBufferFromPool = false;
 	}
 
 	// set before submitting
@@ -65,10 +133,35 @@ public:
 	IO_CALLBACK_FUNCTION* userCallbackFunction;
 	void* userCallbackData;
 
+	// if true, xferBuffer is freed after the callback. Defaults to true for reads and false for writes
+	bool freeXferBufferAfterCallback;
+
+	// If set, the IO is vectored: it moves numBytesRequested bytes to/from these buffers in order instead of
+	//  xferBuffer. Owned by the caller and must stay valid until the callback. See IO::readv()
+	const IO_IOVEC* ioVecs;
+	size_t numIoVecs;
+
 	// set by callback.
 	uint64_t numBytesXferred;
 	uint32_t errorCode;
 
+	// time from handing the IO to the OS until just before the callback. Only set if IO_ENABLE_STATS
+	uint64_t latencyNanoseconds;
+
+	// used internally by the IO object. Embedded so queueing doesn't need another allocation.
+	bool xferBufferFromPool;
+	uint64_t submitTimeNanoseconds;
+
+	// only set on the IO the OS sees for a merged IO (see IO::setMaxMergeBytes())
+	IO_MERGED_REQUEST* mergedRequest;
+#ifdef IO_LINUX
+	iocb osIocb;
+#endif
+#ifdef IO_WIN32
+	OVERLAPPED osOverlapped;
+	IO* owner;
+#endif
+
 	bool failed() const
 	{
 		return !succeeded();
@@ -106,52 +199,153 @@ public:
 	}
 };
 
-#if IO_ENABLE_STATS
-// Used to keep track of some stats about this IO Object
-class IO_STATS_STRUCT
+
+// Adjacent IOs from one batch merged into one vectored IO. Only ioCallbackStruct goes to the OS.
+//  Recycled by the IO object, so the vectors keep their capacity
+struct IO_MERGED_REQUEST
 {
-public:
-	IO_STATS_STRUCT()
-	{
-		clear();
-	}
+	IO_CALLBACK_STRUCT ioCallbackStruct;
+
+	// the IOs merged, in lba order. Each is called back with its share of the result
+	std::vector<IO_CALLBACK_STRUCT*> ios;
+
+	// ioCallbackStruct's buffers: those of every IO in ios, in order
+	std::vector<IO_IOVEC> ioVecs;
+};
+
+// an IO queued to a simulated device, waiting for its completion time
+struct IO_SIMULATED_COMPLETION
+{
+	uint64_t completionTimeNanoseconds;
+
+	// ties go to the IO queued first
+	uint64_t sequence;
 
-	void clear()
+	uint32_t errorCode;
+	IO_CALLBACK_STRUCT* ioCallbackStruct;
+
+	// orders a std::push_heap() heap so the next completion is on top
+	bool operator<(const IO_SIMULATED_COMPLETION& other) const
 	{
-		memset(this, 0, sizeof(IO_STATS_STRUCT));
+		if (completionTimeNanoseconds != other.completionTimeNanoseconds)
+		{
+			return completionTimeNanoseconds > other.completionTimeNanoseconds;
+		}
+		return sequence > other.sequence;
 	}
-
-	uint64_t NumberOfQueuedReads;
-	uint64_t NumberOfQueuedWrites;
-	uint64_t LargestQueuedReadInSectors;
-	uint64_t LargestQueuedWriteInSectors;
-	uint64_t LowestQueuedReadLba;
-	uint64_t HighestQueuedReadLba;
-	uint64_t LowestQueuedWriteLba;
-	uint64_t HighestQueuedWriteLba;
-	uint64_t NumberOfReadQueueFailures;
-	uint64_t NumberOfWriteQueueFailures;
 };
-#endif
 
 class IO
 {
 public:
+	// paths starting with IO_SIMULATED_DEVICE_PATH_PREFIX ("sim:") open an in-memory device (see io_simulated_device.h)
 	IO(std::string path);
+	IO(std::string path, IO_BACKEND_ENUM backend);
+	IO(std::string path, IO_BACKEND_ENUM backend, size_t requestPoolSize);
 	~IO();
 
 	// return true if the command is queued
+	//  returns false without trying if all requestPoolSize IO_CALLBACK_STRUCTs are in flight.
 	bool read(uint64_t lba, uint64_t blockCount, IO_CALLBACK_FUNCTION* callback, void* userCallbackData);
 	bool write(uint64_t lba, uint64_t blockCount, void* xferData, IO_CALLBACK_FUNCTION* callback, void* userCallbackData);
 	inline bool read(uint64_t lba, uint64_t blockCount, IO_CALLBACK_FUNCTION* callback) { return read(lba, blockCount, callback, NULL); }
+
+	// reads into the caller's buffer (aligned to the block size). The caller owns it and must free it
+	bool read(uint64_t lba, uint64_t blockCount, void* xferData, IO_CALLBACK_FUNCTION* callback, void* userCallbackData);
+	inline bool read(uint64_t lba, uint64_t blockCount, void* xferData, IO_CALLBACK_FUNCTION* callback) { return read(lba, blockCount, xferData, callback, NULL); }
 	inline bool write(uint64_t lba, uint64_t blockCount, void* xferData, IO_CALLBACK_FUNCTION* callback) { return write(lba, blockCount, xferData, callback, NULL); }
 	
+	// Vectored (scatter/gather) read and write: blockCount blocks starting at lba go to/come from each of the
+	//  numIoVecs buffers in ioVecs in turn. Each length must be a multiple of the block size (and each buffer
+	//  aligned to it) and they must add up to blockCount blocks. ioVecs and the buffers are the caller's and
+	//  must stay valid until the callback. Returns false if the list is bad or nothing could be queued
+	bool readv(uint64_t lba, uint64_t blockCount, const IO_IOVEC* ioVecs, size_t numIoVecs, IO_CALLBACK_FUNCTION* callback, void* userCallbackData);
+	bool writev(uint64_t lba, uint64_t blockCount, const IO_IOVEC* ioVecs, size_t numIoVecs, IO_CALLBACK_FUNCTION* callback, void* userCallbackData);
+
+	// Returns an IO_CALLBACK_STRUCT from the request pool or NULL if it is exhausted.
+	//  Fill it in then give it to submitIo(), which will give it back to the pool.
+	IO_CALLBACK_STRUCT* allocateIoCallbackStruct();
+
+	// returns the number of IO_CALLBACK_STRUCTs left in the request pool
+	size_t getFreeRequestCount() const;
+
 	// Will free ioCallbackStruct on fail or in the callback on pass. This function is the same on all OSes
+	//  Structs from allocateIoCallbackStruct() go back to the pool, others are deleted
 	bool submitIo(IO_CALLBACK_STRUCT* ioCallbackStruct);
 
-	// returns true if at least one callback is called
+	// Queues count IOs with as few calls into the OS as possible. Returns the number queued.
+	//  Any that fail to queue are freed and set to NULL in ioCallbackStructs. Ignores plug().
+	size_t submitIoBatch(IO_CALLBACK_STRUCT** ioCallbackStructs, size_t count);
+
+	// Thread safe and lock-free. Hands ioCallbackStruct to the thread that owns this object, which
+	//  queues it on its next drainSubmissionQueue(). Returns false (freeing nothing) if the queue is full.
+	//  Use your own IO_CALLBACK_STRUCT (not allocateIoCallbackStruct(), the request pool is owner-only).
+	//  Callbacks run on the owner thread. IOs that fail to queue get their callback with a nonzero errorCode
+	bool enqueueIo(IO_CALLBACK_STRUCT* ioCallbackStruct);
+
+	// Owner thread only. Queues everything enqueueIo()'d so far in as few batches as possible, up to
+	//  getMaxIosInFlight(). The rest are held for the next drain once some complete.
+	//  Returns the number queued. The owner should loop on this and poll()
+	size_t drainSubmissionQueue();
+
+	// returns the number of IOs enqueueIo()'d and drained but held back since too many were in flight
+	size_t getNumHeldIos() const;
+
+	// returns the most IOs the OS takes at once (the AIO context or io_uring completion ring size).
+	//  drainSubmissionQueue() stays under it. SIZE_MAX if there is no limit
+	size_t getMaxIosInFlight() const;
+
+	// After plug(), submitIo() (and so read()/write()) only stages IOs until flush() or unplug().
+	//  Staged IOs that later fail to queue get their callback with a nonzero errorCode.
+	void plug();
+
+	// Queues all staged IOs in one batch. Returns the number queued.
+	size_t flush();
+
+	// flush() then stop staging IOs
+	size_t unplug();
+
+	// returns true if IOs are being staged
+	bool isPlugged() const;
+
+	// returns the number of IOs given to the OS that have not been called back yet
+	size_t getNumIosInFlight() const;
+
+	// Once set, each batch (submitIoBatch(), flush(), drainSubmissionQueue()) is sorted by lba and same direction IOs
+	//  to adjacent lbas are sent to the OS as one vectored IO of up to maxMergeBytes (and IO_MAX_IOVECS buffers).
+	//  Every IO merged is still called back on its own. Staging with plug() until flush() is the window to collect
+	//  IOs in. 0 (the default) turns it off.
+	//  Returns false if this backend can't do vectored IO
+	bool setMaxMergeBytes(size_t maxMergeBytes);
+	size_t getMaxMergeBytes() const;
+
+	// returns true if at least one callback is called. Does not wait
 	bool poll();
 
+	// Calls back up to maxEvents completed IOs, waiting up to timeoutMicroseconds for at least minEvents of them.
+	//  A timeout of 0 does not wait, IO_POLL_WAIT_FOREVER waits as long as it takes. Returns the number called back.
+	//  On Windows, all ready completions are called back so maxEvents is not enforced. Every IO in a merged IO
+	//  (see setMaxMergeBytes()) is called back at once, so that can go past maxEvents too.
+	size_t poll(size_t minEvents, size_t maxEvents, int64_t timeoutMicroseconds);
+
+#ifdef IO_LINUX
+	// Creates an eventfd that becomes readable whenever IO completes, so this object can sit in an epoll loop.
+	//  poll() resets it. Returns false if it could not be setup. Only affects IO queued after the call.
+	bool enableCompletionFd();
+
+	// returns the fd from enableCompletionFd() or -1 if not enabled
+	int getCompletionFd() const;
+#endif // IO_LINUX
+
+	// returns the backend actually in use (may differ from the requested one after a fallback)
+	IO_BACKEND_ENUM getBackend() const;
+
+	// Once set, every block written is CRC32C'd into table as the write is queued, and every read that completes
+	//  is checked against it. A read that doesn't match completes with errorCode IO_ERROR_CHECKSUM_MISMATCH.
+	//  Pass NULL to stop. Returns false if the table was made for a different block size
+	bool setChecksumTable(std::shared_ptr<IOChecksumTable> table);
+	std::shared_ptr<IOChecksumTable> getChecksumTable() const;
+
 	// will ask the OS for the block size once then cache it after
 	uint32_t getBlockSize();
 
@@ -165,8 +359,12 @@ public:
 	static void freeAlignedBuffer(void* buffer);
 
 #if IO_ENABLE_STATS
-	// Returns a struct of stats
-	IO_STATS_STRUCT& getIoStatsStruct();
+	// Returns a copy of the stats, merged from every thread that has used this object.
+	//  Safe to call from any thread while IO is in flight
+	IO_STATS_STRUCT snapshotIoStats();
+
+	// Clears the stats. Safe to call from any thread while IO is in flight
+	void resetIoStats();
 #endif // IO_ENABLE_STATS
 
 private:
@@ -179,19 +377,179 @@ private:
 	bool allowWrites;
 #endif // #if IO_DISABLE_WRITES_TO_DRIVE_WITH_PARTITIONS
 
-	// called by submitIo(). This is OS specific.
-	bool doSubmitIo(IO_CALLBACK_STRUCT* ioCallbackStruct);
+	// common implementation for readv() and writev()
+	bool submitVectoredIo(uint64_t lba, uint64_t blockCount, const IO_IOVEC* ioVecs, size_t numIoVecs,
+		IO_OPERATION_ENUM operation, IO_CALLBACK_FUNCTION* callback, void* userCallbackData);
+
+	// common implementation for submitIoBatch() and flush()
+	//  if callbackOnFailure is set, IOs that fail to queue get their callback instead of being set to NULL
+	size_t submitIoBatch(IO_CALLBACK_STRUCT** ioCallbackStructs, size_t count, bool callbackOnFailure);
+
+	// called by submitIoBatch(). This is OS specific.
+	//  returns the number of IOs queued. These are always the first ones in ioCallbackStructs
+	size_t doSubmitIoBatch(IO_CALLBACK_STRUCT** ioCallbackStructs, size_t count);
+
+	// called by poll(). This is OS specific.
+	//  minEvents and maxEvents count completions from the OS. Returns the number of those
+	size_t doPoll(size_t minEvents, size_t maxEvents, int64_t timeoutMicroseconds);
+
+	// Sets this object up on the simulated device named by path. Called by the constructors
+	//  for IO_BACKEND_SIMULATED or a simulated path. Returns false if the path is malformed
+	bool openSimulatedDevice(std::string path);
+
+	// IO_BACKEND_SIMULATED versions of doSubmitIoBatch() and poll()
+	size_t doSubmitIoBatchSimulated(IO_CALLBACK_STRUCT** ioCallbackStructs, size_t count);
+	size_t pollSimulated(size_t minEvents, size_t maxEvents, int64_t timeoutMicroseconds);
+
+	// drops anything still queued to the simulated device without calling back. Called by the destructors
+	void closeSimulatedDevice();
+
+	// Sends batchIos to the OS, merged if setMaxMergeBytes() was called. Returns the number of batchIos queued.
+	//  The ones that weren't get a nonzero errorCode
+	size_t submitBatchToOs();
+
+	// fills osIos from batchIos, merging runs of adjacent IOs into IO_MERGED_REQUESTs
+	void mergeBatch();
+
+	// calls back every IO in a merged IO that completed, then recycles it
+	void completeMergedIo(IO_MERGED_REQUEST* mergedRequest);
+
+	// calls the user's callback then releaseIo()
+	void completeIo(IO_CALLBACK_STRUCT* ioCallbackStruct);
+
+	// frees everything allocated for this IO (without calling the callback)
+	void releaseIo(IO_CALLBACK_STRUCT* ioCallbackStruct);
+
+	// allocates the request pool. Called by the constructors
+	void initRequestPool(size_t requestPoolSize);
+
+	// returns a recycled buffer of getReadBufferPoolBufferSize(sizeClass) bytes. Allocated the first time we run out
+	void* allocateReadBuffer(size_t sizeClass);
+
+	// size of each buffer in a size class of the read buffer pool
+	size_t getReadBufferPoolBufferSize(size_t sizeClass);
+
+	// the smallest size class a read of blockCount blocks fits in. READ_BUFFER_POOL_SIZE_CLASSES if none
+	static size_t getReadBufferSizeClass(uint64_t blockCount);
+
+	// frees every buffer the read buffer pool ever allocated. Called by the destructors
+	void freeReadBufferPool();
+
+	// every buffer allocated by allocateReadBuffer(). There are at most requestPoolSize of each size
+	std::vector<void*> readBufferPool;
+
+	// unused members of readBufferPool by size class
+	std::vector<void*> freeReadBuffers[READ_BUFFER_POOL_SIZE_CLASSES];
+
+	// preallocated IO_CALLBACK_STRUCTs. Never resized after construction so pointers into it stay valid
+	std::vector<IO_CALLBACK_STRUCT> requestPool;
+
+	// unused members of requestPool
+	std::vector<IO_CALLBACK_STRUCT*> freeRequests;
 
 	IO_HANDLE handle;
 
+	// set between plug() and unplug()
+	bool plugged;
+
+	// see getNumIosInFlight()
+	size_t numIosInFlight;
+
+	// IOs staged while plugged
+	std::vector<IO_CALLBACK_STRUCT*> pluggedIos;
+
+	// IOs that passed the common checks in submitIoBatch() and are going to the OS
+	std::vector<IO_CALLBACK_STRUCT*> batchIos;
+
+	// see setMaxMergeBytes()
+	size_t maxMergeBytes;
+
+	// what submitBatchToOs() hands the OS: batchIos, or batchIos with runs merged. Reused for each batch
+	std::vector<IO_CALLBACK_STRUCT*> osIos;
+
+	// batchIos sorted by direction and lba for mergeBatch()
+	std::vector<IO_CALLBACK_STRUCT*> sortedIos;
+
+	// every IO_MERGED_REQUEST ever made and the ones not in flight
+	std::vector<std::unique_ptr<IO_MERGED_REQUEST>> mergedRequests;
+	std::vector<IO_MERGED_REQUEST*> freeMergedRequests;
+
+	// IOs called back by completeMergedIo() past the first of each merged IO. The OS completions
+	//  doPoll() counts plus these are the IOs called back
+	uint64_t numExtraMergedCompletions;
+
+	// filled by any thread via enqueueIo(), emptied by the owner in drainSubmissionQueue()
+	IORingQueue<IO_CALLBACK_STRUCT*> submissionQueue{ DEFAULT_SUBMISSION_QUEUE_SIZE };
+
+	// IOs popped off submissionQueue. The first numHeldIos of them are waiting for room to go to the OS
+	std::vector<IO_CALLBACK_STRUCT*> drainedIos;
+	size_t numHeldIos;
+
+	// see getMaxIosInFlight()
+	size_t maxIosInFlight;
+
+	IO_BACKEND_ENUM backend;
+
+	// only set if using IO_BACKEND_SIMULATED. Shared with every other IO object on the same device
+	std::shared_ptr<IOSimulatedDevice> simulatedDevice;
+
+	// IOs queued to simulatedDevice, as a heap with the next to complete on top
+	std::vector<IO_SIMULATED_COMPLETION> simulatedCompletions;
+
+	// bumped for every IO queued to simulatedDevice
+	uint64_t simulatedSequence;
+
+	// see setChecksumTable()
+	std::shared_ptr<IOChecksumTable> checksumTable;
+
+#ifdef IO_WIN32
+	// needs completeIo()
+	friend void CALLBACK overlappedCompletionRoutine(DWORD dwErrorCode, DWORD dwNumberOfBytesTransfered, OVERLAPPED* lpOverlapped);
+
+	// bumped by overlappedCompletionRoutine() so poll() can tell how many of the APCs were ours
+	size_t numApcCompletions;
+#endif
+
 #ifdef IO_LINUX
 	aio_context_t aioContext;
+
+	// only set if using IO_BACKEND_IO_URING
+	IOUring* uring;
+
+	// eventfd signaled on completion. -1 until enableCompletionFd()
+	//  Simulated devices use a timerfd set to the next completion time instead
+	int completionFd;
+
+	// sets the timerfd completionFd to go off at the next simulated completion (if enabled)
+	void armSimulatedCompletionFd();
+
+	// zeroes the completionFd counter (if enabled)
+	void clearCompletionFd();
+
+	// makes the eventfd completionFd readable again (if enabled). For when poll() leaves completions behind
+	void signalCompletionFd();
+
+	// pointers to the iocbs handed to io_submit(). Reused for each batch
+	std::vector<iocb*> batchIocbs;
+
+	// completions filled by io_getevents(). Grows to the largest maxEvents given to poll() then is reused
+	std::vector<io_event> completionEvents;
+
+	// io_uring versions of doSubmitIoBatch() and poll()
+	size_t doSubmitIoBatchUring(IO_CALLBACK_STRUCT** ioCallbackStructs, size_t count);
+	size_t pollUring(size_t minEvents, size_t maxEvents, int64_t timeoutMicroseconds);
+
+	// calls back up to maxEvents completions already in the completion ring
+	size_t reapUring(size_t maxEvents);
+
+	// waits for everything in flight on the ring and releases it without calling back
+	void drainUring();
 #endif
 
 	uint32_t blockSize;
 	uint64_t blockCount;
 
 #if IO_ENABLE_STATS
-	IO_STATS_STRUCT ioStatsStruct;
+	IOStats ioStats;
 #endif // IO_ENABLE_STATS
 };
@@ -0,0 +1,311 @@
+// IO Checksum Table implementation file for IO
+// (C) - csm10495 - MIT License 2019
+
+#include "io_checksum_table.h"
+#include "io_crc32c.h"
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+#ifdef IO_LINUX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// blocks checksummed per ioCrc32cBlocks() call in update()/check()
+#define CHECKSUM_BATCH_BLOCKS 64
+
+// in-memory and file tables live in the same registry, so keep their names apart
+#define CHECKSUM_REGISTRY_FILE_PREFIX "file:"
+#define CHECKSUM_REGISTRY_SHARED_PREFIX "shared:"
+
+// a table per name, held weakly so each goes away with its last user
+static std::mutex registryLock;
+static std::unordered_map<std::string, std::weak_ptr<IOChecksumTable>> registry;
+
+IOChecksumTable::IOChecksumTable()
+{
+	blockCount = 0;
+	blockSize = 0;
+	entries = NULL;
+	mapping = NULL;
+	mappingSize = 0;
+#ifdef IO_WIN32
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = NULL;
+#else
+	fileDescriptor = -1;
+#endif
+}
+
+IOChecksumTable::IOChecksumTable(uint64_t blockCount, uint32_t blockSize) : IOChecksumTable()
+{
+	this->blockCount = blockCount;
+	this->blockSize = blockSize;
+
+	// value-initialized, so every entry starts as IO_CHECKSUM_UNKNOWN
+	memoryEntries.reset(new std::atomic<uint32_t>[(size_t)blockCount]());
+	entries = memoryEntries.get();
+}
+
+IOChecksumTable::~IOChecksumTable()
+{
+#ifdef IO_WIN32
+	if (mapping)
+	{
+		UnmapViewOfFile(mapping);
+	}
+	if (mappingHandle)
+	{
+		CloseHandle(mappingHandle);
+	}
+	if (fileHandle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(fileHandle);
+	}
+#else
+	if (mapping)
+	{
+		munmap(mapping, mappingSize);
+	}
+	if (fileDescriptor != -1)
+	{
+		close(fileDescriptor);
+	}
+#endif
+}
+
+std::shared_ptr<IOChecksumTable> IOChecksumTable::open(const std::string& path, uint64_t blockCount, uint32_t blockSize)
+{
+	std::lock_guard<std::mutex> lockGuard(registryLock);
+	std::string key = CHECKSUM_REGISTRY_FILE_PREFIX + path;
+	std::shared_ptr<IOChecksumTable> table = registry[key].lock();
+	if (table)
+	{
+		if (table->blockCount != blockCount || table->blockSize != blockSize)
+		{
+			std::cerr << "Checksum file " << path << " is already open for a different device" << std::endl;
+			return NULL;
+		}
+		return table;
+	}
+
+	table.reset(new IOChecksumTable());
+	if (!table->mapFile(path, blockCount, blockSize))
+	{
+		return NULL;
+	}
+
+	registry[key] = table;
+	return table;
+}
+
+std::shared_ptr<IOChecksumTable> IOChecksumTable::openShared(const std::string& name, uint64_t blockCount, uint32_t blockSize)
+{
+	std::lock_guard<std::mutex> lockGuard(registryLock);
+	std::string key = CHECKSUM_REGISTRY_SHARED_PREFIX + name;
+	std::shared_ptr<IOChecksumTable> table = registry[key].lock();
+	if (table)
+	{
+		if (table->blockCount != blockCount || table->blockSize != blockSize)
+		{
+			std::cerr << "Checksum table " << name << " is already open for a different device" << std::endl;
+			return NULL;
+		}
+		return table;
+	}
+
+	table.reset(new IOChecksumTable(blockCount, blockSize));
+	registry[key] = table;
+	return table;
+}
+
+bool IOChecksumTable::mapFile(const std::string& path, uint64_t blockCount, uint32_t blockSize)
+{
+	this->blockCount = blockCount;
+	this->blockSize = blockSize;
+	mappingSize = (size_t)(sizeof(IO_CHECKSUM_FILE_HEADER) + blockCount * sizeof(uint32_t));
+
+	bool created = false;
+#ifdef IO_WIN32
+	fileHandle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+	{
+		fprintf(stderr, "Failed to open checksum file %s: %lu\n", path.c_str(), GetLastError());
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(fileHandle, &fileSize);
+	created = fileSize.QuadPart == 0;
+
+	// sizes the file too, zero filled
+	mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READWRITE, (DWORD)((uint64_t)mappingSize >> 32), (DWORD)mappingSize, NULL);
+	if (!mappingHandle)
+	{
+		fprintf(stderr, "Failed to map checksum file %s: %lu\n", path.c_str(), GetLastError());
+		return false;
+	}
+
+	mapping = MapViewOfFile(mappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, mappingSize);
+	if (!mapping)
+	{
+		fprintf(stderr, "Failed to map checksum file %s: %lu\n", path.c_str(), GetLastError());
+		return false;
+	}
+#else
+	fileDescriptor = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fileDescriptor == -1)
+	{
+		perror("Failed to open checksum file");
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(fileDescriptor, &fileStat) != 0)
+	{
+		perror("Failed to stat checksum file");
+		return false;
+	}
+
+	created = fileStat.st_size == 0;
+	if (created && ftruncate(fileDescriptor, (off_t)mappingSize) != 0)
+	{
+		perror("Failed to size checksum file");
+		return false;
+	}
+	else if (!created && (uint64_t)fileStat.st_size < mappingSize)
+	{
+		fprintf(stderr, "Checksum file %s is too small for %llu blocks\n", path.c_str(), (unsigned long long)blockCount);
+		return false;
+	}
+
+	mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+	if (mapping == MAP_FAILED)
+	{
+		mapping = NULL;
+		perror("Failed to mmap checksum file");
+		return false;
+	}
+#endif
+
+	IO_CHECKSUM_FILE_HEADER* header = (IO_CHECKSUM_FILE_HEADER*)mapping;
+	if (created)
+	{
+		memcpy(header->magic, IO_CHECKSUM_FILE_MAGIC, sizeof(header->magic));
+		header->version = IO_CHECKSUM_FILE_VERSION;
+		header->blockSize = blockSize;
+		header->blockCount = blockCount;
+	}
+	else if (memcmp(header->magic, IO_CHECKSUM_FILE_MAGIC, sizeof(header->magic)) != 0 || header->version != IO_CHECKSUM_FILE_VERSION)
+	{
+		fprintf(stderr, "%s is not a checksum file\n", path.c_str());
+		return false;
+	}
+	else if (header->blockSize != blockSize || header->blockCount != blockCount)
+	{
+		fprintf(stderr, "Checksum file %s is for %llu blocks of %u bytes, not %llu of %u\n", path.c_str(),
+			(unsigned long long)header->blockCount, header->blockSize, (unsigned long long)blockCount, blockSize);
+		return false;
+	}
+
+	// std::atomic<uint32_t> is lock-free and the size of a uint32_t, so the entries can live in the file
+	entries = (std::atomic<uint32_t>*)((uint8_t*)mapping + sizeof(IO_CHECKSUM_FILE_HEADER));
+	return true;
+}
+
+void IOChecksumTable::update(const void* buffer, uint64_t lba, uint64_t numBlocks)
+{
+	if (lba >= blockCount)
+	{
+		return;
+	}
+	numBlocks = std::min(numBlocks, blockCount - lba);
+
+	const uint8_t* bytes = (const uint8_t*)buffer;
+	uint32_t crcs[CHECKSUM_BATCH_BLOCKS];
+	for (uint64_t done = 0; done < numBlocks; done += CHECKSUM_BATCH_BLOCKS)
+	{
+		size_t batch = (size_t)std::min<uint64_t>(CHECKSUM_BATCH_BLOCKS, numBlocks - done);
+		ioCrc32cBlocks(bytes + done * blockSize, blockSize, batch, crcs);
+		for (size_t i = 0; i < batch; i++)
+		{
+			entries[lba + done + i].store(crcs[i], std::memory_order_relaxed);
+		}
+	}
+}
+
+void IOChecksumTable::forget(uint64_t lba, uint64_t numBlocks)
+{
+	for (uint64_t i = lba; i < blockCount && i - lba < numBlocks; i++)
+	{
+		entries[i].store(IO_CHECKSUM_UNKNOWN, std::memory_order_relaxed);
+	}
+}
+
+uint64_t IOChecksumTable::check(const void* buffer, uint64_t lba, uint64_t numBlocks) const
+{
+	if (lba >= blockCount)
+	{
+		return numBlocks;
+	}
+	uint64_t numChecked = std::min(numBlocks, blockCount - lba);
+
+	const uint8_t* bytes = (const uint8_t*)buffer;
+	uint32_t crcs[CHECKSUM_BATCH_BLOCKS];
+	for (uint64_t done = 0; done < numChecked; done += CHECKSUM_BATCH_BLOCKS)
+	{
+		size_t batch = (size_t)std::min<uint64_t>(CHECKSUM_BATCH_BLOCKS, numChecked - done);
+		ioCrc32cBlocks(bytes + done * blockSize, blockSize, batch, crcs);
+		for (size_t i = 0; i < batch; i++)
+		{
+			uint32_t expected = entries[lba + done + i].load(std::memory_order_relaxed);
+			if (expected != IO_CHECKSUM_UNKNOWN && expected != crcs[i])
+			{
+				return done + i;
+			}
+		}
+	}
+
+	return numBlocks;
+}
+
+uint32_t IOChecksumTable::get(uint64_t lba) const
+{
+	return lba < blockCount ? entries[lba].load(std::memory_order_relaxed) : IO_CHECKSUM_UNKNOWN;
+}
+
+uint64_t IOChecksumTable::getBlockCount() const
+{
+	return blockCount;
+}
+
+uint32_t IOChecksumTable::getBlockSize() const
+{
+	return blockSize;
+}
+
+bool IOChecksumTable::sync()
+{
+	if (!mapping)
+	{
+		return true;
+	}
+
+#ifdef IO_WIN32
+	return FlushViewOfFile(mapping, mappingSize) && FlushFileBuffers(fileHandle);
+#else
+	if (msync(mapping, mappingSize, MS_SYNC) != 0)
+	{
+		perror("Failed to sync checksum file");
+		return false;
+	}
+	return true;
+#endif
+}
@@ -0,0 +1,99 @@
+// IO Checksum Table header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+#include "switches.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#ifdef IO_WIN32
+#define NOMINMAX
+#include <Windows.h>
+#define IO_ERROR_CHECKSUM_MISMATCH ERROR_CRC
+#else
+#include <errno.h>
+#define IO_ERROR_CHECKSUM_MISMATCH EBADMSG
+#endif
+
+// "IOCRC32C" starts every checksum file
+#define IO_CHECKSUM_FILE_MAGIC "IOCRC32C"
+#define IO_CHECKSUM_FILE_VERSION 1
+
+// entries hold this until their block is written. A block whose real CRC32C is 0 is never checked
+#define IO_CHECKSUM_UNKNOWN 0
+
+// starts a checksum file. The entries follow it, one uint32_t per lba
+struct IO_CHECKSUM_FILE_HEADER
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t blockSize;
+	uint64_t blockCount;
+	uint8_t reserved[40];
+};
+
+// The CRC32C of every block written through an IO object, indexed by lba (see IO::setChecksumTable()).
+//  Entries are atomic so one table can be shared by IO objects on different threads
+class IOChecksumTable
+{
+public:
+	// an in-memory table, gone when the last reference is
+	IOChecksumTable(uint64_t blockCount, uint32_t blockSize);
+	~IOChecksumTable();
+
+	// Returns the table kept in the file at path (mmap'd), creating it if it doesn't exist so checksums
+	//  survive the process. Opening the same path again in this process returns the same table.
+	//  Returns NULL if the file can't be mapped or was made for a different block size/count
+	static std::shared_ptr<IOChecksumTable> open(const std::string& path, uint64_t blockCount, uint32_t blockSize);
+
+	// Returns the in-memory table registered under name, creating it if needed. Lets IO objects on the same
+	//  device share one without a file. Lives as long as someone holds it
+	static std::shared_ptr<IOChecksumTable> openShared(const std::string& name, uint64_t blockCount, uint32_t blockSize);
+
+	// records the checksum of each of the numBlocks blocks in buffer, starting at lba
+	void update(const void* buffer, uint64_t lba, uint64_t numBlocks);
+
+	// marks numBlocks blocks starting at lba as unknown, for writes that may or may not have happened
+	void forget(uint64_t lba, uint64_t numBlocks);
+
+	// Checks numBlocks blocks in buffer read from lba. Returns the index of the first block that doesn't
+	//  match its entry, or numBlocks if they all do. Blocks with unknown entries always match
+	uint64_t check(const void* buffer, uint64_t lba, uint64_t numBlocks) const;
+
+	// the entry for lba, or IO_CHECKSUM_UNKNOWN
+	uint32_t get(uint64_t lba) const;
+
+	uint64_t getBlockCount() const;
+	uint32_t getBlockSize() const;
+
+	// flushes a file-backed table to disk. Returns false on failure
+	bool sync();
+
+private:
+	// only through open()
+	IOChecksumTable();
+
+	// maps the file at path. Returns false (with a message) on failure
+	bool mapFile(const std::string& path, uint64_t blockCount, uint32_t blockSize);
+
+	uint64_t blockCount;
+	uint32_t blockSize;
+
+	// blockCount entries, either in memoryEntries or in the mapping
+	std::atomic<uint32_t>* entries;
+	std::unique_ptr<std::atomic<uint32_t>[]> memoryEntries;
+
+	// only set for file-backed tables
+	void* mapping;
+	size_t mappingSize;
+#ifdef IO_WIN32
+	HANDLE fileHandle;
+	HANDLE mappingHandle;
+#else
+	int fileDescriptor;
+#endif
+};
@@ -0,0 +1,63 @@
+// IO CPU Features header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+
+// Runtime checks for optional instruction sets. Code for them is compiled with IO_TARGET_* on the
+//  function so the rest of the build doesn't need extra compiler flags, then picked at runtime.
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define IO_HAS_AVX2 1
+#define IO_HAS_SSE42 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define IO_TARGET_AVX2
+#define IO_TARGET_SSE42
+#else
+#define IO_TARGET_AVX2 __attribute__((target("avx2")))
+#define IO_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#endif
+
+// the CRC32 instructions are optional in ARMv8.0
+#if defined(__aarch64__) && defined(__linux__)
+#define IO_HAS_ARM_CRC32 1
+#include <arm_acle.h>
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#define IO_TARGET_ARM_CRC32 __attribute__((target("+crc")))
+#endif
+
+#if IO_HAS_AVX2
+inline bool ioCpuHasAvx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif // IO_HAS_AVX2
+
+#if IO_HAS_SSE42
+inline bool ioCpuHasSse42()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 20)) != 0;
+#else
+	return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#endif // IO_HAS_SSE42
+
+#if IO_HAS_ARM_CRC32
+inline bool ioCpuHasArmCrc32()
+{
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#endif // IO_HAS_ARM_CRC32
@@ -0,0 +1,334 @@
+// IO CRC32C implementation file for IO
+// (C) - csm10495 - MIT License 2019
+
+#include "io_crc32c.h"
+#include "io_cpu_features.h"
+
+#include <string.h>
+
+// reflected Castagnoli polynomial
+#define CRC32C_POLYNOMIAL 0x82F63B78U
+
+// Bytes per stream when running 3 streams at once. The 3 results are stitched together with a table
+//  lookup that shifts a crc past this many zero bytes, so there is one of those tables per length
+#define CRC32C_LONG_STREAM 8192
+#define CRC32C_SHORT_STREAM 256
+
+// Everything here is "raw": no inversion before or after. That keeps it linear, so
+//  raw(crc, A + B) == shift(raw(crc, A), length of B) ^ raw(0, B)
+class Crc32cTables
+{
+public:
+	Crc32cTables()
+	{
+		for (uint32_t b = 0; b < 256; b++)
+		{
+			uint32_t crc = b;
+			for (int bit = 0; bit < 8; bit++)
+			{
+				crc = (crc >> 1) ^ (CRC32C_POLYNOMIAL & (0 - (crc & 1)));
+			}
+			slice[0][b] = crc;
+		}
+
+		for (int k = 1; k < 8; k++)
+		{
+			for (uint32_t b = 0; b < 256; b++)
+			{
+				slice[k][b] = (slice[k - 1][b] >> 8) ^ slice[0][slice[k - 1][b] & 0xFF];
+			}
+		}
+
+		buildShiftTable(CRC32C_LONG_STREAM, shiftLong);
+		buildShiftTable(CRC32C_SHORT_STREAM, shiftShort);
+	}
+
+	// the crc after running numBytes zero bytes through it
+	static inline uint32_t shift(const uint32_t table[4][256], uint32_t crc)
+	{
+		return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+	}
+
+	// slicing-by-8: slice[k][b] is the crc of b followed by k zero bytes
+	uint32_t slice[8][256];
+	uint32_t shiftLong[4][256];
+	uint32_t shiftShort[4][256];
+
+private:
+	void buildShiftTable(size_t numBytes, uint32_t table[4][256])
+	{
+		// zero bytes are linear in the crc, so do each bit on its own and combine
+		uint32_t bitImages[32];
+		for (int bit = 0; bit < 32; bit++)
+		{
+			uint32_t crc = 1U << bit;
+			for (size_t i = 0; i < numBytes; i++)
+			{
+				crc = (crc >> 8) ^ slice[0][crc & 0xFF];
+			}
+			bitImages[bit] = crc;
+		}
+
+		for (int k = 0; k < 4; k++)
+		{
+			for (uint32_t b = 0; b < 256; b++)
+			{
+				uint32_t crc = 0;
+				for (int bit = 0; bit < 8; bit++)
+				{
+					crc ^= (b & (1U << bit)) ? bitImages[k * 8 + bit] : 0;
+				}
+				table[k][b] = crc;
+			}
+		}
+	}
+};
+
+static const Crc32cTables& getTables()
+{
+	static const Crc32cTables tables;
+	return tables;
+}
+
+static inline uint64_t load64(const uint8_t* data)
+{
+	uint64_t word;
+	memcpy(&word, data, sizeof(word));
+	return word;
+}
+
+static uint32_t crc32cRawSoftware(uint32_t crc, const uint8_t* data, size_t length)
+{
+	const Crc32cTables& tables = getTables();
+
+	while (length >= 8)
+	{
+		uint64_t word = load64(data) ^ crc;
+		crc = tables.slice[7][word & 0xFF] ^ tables.slice[6][(word >> 8) & 0xFF] ^
+			tables.slice[5][(word >> 16) & 0xFF] ^ tables.slice[4][(word >> 24) & 0xFF] ^
+			tables.slice[3][(word >> 32) & 0xFF] ^ tables.slice[2][(word >> 40) & 0xFF] ^
+			tables.slice[1][(word >> 48) & 0xFF] ^ tables.slice[0][word >> 56];
+		data += 8;
+		length -= 8;
+	}
+
+	while (length--)
+	{
+		crc = (crc >> 8) ^ tables.slice[0][(crc ^ *data++) & 0xFF];
+	}
+
+	return crc;
+}
+
+#if IO_HAS_SSE42
+IO_TARGET_SSE42 static uint32_t crc32cRawSse42(uint32_t crc, const uint8_t* data, size_t length)
+{
+	const Crc32cTables& tables = getTables();
+	uint64_t crc0 = crc;
+
+	// the crc32 instruction takes 3 cycles but can start one a cycle, so keep 3 independent streams going
+	while (length >= 3 * CRC32C_LONG_STREAM)
+	{
+		uint64_t crc1 = 0;
+		uint64_t crc2 = 0;
+		for (size_t i = 0; i < CRC32C_LONG_STREAM; i += 8)
+		{
+			crc0 = _mm_crc32_u64(crc0, load64(data + i));
+			crc1 = _mm_crc32_u64(crc1, load64(data + CRC32C_LONG_STREAM + i));
+			crc2 = _mm_crc32_u64(crc2, load64(data + 2 * CRC32C_LONG_STREAM + i));
+		}
+		crc0 = Crc32cTables::shift(tables.shiftLong, Crc32cTables::shift(tables.shiftLong, (uint32_t)crc0) ^ (uint32_t)crc1) ^ (uint32_t)crc2;
+		data += 3 * CRC32C_LONG_STREAM;
+		length -= 3 * CRC32C_LONG_STREAM;
+	}
+
+	while (length >= 3 * CRC32C_SHORT_STREAM)
+	{
+		uint64_t crc1 = 0;
+		uint64_t crc2 = 0;
+		for (size_t i = 0; i < CRC32C_SHORT_STREAM; i += 8)
+		{
+			crc0 = _mm_crc32_u64(crc0, load64(data + i));
+			crc1 = _mm_crc32_u64(crc1, load64(data + CRC32C_SHORT_STREAM + i));
+			crc2 = _mm_crc32_u64(crc2, load64(data + 2 * CRC32C_SHORT_STREAM + i));
+		}
+		crc0 = Crc32cTables::shift(tables.shiftShort, Crc32cTables::shift(tables.shiftShort, (uint32_t)crc0) ^ (uint32_t)crc1) ^ (uint32_t)crc2;
+		data += 3 * CRC32C_SHORT_STREAM;
+		length -= 3 * CRC32C_SHORT_STREAM;
+	}
+
+	for (; length >= 8; data += 8, length -= 8)
+	{
+		crc0 = _mm_crc32_u64(crc0, load64(data));
+	}
+
+	uint32_t crc32 = (uint32_t)crc0;
+	while (length--)
+	{
+		crc32 = _mm_crc32_u8(crc32, *data++);
+	}
+
+	return crc32;
+}
+
+// 3 whole blocks at a time, so there's nothing to stitch together. Returns the number of blocks done
+IO_TARGET_SSE42 static size_t crc32cBlocksSse42(const uint8_t* data, size_t blockSize, size_t numBlocks, uint32_t* crcs)
+{
+	size_t block = 0;
+	for (; block + 3 <= numBlocks; block += 3)
+	{
+		const uint8_t* data0 = data + block * blockSize;
+		const uint8_t* data1 = data0 + blockSize;
+		const uint8_t* data2 = data1 + blockSize;
+
+		uint64_t crc0 = 0xFFFFFFFF;
+		uint64_t crc1 = 0xFFFFFFFF;
+		uint64_t crc2 = 0xFFFFFFFF;
+		for (size_t i = 0; i < blockSize; i += 8)
+		{
+			crc0 = _mm_crc32_u64(crc0, load64(data0 + i));
+			crc1 = _mm_crc32_u64(crc1, load64(data1 + i));
+			crc2 = _mm_crc32_u64(crc2, load64(data2 + i));
+		}
+
+		crcs[block] = ~(uint32_t)crc0;
+		crcs[block + 1] = ~(uint32_t)crc1;
+		crcs[block + 2] = ~(uint32_t)crc2;
+	}
+	return block;
+}
+#endif // IO_HAS_SSE42
+
+#if IO_HAS_ARM_CRC32
+IO_TARGET_ARM_CRC32 static uint32_t crc32cRawArm(uint32_t crc, const uint8_t* data, size_t length)
+{
+	const Crc32cTables& tables = getTables();
+	uint32_t crc0 = crc;
+
+	// same 3 stream layout as crc32cRawSse42()
+	while (length >= 3 * CRC32C_LONG_STREAM)
+	{
+		uint32_t crc1 = 0;
+		uint32_t crc2 = 0;
+		for (size_t i = 0; i < CRC32C_LONG_STREAM; i += 8)
+		{
+			crc0 = __crc32cd(crc0, load64(data + i));
+			crc1 = __crc32cd(crc1, load64(data + CRC32C_LONG_STREAM + i));
+			crc2 = __crc32cd(crc2, load64(data + 2 * CRC32C_LONG_STREAM + i));
+		}
+		crc0 = Crc32cTables::shift(tables.shiftLong, Crc32cTables::shift(tables.shiftLong, crc0) ^ crc1) ^ crc2;
+		data += 3 * CRC32C_LONG_STREAM;
+		length -= 3 * CRC32C_LONG_STREAM;
+	}
+
+	while (length >= 3 * CRC32C_SHORT_STREAM)
+	{
+		uint32_t crc1 = 0;
+		uint32_t crc2 = 0;
+		for (size_t i = 0; i < CRC32C_SHORT_STREAM; i += 8)
+		{
+			crc0 = __crc32cd(crc0, load64(data + i));
+			crc1 = __crc32cd(crc1, load64(data + CRC32C_SHORT_STREAM + i));
+			crc2 = __crc32cd(crc2, load64(data + 2 * CRC32C_SHORT_STREAM + i));
+		}
+		crc0 = Crc32cTables::shift(tables.shiftShort, Crc32cTables::shift(tables.shiftShort, crc0) ^ crc1) ^ crc2;
+		data += 3 * CRC32C_SHORT_STREAM;
+		length -= 3 * CRC32C_SHORT_STREAM;
+	}
+
+	for (; length >= 8; data += 8, length -= 8)
+	{
+		crc0 = __crc32cd(crc0, load64(data));
+	}
+
+	while (length--)
+	{
+		crc0 = __crc32cb(crc0, *data++);
+	}
+
+	return crc0;
+}
+
+IO_TARGET_ARM_CRC32 static size_t crc32cBlocksArm(const uint8_t* data, size_t blockSize, size_t numBlocks, uint32_t* crcs)
+{
+	size_t block = 0;
+	for (; block + 3 <= numBlocks; block += 3)
+	{
+		const uint8_t* data0 = data + block * blockSize;
+		const uint8_t* data1 = data0 + blockSize;
+		const uint8_t* data2 = data1 + blockSize;
+
+		uint32_t crc0 = 0xFFFFFFFF;
+		uint32_t crc1 = 0xFFFFFFFF;
+		uint32_t crc2 = 0xFFFFFFFF;
+		for (size_t i = 0; i < blockSize; i += 8)
+		{
+			crc0 = __crc32cd(crc0, load64(data0 + i));
+			crc1 = __crc32cd(crc1, load64(data1 + i));
+			crc2 = __crc32cd(crc2, load64(data2 + i));
+		}
+
+		crcs[block] = ~crc0;
+		crcs[block + 1] = ~crc1;
+		crcs[block + 2] = ~crc2;
+	}
+	return block;
+}
+#endif // IO_HAS_ARM_CRC32
+
+static uint32_t crc32cRaw(uint32_t crc, const uint8_t* data, size_t length)
+{
+#if IO_HAS_SSE42
+	static const bool hasSse42 = ioCpuHasSse42();
+	if (hasSse42)
+	{
+		return crc32cRawSse42(crc, data, length);
+	}
+#endif // IO_HAS_SSE42
+
+#if IO_HAS_ARM_CRC32
+	static const bool hasArmCrc32 = ioCpuHasArmCrc32();
+	if (hasArmCrc32)
+	{
+		return crc32cRawArm(crc, data, length);
+	}
+#endif // IO_HAS_ARM_CRC32
+
+	return crc32cRawSoftware(crc, data, length);
+}
+
+uint32_t ioCrc32c(const void* data, size_t length, uint32_t crc)
+{
+	return ~crc32cRaw(~crc, (const uint8_t*)data, length);
+}
+
+void ioCrc32cBlocks(const void* data, size_t blockSize, size_t numBlocks, uint32_t* crcs)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	size_t block = 0;
+
+	// the interleaved versions only work in whole words
+	if (blockSize % 8 == 0)
+	{
+#if IO_HAS_SSE42
+		static const bool hasSse42 = ioCpuHasSse42();
+		if (hasSse42)
+		{
+			block = crc32cBlocksSse42(bytes, blockSize, numBlocks, crcs);
+		}
+#endif // IO_HAS_SSE42
+
+#if IO_HAS_ARM_CRC32
+		static const bool hasArmCrc32 = ioCpuHasArmCrc32();
+		if (hasArmCrc32)
+		{
+			block = crc32cBlocksArm(bytes, blockSize, numBlocks, crcs);
+		}
+#endif // IO_HAS_ARM_CRC32
+	}
+
+	for (; block < numBlocks; block++)
+	{
+		crcs[block] = ioCrc32c(bytes + block * blockSize, blockSize);
+	}
+}
@@ -0,0 +1,15 @@
+// IO CRC32C header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli, as used by iSCSI/ext4/NVMe) of length bytes. Pass a previous result as crc to continue it.
+//  Uses the SSE4.2 or ARMv8 CRC instructions (3 streams at once to hide their latency) when the CPU has them,
+//  otherwise slicing-by-8 tables
+uint32_t ioCrc32c(const void* data, size_t length, uint32_t crc = 0);
+
+// one CRC32C per blockSize bytes of data into crcs. Works on 3 blocks at once, so it is faster than a loop of ioCrc32c()
+void ioCrc32cBlocks(const void* data, size_t blockSize, size_t numBlocks, uint32_t* crcs);
@@ -0,0 +1,111 @@
+// IO Histogram implementation file for IO
+// (C) - csm10495 - MIT License 2019
+
+#include "io_histogram.h"
+
+#include <algorithm>
+#include <string.h>
+
+void IOLatencyHistogram::clear()
+{
+	memset(this, 0, sizeof(IOLatencyHistogram));
+}
+
+void IOLatencyHistogram::merge(const IOLatencyHistogram& other)
+{
+	if (other.count == 0)
+	{
+		return;
+	}
+
+	if (count == 0 || other.minValue < minValue)
+	{
+		minValue = other.minValue;
+	}
+	maxValue = std::max(maxValue, other.maxValue);
+	count += other.count;
+	sum += other.sum;
+
+	for (uint32_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++)
+	{
+		buckets[i] += other.buckets[i];
+	}
+}
+
+uint64_t IOLatencyHistogram::getPercentile(double percentile) const
+{
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	// the number of values that have to be at or below the answer
+	uint64_t target = (uint64_t)((percentile / 100.0) * count + 0.5);
+	target = std::max(std::min(target, count), (uint64_t)1);
+
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++)
+	{
+		seen += buckets[i];
+		if (seen >= target)
+		{
+			// the bucket's range may go past what was actually recorded
+			return std::min(std::max(getBucketHighestValue(i), minValue), maxValue);
+		}
+	}
+
+	return maxValue;
+}
+
+uint64_t IOLatencyHistogram::getCount() const
+{
+	return count;
+}
+
+uint64_t IOLatencyHistogram::getMin() const
+{
+	return minValue;
+}
+
+uint64_t IOLatencyHistogram::getMax() const
+{
+	return maxValue;
+}
+
+double IOLatencyHistogram::getMean() const
+{
+	return count ? (double)sum / count : 0.0;
+}
+
+std::string IOLatencyHistogram::toString() const
+{
+	std::string retString = "";
+	retString += "count=" + std::to_string(count);
+	retString += " min=" + std::to_string(getMin());
+	retString += " mean=" + std::to_string((uint64_t)getMean());
+	retString += " p50=" + std::to_string(getPercentile(50));
+	retString += " p99=" + std::to_string(getPercentile(99));
+	retString += " p99.9=" + std::to_string(getPercentile(99.9));
+	retString += " p99.99=" + std::to_string(getPercentile(99.99));
+	retString += " max=" + std::to_string(getMax());
+	return retString;
+}
+
+uint64_t IOLatencyHistogram::getBucketHighestValue(uint32_t bucketIndex)
+{
+	if (bucketIndex < HISTOGRAM_LINEAR_BUCKETS)
+	{
+		return bucketIndex;
+	}
+
+	if (bucketIndex >= HISTOGRAM_NUM_BUCKETS - 1)
+	{
+		return UINT64_MAX;
+	}
+
+	// undo getBucketIndex()
+	uint32_t offset = bucketIndex - HISTOGRAM_LINEAR_BUCKETS;
+	uint32_t shift = offset / HISTOGRAM_SUB_BUCKETS + 1;
+	uint64_t top = HISTOGRAM_SUB_BUCKETS + offset % HISTOGRAM_SUB_BUCKETS;
+	return ((top + 1) << shift) - 1;
+}
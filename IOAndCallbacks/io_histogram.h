@@ -0,0 +1,103 @@
+// IO Histogram header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Values below this are recorded exactly. Above it, each power of 2 is split into half this many buckets (~1.5% error)
+#define HISTOGRAM_LINEAR_BITS 7
+#define HISTOGRAM_LINEAR_BUCKETS (1 << HISTOGRAM_LINEAR_BITS)
+#define HISTOGRAM_SUB_BUCKETS (HISTOGRAM_LINEAR_BUCKETS / 2)
+
+// Values at or above 2^HISTOGRAM_MAX_VALUE_BITS are recorded in the last bucket (about 4.9 hours in nanoseconds)
+#define HISTOGRAM_MAX_VALUE_BITS 44
+#define HISTOGRAM_NUM_BUCKETS (HISTOGRAM_LINEAR_BUCKETS + (HISTOGRAM_MAX_VALUE_BITS - HISTOGRAM_LINEAR_BITS) * HISTOGRAM_SUB_BUCKETS)
+
+// Log-linear (HDR-style) histogram. Recording is a couple of shifts and an increment.
+//  This is plain data: all zeros is a valid empty histogram, so it can be memset/memcpy'd
+class IOLatencyHistogram
+{
+public:
+	IOLatencyHistogram()
+	{
+		clear();
+	}
+
+	void clear();
+
+	inline void record(uint64_t value)
+	{
+		if (count == 0 || value < minValue)
+		{
+			minValue = value;
+		}
+		if (value > maxValue)
+		{
+			maxValue = value;
+		}
+
+		count++;
+		sum += value;
+		buckets[getBucketIndex(value)]++;
+	}
+
+	// adds all of other's values to this one
+	void merge(const IOLatencyHistogram& other);
+
+	// returns the highest value that is within the given percentile (0 - 100). 0 if empty
+	uint64_t getPercentile(double percentile) const;
+
+	uint64_t getCount() const;
+	uint64_t getMin() const;
+	uint64_t getMax() const;
+	double getMean() const;
+
+	// one line summary with the count, min, mean, p50, p99, p99.9, p99.99 and max
+	std::string toString() const;
+
+	static inline uint32_t getBucketIndex(uint64_t value)
+	{
+		if (value < HISTOGRAM_LINEAR_BUCKETS)
+		{
+			return (uint32_t)value;
+		}
+
+		uint32_t msb = mostSignificantBit(value);
+		if (msb >= HISTOGRAM_MAX_VALUE_BITS)
+		{
+			return HISTOGRAM_NUM_BUCKETS - 1;
+		}
+
+		// keep the top HISTOGRAM_LINEAR_BITS bits of the value. The highest of those is always set
+		uint32_t shift = msb - (HISTOGRAM_LINEAR_BITS - 1);
+		uint32_t top = (uint32_t)(value >> shift);
+		return HISTOGRAM_LINEAR_BUCKETS + (shift - 1) * HISTOGRAM_SUB_BUCKETS + (top - HISTOGRAM_SUB_BUCKETS);
+	}
+
+	// returns the highest value that lands in the given bucket
+	static uint64_t getBucketHighestValue(uint32_t bucketIndex);
+
+private:
+	static inline uint32_t mostSignificantBit(uint64_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long idx;
+		_BitScanReverse64(&idx, value);
+		return (uint32_t)idx;
+#else
+		return 63 - (uint32_t)__builtin_clzll(value);
+#endif
+	}
+
+	uint64_t count;
+	uint64_t sum;
+	uint64_t minValue;
+	uint64_t maxValue;
+	uint64_t buckets[HISTOGRAM_NUM_BUCKETS];
+};
@@ -0,0 +1,135 @@
+// IO Interval Set implementation file for IO
+// (C) - csm10495 - MIT License 2019
+
+#include "io_interval_set.h"
+
+#include <iterator>
+
+void IOIntervalSet::insert(uint64_t start, uint64_t count)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	uint64_t end = start + count;
+
+	// the first range that could overlap or touch us is the one before start (if it reaches start)
+	auto it = ranges.upper_bound(start);
+	if (it != ranges.begin())
+	{
+		auto prev = std::prev(it);
+		if (prev->second >= start)
+		{
+			start = prev->first;
+			if (prev->second > end)
+			{
+				end = prev->second;
+			}
+			it = prev;
+		}
+	}
+
+	// swallow everything that starts at or before our end
+	while (it != ranges.end() && it->first <= end)
+	{
+		if (it->second > end)
+		{
+			end = it->second;
+		}
+		it = ranges.erase(it);
+	}
+
+	ranges.emplace_hint(it, start, end);
+}
+
+void IOIntervalSet::remove(uint64_t start, uint64_t count)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	uint64_t end = start + count;
+
+	// anything starting at or after start is handled by the loop below
+	auto it = ranges.lower_bound(start);
+	if (it != ranges.begin())
+	{
+		auto prev = std::prev(it);
+		if (prev->second > start)
+		{
+			// prev starts before us. Keep its head and, if it runs past us, its tail
+			uint64_t prevEnd = prev->second;
+			prev->second = start;
+			if (prevEnd > end)
+			{
+				ranges.emplace_hint(it, end, prevEnd);
+				return;
+			}
+		}
+	}
+
+	while (it != ranges.end() && it->first < end)
+	{
+		if (it->second > end)
+		{
+			// keep the tail past our end
+			uint64_t tailEnd = it->second;
+			it = ranges.erase(it);
+			ranges.emplace_hint(it, end, tailEnd);
+			return;
+		}
+		it = ranges.erase(it);
+	}
+}
+
+bool IOIntervalSet::overlaps(uint64_t start, uint64_t count, uint64_t* overlapEnd) const
+{
+	if (count == 0)
+	{
+		return false;
+	}
+
+	uint64_t end = start + count;
+
+	auto it = ranges.upper_bound(start);
+	if (it != ranges.begin())
+	{
+		auto prev = std::prev(it);
+		if (prev->second > start)
+		{
+			if (overlapEnd)
+			{
+				*overlapEnd = prev->second;
+			}
+			return true;
+		}
+	}
+
+	if (it != ranges.end() && it->first < end)
+	{
+		if (overlapEnd)
+		{
+			*overlapEnd = it->second;
+		}
+		return true;
+	}
+
+	return false;
+}
+
+bool IOIntervalSet::contains(uint64_t lba) const
+{
+	return overlaps(lba, 1);
+}
+
+size_t IOIntervalSet::getRangeCount() const
+{
+	return ranges.size();
+}
+
+void IOIntervalSet::clear()
+{
+	ranges.clear();
+}
@@ -0,0 +1,36 @@
+// IO Interval Set header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+
+// A set of LBAs stored as disjoint, non-touching [start, end) ranges.
+//  Every operation is O(log n) in the number of ranges, no matter how many LBAs a range covers
+class IOIntervalSet
+{
+public:
+	// adds [start, start + count). Merges with any ranges it overlaps or touches
+	void insert(uint64_t start, uint64_t count);
+
+	// removes [start, start + count). Ranges that are partly covered are trimmed or split
+	void remove(uint64_t start, uint64_t count);
+
+	// returns true if any of [start, start + count) is in the set.
+	//  If so, overlapEnd (if given) is set to the end of the first range that overlaps
+	bool overlaps(uint64_t start, uint64_t count, uint64_t* overlapEnd = NULL) const;
+
+	// returns true if lba is in the set
+	bool contains(uint64_t lba) const;
+
+	// returns the number of disjoint ranges
+	size_t getRangeCount() const;
+
+	void clear();
+
+private:
+	// start -> end (exclusive)
+	std::map<uint64_t, uint64_t> ranges;
+};
@@ -0,0 +1,924 @@
+// IO Job implementation file for IO
+// (C) - csm10495 - MIT License 2019
+
+#include "io_job.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+// how long the run loop waits for completions before checking the clock again
+#define JOB_POLL_TIMEOUT_MICROSECONDS 10000
+
+// how far a rate capped job can fall behind schedule before it stops trying to catch up
+#define JOB_RATE_MAX_CATCH_UP_NANOSECONDS 10000000
+
+// requests in the pool beyond the queue depth, since callbacks queue the next IO before theirs is released
+#define JOB_EXTRA_REQUESTS 16
+
+// parses a size like 4096, 4k, 1m or 2g (powers of 1024). Returns false if it isn't one
+static bool parseSize(const std::string& value, uint64_t* size)
+{
+	if (value.empty())
+	{
+		return false;
+	}
+
+	size_t end = 0;
+	unsigned long long number;
+	try
+	{
+		number = std::stoull(value, &end);
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+
+	uint64_t multiplier = 1;
+	if (end < value.size())
+	{
+		switch (tolower(value[end]))
+		{
+		case 'k': multiplier = 1ULL << 10; break;
+		case 'm': multiplier = 1ULL << 20; break;
+		case 'g': multiplier = 1ULL << 30; break;
+		case 't': multiplier = 1ULL << 40; break;
+		default: return false;
+		}
+
+		// allow 4k, 4kb and 4kib
+		std::string suffix = value.substr(end + 1);
+		if (!suffix.empty() && suffix != "b" && suffix != "B" && suffix != "ib" && suffix != "iB")
+		{
+			return false;
+		}
+	}
+
+	*size = number * multiplier;
+	return true;
+}
+
+static bool parseDouble(const std::string& value, double* number)
+{
+	try
+	{
+		size_t end = 0;
+		double parsed = std::stod(value, &end);
+		if (end != value.size())
+		{
+			return false;
+		}
+
+		*number = parsed;
+		return true;
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+}
+
+// splits value on delimiter
+static std::vector<std::string> split(const std::string& value, char delimiter)
+{
+	std::vector<std::string> parts;
+	std::stringstream stream(value);
+	std::string part;
+	while (std::getline(stream, part, delimiter))
+	{
+		parts.push_back(part);
+	}
+	return parts;
+}
+
+// parses fio's random_distribution: random, zipf:theta, pareto:h, normal:stddev%[:center%] or zoned:io%/range%:...
+static bool parseDistribution(const std::string& value, IOLBADistribution* distribution)
+{
+	std::vector<std::string> parts = split(value, ':');
+	if (parts.empty())
+	{
+		return false;
+	}
+
+	double first = 0;
+	if (parts[0] == "random" || parts[0] == "uniform")
+	{
+		distribution->setUniform();
+		return parts.size() == 1;
+	}
+	else if (parts[0] == "zipf")
+	{
+		return parts.size() == 2 && parseDouble(parts[1], &first) && distribution->setZipf(first);
+	}
+	else if (parts[0] == "pareto")
+	{
+		return parts.size() == 2 && parseDouble(parts[1], &first) && distribution->setPareto(first);
+	}
+	else if (parts[0] == "normal")
+	{
+		double center = 50;
+		if (parts.size() < 2 || parts.size() > 3 || !parseDouble(parts[1], &first) || (parts.size() == 3 && !parseDouble(parts[2], &center)))
+		{
+			return false;
+		}
+		return distribution->setNormal(center / 100, first / 100);
+	}
+	else if (parts[0] == "zoned")
+	{
+		std::vector<IO_LBA_ZONE> zones;
+		for (size_t i = 1; i < parts.size(); i++)
+		{
+			std::vector<std::string> percents = split(parts[i], '/');
+			IO_LBA_ZONE zone;
+			if (percents.size() != 2 || !parseDouble(percents[0], &zone.ioPercent) || !parseDouble(percents[1], &zone.rangePercent))
+			{
+				return false;
+			}
+			zones.push_back(zone);
+		}
+		return distribution->setZoned(zones);
+	}
+
+	return false;
+}
+
+void IO_JOB_RESULT::merge(const IO_JOB_RESULT& other)
+{
+	numReads += other.numReads;
+	numWrites += other.numWrites;
+	numReadBytes += other.numReadBytes;
+	numWriteBytes += other.numWriteBytes;
+	numErrors += other.numErrors;
+	numVerifyErrors += other.numVerifyErrors;
+	numChecksumErrors += other.numChecksumErrors;
+	if (firstVerifyError.empty())
+	{
+		firstVerifyError = other.firstVerifyError;
+	}
+	seconds = std::max(seconds, other.seconds);
+	readLatency.merge(other.readLatency);
+	writeLatency.merge(other.writeLatency);
+}
+
+std::string IO_JOB_RESULT::toString() const
+{
+	double safeSeconds = seconds > 0 ? seconds : 1;
+	std::string retString = "";
+
+	if (numReads)
+	{
+		retString += "  read:  IOPS=" + std::to_string((uint64_t)(numReads / safeSeconds));
+		retString += " BW=" + std::to_string(numReadBytes / safeSeconds / (1 << 20)) + "MiB/s\n";
+		retString += "    lat (nsec): " + readLatency.toString() + "\n";
+	}
+
+	if (numWrites)
+	{
+		retString += "  write: IOPS=" + std::to_string((uint64_t)(numWrites / safeSeconds));
+		retString += " BW=" + std::to_string(numWriteBytes / safeSeconds / (1 << 20)) + "MiB/s\n";
+		retString += "    lat (nsec): " + writeLatency.toString() + "\n";
+	}
+
+	retString += "  errors=" + std::to_string(numErrors) + " runtime=" + std::to_string(seconds) + "s\n";
+	if (numVerifyErrors)
+	{
+		retString += "  verify errors=" + std::to_string(numVerifyErrors) + " first: " + firstVerifyError + "\n";
+	}
+	if (numChecksumErrors)
+	{
+		retString += "  checksum errors=" + std::to_string(numChecksumErrors) + "\n";
+	}
+	return retString;
+}
+
+bool IO_JOB_RESULT::hasErrors() const
+{
+	return numErrors != 0 || numVerifyErrors != 0 || numChecksumErrors != 0;
+}
+
+IOJob::IOJob(const IO_JOB_CONFIG& config)
+{
+	this->config = config;
+	writeBuffer = NULL;
+	readBuffer = NULL;
+	numIosInFlight = 0;
+	numDeferredIos = 0;
+	numMissingIos = 0;
+	nextIoTimeNanoseconds = 0;
+	writeGeneration = 0;
+	stopping = false;
+	measuring = false;
+}
+
+IOJob::~IOJob()
+{
+	// the IO object has to be done with the buffers first
+	lbaGenerator.reset();
+	io.reset();
+
+	IO::freeAlignedBuffer(writeBuffer);
+	IO::freeAlignedBuffer(readBuffer);
+	for (void* buffer : ownWriteBuffers)
+	{
+		IO::freeAlignedBuffer(buffer);
+	}
+}
+
+bool IOJob::run()
+{
+	if (config.blockSizes.empty() || config.queueDepth == 0)
+	{
+		std::cerr << config.name << ": needs at least one block size and a queue depth" << std::endl;
+		return false;
+	}
+
+	if (config.runtimeSeconds <= 0 && config.byteLimit == 0)
+	{
+		std::cerr << config.name << ": needs a runtime or an io_size to know when to stop" << std::endl;
+		return false;
+	}
+
+	io.reset(new IO(config.path, config.backend, config.queueDepth + JOB_EXTRA_REQUESTS));
+	uint32_t blockSize = io->getBlockSize();
+	uint64_t blockCount = io->getBlockCount();
+	if (blockSize == 0 || blockCount == 0)
+	{
+		std::cerr << config.name << ": could not open " << config.path << std::endl;
+		return false;
+	}
+
+	if (config.checksum)
+	{
+		std::shared_ptr<IOChecksumTable> checksumTable = config.checksumFile.empty() ?
+			IOChecksumTable::openShared(config.path, blockCount, blockSize) : IOChecksumTable::open(config.checksumFile, blockCount, blockSize);
+		if (!checksumTable || !io->setChecksumTable(checksumTable))
+		{
+			std::cerr << config.name << ": could not set up the checksum table" << std::endl;
+			return false;
+		}
+	}
+
+	if (config.maxMergeBytes && !io->setMaxMergeBytes((size_t)config.maxMergeBytes))
+	{
+		std::cerr << config.name << ": can't merge IOs on " << config.path << std::endl;
+		return false;
+	}
+
+	// work in blocks from here on
+	uint64_t maxBytes = 0;
+	uint32_t totalWeight = 0;
+	for (auto& size : config.blockSizes)
+	{
+		if (size.bytes == 0 || size.bytes % blockSize)
+		{
+			std::cerr << config.name << ": block size " << size.bytes << " is not a multiple of the device block size " << blockSize << std::endl;
+			return false;
+		}
+
+		blockCounts.push_back(size.bytes / blockSize);
+		totalWeight += size.weight;
+		cumulativeWeights.push_back(totalWeight);
+		maxBytes = std::max(maxBytes, size.bytes);
+	}
+
+	if (totalWeight == 0)
+	{
+		std::cerr << config.name << ": block size weights add up to 0" << std::endl;
+		return false;
+	}
+
+	uint64_t lbaStart = config.lbaStart / blockSize;
+	uint64_t lbaCount = config.lbaCount ? config.lbaCount / blockSize : blockCount - std::min(lbaStart, blockCount);
+	if (lbaStart + lbaCount > blockCount || lbaCount < *std::max_element(blockCounts.begin(), blockCounts.end()))
+	{
+		std::cerr << config.name << ": the lba range doesn't fit on the device or can't hold the largest IO" << std::endl;
+		return false;
+	}
+	config.lbaStart = lbaStart;
+	config.lbaCount = lbaCount;
+
+	uint64_t seed = config.seed ? config.seed : getTimestampNanoseconds();
+	ioRand.reset(new IORand(seed, IO_RAND_ENGINE_XOSHIRO256STARSTAR, config.streamId));
+	// the generator's max lba is the last one it may use
+	lbaGenerator.reset(new IOLBAGenerator(io, ioRand, lbaCount - 1));
+	if (config.pattern == IO_JOB_PATTERN_RANDOM)
+	{
+		lbaGenerator->setDistribution(config.distribution);
+	}
+
+	writeBuffer = io->getAlignedBuffer((size_t)maxBytes);
+	readBuffer = io->getAlignedBuffer((size_t)maxBytes);
+	if (!writeBuffer || !readBuffer)
+	{
+		std::cerr << config.name << ": could not allocate IO buffers" << std::endl;
+		return false;
+	}
+	ioRand->fillBuffer((char*)writeBuffer, (size_t)maxBytes);
+
+	if (config.verify)
+	{
+		if (blockSize <= sizeof(IO_VERIFY_HEADER) || blockSize % sizeof(uint32_t))
+		{
+			std::cerr << config.name << ": can't verify with a block size of " << blockSize << std::endl;
+			return false;
+		}
+		if (config.compressionRatio > 1 || config.dedupPercent)
+		{
+			std::cerr << config.name << ": verify writes its own data, so it can't be compressible or dedupable" << std::endl;
+			return false;
+		}
+
+		verifier.reset(new IOVerifier(blockSize, config.verifySeed));
+	}
+	else if (config.compressionRatio > 1 || config.dedupPercent)
+	{
+		// at least the device's block size so a block never straddles two payload blocks
+		IO_PAYLOAD_CONFIG payloadConfig;
+		payloadConfig.blockSize = std::max<uint32_t>(blockSize, DEFAULT_PAYLOAD_BLOCK_SIZE);
+		payloadConfig.compressionRatio = config.compressionRatio;
+		payloadConfig.dedupPercent = config.dedupPercent;
+		payloadGenerator.reset(new IOPayloadGenerator(payloadConfig, ioRand));
+	}
+
+	if (verifier || payloadGenerator)
+	{
+		// one per request, so there is always one for the next write
+		for (size_t i = 0; i < config.queueDepth + JOB_EXTRA_REQUESTS; i++)
+		{
+			void* buffer = io->getAlignedBuffer((size_t)maxBytes);
+			if (!buffer)
+			{
+				std::cerr << config.name << ": could not allocate IO buffers" << std::endl;
+				return false;
+			}
+			ownWriteBuffers.push_back(buffer);
+		}
+		freeWriteBuffers = ownWriteBuffers;
+	}
+
+	uint64_t startTime = getTimestampNanoseconds();
+	uint64_t measureStartTime = startTime + (uint64_t)(config.rampSeconds * 1e9);
+	uint64_t endTime = measureStartTime + (uint64_t)(config.runtimeSeconds * 1e9);
+	measuring = config.rampSeconds <= 0;
+
+	// the rate cap's schedule starts now. Left at 0 it would look like we were behind and burst
+	nextIoTimeNanoseconds = startTime;
+
+	// when merging, IOs are staged and sent a batch at a time so there is something to merge
+	if (config.maxMergeBytes)
+	{
+		io->plug();
+	}
+
+	// from here on, every completion queues the next IO. Any that can't be queued are retried below
+	for (size_t i = 0; i < config.queueDepth; i++)
+	{
+		queueNextIo();
+	}
+
+	while (numIosInFlight || numDeferredIos)
+	{
+		// don't sleep past when a rate capped IO can go
+		uint64_t waitNanoseconds = queueDeferredIos();
+		queueMissingIos();
+		int64_t timeoutMicroseconds = JOB_POLL_TIMEOUT_MICROSECONDS;
+		if (waitNanoseconds)
+		{
+			timeoutMicroseconds = std::min(timeoutMicroseconds, (int64_t)(waitNanoseconds / 1000));
+		}
+		if (config.maxMergeBytes)
+		{
+			io->flush();
+		}
+
+		if (numIosInFlight)
+		{
+			io->poll(1, DEFAULT_POLL_MAX_EVENTS, timeoutMicroseconds);
+		}
+		else if (waitNanoseconds)
+		{
+			// everything is waiting on the rate cap
+			std::this_thread::sleep_for(std::chrono::nanoseconds(waitNanoseconds));
+		}
+
+		uint64_t now = getTimestampNanoseconds();
+		if (!measuring && now >= measureStartTime)
+		{
+			// IOs that complete from here on count. Whatever is in flight is already at full queue depth
+			measuring = true;
+			result = IO_JOB_RESULT();
+		}
+
+		if (config.runtimeSeconds > 0 && now >= endTime)
+		{
+			stopping = true;
+		}
+	}
+
+	if (config.maxMergeBytes)
+	{
+		io->unplug();
+	}
+
+	result.seconds = (getTimestampNanoseconds() - std::max(startTime, measureStartTime)) / 1e9;
+	return true;
+}
+
+const IO_JOB_CONFIG& IOJob::getConfig() const
+{
+	return config;
+}
+
+const IO_JOB_RESULT& IOJob::getResult() const
+{
+	return result;
+}
+
+bool IOJob::queueNextIo()
+{
+	bool rateCapped = config.rateIops || config.rateBytesPerSecond;
+	if (rateCapped && getTimestampNanoseconds() < nextIoTimeNanoseconds)
+	{
+		numDeferredIos++;
+		return true;
+	}
+
+	// pick a size by weight
+	uint32_t pick = (uint32_t)ioRand->getBoundedRandomNumber(cumulativeWeights.back());
+	size_t sizeIdx = 0;
+	while (pick >= cumulativeWeights[sizeIdx])
+	{
+		sizeIdx++;
+	}
+	uint64_t ioBlockCount = blockCounts[sizeIdx];
+
+	uint64_t lba;
+	try
+	{
+		lba = config.pattern == IO_JOB_PATTERN_RANDOM ? lbaGenerator->generateRandomLba(ioBlockCount) : lbaGenerator->generateSequentialLba(ioBlockCount);
+	}
+	catch (const std::runtime_error&)
+	{
+		// every range is in flight. Run at a lower queue depth until some complete
+		numMissingIos++;
+		return false;
+	}
+
+	bool isRead = config.readPercent >= 100 || ioRand->getBoundedRandomNumber(100) < config.readPercent;
+	bool queued;
+	void* ownWriteBuffer = NULL;
+	if (verifier && isRead)
+	{
+		// each read needs its own buffer to be checked in its callback. The IO object recycles them
+		queued = io->read(config.lbaStart + lba, ioBlockCount, ioCallback, this);
+	}
+	else if (!isRead && (verifier || payloadGenerator))
+	{
+		ownWriteBuffer = freeWriteBuffers.back();
+		freeWriteBuffers.pop_back();
+		if (verifier)
+		{
+			verifier->fill(ownWriteBuffer, config.lbaStart + lba, ioBlockCount, ++writeGeneration);
+		}
+		else
+		{
+			payloadGenerator->fill(ownWriteBuffer, (size_t)(ioBlockCount * io->getBlockSize()));
+		}
+		queued = io->write(config.lbaStart + lba, ioBlockCount, ownWriteBuffer, ioCallback, this);
+	}
+	else
+	{
+		queued = isRead ? io->read(config.lbaStart + lba, ioBlockCount, readBuffer, ioCallback, this) :
+			io->write(config.lbaStart + lba, ioBlockCount, writeBuffer, ioCallback, this);
+	}
+
+	if (!queued)
+	{
+		if (ownWriteBuffer)
+		{
+			freeWriteBuffers.push_back(ownWriteBuffer);
+		}
+		lbaGenerator->removeInUseLba(lba, ioBlockCount);
+		result.numErrors++;
+		numMissingIos++;
+		return false;
+	}
+
+	numIosInFlight++;
+
+	if (rateCapped)
+	{
+		// space IOs out evenly. Whichever cap is tighter wins
+		uint64_t intervalNanoseconds = 0;
+		if (config.rateIops)
+		{
+			intervalNanoseconds = 1000000000ULL / config.rateIops;
+		}
+		if (config.rateBytesPerSecond)
+		{
+			uint64_t bytes = ioBlockCount * io->getBlockSize();
+			intervalNanoseconds = std::max(intervalNanoseconds, (uint64_t)(bytes * 1e9 / config.rateBytesPerSecond));
+		}
+
+		// after a stall, don't burst to make up for all of it
+		uint64_t now = getTimestampNanoseconds();
+		if (nextIoTimeNanoseconds + JOB_RATE_MAX_CATCH_UP_NANOSECONDS < now)
+		{
+			nextIoTimeNanoseconds = now - JOB_RATE_MAX_CATCH_UP_NANOSECONDS;
+		}
+		nextIoTimeNanoseconds += intervalNanoseconds;
+	}
+
+	return true;
+}
+
+uint64_t IOJob::queueDeferredIos()
+{
+	if (stopping)
+	{
+		numDeferredIos = 0;
+	}
+
+	while (numDeferredIos)
+	{
+		uint64_t now = getTimestampNanoseconds();
+		if (now < nextIoTimeNanoseconds)
+		{
+			return nextIoTimeNanoseconds - now;
+		}
+
+		numDeferredIos--;
+		queueNextIo();
+	}
+
+	return 0;
+}
+
+void IOJob::queueMissingIos()
+{
+	// ones that fail again count themselves as missing again, so each is only tried once per call
+	size_t numToRetry = stopping ? 0 : numMissingIos;
+	numMissingIos = 0;
+	for (size_t i = 0; i < numToRetry; i++)
+	{
+		queueNextIo();
+	}
+}
+
+void IOJob::ioCallback(IO_CALLBACK_STRUCT* ioCallbackStruct)
+{
+	((IOJob*)ioCallbackStruct->userCallbackData)->onIoComplete(ioCallbackStruct);
+}
+
+void IOJob::onIoComplete(IO_CALLBACK_STRUCT* ioCallbackStruct)
+{
+	numIosInFlight--;
+	lbaGenerator->removeInUseLba(ioCallbackStruct->lba - config.lbaStart, ioCallbackStruct->numBlocksRequested);
+
+	if (!ownWriteBuffers.empty() && ioCallbackStruct->operation == IO_OPERATION_WRITE)
+	{
+		freeWriteBuffers.push_back(ioCallbackStruct->xferBuffer);
+	}
+	else if (verifier && ioCallbackStruct->errorCode == 0)
+	{
+		// other jobs may have rewritten it since, so any generation will do
+		IO_VERIFY_RESULT verifyResult;
+		if (!verifier->verify(ioCallbackStruct->xferBuffer, ioCallbackStruct->lba, ioCallbackStruct->numBlocksRequested, IO_VERIFY_ANY_GENERATION, &verifyResult))
+		{
+			if (result.numVerifyErrors++ == 0)
+			{
+				result.firstVerifyError = verifyResult.toString();
+			}
+		}
+	}
+
+	if (ioCallbackStruct->errorCode == IO_ERROR_CHECKSUM_MISMATCH && io->getChecksumTable())
+	{
+		result.numChecksumErrors++;
+	}
+
+	if (measuring)
+	{
+		if (ioCallbackStruct->errorCode)
+		{
+			result.numErrors++;
+		}
+		else if (ioCallbackStruct->operation == IO_OPERATION_READ)
+		{
+			result.numReads++;
+			result.numReadBytes += ioCallbackStruct->numBytesXferred;
+#if IO_ENABLE_STATS
+			result.readLatency.record(ioCallbackStruct->latencyNanoseconds);
+#endif // IO_ENABLE_STATS
+		}
+		else
+		{
+			result.numWrites++;
+			result.numWriteBytes += ioCallbackStruct->numBytesXferred;
+#if IO_ENABLE_STATS
+			result.writeLatency.record(ioCallbackStruct->latencyNanoseconds);
+#endif // IO_ENABLE_STATS
+		}
+
+		if (config.byteLimit && result.numReadBytes + result.numWriteBytes >= config.byteLimit)
+		{
+			stopping = true;
+		}
+	}
+
+	if (!stopping)
+	{
+		queueNextIo();
+	}
+}
+
+bool IOJob::runAll(const std::vector<IO_JOB_CONFIG>& configs, std::vector<IO_JOB_RESULT>& results)
+{
+	// one seed for everything that didn't pick one, so copies only differ by stream
+	uint64_t clockSeed = getTimestampNanoseconds();
+
+	std::vector<std::unique_ptr<IOJob>> jobs;
+	std::vector<size_t> configIndexes;
+	for (size_t i = 0; i < configs.size(); i++)
+	{
+		for (size_t copy = 0; copy < configs[i].numJobs; copy++)
+		{
+			IO_JOB_CONFIG config = configs[i];
+			config.seed = config.seed ? config.seed : clockSeed;
+			config.streamId = jobs.size();
+			if (configs[i].numJobs > 1)
+			{
+				config.name += "." + std::to_string(copy);
+			}
+
+			jobs.emplace_back(new IOJob(config));
+			configIndexes.push_back(i);
+		}
+	}
+
+	std::vector<std::thread> threads;
+	std::vector<char> started(jobs.size(), 0);
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		threads.push_back(std::thread([&jobs, &started, i]() {
+			started[i] = jobs[i]->run();
+		}));
+	}
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	bool allStarted = true;
+	results.assign(configs.size(), IO_JOB_RESULT());
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		allStarted &= started[i] != 0;
+		results[configIndexes[i]].merge(jobs[i]->getResult());
+	}
+
+	return allStarted;
+}
+
+bool IOJob::setOption(IO_JOB_CONFIG& config, const std::string& key, const std::string& value)
+{
+	// config is only changed if the value is good
+	uint64_t size = 0;
+	double number = 0;
+	bool valid = true;
+
+	if (key == "name")
+	{
+		config.name = value;
+	}
+	else if (key == "filename")
+	{
+		config.path = value;
+	}
+	else if (key == "rw" || key == "readwrite")
+	{
+		uint32_t readPercent;
+		if (value == "read" || value == "randread")
+		{
+			readPercent = 100;
+		}
+		else if (value == "write" || value == "randwrite")
+		{
+			readPercent = 0;
+		}
+		else if (value == "rw" || value == "readwrite" || value == "randrw")
+		{
+			readPercent = 50;
+		}
+		else
+		{
+			valid = false;
+		}
+
+		if (valid)
+		{
+			config.readPercent = readPercent;
+			config.pattern = value.compare(0, 4, "rand") == 0 ? IO_JOB_PATTERN_RANDOM : IO_JOB_PATTERN_SEQUENTIAL;
+		}
+	}
+	else if (key == "rwmixread" || key == "rwmixwrite")
+	{
+		valid = parseDouble(value, &number) && number >= 0 && number <= 100;
+		if (valid)
+		{
+			config.readPercent = (uint32_t)(key == "rwmixread" ? number : 100 - number);
+		}
+	}
+	else if (key == "bs" || key == "blocksize")
+	{
+		valid = parseSize(value, &size);
+		if (valid)
+		{
+			config.blockSizes.clear();
+			config.blockSizes.push_back({ size, 1 });
+		}
+	}
+	else if (key == "bssplit")
+	{
+		// 4k/50:64k/50
+		std::vector<IO_JOB_BLOCK_SIZE> blockSizes;
+		for (auto& part : split(value, ':'))
+		{
+			std::vector<std::string> sizeAndWeight = split(part, '/');
+			valid &= sizeAndWeight.size() == 2 && parseSize(sizeAndWeight[0], &size) && parseDouble(sizeAndWeight[1], &number) && number >= 0;
+			blockSizes.push_back({ size, (uint32_t)number });
+		}
+
+		valid &= !blockSizes.empty();
+		if (valid)
+		{
+			config.blockSizes = blockSizes;
+		}
+	}
+	else if (key == "iodepth")
+	{
+		valid = parseSize(value, &size) && size > 0;
+		if (valid)
+		{
+			config.queueDepth = (size_t)size;
+		}
+	}
+	else if (key == "runtime")
+	{
+		valid = parseDouble(value, &number) && number >= 0;
+		if (valid)
+		{
+			config.runtimeSeconds = number;
+		}
+	}
+	else if (key == "ramp_time")
+	{
+		valid = parseDouble(value, &number) && number >= 0;
+		if (valid)
+		{
+			config.rampSeconds = number;
+		}
+	}
+	else if (key == "io_size" || key == "io_limit")
+	{
+		valid = parseSize(value, &config.byteLimit);
+	}
+	else if (key == "offset")
+	{
+		valid = parseSize(value, &config.lbaStart);
+	}
+	else if (key == "size")
+	{
+		valid = parseSize(value, &config.lbaCount);
+	}
+	else if (key == "numjobs")
+	{
+		valid = parseSize(value, &size) && size > 0;
+		if (valid)
+		{
+			config.numJobs = (size_t)size;
+		}
+	}
+	else if (key == "rate_iops")
+	{
+		valid = parseSize(value, &config.rateIops);
+	}
+	else if (key == "rate")
+	{
+		// bytes per second, like bs
+		valid = parseSize(value, &config.rateBytesPerSecond);
+	}
+	else if (key == "randseed")
+	{
+		valid = parseSize(value, &config.seed);
+	}
+	else if (key == "verify")
+	{
+		// only the built in header + generated payload, whatever the name
+		valid = value == "0" || value == "1" || value == "none" || value == "meta" || value == "pattern";
+		if (valid)
+		{
+			config.verify = value != "0" && value != "none";
+		}
+	}
+	else if (key == "verify_seed")
+	{
+		valid = parseSize(value, &config.verifySeed);
+	}
+	else if (key == "checksum")
+	{
+		valid = value == "0" || value == "1" || value == "none" || value == "crc32c";
+		if (valid)
+		{
+			config.checksum = value != "0" && value != "none";
+		}
+	}
+	else if (key == "checksum_file")
+	{
+		valid = !value.empty();
+		if (valid)
+		{
+			config.checksumFile = value;
+			config.checksum = true;
+		}
+	}
+	else if (key == "buffer_compress_percentage")
+	{
+		// percent of each block that compresses away
+		double number;
+		valid = parseDouble(value, &number) && number >= 0 && number < 100;
+		if (valid)
+		{
+			config.compressionRatio = 100 / (100 - number);
+		}
+	}
+	else if (key == "compress_ratio")
+	{
+		double number;
+		valid = parseDouble(value, &number) && number >= 1;
+		if (valid)
+		{
+			config.compressionRatio = number;
+		}
+	}
+	else if (key == "dedupe_percentage")
+	{
+		valid = parseSize(value, &size) && size <= 100;
+		if (valid)
+		{
+			config.dedupPercent = (uint32_t)size;
+		}
+	}
+	else if (key == "merge_bytes")
+	{
+		valid = parseSize(value, &config.maxMergeBytes);
+	}
+	else if (key == "random_distribution")
+	{
+		IOLBADistribution distribution;
+		valid = parseDistribution(value, &distribution);
+		if (valid)
+		{
+			config.distribution = distribution;
+		}
+	}
+	else if (key == "ioengine")
+	{
+		if (value == "libaio")
+		{
+			config.backend = IO_BACKEND_LINUX_AIO;
+		}
+		else if (value == "io_uring")
+		{
+			config.backend = IO_BACKEND_IO_URING;
+		}
+		else if (value == "default" || value == "windowsaio")
+		{
+			config.backend = IO_BACKEND_DEFAULT;
+		}
+		else if (value == "sim")
+		{
+			// filename is the simulated device's name (and options)
+			config.backend = IO_BACKEND_SIMULATED;
+		}
+		else
+		{
+			valid = false;
+		}
+	}
+	else
+	{
+		std::cerr << "Unknown job option: " << key << std::endl;
+		return false;
+	}
+
+	if (!valid)
+	{
+		std::cerr << "Bad value for job option " << key << ": " << value << std::endl;
+	}
+	return valid;
+}
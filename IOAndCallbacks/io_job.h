@@ -0,0 +1,259 @@
+// IO Job header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+
+#include "io.h"
+#include "io_checksum_table.h"
+#include "io_histogram.h"
+#include "io_lba_distribution.h"
+#include "io_lba_generator.h"
+#include "io_payload.h"
+#include "io_verify.h"
+#include "iorand.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+// the verify seed jobs use unless told otherwise, so separate jobs check each other's writes
+#define IO_JOB_DEFAULT_VERIFY_SEED 0x1F0A11CA11BAC55ULL
+
+// how a job picks its lbas
+enum IO_JOB_PATTERN_ENUM {
+	IO_JOB_PATTERN_SEQUENTIAL,
+	IO_JOB_PATTERN_RANDOM,
+};
+
+// one entry of a block size split: weight out of the total weight of all entries
+struct IO_JOB_BLOCK_SIZE
+{
+	uint64_t bytes;
+	uint32_t weight;
+};
+
+// Everything a job needs to know. Defaults are a 4k random read at queue depth 1 for 10 seconds
+struct IO_JOB_CONFIG
+{
+	IO_JOB_CONFIG()
+	{
+		name = "job";
+		backend = IO_BACKEND_DEFAULT;
+		pattern = IO_JOB_PATTERN_RANDOM;
+		readPercent = 100;
+		blockSizes.push_back({ 4096, 1 });
+		queueDepth = 1;
+		runtimeSeconds = 10;
+		rampSeconds = 0;
+		byteLimit = 0;
+		lbaStart = 0;
+		lbaCount = 0;
+		seed = 0;
+		numJobs = 1;
+		streamId = 0;
+		rateIops = 0;
+		rateBytesPerSecond = 0;
+		verify = false;
+		verifySeed = IO_JOB_DEFAULT_VERIFY_SEED;
+		checksum = false;
+		compressionRatio = 1;
+		dedupPercent = 0;
+		maxMergeBytes = 0;
+	}
+
+	std::string name;
+	std::string path;
+	IO_BACKEND_ENUM backend;
+
+	IO_JOB_PATTERN_ENUM pattern;
+
+	// only used for IO_JOB_PATTERN_RANDOM
+	IOLBADistribution distribution;
+
+	// 0 - 100. The rest are writes
+	uint32_t readPercent;
+
+	// picked per IO by weight. Each must be a multiple of the device's block size
+	std::vector<IO_JOB_BLOCK_SIZE> blockSizes;
+
+	// IOs kept in flight
+	size_t queueDepth;
+
+	// measured time, after the ramp. 0 means until byteLimit
+	double runtimeSeconds;
+
+	// IO runs at full queue depth for this long before anything is measured
+	double rampSeconds;
+
+	// stop after this many measured bytes. 0 means until runtimeSeconds
+	uint64_t byteLimit;
+
+	// the lba range the job stays in. A count of 0 means to the end of the device
+	uint64_t lbaStart;
+	uint64_t lbaCount;
+
+	// 0 picks one from the clock
+	uint64_t seed;
+
+	// runAll() runs this many copies of the job, each on its own thread with its own IO object
+	size_t numJobs;
+
+	// random stream within seed. runAll() gives each copy its own
+	uint64_t streamId;
+
+	// caps on how fast IO is queued. 0 means no cap
+	uint64_t rateIops;
+	uint64_t rateBytesPerSecond;
+
+	// writes are stamped by an IOVerifier and every read is checked against it.
+	//  Reads of blocks no verify job wrote count as verify errors, so write the range first.
+	//  Any generation is accepted since other jobs may write the same blocks, so a lost write that
+	//  leaves an older stamped copy of the block behind is not detected
+	bool verify;
+
+	// jobs only verify each other's blocks if these match. Separate from seed so they can pick different lbas
+	uint64_t verifySeed;
+
+	// Keep a CRC32C of every block written and check every read against it (see IO::setChecksumTable()).
+	//  Jobs on the same device share the table. Blocks not written since it was made aren't checked
+	bool checksum;
+
+	// if set, the checksum table lives in this file so a later run can check what this one wrote
+	std::string checksumFile;
+
+	// Write data that compresses by about this much (1 is incompressible) and has about this many
+	//  duplicate blocks (see IOPayloadGenerator). Otherwise every write is the same random buffer
+	double compressionRatio;
+	uint32_t dedupPercent;
+
+	// IOs queued by the completions of one poll are sent together, with adjacent ones merged up to
+	//  this size (see IO::setMaxMergeBytes()). 0 sends each one as it is queued
+	uint64_t maxMergeBytes;
+};
+
+// What a job measured (ramp time excluded)
+struct IO_JOB_RESULT
+{
+	IO_JOB_RESULT()
+	{
+		numReads = 0;
+		numWrites = 0;
+		numReadBytes = 0;
+		numWriteBytes = 0;
+		numErrors = 0;
+		numVerifyErrors = 0;
+		numChecksumErrors = 0;
+		seconds = 0;
+	}
+
+	// adds other's numbers to this one (seconds becomes the longer of the two)
+	void merge(const IO_JOB_RESULT& other);
+
+	// IOPS, bandwidth and latency percentiles
+	std::string toString() const;
+
+	// true if any IO failed or any read didn't match, including verify/checksum misses during ramp
+	bool hasErrors() const;
+
+	uint64_t numReads;
+	uint64_t numWrites;
+	uint64_t numReadBytes;
+	uint64_t numWriteBytes;
+	uint64_t numErrors;
+	double seconds;
+
+	// reads that completed but didn't match what was written, and what was wrong with the first one
+	uint64_t numVerifyErrors;
+	std::string firstVerifyError;
+
+	// reads that didn't match the checksum table (also counted in numErrors once measuring)
+	uint64_t numChecksumErrors;
+
+	// nanoseconds from queueing to callback. Only filled in if IO_ENABLE_STATS is on
+	IOLatencyHistogram readLatency;
+	IOLatencyHistogram writeLatency;
+};
+
+// IOJob drives one IO object at a fixed queue depth. Every completion callback queues the next IO,
+//  so the only per-IO work on top of the library is picking an lba and a size
+class IOJob
+{
+public:
+	IOJob(const IO_JOB_CONFIG& config);
+	~IOJob();
+
+	// Runs the job to completion on the calling thread. Returns false if it could not start
+	bool run();
+
+	const IO_JOB_CONFIG& getConfig() const;
+	const IO_JOB_RESULT& getResult() const;
+
+	// Sets one option by its fio-style name (rw, rwmixread, bs, bssplit, iodepth, runtime, ramp_time, size,
+	//  offset, seed, backend, ...). Returns false (with a message) if the name or value is bad
+	static bool setOption(IO_JOB_CONFIG& config, const std::string& key, const std::string& value);
+
+	// Runs every config (numJobs copies of each) in parallel, one thread each.
+	//  Returns one result per config with its copies merged. Returns false if any copy failed to start
+	static bool runAll(const std::vector<IO_JOB_CONFIG>& configs, std::vector<IO_JOB_RESULT>& results);
+
+private:
+	// picks an lba/size/direction and queues it. Returns false if nothing could be queued, which counts as a
+	//  missing IO. If a rate cap says it is too early, the IO is deferred to the run loop instead
+	bool queueNextIo();
+
+	// queues deferred IOs as the rate caps allow. Returns how long until the next one may go (0 if none are waiting)
+	uint64_t queueDeferredIos();
+
+	// tries again to queue the IOs that queueNextIo() couldn't, to get back up to the queue depth
+	void queueMissingIos();
+
+	// called for every completion
+	static void ioCallback(IO_CALLBACK_STRUCT* ioCallbackStruct);
+	void onIoComplete(IO_CALLBACK_STRUCT* ioCallbackStruct);
+
+	IO_JOB_CONFIG config;
+	IO_JOB_RESULT result;
+
+	std::shared_ptr<IO> io;
+	std::shared_ptr<IORand> ioRand;
+	std::unique_ptr<IOLBAGenerator> lbaGenerator;
+
+	// block sizes in blocks and the running total of their weights
+	std::vector<uint64_t> blockCounts;
+	std::vector<uint32_t> cumulativeWeights;
+
+	// writes all come from this one buffer. Reads all land in the other one
+	void* writeBuffer;
+	void* readBuffer;
+
+	// only set if config.verify
+	std::unique_ptr<IOVerifier> verifier;
+
+	// only set for a compression ratio or dedup percent
+	std::unique_ptr<IOPayloadGenerator> payloadGenerator;
+
+	// With either of the above, every write in flight needs its own buffer to fill, from freeWriteBuffers
+	std::vector<void*> ownWriteBuffers;
+	std::vector<void*> freeWriteBuffers;
+
+	// stamped on each verified write
+	uint64_t writeGeneration;
+
+	size_t numIosInFlight;
+
+	// IOs held back by the rate caps
+	size_t numDeferredIos;
+
+	// IOs that queueNextIo() failed to queue. Retried from the run loop
+	size_t numMissingIos;
+
+	// with a rate cap, the earliest the next IO may be queued
+	uint64_t nextIoTimeNanoseconds;
+
+	// once set, completions stop queueing more IO
+	bool stopping;
+
+	// set once the ramp is over and completions count toward result
+	bool measuring;
+};
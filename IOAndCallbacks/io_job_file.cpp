@@ -0,0 +1,119 @@
+// IO Job File implementation file for IO
+// (C) - csm10495 - MIT License 2019
+
+#include "io_job_file.h"
+
+#include <fstream>
+#include <iostream>
+
+// removes leading and trailing whitespace
+static std::string trim(const std::string& value)
+{
+	const char* whitespace = " \t\r\n";
+	size_t start = value.find_first_not_of(whitespace);
+	if (start == std::string::npos)
+	{
+		return "";
+	}
+
+	size_t end = value.find_last_not_of(whitespace);
+	return value.substr(start, end - start + 1);
+}
+
+bool IOJobFile::load(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		std::cerr << "Could not open job file " << path << std::endl;
+		return false;
+	}
+
+	return parse(file, path);
+}
+
+bool IOJobFile::parse(std::istream& stream, const std::string& source)
+{
+	jobs.clear();
+
+	IO_JOB_CONFIG global;
+
+	// the section options are going to. NULL before the first section
+	IO_JOB_CONFIG* current = NULL;
+
+	std::string line;
+	size_t lineNumber = 0;
+	while (std::getline(stream, line))
+	{
+		lineNumber++;
+		line = trim(line);
+		if (line.empty() || line[0] == ';' || line[0] == '#')
+		{
+			continue;
+		}
+
+		if (line[0] == '[')
+		{
+			if (line.back() != ']' || line.size() < 3)
+			{
+				std::cerr << source << ":" << lineNumber << ": bad section header: " << line << std::endl;
+				return false;
+			}
+
+			std::string section = trim(line.substr(1, line.size() - 2));
+			if (section == "global")
+			{
+				current = &global;
+			}
+			else
+			{
+				// a job starts from whatever global is at this point
+				jobs.push_back(global);
+				jobs.back().name = section;
+				current = &jobs.back();
+			}
+			continue;
+		}
+
+		size_t equals = line.find('=');
+		if (equals == std::string::npos)
+		{
+			std::cerr << source << ":" << lineNumber << ": expected option=value: " << line << std::endl;
+			return false;
+		}
+
+		if (!current)
+		{
+			std::cerr << source << ":" << lineNumber << ": option outside of a section: " << line << std::endl;
+			return false;
+		}
+
+		if (!IOJob::setOption(*current, trim(line.substr(0, equals)), trim(line.substr(equals + 1))))
+		{
+			std::cerr << source << ":" << lineNumber << ": bad option: " << line << std::endl;
+			return false;
+		}
+	}
+
+	if (jobs.empty())
+	{
+		std::cerr << source << ": no jobs were found" << std::endl;
+		return false;
+	}
+
+	for (auto& job : jobs)
+	{
+		if (job.path.empty())
+		{
+			std::cerr << source << ": job " << job.name << " has no filename" << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+const std::vector<IO_JOB_CONFIG>& IOJobFile::getJobs() const
+{
+	return jobs;
+}
@@ -0,0 +1,46 @@
+// IO Job File header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+
+#include "io_job.h"
+
+#include <istream>
+#include <string>
+#include <vector>
+
+// IOJobFile reads an INI-style (fio-like) job file:
+//
+//	; comments start with ; or #
+//	[global]
+//	filename=/dev/nvme0n1
+//	ioengine=io_uring
+//
+//	[tenant-a]
+//	rw=randread
+//	bs=4k
+//	iodepth=32
+//	numjobs=2
+//	rate_iops=20000
+//
+//	[tenant-b]
+//	filename=/dev/nvme1n1
+//	rw=randwrite
+//	random_distribution=zipf:1.1
+//
+// Each section other than [global] is a job named after the section. Options in [global] apply to the jobs
+//  after it. Option names and values are the same as IOJob::setOption()
+class IOJobFile
+{
+public:
+	// returns false (with a message naming the line) if the file can't be read or has a bad line
+	bool load(const std::string& path);
+
+	// same as load() but from a stream. source is only used in messages
+	bool parse(std::istream& stream, const std::string& source);
+
+	const std::vector<IO_JOB_CONFIG>& getJobs() const;
+
+private:
+	std::vector<IO_JOB_CONFIG> jobs;
+};
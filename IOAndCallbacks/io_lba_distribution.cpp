@@ -0,0 +1,265 @@
+// IO LBA Distribution implementation file for IO
+// (C) - csm10495 - MIT License 2019
+
+#include "io_lba_distribution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// how far off 100 the zone percents can add up to
+#define ZONE_PERCENT_TOLERANCE 0.01
+
+#define IO_PI 3.14159265358979323846
+
+// log1p(x) / x without losing precision near 0
+static double helper1(double x)
+{
+	if (std::fabs(x) > 1e-8)
+	{
+		return std::log1p(x) / x;
+	}
+	return 1 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+}
+
+// expm1(x) / x without losing precision near 0
+static double helper2(double x)
+{
+	if (std::fabs(x) > 1e-8)
+	{
+		return std::expm1(x) / x;
+	}
+	return 1 + x * 0.5 * (1 + x * (1.0 / 3.0) * (1 + 0.25 * x));
+}
+
+IOLBADistribution::IOLBADistribution()
+{
+	type = IO_LBA_DISTRIBUTION_UNIFORM;
+	numLbas = 0;
+	theta = 0;
+	paretoH = 0;
+	normalCenterFraction = 0;
+	normalStdDevFraction = 0;
+	zipfHIntegralX1 = 0;
+	zipfHIntegralNumLbas = 0;
+	zipfS = 0;
+	paretoPower = 0;
+	normalCenter = 0;
+	normalStdDev = 0;
+}
+
+void IOLBADistribution::setUniform()
+{
+	type = IO_LBA_DISTRIBUTION_UNIFORM;
+}
+
+bool IOLBADistribution::setZipf(double theta)
+{
+	if (!(theta > 0))
+	{
+		std::cerr << "Zipf theta must be > 0, got " << theta << std::endl;
+		return false;
+	}
+
+	type = IO_LBA_DISTRIBUTION_ZIPF;
+	this->theta = theta;
+	return true;
+}
+
+bool IOLBADistribution::setPareto(double h)
+{
+	if (!(h > 0 && h < 1))
+	{
+		std::cerr << "Pareto h must be between 0 and 1, got " << h << std::endl;
+		return false;
+	}
+
+	type = IO_LBA_DISTRIBUTION_PARETO;
+	paretoH = h;
+	return true;
+}
+
+bool IOLBADistribution::setNormal(double centerFraction, double stdDevFraction)
+{
+	if (!(centerFraction >= 0 && centerFraction <= 1 && stdDevFraction > 0))
+	{
+		std::cerr << "Normal center must be between 0 and 1 and the standard deviation > 0" << std::endl;
+		return false;
+	}
+
+	type = IO_LBA_DISTRIBUTION_NORMAL;
+	normalCenterFraction = centerFraction;
+	normalStdDevFraction = stdDevFraction;
+	return true;
+}
+
+bool IOLBADistribution::setZoned(const std::vector<IO_LBA_ZONE>& zones)
+{
+	double totalIoPercent = 0;
+	double totalRangePercent = 0;
+	for (auto& zone : zones)
+	{
+		if (zone.ioPercent < 0 || zone.rangePercent < 0)
+		{
+			std::cerr << "Zone percents can't be negative" << std::endl;
+			return false;
+		}
+		totalIoPercent += zone.ioPercent;
+		totalRangePercent += zone.rangePercent;
+	}
+
+	if (zones.empty() || std::fabs(totalIoPercent - 100) > ZONE_PERCENT_TOLERANCE || std::fabs(totalRangePercent - 100) > ZONE_PERCENT_TOLERANCE)
+	{
+		std::cerr << "Zone io and range percents must each add up to 100" << std::endl;
+		return false;
+	}
+
+	type = IO_LBA_DISTRIBUTION_ZONED;
+	this->zones = zones;
+	return true;
+}
+
+void IOLBADistribution::prepare(uint64_t numLbas, uint64_t seed)
+{
+	this->numLbas = numLbas;
+	scatter.reset(numLbas, seed);
+
+	if (type == IO_LBA_DISTRIBUTION_ZIPF)
+	{
+		zipfHIntegralX1 = zipfHIntegral(1.5) - 1;
+		zipfHIntegralNumLbas = zipfHIntegral(numLbas + 0.5);
+		zipfS = 2 - zipfHIntegralInverse(zipfHIntegral(2.5) - zipfH(2));
+	}
+	else if (type == IO_LBA_DISTRIBUTION_PARETO)
+	{
+		// u^paretoPower < h happens with probability 1 - h
+		paretoPower = std::log(paretoH) / std::log(1 - paretoH);
+	}
+	else if (type == IO_LBA_DISTRIBUTION_NORMAL)
+	{
+		normalCenter = normalCenterFraction * numLbas;
+		normalStdDev = normalStdDevFraction * numLbas;
+	}
+	else if (type == IO_LBA_DISTRIBUTION_ZONED)
+	{
+		zoneCumulativeIoPercent.clear();
+		zoneStartLba.clear();
+		zoneNumLbas.clear();
+
+		double ioPercent = 0;
+		double rangePercent = 0;
+		for (size_t i = 0; i < zones.size(); i++)
+		{
+			uint64_t start = (uint64_t)(rangePercent / 100 * numLbas);
+			ioPercent += zones[i].ioPercent;
+			rangePercent += zones[i].rangePercent;
+			uint64_t end = i == zones.size() - 1 ? numLbas : std::min((uint64_t)(rangePercent / 100 * numLbas), numLbas);
+
+			zoneCumulativeIoPercent.push_back(ioPercent);
+			zoneStartLba.push_back(start);
+			zoneNumLbas.push_back(end > start ? end - start : 0);
+		}
+	}
+}
+
+uint64_t IOLBADistribution::sample(IORand& ioRand) const
+{
+	if (numLbas == 0)
+	{
+		return 0;
+	}
+
+	switch (type)
+	{
+	case IO_LBA_DISTRIBUTION_ZIPF:
+		return scatter.permute(sampleZipfRank(ioRand) - 1);
+	case IO_LBA_DISTRIBUTION_PARETO:
+	{
+		uint64_t rank = (uint64_t)(numLbas * std::pow(ioRand.getRandomDouble(), paretoPower));
+		return scatter.permute(std::min(rank, numLbas - 1));
+	}
+	case IO_LBA_DISTRIBUTION_NORMAL:
+		while (true)
+		{
+			// Box-Muller. 1 - u keeps the log away from 0
+			double u1 = 1 - ioRand.getRandomDouble();
+			double u2 = ioRand.getRandomDouble();
+			double value = normalCenter + normalStdDev * std::sqrt(-2 * std::log(u1)) * std::cos(2 * IO_PI * u2);
+
+			// throw out the tails that fall off the ends instead of piling them up there
+			if (value >= 0 && value < (double)numLbas)
+			{
+				return (uint64_t)value;
+			}
+		}
+	case IO_LBA_DISTRIBUTION_ZONED:
+	{
+		double percent = ioRand.getRandomDouble() * 100;
+		size_t zone = 0;
+		while (zone < zoneCumulativeIoPercent.size() - 1 && percent >= zoneCumulativeIoPercent[zone])
+		{
+			zone++;
+		}
+
+		if (zoneNumLbas[zone] == 0)
+		{
+			return std::min(zoneStartLba[zone], numLbas - 1);
+		}
+		return zoneStartLba[zone] + ioRand.getBoundedRandomNumber(zoneNumLbas[zone]);
+	}
+	default:
+		return ioRand.getBoundedRandomNumber(numLbas);
+	}
+}
+
+IO_LBA_DISTRIBUTION_ENUM IOLBADistribution::getType() const
+{
+	return type;
+}
+
+uint64_t IOLBADistribution::sampleZipfRank(IORand& ioRand) const
+{
+	while (true)
+	{
+		double u = zipfHIntegralNumLbas + ioRand.getRandomDouble() * (zipfHIntegralX1 - zipfHIntegralNumLbas);
+		double x = zipfHIntegralInverse(u);
+
+		uint64_t k = (uint64_t)(x + 0.5);
+		if (x + 0.5 < 1)
+		{
+			k = 1;
+		}
+		else if (k > numLbas)
+		{
+			k = numLbas;
+		}
+
+		// accepted right away almost every time
+		if (k - x <= zipfS || u >= zipfHIntegral(k + 0.5) - zipfH((double)k))
+		{
+			return k;
+		}
+	}
+}
+
+double IOLBADistribution::zipfH(double x) const
+{
+	return std::exp(-theta * std::log(x));
+}
+
+double IOLBADistribution::zipfHIntegral(double x) const
+{
+	double logX = std::log(x);
+	return helper2((1 - theta) * logX) * logX;
+}
+
+double IOLBADistribution::zipfHIntegralInverse(double x) const
+{
+	double t = x * (1 - theta);
+	if (t < -1)
+	{
+		// only from rounding error
+		t = -1;
+	}
+	return std::exp(helper1(t) * x);
+}
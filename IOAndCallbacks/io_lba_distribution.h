@@ -0,0 +1,92 @@
+// IO LBA Distribution header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+
+#include "io_permutation.h"
+#include "iorand.h"
+
+#include <cstdint>
+#include <vector>
+
+// how IOLBAGenerator::generateRandomLba() picks where to start
+enum IO_LBA_DISTRIBUTION_ENUM {
+	IO_LBA_DISTRIBUTION_UNIFORM,	// every lba equally likely
+	IO_LBA_DISTRIBUTION_ZIPF,		// lba of rank k is picked with weight 1/k^theta
+	IO_LBA_DISTRIBUTION_PARETO,		// (1 - h) of the IOs go to h of the lbas (h = 0.2 is the 80/20 rule)
+	IO_LBA_DISTRIBUTION_NORMAL,		// normal around a hotspot
+	IO_LBA_DISTRIBUTION_ZONED,		// ioPercent of the IOs go to rangePercent of the lbas, per zone
+};
+
+// one zone for IO_LBA_DISTRIBUTION_ZONED. Zones are laid out in order from lba 0
+struct IO_LBA_ZONE
+{
+	double ioPercent;
+	double rangePercent;
+};
+
+// IOLBADistribution turns uniform random numbers into lbas in [0, numLbas) with the chosen skew.
+//  Everything that depends on the parameters is worked out in prepare(), so sample() is O(1)
+//  (O(number of zones) for zoned)
+class IOLBADistribution
+{
+public:
+	// uniform until one of the set functions is called
+	IOLBADistribution();
+
+	void setUniform();
+
+	// theta > 0. Around 0.8 - 1.2 is typical for caches. Hot lbas are scattered over the range, not bunched at 0
+	bool setZipf(double theta);
+
+	// 0 < h < 1. Hot lbas are scattered over the range, not bunched at 0
+	bool setPareto(double h);
+
+	// center and stdDev are fractions of the range (0.5 and 0.1 put ~68% of IOs in the middle 20%)
+	bool setNormal(double centerFraction, double stdDevFraction);
+
+	// each of ioPercent and rangePercent must add up to 100 across the zones
+	bool setZoned(const std::vector<IO_LBA_ZONE>& zones);
+
+	// works out the constants for numLbas. seed picks how hot lbas are scattered
+	void prepare(uint64_t numLbas, uint64_t seed);
+
+	// returns an lba in [0, numLbas). prepare() must have been called
+	uint64_t sample(IORand& ioRand) const;
+
+	IO_LBA_DISTRIBUTION_ENUM getType() const;
+
+private:
+	// Zipf by rejection-inversion (Hormann and Derflinger), so setup doesn't need the O(n) zeta sum.
+	//  Returns a rank in [1, numLbas]
+	uint64_t sampleZipfRank(IORand& ioRand) const;
+	double zipfH(double x) const;
+	double zipfHIntegral(double x) const;
+	double zipfHIntegralInverse(double x) const;
+
+	IO_LBA_DISTRIBUTION_ENUM type;
+	uint64_t numLbas;
+
+	// parameters as given
+	double theta;
+	double paretoH;
+	double normalCenterFraction;
+	double normalStdDevFraction;
+	std::vector<IO_LBA_ZONE> zones;
+
+	// worked out by prepare()
+	double zipfHIntegralX1;
+	double zipfHIntegralNumLbas;
+	double zipfS;
+	double paretoPower;
+	double normalCenter;
+	double normalStdDev;
+
+	// per zone: the io percent up to and including it, and its first lba and lba count
+	std::vector<double> zoneCumulativeIoPercent;
+	std::vector<uint64_t> zoneStartLba;
+	std::vector<uint64_t> zoneNumLbas;
+
+	// spreads the hot ranks of zipf and pareto over the range
+	IOPermutation scatter;
+};
@@ -3,9 +3,17 @@
 
 #include "io_lba_generator.h"
 
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
 IOLBAGenerator::IOLBAGenerator()
 {
 	this->lastGeneratedLba = -1;
+	this->permutationBlockCount = 0;
+	this->permutationIndex = 0;
+	this->streamSelection = IO_STREAM_SELECTION_ROUND_ROBIN;
+	this->nextStreamIndex = 0;
 }
 
 IOLBAGenerator::IOLBAGenerator(std::shared_ptr<IO> ioPtr, std::shared_ptr<IORand> ioRand) : IOLBAGenerator()
@@ -24,62 +32,184 @@ IOLBAGenerator::IOLBAGenerator(std::shared_ptr<IO> ioPtr, std::shared_ptr<IORand
 
 uint64_t IOLBAGenerator::generateSequentialLba(uint64_t blockCount)
 {
-	this->lastGeneratedLba++;
-	if (this->lastGeneratedLba >= maxLba - blockCount)
+	if (blockCount == 0 || blockCount > maxLba + 1)
 	{
-		this->lastGeneratedLba = 0;
+		throw std::runtime_error("Could not generate sequential LBA, blockCount doesn't fit in the LBA range");
 	}
 
-	uint64_t attemptNum = 0;
-	while (true)
+	// one past the last lba given, back to 0 once an IO there wouldn't fit before maxLba
+	uint64_t lba = this->lastGeneratedLba + 1;
+	if (lba > maxLba + 1 - blockCount)
 	{
-		if (!isGenerateable(this->lastGeneratedLba, blockCount))
+		lba = 0;
+	}
+
+	return claimFreeLba(lba, blockCount);
+}
+
+uint64_t IOLBAGenerator::generateRandomLba(uint64_t blockCount)
+{
+	if (blockCount == 0 || blockCount > maxLba + 1)
+	{
+		throw std::runtime_error("Could not generate random LBA, blockCount doesn't fit in the LBA range");
+	}
+
+	// maxLba is inclusive, so this is the last lba an IO can start at
+	uint64_t lastStartLba = maxLba + 1 - blockCount;
+
+	uint64_t lba;
+	if (distribution.getType() == IO_LBA_DISTRIBUTION_UNIFORM)
+	{
+		lba = ioRand->getRandomNumber<uint64_t>(0, lastStartLba);
+	}
+	else
+	{
+		// Samples in the last blockCount - 1 lbas can't start an IO. Fold them back from the end (not
+		//  onto it) so a hotspot there stays a spread out hotspot
+		lba = distribution.sample(*ioRand);
+		if (lba > lastStartLba)
 		{
-			this->lastGeneratedLba += 1;
+			lba = lastStartLba - (lba - lastStartLba - 1) % (lastStartLba + 1);
 		}
-		else if (this->lastGeneratedLba > maxLba - blockCount)
+	}
+
+	return claimFreeLba(lba, blockCount);
+}
+
+void IOLBAGenerator::setDistribution(const IOLBADistribution& distribution)
+{
+	this->distribution = distribution;
+	this->distribution.prepare(maxLba + 1, ioRand->getRandomNumber<uint64_t>());
+}
+
+uint64_t IOLBAGenerator::generatePermutedLba(uint64_t blockCount)
+{
+	if (blockCount != permutationBlockCount || permutationIndex >= permutation.getSize())
+	{
+		// maxLba is the last usable lba, not one past it
+		uint64_t numSlots = blockCount ? (maxLba + 1) / blockCount : 0;
+		if (numSlots == 0)
+		{
+			throw std::runtime_error("Could not generate permuted LBA, blockCount is larger than the LBA range");
+		}
+
+		permutation.reset(numSlots, ioRand->getRandomNumber<uint64_t>());
+		permutationBlockCount = blockCount;
+		permutationIndex = 0;
+	}
+
+	this->lastGeneratedLba = permutation.permute(permutationIndex++) * blockCount;
+	return this->lastGeneratedLba;
+}
+
+uint64_t IOLBAGenerator::getPermutationRemaining() const
+{
+	return permutationBlockCount ? permutation.getSize() - permutationIndex : 0;
+}
+
+bool IOLBAGenerator::setSequentialStreams(size_t numStreams, IO_STREAM_LAYOUT_ENUM layout, uint64_t blockCount, uint64_t stride)
+{
+	streams.clear();
+	nextStreamIndex = 0;
+
+	// maxLba is the last usable lba, so the streams end one past it. The last region takes the remainder
+	uint64_t endLba = maxLba + 1;
+	for (size_t i = 0; i < numStreams; i++)
+	{
+		bool added;
+		if (layout == IO_STREAM_LAYOUT_INTERLEAVED)
 		{
-			this->lastGeneratedLba = 0;
+			added = addSequentialStream(i * blockCount, endLba, blockCount, stride ? stride : numStreams * blockCount);
 		}
 		else
 		{
-			break;
+			uint64_t regionSize = endLba / numStreams;
+			added = addSequentialStream(i * regionSize, i + 1 == numStreams ? endLba : (i + 1) * regionSize, blockCount, stride ? stride : blockCount);
 		}
-		attemptNum++;
 
-		if (attemptNum >= maxLba)
+		if (!added)
 		{
-			//throw std::runtime_error("Could not generate sequential LBA");
-			return -1;
+			streams.clear();
+			return false;
 		}
 	}
 
-	// add all of these lbas to the inUseLbas set
-	for (uint64_t lba = this->lastGeneratedLba; lba < this->lastGeneratedLba + blockCount; lba++)
+	return true;
+}
+
+bool IOLBAGenerator::addSequentialStream(uint64_t startLba, uint64_t endLba, uint64_t blockCount, uint64_t stride)
+{
+	if (blockCount == 0 || stride == 0 || startLba + blockCount > endLba)
 	{
-		inUseLbas.insert(lba);
+		std::cerr << "Sequential stream [" << startLba << ", " << endLba << ") can't fit an IO of " << blockCount << " blocks" << std::endl;
+		return false;
 	}
 
-	return this->lastGeneratedLba;
+	IO_SEQUENTIAL_STREAM stream;
+	stream.startLba = startLba;
+	stream.endLba = endLba;
+	stream.blockCount = blockCount;
+	stream.stride = stride;
+	stream.nextLba = startLba;
+	streams.push_back(stream);
+	return true;
 }
 
-uint64_t IOLBAGenerator::generateRandomLba(uint64_t blockCount)
+void IOLBAGenerator::setStreamSelection(IO_STREAM_SELECTION_ENUM selection)
+{
+	streamSelection = selection;
+}
+
+uint64_t IOLBAGenerator::generateStreamLba(uint64_t* blockCount, size_t* streamIndex)
+{
+	if (streams.empty())
+	{
+		throw std::runtime_error("Could not generate stream LBA, there are no streams");
+	}
+
+	size_t idx;
+	if (streamSelection == IO_STREAM_SELECTION_RANDOM)
+	{
+		idx = (size_t)ioRand->getBoundedRandomNumber(streams.size());
+	}
+	else
+	{
+		idx = nextStreamIndex;
+		nextStreamIndex = (nextStreamIndex + 1) % streams.size();
+	}
+
+	IO_SEQUENTIAL_STREAM& stream = streams[idx];
+	uint64_t lba = stream.nextLba;
+
+	stream.nextLba += stream.stride;
+	if (stream.nextLba + stream.blockCount > stream.endLba)
+	{
+		stream.nextLba = stream.startLba;
+	}
+
+	*blockCount = stream.blockCount;
+	if (streamIndex)
+	{
+		*streamIndex = idx;
+	}
+
+	this->lastGeneratedLba = lba;
+	return lba;
+}
+
+size_t IOLBAGenerator::getNumStreams() const
 {
-	this->lastGeneratedLba = ioRand->getRandomNumber<uint64_t>(0, maxLba - blockCount);
-	return generateSequentialLba(blockCount);
+	return streams.size();
 }
 
 void IOLBAGenerator::removeInUseLba(uint64_t lba)
 {
-	inUseLbas.erase(lba);
+	inUseLbas.remove(lba, 1);
 }
 
 void IOLBAGenerator::removeInUseLba(uint64_t lba, uint64_t blockCount)
 {
-	for (uint64_t i = lba; i < lba + blockCount; i++)
-	{
-		inUseLbas.erase(i);
-	}
+	inUseLbas.remove(lba, blockCount);
 }
 
 uint64_t IOLBAGenerator::getLastGeneratedLba() const
@@ -87,14 +217,38 @@ uint64_t IOLBAGenerator::getLastGeneratedLba() const
 	return lastGeneratedLba;
 }
 
-bool IOLBAGenerator::isGenerateable(uint64_t lba, uint64_t blockCount)
+uint64_t IOLBAGenerator::claimFreeLba(uint64_t lba, uint64_t blockCount)
 {
-	for (uint64_t testLba = lba; testLba < lba + blockCount; testLba++)
+	uint64_t lastStartLba = maxLba + 1 - blockCount;
+
+	// every start lba is looked at (or skipped as in use) at most once
+	uint64_t numStartsChecked = 0;
+	uint64_t nextCandidateLba;
+	while (!isGenerateable(lba, blockCount, &nextCandidateLba))
 	{
-		if (inUseLbas.find(testLba) != inUseLbas.end())
+		if (nextCandidateLba > lastStartLba)
 		{
-			return false;
+			numStartsChecked += lastStartLba + 1 - lba;
+			lba = 0;
+		}
+		else
+		{
+			numStartsChecked += nextCandidateLba - lba;
+			lba = nextCandidateLba;
+		}
+
+		if (numStartsChecked > lastStartLba)
+		{
+			throw std::runtime_error("Could not find a free LBA range");
 		}
 	}
-	return true;
+
+	inUseLbas.insert(lba, blockCount);
+	this->lastGeneratedLba = lba;
+	return lba;
+}
+
+bool IOLBAGenerator::isGenerateable(uint64_t lba, uint64_t blockCount, uint64_t* nextCandidateLba)
+{
+	return !inUseLbas.overlaps(lba, blockCount, nextCandidateLba);
 }
@@ -4,10 +4,40 @@
 #pragma once
 
 #include "io.h"
+#include "io_interval_set.h"
+#include "io_lba_distribution.h"
+#include "io_permutation.h"
 #include "iorand.h"
 
 #include <memory>
-#include <unordered_set>
+#include <vector>
+
+// how setSequentialStreams() places its streams
+enum IO_STREAM_LAYOUT_ENUM {
+	IO_STREAM_LAYOUT_REGIONS,		// the range is split into one region per stream
+	IO_STREAM_LAYOUT_INTERLEAVED,	// stream i starts at block i and they stride past each other
+};
+
+// how generateStreamLba() picks the stream for each IO
+enum IO_STREAM_SELECTION_ENUM {
+	IO_STREAM_SELECTION_ROUND_ROBIN,
+	IO_STREAM_SELECTION_RANDOM,
+};
+
+// one sequential cursor for generateStreamLba()
+struct IO_SEQUENTIAL_STREAM
+{
+	// the stream wraps from endLba (exclusive) back to startLba
+	uint64_t startLba;
+	uint64_t endLba;
+
+	// size of each IO and how far apart consecutive IOs start
+	uint64_t blockCount;
+	uint64_t stride;
+
+	// where the next IO goes
+	uint64_t nextLba;
+};
 
 class IOLBAGenerator
 {
@@ -16,12 +46,42 @@ public:
 	IOLBAGenerator(std::shared_ptr<IO> ioPtr, std::shared_ptr<IORand> ioRand);
 	IOLBAGenerator(std::shared_ptr<IO> ioPtr, std::shared_ptr<IORand> ioRand, uint64_t maxLba);
 
-	// gives the next sequential lba
+	// gives the next sequential lba that fits in [0, maxLba]. Throws std::runtime_error if no free range is left
 	uint64_t generateSequentialLba(uint64_t blockCount);
 
-	// gives the next random lba
+	// Gives the next random lba, picked with the distribution from setDistribution() (uniform by default) from
+	//  every start that fits in [0, maxLba]. If that range is in use, the first free one after it is given instead.
+	//  Throws std::runtime_error if no free range is left
 	uint64_t generateRandomLba(uint64_t blockCount);
 
+	// copies distribution and works out its constants for this generator's lba range
+	void setDistribution(const IOLBADistribution& distribution);
+
+	// Gives every blockCount-aligned IO that fits in [0, maxLba] exactly once per pass, in a random order from ioRand.
+	//  Never scans or collides within a pass and uses no per-lba memory. A new pass (new order) starts when one
+	//  finishes or blockCount changes. Does not check or add to the in use lbas
+	uint64_t generatePermutedLba(uint64_t blockCount);
+
+	// returns the number of lbas generatePermutedLba() has left in its current pass
+	uint64_t getPermutationRemaining() const;
+
+	// Replaces the streams with numStreams of blockCount-sized IOs laid out over [0, maxLba].
+	//  A stride of 0 means back to back (blockCount for regions, numStreams * blockCount for interleaved).
+	//  Returns false (and leaves no streams) if a stream can't fit even one IO
+	bool setSequentialStreams(size_t numStreams, IO_STREAM_LAYOUT_ENUM layout, uint64_t blockCount, uint64_t stride);
+
+	// adds one stream over [startLba, endLba). Returns false if not even one IO fits
+	bool addSequentialStream(uint64_t startLba, uint64_t endLba, uint64_t blockCount, uint64_t stride);
+
+	void setStreamSelection(IO_STREAM_SELECTION_ENUM selection);
+
+	// Gives the next lba from one of the streams and sets blockCount to that stream's IO size.
+	//  streamIndex (if given) is set to the stream used. Throws std::runtime_error if there are no streams.
+	//  Streams don't check or add to the in use lbas
+	uint64_t generateStreamLba(uint64_t* blockCount, size_t* streamIndex = NULL);
+
+	size_t getNumStreams() const;
+
 	// removes an in use lba
 	void removeInUseLba(uint64_t lba);
 	void removeInUseLba(uint64_t lba, uint64_t blockCount);
@@ -31,8 +91,13 @@ public:
 
 private:
 
+	// Marks and returns the first free blockCount range starting at or after lba, wrapping back to 0 past the
+	//  end. Throws std::runtime_error if there is none
+	uint64_t claimFreeLba(uint64_t lba, uint64_t blockCount);
+
 	// returns true if this is a generateable lba/blockcount combo
-	bool isGenerateable(uint64_t lba, uint64_t blockCount);
+	//  if not, nextCandidateLba is set to the first lba past the in use range in the way
+	bool isGenerateable(uint64_t lba, uint64_t blockCount, uint64_t* nextCandidateLba);
 
 	// saved IO object
 	std::shared_ptr<IO> ioPtr;
@@ -43,9 +108,28 @@ private:
 	// Last generated LBA
 	uint64_t lastGeneratedLba;
 
-	// max generate-able LBA
+	// max generate-able LBA (inclusive)
 	uint64_t maxLba;
 
-	// keep track of lbas in use.
-	std::unordered_set<uint64_t> inUseLbas;
+	// used by generateRandomLba()
+	IOLBADistribution distribution;
+
+	// order for generatePermutedLba()
+	IOPermutation permutation;
+
+	// blockCount the current permutation pass was built for (0 if none)
+	uint64_t permutationBlockCount;
+
+	// how far into the current pass we are
+	uint64_t permutationIndex;
+
+	// cursors for generateStreamLba()
+	std::vector<IO_SEQUENTIAL_STREAM> streams;
+	IO_STREAM_SELECTION_ENUM streamSelection;
+
+	// next stream for round robin
+	size_t nextStreamIndex;
+
+	// keep track of lbas in use. One entry per run of in use lbas, not per lba
+	IOIntervalSet inUseLbas;
 };
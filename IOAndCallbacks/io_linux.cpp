@@ -6,21 +6,30 @@
 
 #ifdef IO_LINUX
 
+#include "io_simulated_device.h"
+
+#include <algorithm>
 #include <iostream>
 #include <string>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <fcntl.h>
 #include <linux/fs.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 #define DEFAULT_MAX_EVENTS 0xFFFF
 
+// io_uring caps a ring at 32K entries. The completion ring is twice this size.
+#define DEFAULT_URING_ENTRIES 0x1000
+
 inline int io_setup(unsigned nr, aio_context_t *ctxp)
 {
 	return syscall(__NR_io_setup, nr, ctxp);
@@ -47,19 +56,85 @@ void perror(std::string str)
 	perror(str.c_str());
 }
 
-IO::IO(std::string path)
+IO::IO(std::string path) : IO(path, IO_BACKEND_DEFAULT)
+{
+}
+
+IO::IO(std::string path, IO_BACKEND_ENUM backend) : IO(path, backend, DEFAULT_REQUEST_POOL_SIZE)
+{
+}
+
+IO::IO(std::string path, IO_BACKEND_ENUM backend, size_t requestPoolSize)
 {
 	blockSize = 0;
 	blockCount = 0;
+	uring = NULL;
+	completionFd = -1;
+	aioContext = 0; // must be pre-initialized
 
-	handle = open(path.c_str(), O_ASYNC | O_DIRECT | O_RDWR);
+	bool simulated = backend == IO_BACKEND_SIMULATED || IOSimulatedDevice::isSimulatedPath(path);
+	handle = simulated ? -1 : open(path.c_str(), O_ASYNC | O_DIRECT | O_RDWR);
 
-	aioContext = 0; // must be pre-initialized
-	if (io_setup(DEFAULT_MAX_EVENTS, &aioContext) != 0)
+	if (simulated)
+	{
+		backend = IO_BACKEND_SIMULATED;
+	}
+	else if (backend == IO_BACKEND_IO_URING)
+	{
+		// io_uring_setup() works from 5.1, but IORING_OP_READ/WRITE (and the probe) only arrive in 5.6.
+		//  The timeouts are for wait() on kernels without IORING_FEAT_EXT_ARG
+		uring = new IOUring(DEFAULT_URING_ENTRIES);
+		bool opcodesSupported = true;
+		for (unsigned opcode : { IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READV, IORING_OP_WRITEV, IORING_OP_TIMEOUT, IORING_OP_TIMEOUT_REMOVE })
+		{
+			opcodesSupported &= uring->supportsOpcode(opcode);
+		}
+
+		if (!uring->isValid() || !opcodesSupported)
+		{
+			std::cerr << "io_uring is unavailable or too old, falling back to Linux AIO" << std::endl;
+			delete uring;
+			uring = NULL;
+			backend = IO_BACKEND_LINUX_AIO;
+		}
+	}
+	else if (backend == IO_BACKEND_DEFAULT)
+	{
+		backend = IO_BACKEND_LINUX_AIO;
+	}
+
+	this->backend = backend;
+	plugged = false;
+	numIosInFlight = 0;
+	maxMergeBytes = 0;
+	numHeldIos = 0;
+	numExtraMergedCompletions = 0;
+	initRequestPool(requestPoolSize);
+
+	if (simulated)
+	{
+		openSimulatedDevice(path);
+	}
+
+	// room for the whole request pool plus a full submission queue. Every context counts against
+	//  the system-wide fs.aio-max-nr, so don't ask for more than can be in flight
+	unsigned maxEvents = (unsigned)std::min((size_t)DEFAULT_MAX_EVENTS, requestPoolSize + DEFAULT_SUBMISSION_QUEUE_SIZE);
+	if (backend == IO_BACKEND_LINUX_AIO && io_setup(maxEvents, &aioContext) != 0)
 	{
 		perror("io_setup() failed");
 	}
 
+	// io_submit() turns away IOs past the context size with EAGAIN
+	maxIosInFlight = SIZE_MAX;
+	if (backend == IO_BACKEND_LINUX_AIO)
+	{
+		maxIosInFlight = maxEvents;
+	}
+	else if (uring)
+	{
+		maxIosInFlight = uring->getCqEntries();
+	}
+
 #if IO_DISABLE_WRITES_TO_DRIVE_WITH_PARTITIONS
 	checkAndSetIfWeShouldAllowWrites();
 #endif // IO_DISABLE_WRITES_TO_DRIVE_WITH_PARTITIONS
@@ -67,59 +142,297 @@ IO::IO(std::string path)
 
 IO::~IO()
 {
-	if (io_destroy(aioContext) != 0)
+	if (uring)
+	{
+		// closing the ring doesn't wait for in flight IO, so wait here before the buffers go away.
+		//  Like io_destroy(), nothing is called back
+		drainUring();
+		delete uring;
+		uring = NULL;
+	}
+	else if (backend == IO_BACKEND_LINUX_AIO && io_destroy(aioContext) != 0)
 	{
 		perror("io_destroy failed");
 	}
 
+	closeSimulatedDevice();
+
+	// nothing is in flight anymore, so this is safe to do after
+	freeReadBufferPool();
+
+	if (completionFd >= 0)
+	{
+		close(completionFd);
+		completionFd = -1;
+	}
+
 	// finally close the fd;
-	close(handle);
+	if (handle >= 0)
+	{
+		close(handle);
+	}
 	handle = 0;
 }
 
-bool IO::poll()
+size_t IO::doPoll(size_t minEvents, size_t maxEvents, int64_t timeoutMicroseconds)
 {
-	io_event events[DEFAULT_MAX_EVENTS];
-	int numEventsCompleted = io_getevents(aioContext, 0, DEFAULT_MAX_EVENTS, events, NULL);
+	if (backend == IO_BACKEND_SIMULATED)
+	{
+		return pollSimulated(minEvents, maxEvents, timeoutMicroseconds);
+	}
+
+	if (uring)
+	{
+		return pollUring(minEvents, maxEvents, timeoutMicroseconds);
+	}
+
+	if (maxEvents == 0)
+	{
+		return 0;
+	}
+
+	// reset before reaping so completions that land after we look still wake up epoll
+	clearCompletionFd();
+
+	if (completionEvents.size() < maxEvents)
+	{
+		completionEvents.resize(maxEvents);
+	}
+
+	// NULL means wait forever
+	timespec timeout;
+	timespec* pTimeout = NULL;
+	if (timeoutMicroseconds >= 0)
+	{
+		timeout.tv_sec = timeoutMicroseconds / 1000000;
+		timeout.tv_nsec = (timeoutMicroseconds % 1000000) * 1000;
+		pTimeout = &timeout;
+	}
+
+	int numEventsCompleted = io_getevents(aioContext, (long)minEvents, (long)maxEvents, completionEvents.data(), pTimeout);
 
 	if (numEventsCompleted < 0)
 	{
-		perror(std::string("io_getevents returned a negative number: ") + std::to_string(numEventsCompleted));
-		return false;
+		if (errno != EINTR)
+		{
+			perror(std::string("io_getevents returned a negative number: ") + std::to_string(numEventsCompleted));
+		}
+		return 0;
 	}
 
 	// now we do the callbacks
 	for (int idx = 0; idx < numEventsCompleted; idx++)
 	{
-		io_event* event = &events[idx];
+		io_event* event = &completionEvents[idx];
 		IO_CALLBACK_STRUCT* pCbStruct = (IO_CALLBACK_STRUCT*)event->data;
-		iocb* io = (iocb*)event->obj;
 
-		// res will be the number of bytes xfer'd or -1 on error
-		if (event->res == -1)
+		// res will be the number of bytes xfer'd or -errno on error
+		if (event->res < 0)
+		{
+			pCbStruct->errorCode = (uint32_t)-event->res;
+			pCbStruct->numBytesXferred = 0;
+		}
+		else
 		{
-			pCbStruct->errorCode = errno;
+			pCbStruct->numBytesXferred = event->res;
 		}
 
-		pCbStruct->numBytesXferred = event->res;
+		numIosInFlight--;
+		completeIo(pCbStruct);
+	}
+
+	// stopping at maxEvents may leave completions behind that already signaled the fd we cleared
+	if ((size_t)numEventsCompleted == maxEvents && numIosInFlight)
+	{
+		signalCompletionFd();
+	}
+
+	return numEventsCompleted;
+}
+
+size_t IO::pollUring(size_t minEvents, size_t maxEvents, int64_t timeoutMicroseconds)
+{
+	// reset before reaping so completions that land after we look still wake up epoll
+	clearCompletionFd();
 
-		if (pCbStruct->userCallbackFunction)
+	// the completion ring is shared memory, so reaping what's already there doesn't need a syscall
+	size_t numEventsCompleted = reapUring(maxEvents);
+	if (numEventsCompleted < minEvents)
+	{
+		int ret = uring->wait((unsigned)(minEvents - numEventsCompleted), timeoutMicroseconds);
+		if (ret < 0 && ret != -ETIME && ret != -EINTR)
 		{
-			pCbStruct->userCallbackFunction(pCbStruct);
+			errno = -ret;
+			perror("Failed to wait for io_uring completions");
 		}
 
-		// free all allocated
-		if (pCbStruct->operation == IO_OPERATION_READ)
+		numEventsCompleted += reapUring(maxEvents - numEventsCompleted);
+	}
+
+	// stopping at maxEvents may leave completions behind that already signaled the fd we cleared
+	if (uring->peekCqe() != NULL)
+	{
+		signalCompletionFd();
+	}
+
+	return numEventsCompleted;
+}
+
+size_t IO::reapUring(size_t maxEvents)
+{
+	size_t numEventsCompleted = 0;
+	io_uring_cqe* cqe;
+	while (numEventsCompleted < maxEvents && (cqe = uring->peekCqe()) != NULL)
+	{
+		IO_CALLBACK_STRUCT* pCbStruct = (IO_CALLBACK_STRUCT*)cqe->user_data;
+		int res = cqe->res;
+
+		// give the slot back before the callback in case it queues more IO
+		uring->advanceCq(1);
+
+		// res will be the number of bytes xfer'd or -errno on error
+		if (res < 0)
 		{
-			// if doing a write, the user owns the buffer. Let them free it.
-			IO::freeAlignedBuffer(pCbStruct->xferBuffer);
+			pCbStruct->errorCode = -res;
+			pCbStruct->numBytesXferred = 0;
+		}
+		else
+		{
+			pCbStruct->numBytesXferred = res;
 		}
 
-		delete pCbStruct;
-		delete io;
+		numIosInFlight--;
+		completeIo(pCbStruct);
+		numEventsCompleted++;
 	}
 
-	return (bool)numEventsCompleted;
+	return numEventsCompleted;
+}
+
+void IO::drainUring()
+{
+	while (numIosInFlight)
+	{
+		io_uring_cqe* cqe;
+		while ((cqe = uring->peekCqe()) != NULL)
+		{
+			IO_CALLBACK_STRUCT* pCbStruct = (IO_CALLBACK_STRUCT*)cqe->user_data;
+			uring->advanceCq(1);
+
+			numIosInFlight -= pCbStruct->mergedRequest ? pCbStruct->mergedRequest->ios.size() : 1;
+			releaseIo(pCbStruct);
+		}
+
+		if (numIosInFlight == 0)
+		{
+			break;
+		}
+
+		int ret = uring->wait(1, IO_POLL_WAIT_FOREVER);
+		if (ret < 0 && ret != -EINTR)
+		{
+			errno = -ret;
+			perror("Failed to wait for in flight io_uring IO");
+			break;
+		}
+	}
+}
+
+bool IO::enableCompletionFd()
+{
+	if (completionFd >= 0)
+	{
+		return true;
+	}
+
+	if (backend == IO_BACKEND_SIMULATED)
+	{
+		// simulated completions happen at a time, not on an event. Nothing else would signal an eventfd
+		completionFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (completionFd < 0)
+		{
+			perror("timerfd_create() failed");
+			return false;
+		}
+
+		armSimulatedCompletionFd();
+		return true;
+	}
+
+	completionFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (completionFd < 0)
+	{
+		perror("eventfd() failed");
+		return false;
+	}
+
+	// aio gets the fd per iocb (see prepareIocb()), io_uring gets it once for the whole ring
+	if (uring)
+	{
+		int ret = uring->registerEventFd(completionFd);
+		if (ret < 0)
+		{
+			errno = -ret;
+			perror("Failed to register eventfd with io_uring");
+			close(completionFd);
+			completionFd = -1;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int IO::getCompletionFd() const
+{
+	return completionFd;
+}
+
+void IO::clearCompletionFd()
+{
+	if (completionFd >= 0)
+	{
+		// nonblocking, so this just fails with EAGAIN if nothing completed since the last time
+		eventfd_t value;
+		eventfd_read(completionFd, &value);
+	}
+}
+
+void IO::signalCompletionFd()
+{
+	if (completionFd >= 0 && backend != IO_BACKEND_SIMULATED)
+	{
+		eventfd_write(completionFd, 1);
+	}
+}
+
+void IO::armSimulatedCompletionFd()
+{
+	if (completionFd < 0 || backend != IO_BACKEND_SIMULATED)
+	{
+		return;
+	}
+
+	// all zeros disarms the timer
+	itimerspec timerSpec;
+	memset(&timerSpec, 0, sizeof(timerSpec));
+	if (!simulatedCompletions.empty())
+	{
+		// getTimestampNanoseconds() is CLOCK_MONOTONIC. A time that already passed goes off right away
+		uint64_t completionTime = std::max(simulatedCompletions.front().completionTimeNanoseconds, (uint64_t)1);
+		timerSpec.it_value.tv_sec = completionTime / 1000000000;
+		timerSpec.it_value.tv_nsec = completionTime % 1000000000;
+	}
+
+	if (timerfd_settime(completionFd, TFD_TIMER_ABSTIME, &timerSpec, NULL) != 0)
+	{
+		perror("timerfd_settime() failed");
+	}
+}
+
+IO_BACKEND_ENUM IO::getBackend() const
+{
+	return backend;
 }
 
 uint32_t IO::getBlockSize()
@@ -167,8 +480,11 @@ uint64_t IO::getBlockCount()
 
 void* IO::getAlignedBuffer(size_t size)
 {
-	void *data;
-	posix_memalign(&data, getBlockSize(), size);
+	void *data = NULL;
+	if (posix_memalign(&data, getBlockSize(), size) != 0)
+	{
+		return NULL;
+	}
 	return data;
 }
 
@@ -177,46 +493,164 @@ void IO::freeAlignedBuffer(void* buffer)
 	free(buffer);
 }
 
-bool IO::doSubmitIo(IO_CALLBACK_STRUCT* ioCallbackStruct)
+// fills in the common parts of an iocb. Returns false if the operation is unknown
+//  if completionFd is not -1, the kernel will signal it when this IO completes
+static bool prepareIocb(iocb* io, IO_CALLBACK_STRUCT* ioCallbackStruct, IO_HANDLE handle, uint32_t blockSize, int completionFd)
 {
-	iocb* io = new iocb;
 	memset(io, 0, sizeof(iocb));
 
+	bool vectored = ioCallbackStruct->ioVecs != NULL;
 	if (ioCallbackStruct->operation == IO_OPERATION_READ)
 	{
-		io->aio_lio_opcode = IOCB_CMD_PREAD;
+		io->aio_lio_opcode = vectored ? IOCB_CMD_PREADV : IOCB_CMD_PREAD;
 	}
 	else if (ioCallbackStruct->operation == IO_OPERATION_WRITE)
 	{
-		io->aio_lio_opcode = IOCB_CMD_PWRITE;
+		io->aio_lio_opcode = vectored ? IOCB_CMD_PWRITEV : IOCB_CMD_PWRITE;
 	}
 	else
 	{
 		std::cerr << ("Invalid IO Operation: " + std::to_string(ioCallbackStruct->operation)) << std::endl;
-
-		delete io;
 		return false;
 	}
 
 	io->aio_fildes = handle;
-	io->aio_nbytes = ioCallbackStruct->numBytesRequested;
-	io->aio_offset = ioCallbackStruct->lba * getBlockSize();
-	io->aio_buf = (__u64)ioCallbackStruct->xferBuffer;
+	io->aio_offset = ioCallbackStruct->lba * blockSize;
+	if (vectored)
+	{
+		// the kernel copies the list in io_submit()
+		io->aio_nbytes = ioCallbackStruct->numIoVecs;
+		io->aio_buf = (__u64)ioCallbackStruct->ioVecs;
+	}
+	else
+	{
+		io->aio_nbytes = ioCallbackStruct->numBytesRequested;
+		io->aio_buf = (__u64)ioCallbackStruct->xferBuffer;
+	}
+
+	if (completionFd >= 0)
+	{
+		io->aio_flags = IOCB_FLAG_RESFD;
+		io->aio_resfd = completionFd;
+	}
 
 	// pass our callback via the kernel
 	io->aio_data = (__u64)ioCallbackStruct;
+	return true;
+}
 
-	int ret = io_submit(aioContext, 1, &io);
-	if (ret != 1)
+size_t IO::doSubmitIoBatch(IO_CALLBACK_STRUCT** ioCallbackStructs, size_t count)
+{
+	if (backend == IO_BACKEND_SIMULATED)
 	{
-		perror("Failed to submit IO");
-		delete io;
-		delete ioCallbackStruct;
+		return doSubmitIoBatchSimulated(ioCallbackStructs, count);
+	}
 
-		return false;
+	if (uring)
+	{
+		return doSubmitIoBatchUring(ioCallbackStructs, count);
 	}
 
-	return true;
+	batchIocbs.clear();
+	for (size_t i = 0; i < count; i++)
+	{
+		// the iocb lives in the IO_CALLBACK_STRUCT so there is nothing to allocate
+		iocb* io = &ioCallbackStructs[i]->osIocb;
+		if (!prepareIocb(io, ioCallbackStructs[i], handle, getBlockSize(), completionFd))
+		{
+			// only submit up to the bad one
+			break;
+		}
+		batchIocbs.push_back(io);
+	}
+
+	// the kernel may accept only part of the list. Keep going until it takes everything or errors out
+	size_t numQueued = 0;
+	while (numQueued < batchIocbs.size())
+	{
+		int ret = io_submit(aioContext, (long)(batchIocbs.size() - numQueued), batchIocbs.data() + numQueued);
+		if (ret <= 0)
+		{
+			if (ret < 0)
+			{
+				perror("Failed to submit IO");
+			}
+			break;
+		}
+		numQueued += ret;
+	}
+
+	return numQueued;
+}
+
+size_t IO::doSubmitIoBatchUring(IO_CALLBACK_STRUCT** ioCallbackStructs, size_t count)
+{
+	size_t numQueued = 0;
+	size_t numPrepared = 0;
+	while (numQueued < count)
+	{
+		// fill as much of the submission ring as we can, then tell the kernel about all of it at once
+		for (; numPrepared < count; numPrepared++)
+		{
+			IO_CALLBACK_STRUCT* ioCallbackStruct = ioCallbackStructs[numPrepared];
+			if (ioCallbackStruct->operation != IO_OPERATION_READ && ioCallbackStruct->operation != IO_OPERATION_WRITE)
+			{
+				std::cerr << ("Invalid IO Operation: " + std::to_string(ioCallbackStruct->operation)) << std::endl;
+
+				// only submit up to the bad one
+				count = numPrepared;
+				break;
+			}
+
+			io_uring_sqe* sqe = uring->getSqe();
+			if (!sqe)
+			{
+				break;
+			}
+
+			bool isRead = ioCallbackStruct->operation == IO_OPERATION_READ;
+			sqe->fd = handle;
+			sqe->off = ioCallbackStruct->lba * getBlockSize();
+			if (ioCallbackStruct->ioVecs)
+			{
+				sqe->opcode = isRead ? IORING_OP_READV : IORING_OP_WRITEV;
+				sqe->len = (__u32)ioCallbackStruct->numIoVecs;
+				sqe->addr = (__u64)ioCallbackStruct->ioVecs;
+			}
+			else
+			{
+				sqe->opcode = isRead ? IORING_OP_READ : IORING_OP_WRITE;
+				sqe->len = (__u32)ioCallbackStruct->numBytesRequested;
+				sqe->addr = (__u64)ioCallbackStruct->xferBuffer;
+			}
+
+			// pass our callback via the kernel
+			sqe->user_data = (__u64)ioCallbackStruct;
+		}
+
+		if (numPrepared == numQueued)
+		{
+			// nothing left we can submit
+			break;
+		}
+
+		int ret = uring->submit();
+		if (ret <= 0)
+		{
+			if (ret < 0)
+			{
+				errno = -ret;
+				perror("Failed to submit IO");
+			}
+			break;
+		}
+		numQueued += ret;
+	}
+
+	// anything left in the ring was not seen by the kernel. It must never be issued since we fail it
+	uring->discardUnconsumed();
+
+	return numQueued;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,384 @@
+// IO Uring implementation file for IO
+// (C) - csm10495 - MIT License 2019
+
+#include "io_linux_uring.h"
+
+#ifdef IO_LINUX
+
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+inline int io_uring_setup(unsigned entries, io_uring_params* params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+inline int io_uring_register(int fd, unsigned opcode, void* arg, unsigned numArgs)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, numArgs);
+}
+
+inline int io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t argSize)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+IOUring::IOUring(unsigned entries)
+{
+	sqRing = MAP_FAILED;
+	cqRing = MAP_FAILED;
+	sqes = (io_uring_sqe*)MAP_FAILED;
+	features = 0;
+	lastTimeoutUserData = IO_URING_INTERNAL_USER_DATA;
+	sqRingSize = 0;
+	cqRingSize = 0;
+	sqesSize = 0;
+	sqLocalTail = 0;
+
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	ringFd = io_uring_setup(entries, &params);
+	if (ringFd < 0)
+	{
+		perror("io_uring_setup() failed");
+		return;
+	}
+
+	sqEntries = params.sq_entries;
+	cqEntries = params.cq_entries;
+	features = params.features;
+
+	sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+	// newer kernels let both rings live in one mapping
+	bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (singleMmap)
+	{
+		sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+	}
+
+	sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+	if (sqRing == MAP_FAILED)
+	{
+		perror("Failed to mmap io_uring submission ring");
+		return;
+	}
+
+	if (singleMmap)
+	{
+		cqRing = sqRing;
+	}
+	else
+	{
+		cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+		if (cqRing == MAP_FAILED)
+		{
+			perror("Failed to mmap io_uring completion ring");
+			return;
+		}
+	}
+
+	sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	sqes = (io_uring_sqe*)mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+	{
+		perror("Failed to mmap io_uring sqes");
+		return;
+	}
+
+	char* sqBase = (char*)sqRing;
+	sqHead = (unsigned*)(sqBase + params.sq_off.head);
+	sqTail = (unsigned*)(sqBase + params.sq_off.tail);
+	sqRingMask = (unsigned*)(sqBase + params.sq_off.ring_mask);
+	sqArray = (unsigned*)(sqBase + params.sq_off.array);
+
+	char* cqBase = (char*)cqRing;
+	cqHead = (unsigned*)(cqBase + params.cq_off.head);
+	cqTail = (unsigned*)(cqBase + params.cq_off.tail);
+	cqRingMask = (unsigned*)(cqBase + params.cq_off.ring_mask);
+	cqes = (io_uring_cqe*)(cqBase + params.cq_off.cqes);
+
+	sqLocalTail = *sqTail;
+
+	// 5.1 - 5.5 have io_uring but not the probe (or IORING_OP_READ/WRITE). Leave everything unsupported there
+	size_t probeSize = sizeof(io_uring_probe) + supportedOpcodes.size() * sizeof(io_uring_probe_op);
+	io_uring_probe* probe = (io_uring_probe*)calloc(1, probeSize);
+	if (probe && io_uring_register(ringFd, IORING_REGISTER_PROBE, probe, (unsigned)supportedOpcodes.size()) == 0)
+	{
+		for (unsigned i = 0; i < probe->ops_len && i <= probe->last_op; i++)
+		{
+			supportedOpcodes[probe->ops[i].op] = (probe->ops[i].flags & IO_URING_OP_SUPPORTED) != 0;
+		}
+	}
+	free(probe);
+}
+
+IOUring::~IOUring()
+{
+	if (sqes != MAP_FAILED)
+	{
+		munmap(sqes, sqesSize);
+	}
+
+	if (cqRing != MAP_FAILED && cqRing != sqRing)
+	{
+		munmap(cqRing, cqRingSize);
+	}
+
+	if (sqRing != MAP_FAILED)
+	{
+		munmap(sqRing, sqRingSize);
+	}
+
+	if (ringFd >= 0)
+	{
+		close(ringFd);
+		ringFd = -1;
+	}
+}
+
+bool IOUring::isValid() const
+{
+	return ringFd >= 0 && sqRing != MAP_FAILED && cqRing != MAP_FAILED && sqes != MAP_FAILED;
+}
+
+unsigned IOUring::getCqEntries() const
+{
+	return cqEntries;
+}
+
+io_uring_sqe* IOUring::getSqe()
+{
+	unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+	if (sqLocalTail - head >= sqEntries)
+	{
+		// submission ring is full
+		return NULL;
+	}
+
+	unsigned idx = sqLocalTail & *sqRingMask;
+	sqArray[idx] = idx;
+	sqLocalTail++;
+
+	io_uring_sqe* sqe = &sqes[idx];
+	memset(sqe, 0, sizeof(io_uring_sqe));
+	return sqe;
+}
+
+int IOUring::submit(unsigned minComplete)
+{
+	unsigned toSubmit = getPendingSqeCount();
+	if (toSubmit == 0 && minComplete == 0)
+	{
+		// nothing to do. Don't bother the kernel
+		return 0;
+	}
+
+	// publish the new tail so the kernel can see the sqes
+	__atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+
+	unsigned flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+	int ret = io_uring_enter(ringFd, toSubmit, minComplete, flags, NULL, 0);
+	if (ret < 0)
+	{
+		return -errno;
+	}
+
+	return ret;
+}
+
+int IOUring::wait(unsigned minComplete, int64_t timeoutMicroseconds)
+{
+	if (timeoutMicroseconds < 0)
+	{
+		int ret = submit(minComplete);
+		return ret < 0 ? ret : 0;
+	}
+
+	if (features & IORING_FEAT_EXT_ARG)
+	{
+		__kernel_timespec ts;
+		ts.tv_sec = timeoutMicroseconds / 1000000;
+		ts.tv_nsec = (timeoutMicroseconds % 1000000) * 1000;
+
+		io_uring_getevents_arg arg;
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = (__u64)&ts;
+
+		__atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+		int ret = io_uring_enter(ringFd, getPendingSqeCount(), minComplete, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+		return ret < 0 ? -errno : 0;
+	}
+
+	return waitWithTimeoutSqe(minComplete, timeoutMicroseconds);
+}
+
+int IOUring::waitWithTimeoutSqe(unsigned minComplete, int64_t timeoutMicroseconds)
+{
+	bool timedOut = false;
+	if (countReadyCqes(0, &timedOut) >= minComplete)
+	{
+		int ret = submit();
+		return ret < 0 ? ret : 0;
+	}
+
+	// a plain timer (count 0). The kernel copies ts when it consumes the sqe in the first io_uring_enter() below
+	__kernel_timespec ts;
+	ts.tv_sec = timeoutMicroseconds / 1000000;
+	ts.tv_nsec = (timeoutMicroseconds % 1000000) * 1000;
+
+	io_uring_sqe* sqe = getSqe();
+	if (!sqe)
+	{
+		int ret = submit();
+		if (ret < 0 || !(sqe = getSqe()))
+		{
+			return ret < 0 ? ret : -EBUSY;
+		}
+	}
+
+	// internal user_data counts up, so a late completion from an earlier wait() isn't taken as this one's
+	uint64_t timeoutUserData = ++lastTimeoutUserData | IO_URING_INTERNAL_USER_DATA;
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (__u64)&ts;
+	sqe->len = 1;
+	sqe->user_data = timeoutUserData;
+
+	int ret = 0;
+	unsigned numReady;
+	while ((numReady = countReadyCqes(timeoutUserData, &timedOut)) < minComplete && !timedOut)
+	{
+		// returns as soon as anything (an IO or the timeout) is posted past what's already there
+		__atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+		unsigned numPosted = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE) - *cqHead;
+		if (io_uring_enter(ringFd, getPendingSqeCount(), numPosted + 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+		{
+			ret = -errno;
+			break;
+		}
+	}
+
+	if (!timedOut)
+	{
+		// don't leave the timer to post a completion (and wake someone) long after this wait() is over
+		sqe = getSqe();
+		if (sqe)
+		{
+			sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+			sqe->fd = -1;
+			sqe->addr = timeoutUserData;
+			sqe->user_data = IO_URING_INTERNAL_USER_DATA;
+		}
+
+		// if it fired just now anyway, the remove fails and peekCqe() skips both completions
+		int submitRet = submit();
+		if (submitRet < 0 && ret == 0)
+		{
+			ret = submitRet;
+		}
+	}
+
+	if (ret < 0)
+	{
+		return ret;
+	}
+	return numReady >= minComplete ? 0 : -ETIME;
+}
+
+unsigned IOUring::getReadyCqeCount() const
+{
+	bool timedOut;
+	return countReadyCqes(0, &timedOut);
+}
+
+unsigned IOUring::countReadyCqes(uint64_t timeoutUserData, bool* timedOut) const
+{
+	*timedOut = false;
+
+	unsigned numReady = 0;
+	unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+	for (unsigned head = *cqHead; head != tail; head++)
+	{
+		const io_uring_cqe* cqe = &cqes[head & *cqRingMask];
+		if (!(cqe->user_data & IO_URING_INTERNAL_USER_DATA))
+		{
+			numReady++;
+		}
+		else if (cqe->user_data == timeoutUserData)
+		{
+			*timedOut = true;
+		}
+	}
+
+	return numReady;
+}
+
+bool IOUring::supportsOpcode(unsigned opcode) const
+{
+	return opcode < supportedOpcodes.size() && supportedOpcodes[opcode];
+}
+
+unsigned IOUring::discardUnconsumed()
+{
+	unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+	unsigned numDiscarded = sqLocalTail - head;
+
+	sqLocalTail = head;
+	__atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+	return numDiscarded;
+}
+
+io_uring_cqe* IOUring::peekCqe()
+{
+	unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+	for (unsigned head = *cqHead; head != tail; head++)
+	{
+		io_uring_cqe* cqe = &cqes[head & *cqRingMask];
+		if (!(cqe->user_data & IO_URING_INTERNAL_USER_DATA))
+		{
+			return cqe;
+		}
+
+		// wait()'s own timeouts. Nobody else wants these
+		__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+void IOUring::advanceCq(unsigned count)
+{
+	__atomic_store_n(cqHead, *cqHead + count, __ATOMIC_RELEASE);
+}
+
+unsigned IOUring::getPendingSqeCount() const
+{
+	return sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+}
+
+int IOUring::registerEventFd(int eventFd)
+{
+	if (io_uring_register(ringFd, IORING_REGISTER_EVENTFD, &eventFd, 1) != 0)
+	{
+		return -errno;
+	}
+
+	return 0;
+}
+
+int IOUring::getRingFd() const
+{
+	return ringFd;
+}
+
+#endif // IO_LINUX
@@ -0,0 +1,120 @@
+// IO Uring header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+#include "switches.h"
+
+#ifdef IO_LINUX
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+// user_data with this bit set belongs to IOUring itself (wait() timeouts). Those completions are never handed out
+#define IO_URING_INTERNAL_USER_DATA (1ULL << 63)
+
+// IOUring is a thin wrapper around the raw io_uring syscalls and the shared submission/completion rings.
+//  It does not know anything about IO_CALLBACK_STRUCTs, that is left to the IO object
+class IOUring
+{
+public:
+	// Will call io_uring_setup() and map the rings. Check isValid() after construction.
+	IOUring(unsigned entries);
+	~IOUring();
+
+	// returns true if the rings were setup and mapped
+	bool isValid() const;
+
+	// returns the next free sqe (zeroed) or NULL if the submission ring is full
+	//  the sqe is not seen by the kernel until submit() is called
+	io_uring_sqe* getSqe();
+
+	// tells the kernel about all sqes it hasn't consumed yet.
+	//  if minComplete is nonzero, will also wait for that many completions
+	//  returns the number of sqes consumed by the kernel or -errno
+	int submit(unsigned minComplete = 0);
+
+	// submits anything pending then waits until at least minComplete completions are ready
+	//  or timeoutMicroseconds passes (< 0 waits forever). Returns 0 or -errno (-ETIME on timeout).
+	//  Kernels without IORING_FEAT_EXT_ARG need IORING_OP_TIMEOUT and IORING_OP_TIMEOUT_REMOVE for a timeout
+	int wait(unsigned minComplete, int64_t timeoutMicroseconds);
+
+	// returns the number of completions ready to be reaped
+	unsigned getReadyCqeCount() const;
+
+	// returns true if IORING_REGISTER_PROBE says the kernel supports opcode. Always false before 5.6 (no probe)
+	bool supportsOpcode(unsigned opcode) const;
+
+	// drops any sqes the kernel did not consume on the last submit() so they are never issued.
+	//  returns the number dropped. Only safe since we don't use SQPOLL (the kernel only reads the ring in submit())
+	unsigned discardUnconsumed();
+
+	// returns the oldest completion without consuming it, or NULL if there is nothing to reap.
+	//  Internal completions at the head are consumed and skipped
+	io_uring_cqe* peekCqe();
+
+	// marks count completions as consumed so the kernel can reuse their slots
+	void advanceCq(unsigned count);
+
+	// returns the number of sqes gotten but not yet consumed by the kernel
+	unsigned getPendingSqeCount() const;
+
+	// has the kernel signal eventFd whenever a completion is posted. Returns 0 or -errno
+	int registerEventFd(int eventFd);
+
+	// returns the fd for the ring itself
+	int getRingFd() const;
+
+	// returns the size of the completion ring, the most IOs that can be in flight without completions being dropped
+	unsigned getCqEntries() const;
+
+private:
+	// io_uring fd
+	int ringFd;
+
+	// ring sizes as given back by the kernel
+	unsigned sqEntries;
+	unsigned cqEntries;
+
+	// IORING_FEAT_* flags supported by the kernel
+	unsigned features;
+
+	// IORING_OP_*s supported by the kernel, from IORING_REGISTER_PROBE
+	std::bitset<256> supportedOpcodes;
+
+	// user_data of the last timeout wait() queued, so completions of older ones are ignored
+	uint64_t lastTimeoutUserData;
+
+	// mapped regions (the cq ring may share the sq ring mapping)
+	void* sqRing;
+	size_t sqRingSize;
+	void* cqRing;
+	size_t cqRingSize;
+	io_uring_sqe* sqes;
+	size_t sqesSize;
+
+	// pointers into the sq ring
+	unsigned* sqHead;
+	unsigned* sqTail;
+	unsigned* sqRingMask;
+	unsigned* sqArray;
+
+	// pointers into the cq ring
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned* cqRingMask;
+	io_uring_cqe* cqes;
+
+	// our local copy of the sq tail. Published to the kernel on submit()
+	unsigned sqLocalTail;
+
+	// wait() for kernels without IORING_FEAT_EXT_ARG. Sleeps on an IORING_OP_TIMEOUT sqe instead of spinning
+	int waitWithTimeoutSqe(unsigned minComplete, int64_t timeoutMicroseconds);
+
+	// looks through the completions not yet consumed. Returns how many aren't internal, and sets
+	//  *timedOut if the timeout with user_data timeoutUserData has fired
+	unsigned countReadyCqes(uint64_t timeoutUserData, bool* timedOut) const;
+};
+
+#endif // IO_LINUX
@@ -0,0 +1,238 @@
+// IO Multi Queue implementation file for IO
+// (C) - csm10495 - MIT License 2019
+
+#include "io_multi_queue.h"
+
+#include <iostream>
+
+#ifdef IO_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif // IO_LINUX
+
+IOMultiQueue::IOMultiQueue(std::string path, size_t numQueues, IO_BACKEND_ENUM backend, size_t requestPoolSize, bool pinThreads) :
+	IOMultiQueue(path, numQueues, backend, requestPoolSize, pinThreads, DEFAULT_MULTI_QUEUE_IDLE_WAIT_MICROSECONDS)
+{
+}
+
+IOMultiQueue::IOMultiQueue(std::string path, size_t numQueues, IO_BACKEND_ENUM backend, size_t requestPoolSize, bool pinThreads, int64_t idleWaitMicroseconds)
+{
+	this->path = path;
+	this->backend = backend;
+	this->requestPoolSize = requestPoolSize;
+	this->pinThreads = pinThreads;
+	this->idleWaitMicroseconds = idleWaitMicroseconds;
+	stopping = false;
+
+	if (numQueues == 0)
+	{
+		numQueues = 1;
+	}
+
+	for (size_t i = 0; i < numQueues; i++)
+	{
+		Queue* queue = new Queue();
+		queue->ready = false;
+		queue->numIosInFlight = 0;
+		queue->blockSize = 0;
+		queue->blockCount = 0;
+		queues.emplace_back(queue);
+	}
+
+	// the IO objects are created on their worker threads so their memory is local to that CPU
+	for (size_t i = 0; i < numQueues; i++)
+	{
+		queues[i]->thread = std::thread(&IOMultiQueue::workerLoop, this, i);
+	}
+
+	for (auto& queue : queues)
+	{
+		while (!queue->ready.load(std::memory_order_acquire))
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+IOMultiQueue::~IOMultiQueue()
+{
+	stopping.store(true, std::memory_order_release);
+	for (auto& queue : queues)
+	{
+		if (queue->thread.joinable())
+		{
+			queue->thread.join();
+		}
+	}
+}
+
+bool IOMultiQueue::isValid() const
+{
+	for (auto& queue : queues)
+	{
+		if (!queue->io)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+size_t IOMultiQueue::getNumQueues() const
+{
+	return queues.size();
+}
+
+bool IOMultiQueue::enqueueIo(size_t queueIndex, IO_CALLBACK_STRUCT* ioCallbackStruct)
+{
+	if (queueIndex >= queues.size() || !queues[queueIndex]->io)
+	{
+		std::cerr << "Can't enqueue IO to queue " << queueIndex << ". It does not exist or failed to open" << std::endl;
+		return false;
+	}
+
+	return queues[queueIndex]->io->enqueueIo(ioCallbackStruct);
+}
+
+bool IOMultiQueue::enqueueIo(IO_CALLBACK_STRUCT* ioCallbackStruct)
+{
+	return enqueueIo(getQueueForCurrentCpu(), ioCallbackStruct);
+}
+
+size_t IOMultiQueue::getQueueForCurrentCpu() const
+{
+	return getCurrentCpu() % queues.size();
+}
+
+uint32_t IOMultiQueue::getBlockSize() const
+{
+	return queues[0]->blockSize;
+}
+
+uint64_t IOMultiQueue::getBlockCount() const
+{
+	return queues[0]->blockCount;
+}
+
+void* IOMultiQueue::getAlignedBuffer(size_t size)
+{
+	// the block size is cached by the time the workers are ready so this doesn't touch the device
+	return queues[0]->io ? queues[0]->io->getAlignedBuffer(size) : NULL;
+}
+
+size_t IOMultiQueue::getNumIosInFlight(size_t queueIndex) const
+{
+	return queues[queueIndex]->numIosInFlight.load(std::memory_order_relaxed);
+}
+
+#if IO_ENABLE_STATS
+IO_STATS_STRUCT IOMultiQueue::snapshotIoStats(size_t queueIndex)
+{
+	if (queueIndex >= queues.size() || !queues[queueIndex]->io)
+	{
+		return IO_STATS_STRUCT();
+	}
+
+	return queues[queueIndex]->io->snapshotIoStats();
+}
+
+IO_STATS_STRUCT IOMultiQueue::snapshotIoStats()
+{
+	IO_STATS_STRUCT merged;
+	for (size_t i = 0; i < queues.size(); i++)
+	{
+		merged.merge(snapshotIoStats(i));
+	}
+	return merged;
+}
+
+void IOMultiQueue::resetIoStats()
+{
+	for (auto& queue : queues)
+	{
+		if (queue->io)
+		{
+			queue->io->resetIoStats();
+		}
+	}
+}
+#endif // IO_ENABLE_STATS
+
+void IOMultiQueue::workerLoop(size_t queueIndex)
+{
+	Queue* queue = queues[queueIndex].get();
+
+	if (pinThreads)
+	{
+		size_t numCpus = std::thread::hardware_concurrency();
+		if (!pinCurrentThread(queueIndex % (numCpus ? numCpus : 1)))
+		{
+			std::cerr << "Failed to pin queue " << queueIndex << " to a CPU. It will float" << std::endl;
+		}
+	}
+
+	IO* io = new IO(path, backend, requestPoolSize);
+	queue->blockSize = io->getBlockSize();
+	queue->blockCount = io->getBlockCount();
+	if (queue->blockSize == 0)
+	{
+		std::cerr << "Queue " << queueIndex << " failed to open " << path << std::endl;
+		delete io;
+		queue->ready.store(true, std::memory_order_release);
+		return;
+	}
+
+	queue->io.reset(io);
+	queue->ready.store(true, std::memory_order_release);
+
+	while (true)
+	{
+		// read before draining so nothing enqueued before the destructor was called gets left behind
+		bool stopRequested = stopping.load(std::memory_order_acquire);
+
+		size_t numQueued = io->drainSubmissionQueue();
+		size_t numCompleted = io->poll(0, DEFAULT_POLL_MAX_EVENTS, 0);
+		queue->numIosInFlight.store(io->getNumIosInFlight(), std::memory_order_relaxed);
+
+		if (numQueued == 0 && numCompleted == 0)
+		{
+			if (stopRequested && io->getNumIosInFlight() == 0 && io->getNumHeldIos() == 0)
+			{
+				break;
+			}
+
+			// nothing to do. Wait a bit for a completion instead of spinning
+			io->poll(1, DEFAULT_POLL_MAX_EVENTS, idleWaitMicroseconds);
+		}
+	}
+
+	// the IO object goes away on the thread that used it
+	queue->io.reset();
+}
+
+bool IOMultiQueue::pinCurrentThread(size_t cpu)
+{
+#ifdef IO_LINUX
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	CPU_SET(cpu, &cpuSet);
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#elif IO_WIN32
+	if (cpu >= sizeof(DWORD_PTR) * 8)
+	{
+		return false;
+	}
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#endif
+}
+
+size_t IOMultiQueue::getCurrentCpu()
+{
+#ifdef IO_LINUX
+	int cpu = sched_getcpu();
+	return cpu < 0 ? 0 : (size_t)cpu;
+#elif IO_WIN32
+	return (size_t)GetCurrentProcessorNumber();
+#endif
+}
@@ -0,0 +1,102 @@
+// IO Multi Queue header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+
+#include "io.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// how long an idle worker waits for a completion before checking its submission queue again
+#define DEFAULT_MULTI_QUEUE_IDLE_WAIT_MICROSECONDS 50
+
+// IOMultiQueue runs numQueues IO objects against the same device, each owned by its own worker thread.
+//  Every queue has its own aio context (or ring), request pool, read buffers and stats, so queues never share
+//  anything on the submit/complete path. Workers can be pinned so queue i runs on CPU i (mod the CPU count).
+//  IO is handed to a queue with enqueueIo(). Callbacks run on that queue's worker thread.
+class IOMultiQueue
+{
+public:
+	// Will not return until every worker has opened its IO object. Check isValid() after construction
+	IOMultiQueue(std::string path, size_t numQueues, IO_BACKEND_ENUM backend, size_t requestPoolSize, bool pinThreads);
+	IOMultiQueue(std::string path, size_t numQueues, IO_BACKEND_ENUM backend, size_t requestPoolSize, bool pinThreads, int64_t idleWaitMicroseconds);
+
+	// Waits for all in-flight and enqueued IO to be called back then stops the workers
+	~IOMultiQueue();
+
+	// returns true if every queue opened its IO object
+	bool isValid() const;
+
+	size_t getNumQueues() const;
+
+	// Thread safe. Hands ioCallbackStruct to the given queue. Same rules as IO::enqueueIo()
+	bool enqueueIo(size_t queueIndex, IO_CALLBACK_STRUCT* ioCallbackStruct);
+
+	// Thread safe. Hands ioCallbackStruct to the queue for the CPU the calling thread is on
+	bool enqueueIo(IO_CALLBACK_STRUCT* ioCallbackStruct);
+
+	// returns the queue enqueueIo(ioCallbackStruct) would use from the calling thread right now
+	size_t getQueueForCurrentCpu() const;
+
+	// from queue 0 (all queues are against the same device)
+	uint32_t getBlockSize() const;
+	uint64_t getBlockCount() const;
+
+	// Thread safe. Buffer aligned to the block size. Free it with IO::freeAlignedBuffer()
+	void* getAlignedBuffer(size_t size);
+
+	// returns the number of IOs in flight on the given queue (may be stale)
+	size_t getNumIosInFlight(size_t queueIndex) const;
+
+#if IO_ENABLE_STATS
+	// stats for one queue
+	IO_STATS_STRUCT snapshotIoStats(size_t queueIndex);
+
+	// stats for every queue merged together
+	IO_STATS_STRUCT snapshotIoStats();
+
+	void resetIoStats();
+#endif // IO_ENABLE_STATS
+
+private:
+	struct Queue
+	{
+		std::thread thread;
+
+		// created and destroyed on thread
+		std::unique_ptr<IO> io;
+
+		// set by the worker once io is opened (or failed to open)
+		std::atomic<bool> ready;
+
+		// copy of io->getNumIosInFlight() for other threads
+		std::atomic<size_t> numIosInFlight;
+
+		uint32_t blockSize;
+		uint64_t blockCount;
+	};
+
+	// body of each worker thread
+	void workerLoop(size_t queueIndex);
+
+	// pins the calling thread to the given CPU. Returns false on failure
+	static bool pinCurrentThread(size_t cpu);
+
+	// returns the CPU the calling thread is running on
+	static size_t getCurrentCpu();
+
+	std::string path;
+	IO_BACKEND_ENUM backend;
+	size_t requestPoolSize;
+	bool pinThreads;
+	int64_t idleWaitMicroseconds;
+
+	std::vector<std::unique_ptr<Queue>> queues;
+
+	// set by the destructor to tell the workers to finish up
+	std::atomic<bool> stopping;
+};
@@ -0,0 +1,91 @@
+// IO Payload implementation file for IO
+// (C) - csm10495 - MIT License 2019
+
+#include "io_payload.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+// random numbers asked of IORand at once in fill()
+#define PAYLOAD_RANDOM_BATCH 64
+
+IOPayloadGenerator::IOPayloadGenerator(const IO_PAYLOAD_CONFIG& config, std::shared_ptr<IORand> ioRand)
+{
+	this->config = config;
+	this->config.blockSize = std::max<uint32_t>(config.blockSize / 8 * 8, PAYLOAD_STAMP_SIZE);
+	this->config.compressionRatio = std::max(config.compressionRatio, 1.0);
+	this->config.dedupPercent = std::min<uint32_t>(config.dedupPercent, 100);
+	this->config.poolBlocks = std::max<size_t>(config.poolBlocks, 1);
+	this->ioRand = ioRand;
+
+	// whole words, so a chunk is never all zeros
+	size_t randomBytes = (size_t)std::ceil(PAYLOAD_CHUNK_SIZE / this->config.compressionRatio);
+	randomBytesPerChunk = std::min<size_t>(std::max<size_t>((randomBytes + 7) / 8 * 8, 8), PAYLOAD_CHUNK_SIZE);
+	dedupThreshold = ((uint64_t)this->config.dedupPercent << 32) / 100;
+
+	size_t blockSize = this->config.blockSize;
+	pool.resize(this->config.poolBlocks * blockSize);
+	ioRand->fillBuffer((char*)pool.data(), pool.size());
+	for (size_t block = 0; block < this->config.poolBlocks; block++)
+	{
+		uint8_t* blockData = pool.data() + block * blockSize;
+		for (size_t chunk = 0; chunk < blockSize; chunk += PAYLOAD_CHUNK_SIZE)
+		{
+			size_t chunkSize = std::min<size_t>(PAYLOAD_CHUNK_SIZE, blockSize - chunk);
+			if (chunkSize > randomBytesPerChunk)
+			{
+				memset(blockData + chunk + randomBytesPerChunk, 0, chunkSize - randomBytesPerChunk);
+			}
+		}
+	}
+
+	stampSalt = ioRand->getRandomNumber<uint64_t>();
+	uniqueBlockIndex = 0;
+}
+
+void IOPayloadGenerator::fill(void* buffer, size_t size)
+{
+	uint8_t* bytes = (uint8_t*)buffer;
+	size_t blockSize = config.blockSize;
+	size_t numBlocks = (size_t)((size + blockSize - 1) / blockSize);
+
+	// claimed up front so other threads can fill at the same time. Only unique blocks use theirs
+	uint64_t uniqueIndex = uniqueBlockIndex.fetch_add(numBlocks, std::memory_order_relaxed);
+
+	uint64_t randomNumbers[PAYLOAD_RANDOM_BATCH];
+	for (size_t block = 0; block < numBlocks; block++, uniqueIndex++)
+	{
+		size_t batchIdx = block % PAYLOAD_RANDOM_BATCH;
+		if (batchIdx == 0 && config.dedupPercent)
+		{
+			ioRand->getRandomNumbers(randomNumbers, std::min<size_t>(PAYLOAD_RANDOM_BATCH, numBlocks - block));
+		}
+
+		uint8_t* blockData = bytes + block * blockSize;
+		size_t copySize = std::min(blockSize, size - block * blockSize);
+		uint64_t random = config.dedupPercent ? randomNumbers[batchIdx] : UINT64_MAX;
+		if ((random >> 32) < dedupThreshold)
+		{
+			// a duplicate: any pool block, as is
+			memcpy(blockData, pool.data() + ((uint32_t)random % config.poolBlocks) * blockSize, copySize);
+			continue;
+		}
+
+		// walk the pool in order so blocks in the same IO differ past the stamp too
+		memcpy(blockData, pool.data() + (uniqueIndex % config.poolBlocks) * blockSize, copySize);
+
+		uint64_t stamp[PAYLOAD_STAMP_SIZE / sizeof(uint64_t)] = { stampSalt, uniqueIndex };
+		memcpy(blockData, stamp, std::min<size_t>(PAYLOAD_STAMP_SIZE, copySize));
+	}
+}
+
+const IO_PAYLOAD_CONFIG& IOPayloadGenerator::getConfig() const
+{
+	return config;
+}
+
+size_t IOPayloadGenerator::getRandomBytesPerChunk() const
+{
+	return randomBytesPerChunk;
+}
@@ -0,0 +1,85 @@
+// IO Payload header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+
+#include "iorand.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// the size compression and dedup are aimed at. Most drives and arrays work in 4k
+#define DEFAULT_PAYLOAD_BLOCK_SIZE 4096
+
+// unique blocks generated up front (4 MiB at the default block size)
+#define DEFAULT_PAYLOAD_POOL_BLOCKS 1024
+
+// Each block is made of chunks this big. Every chunk is random up front and zeros after, so the
+//  block compresses by about the same ratio whatever window the compressor uses
+#define PAYLOAD_CHUNK_SIZE 512
+
+// bytes at the start of each unique block overwritten with a per-block stamp so no two are the same
+#define PAYLOAD_STAMP_SIZE 16
+
+struct IO_PAYLOAD_CONFIG
+{
+	IO_PAYLOAD_CONFIG()
+	{
+		blockSize = DEFAULT_PAYLOAD_BLOCK_SIZE;
+		compressionRatio = 1;
+		dedupPercent = 0;
+		poolBlocks = DEFAULT_PAYLOAD_POOL_BLOCKS;
+	}
+
+	// a multiple of 8 and at least PAYLOAD_STAMP_SIZE
+	uint32_t blockSize;
+
+	// original size / compressed size. 1 is incompressible
+	double compressionRatio;
+
+	// 0 - 100. About this many of the blocks written are copies of an earlier block
+	uint32_t dedupPercent;
+
+	// pool blocks to copy from. Duplicates are drawn from all of them, so this is also how many
+	//  different duplicate blocks there are. dedupPercent is only reached once a few times this many
+	//  blocks have been written
+	size_t poolBlocks;
+};
+
+// Fills write buffers with data that compresses and dedups by a set amount. Every block is copied from a
+//  pool made up front with IORand::fillBuffer(), so a fill costs about a memcpy. Thread safe
+class IOPayloadGenerator
+{
+public:
+	// out of range config values are clamped
+	IOPayloadGenerator(const IO_PAYLOAD_CONFIG& config, std::shared_ptr<IORand> ioRand);
+
+	// fills size bytes of buffer a block at a time (the last block may be partial)
+	void fill(void* buffer, size_t size);
+
+	const IO_PAYLOAD_CONFIG& getConfig() const;
+
+	// random bytes at the start of each PAYLOAD_CHUNK_SIZE chunk. The rest of the chunk is zero
+	size_t getRandomBytesPerChunk() const;
+
+private:
+	IO_PAYLOAD_CONFIG config;
+	std::shared_ptr<IORand> ioRand;
+
+	// poolBlocks * blockSize bytes
+	std::vector<uint8_t> pool;
+
+	size_t randomBytesPerChunk;
+
+	// a random number's top 32 bits below this makes a duplicate block. 2^32 for 100%
+	uint64_t dedupThreshold;
+
+	// ties the stamps to this generator, so two generators don't make the same "unique" blocks
+	uint64_t stampSalt;
+
+	// counts unique blocks. Stamped into each one and picks its pool block
+	std::atomic<uint64_t> uniqueBlockIndex;
+};
@@ -0,0 +1,68 @@
+// IO Permutation implementation file for IO
+// (C) - csm10495 - MIT License 2019
+
+#include "io_permutation.h"
+#include "iorand_engines.h"
+
+IOPermutation::IOPermutation() : IOPermutation(0, 0)
+{
+}
+
+IOPermutation::IOPermutation(uint64_t size, uint64_t seed)
+{
+	reset(size, seed);
+}
+
+void IOPermutation::reset(uint64_t size, uint64_t seed)
+{
+	this->size = size;
+
+	// smallest bit count that holds size - 1, rounded up to even so the halves match
+	uint32_t bits = 0;
+	while (bits < 64 && (1ULL << bits) < size)
+	{
+		bits++;
+	}
+	bits += bits & 1;
+
+	// the domain is under 4x size, so cycle-walking takes under 4 tries on average
+	halfBits = bits / 2;
+	halfMask = (1ULL << halfBits) - 1;
+
+	IOSplitMix64 keyGenerator(seed);
+	for (int i = 0; i < PERMUTATION_FEISTEL_ROUNDS; i++)
+	{
+		roundKeys[i] = keyGenerator();
+	}
+}
+
+uint64_t IOPermutation::permute(uint64_t index) const
+{
+	// each encrypt() is a bijection on the domain, so walking until we land back in [0, size) is one too
+	uint64_t value = encrypt(index);
+	while (value >= size)
+	{
+		value = encrypt(value);
+	}
+	return value;
+}
+
+uint64_t IOPermutation::getSize() const
+{
+	return size;
+}
+
+uint64_t IOPermutation::encrypt(uint64_t value) const
+{
+	uint64_t left = value >> halfBits;
+	uint64_t right = value & halfMask;
+
+	for (int i = 0; i < PERMUTATION_FEISTEL_ROUNDS; i++)
+	{
+		uint64_t newRight = left ^ (IOSplitMix64::mix(right ^ roundKeys[i]) & halfMask);
+		left = right;
+		right = newRight;
+	}
+
+	return (left << halfBits) | right;
+}
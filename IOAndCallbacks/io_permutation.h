@@ -0,0 +1,41 @@
+// IO Permutation header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+
+#include <cstdint>
+
+// number of Feistel rounds. 4 is plenty to look random for LBA ordering (this is not crypto)
+#define PERMUTATION_FEISTEL_ROUNDS 4
+
+// IOPermutation is a keyed bijection on [0, size): every index maps to a different index in the same range.
+//  It is a balanced Feistel network on the smallest even number of bits that holds size, with cycle-walking
+//  to stay in range. Uses O(1) memory no matter how big size is
+class IOPermutation
+{
+public:
+	// an empty permutation. Call reset() before using it
+	IOPermutation();
+
+	// keys come from seed. The same size and seed always give the same order
+	IOPermutation(uint64_t size, uint64_t seed);
+
+	void reset(uint64_t size, uint64_t seed);
+
+	// returns where index goes. index must be < getSize()
+	uint64_t permute(uint64_t index) const;
+
+	uint64_t getSize() const;
+
+private:
+	// one trip through the Feistel network over the power-of-4 domain
+	uint64_t encrypt(uint64_t value) const;
+
+	uint64_t size;
+
+	// bits in each Feistel half and the mask for one half
+	uint32_t halfBits;
+	uint64_t halfMask;
+
+	uint64_t roundKeys[PERMUTATION_FEISTEL_ROUNDS];
+};
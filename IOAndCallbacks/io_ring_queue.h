@@ -0,0 +1,162 @@
+// IO Ring Queue header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// keeps the producer and consumer positions from sharing a cache line
+#define IO_RING_QUEUE_CACHE_LINE_SIZE 64
+
+// Bounded lock-free queue (Dmitry Vyukov's sequence-per-cell design).
+//  Safe for any number of producers and consumers. Nothing is allocated after construction.
+//  Each cell carries a sequence number that says whether it is ready to be written or read,
+//  so producers/consumers only ever CAS their own position counter.
+template <typename T>
+class IORingQueue
+{
+public:
+	// capacity is rounded up to a power of 2
+	IORingQueue(size_t capacity)
+	{
+		size_t realCapacity = 2;
+		while (realCapacity < capacity)
+		{
+			realCapacity <<= 1;
+		}
+
+		mask = realCapacity - 1;
+		cells.reset(new Cell[realCapacity]);
+		for (size_t i = 0; i < realCapacity; i++)
+		{
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		enqueuePosition.store(0, std::memory_order_relaxed);
+		dequeuePosition.store(0, std::memory_order_relaxed);
+	}
+
+	// returns false if the queue is full
+	bool tryPush(const T& value)
+	{
+		size_t position = enqueuePosition.load(std::memory_order_relaxed);
+		Cell* cell;
+		while (true)
+		{
+			cell = &cells[position & mask];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+			if (difference == 0)
+			{
+				// the cell is free. Claim it
+				if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (difference < 0)
+			{
+				// the cell still holds a value from one lap ago: full
+				return false;
+			}
+			else
+			{
+				// another producer took this one
+				position = enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->data = value;
+		cell->sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	// returns false if the queue is empty
+	bool tryPop(T& value)
+	{
+		return tryPopBulk(&value, 1) == 1;
+	}
+
+	// pops up to maxCount values into values with a single CAS. Returns the number popped
+	size_t tryPopBulk(T* values, size_t maxCount)
+	{
+		size_t position = dequeuePosition.load(std::memory_order_relaxed);
+		size_t count;
+		while (true)
+		{
+			// count how many cells in a row are ready to be read
+			bool stalePosition = false;
+			count = 0;
+			while (count < maxCount && count <= mask)
+			{
+				Cell* cell = &cells[(position + count) & mask];
+				size_t sequence = cell->sequence.load(std::memory_order_acquire);
+				intptr_t difference = (intptr_t)sequence - (intptr_t)(position + count + 1);
+				if (difference != 0)
+				{
+					// > 0 on the first cell means another consumer moved past us
+					stalePosition = difference > 0 && count == 0;
+					break;
+				}
+				count++;
+			}
+
+			if (stalePosition)
+			{
+				position = dequeuePosition.load(std::memory_order_relaxed);
+				continue;
+			}
+
+			if (count == 0)
+			{
+				return 0;
+			}
+
+			// if another consumer got here first, this fails and we look again
+			if (dequeuePosition.compare_exchange_weak(position, position + count, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			Cell* cell = &cells[(position + i) & mask];
+			values[i] = cell->data;
+
+			// free the cell for the producer one lap from now
+			cell->sequence.store(position + i + mask + 1, std::memory_order_release);
+		}
+
+		return count;
+	}
+
+	// may be stale by the time it is returned if other threads are using the queue
+	size_t getApproximateSize() const
+	{
+		size_t enqueued = enqueuePosition.load(std::memory_order_relaxed);
+		size_t dequeued = dequeuePosition.load(std::memory_order_relaxed);
+		return enqueued > dequeued ? enqueued - dequeued : 0;
+	}
+
+	size_t getCapacity() const
+	{
+		return mask + 1;
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	size_t mask;
+
+	alignas(IO_RING_QUEUE_CACHE_LINE_SIZE) std::atomic<size_t> enqueuePosition;
+	alignas(IO_RING_QUEUE_CACHE_LINE_SIZE) std::atomic<size_t> dequeuePosition;
+};
@@ -0,0 +1,363 @@
+// IO Simulated Device implementation file for IO
+// (C) - csm10495 - MIT License 2019
+
+#include "io_simulated_device.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+// parses all of value as an unsigned number. Leaves result alone on failure
+static bool parseNumber(const std::string& value, uint64_t& result)
+{
+	if (value.empty())
+	{
+		return false;
+	}
+
+	char* end = NULL;
+	uint64_t number = strtoull(value.c_str(), &end, 0);
+	if (*end != '\0')
+	{
+		return false;
+	}
+
+	result = number;
+	return true;
+}
+
+IOSimulatedDevice::IOSimulatedDevice(const IO_SIMULATED_DEVICE_CONFIG& config) : random(config.seed)
+{
+	this->config = config;
+	channelFreeTimes.resize(config.latency.channels, 0);
+
+	if (!config.sparse)
+	{
+		flatStorage.reset(new uint8_t[(size_t)(config.blockSize * config.blockCount)]());
+	}
+}
+
+bool IOSimulatedDevice::isSimulatedPath(const std::string& path)
+{
+	return path.compare(0, strlen(IO_SIMULATED_DEVICE_PATH_PREFIX), IO_SIMULATED_DEVICE_PATH_PREFIX) == 0;
+}
+
+std::shared_ptr<IOSimulatedDevice> IOSimulatedDevice::open(const std::string& path)
+{
+	static std::mutex devicesLock;
+	static std::unordered_map<std::string, std::shared_ptr<IOSimulatedDevice>> devices;
+
+	std::string spec = isSimulatedPath(path) ? path.substr(strlen(IO_SIMULATED_DEVICE_PATH_PREFIX)) : path;
+	size_t comma = spec.find(',');
+	std::string name = spec.substr(0, comma);
+	std::string options = comma == std::string::npos ? "" : spec.substr(comma + 1);
+
+	std::lock_guard<std::mutex> lockGuard(devicesLock);
+	auto existing = devices.find(name);
+	if (existing != devices.end())
+	{
+		return existing->second;
+	}
+
+	IO_SIMULATED_DEVICE_CONFIG config;
+	if (!parseOptions(options, config))
+	{
+		return NULL;
+	}
+
+	std::shared_ptr<IOSimulatedDevice> device(new IOSimulatedDevice(config));
+	devices[name] = device;
+	return device;
+}
+
+bool IOSimulatedDevice::parseOptions(const std::string& options, IO_SIMULATED_DEVICE_CONFIG& config)
+{
+	IO_SIMULATED_DEVICE_CONFIG newConfig = config;
+
+	size_t start = 0;
+	while (start < options.size())
+	{
+		size_t end = options.find(',', start);
+		if (end == std::string::npos)
+		{
+			end = options.size();
+		}
+
+		std::string option = options.substr(start, end - start);
+		start = end + 1;
+
+		size_t equals = option.find('=');
+		std::string key = option.substr(0, equals);
+		std::string value = equals == std::string::npos ? "" : option.substr(equals + 1);
+
+		uint64_t number = 0;
+		bool valid = true;
+		if (key == "latency")
+		{
+			if (value == "fixed")
+			{
+				newConfig.latency.type = IO_SIMULATED_LATENCY_FIXED;
+			}
+			else if (value == "uniform")
+			{
+				newConfig.latency.type = IO_SIMULATED_LATENCY_UNIFORM;
+			}
+			else if (value == "exponential")
+			{
+				newConfig.latency.type = IO_SIMULATED_LATENCY_EXPONENTIAL;
+			}
+			else
+			{
+				valid = false;
+			}
+		}
+		else if (key == "error_rate")
+		{
+			char* numberEnd = NULL;
+			double rate = strtod(value.c_str(), &numberEnd);
+			valid = !value.empty() && *numberEnd == '\0' && rate >= 0.0 && rate <= 1.0;
+			newConfig.errorRate = valid ? rate : newConfig.errorRate;
+		}
+		else if (!parseNumber(value, number))
+		{
+			valid = false;
+		}
+		else if (key == "bs")
+		{
+			// has to be a power of 2 to be usable as a buffer alignment
+			valid = number >= 1 && number <= 0x100000 && (number & (number - 1)) == 0;
+			newConfig.blockSize = (uint32_t)number;
+		}
+		else if (key == "blocks")
+		{
+			valid = number > 0;
+			newConfig.blockCount = number;
+		}
+		else if (key == "sparse")
+		{
+			newConfig.sparse = number != 0;
+		}
+		else if (key == "seed")
+		{
+			newConfig.seed = number;
+		}
+		else if (key == "read_ns")
+		{
+			newConfig.latency.readNanoseconds = number;
+		}
+		else if (key == "write_ns")
+		{
+			newConfig.latency.writeNanoseconds = number;
+		}
+		else if (key == "jitter_ns")
+		{
+			newConfig.latency.jitterNanoseconds = number;
+		}
+		else if (key == "per_kib_ns")
+		{
+			newConfig.latency.nanosecondsPerKiB = number;
+		}
+		else if (key == "channels")
+		{
+			newConfig.latency.channels = (uint32_t)number;
+		}
+		else
+		{
+			valid = false;
+		}
+
+		if (!valid)
+		{
+			std::cerr << "Invalid simulated device option: " << option << std::endl;
+			return false;
+		}
+	}
+
+	config = newConfig;
+	return true;
+}
+
+uint32_t IOSimulatedDevice::getBlockSize() const
+{
+	return config.blockSize;
+}
+
+uint64_t IOSimulatedDevice::getBlockCount() const
+{
+	return config.blockCount;
+}
+
+void IOSimulatedDevice::setLatencyModel(const IO_SIMULATED_LATENCY_MODEL& latencyModel)
+{
+	std::lock_guard<std::mutex> lockGuard(lock);
+	config.latency = latencyModel;
+	channelFreeTimes.assign(latencyModel.channels, 0);
+}
+
+void IOSimulatedDevice::setErrorRate(double errorRate)
+{
+	std::lock_guard<std::mutex> lockGuard(lock);
+	config.errorRate = errorRate;
+}
+
+void IOSimulatedDevice::addBadBlocks(uint64_t lba, uint64_t count)
+{
+	std::lock_guard<std::mutex> lockGuard(lock);
+	badBlocks.insert(lba, count);
+}
+
+void IOSimulatedDevice::clearBadBlocks()
+{
+	std::lock_guard<std::mutex> lockGuard(lock);
+	badBlocks.clear();
+}
+
+uint64_t IOSimulatedDevice::scheduleIo(const IO_CALLBACK_STRUCT* ioCallbackStruct, uint64_t nowNanoseconds, size_t queueDepth, uint32_t* errorCode)
+{
+	*errorCode = 0;
+
+	uint64_t lba = ioCallbackStruct->lba;
+	uint64_t numBlocks = ioCallbackStruct->numBlocksRequested;
+	if (lba >= config.blockCount || numBlocks > config.blockCount - lba || ioCallbackStruct->numBytesRequested != numBlocks * config.blockSize)
+	{
+		// a real device would reject this before doing anything
+		*errorCode = IO_SIMULATED_ERROR_OUT_OF_RANGE;
+		return nowNanoseconds;
+	}
+
+	std::lock_guard<std::mutex> lockGuard(lock);
+
+	if (badBlocks.overlaps(lba, numBlocks))
+	{
+		*errorCode = IO_SIMULATED_ERROR_MEDIA;
+	}
+	else if (config.errorRate > 0.0 && (random() >> 11) * 0x1.0p-53 < config.errorRate)
+	{
+		*errorCode = IO_SIMULATED_ERROR_MEDIA;
+	}
+
+	uint64_t serviceTime = getServiceTime(ioCallbackStruct, queueDepth);
+	if (channelFreeTimes.empty())
+	{
+		return nowNanoseconds + serviceTime;
+	}
+
+	// take the channel that frees up first
+	std::pop_heap(channelFreeTimes.begin(), channelFreeTimes.end(), std::greater<uint64_t>());
+	uint64_t completionTime = std::max(channelFreeTimes.back(), nowNanoseconds) + serviceTime;
+	channelFreeTimes.back() = completionTime;
+	std::push_heap(channelFreeTimes.begin(), channelFreeTimes.end(), std::greater<uint64_t>());
+	return completionTime;
+}
+
+uint64_t IOSimulatedDevice::getServiceTime(const IO_CALLBACK_STRUCT* ioCallbackStruct, size_t queueDepth)
+{
+	const IO_SIMULATED_LATENCY_MODEL& latency = config.latency;
+	uint64_t serviceTime = ioCallbackStruct->operation == IO_OPERATION_READ ? latency.readNanoseconds : latency.writeNanoseconds;
+
+	switch (latency.type)
+	{
+	case IO_SIMULATED_LATENCY_UNIFORM:
+		serviceTime += latency.jitterNanoseconds ? random() % (latency.jitterNanoseconds + 1) : 0;
+		break;
+	case IO_SIMULATED_LATENCY_EXPONENTIAL:
+		// 1 - u is in (0, 1] so the log is finite
+		serviceTime = (uint64_t)(-std::log(1.0 - (random() >> 11) * 0x1.0p-53) * serviceTime);
+		break;
+	case IO_SIMULATED_LATENCY_CUSTOM:
+		if (latency.customFunction)
+		{
+			serviceTime = latency.customFunction(ioCallbackStruct, queueDepth, latency.customUserData);
+		}
+		break;
+	default:
+		break;
+	}
+
+	return serviceTime + latency.nanosecondsPerKiB * ioCallbackStruct->numBytesRequested / 1024;
+}
+
+uint8_t* IOSimulatedDevice::getChunk(uint64_t offset, bool create)
+{
+	uint64_t chunkIndex = offset / SIMULATED_DEVICE_CHUNK_SIZE;
+
+	std::lock_guard<std::mutex> lockGuard(storageLock);
+	auto chunk = chunks.find(chunkIndex);
+	if (chunk != chunks.end())
+	{
+		return chunk->second.get();
+	}
+
+	if (!create)
+	{
+		return NULL;
+	}
+
+	uint8_t* newChunk = new uint8_t[SIMULATED_DEVICE_CHUNK_SIZE]();
+	chunks[chunkIndex].reset(newChunk);
+	return newChunk;
+}
+
+uint64_t IOSimulatedDevice::transfer(IO_CALLBACK_STRUCT* ioCallbackStruct)
+{
+	uint64_t offset = ioCallbackStruct->lba * config.blockSize;
+	bool isWrite = ioCallbackStruct->operation == IO_OPERATION_WRITE;
+
+	if (!ioCallbackStruct->ioVecs)
+	{
+		transferRange(offset, (uint8_t*)ioCallbackStruct->xferBuffer, ioCallbackStruct->numBytesRequested, isWrite);
+		return ioCallbackStruct->numBytesRequested;
+	}
+
+	uint64_t done = 0;
+	for (size_t i = 0; i < ioCallbackStruct->numIoVecs; i++)
+	{
+		const IO_IOVEC& ioVec = ioCallbackStruct->ioVecs[i];
+		transferRange(offset + done, (uint8_t*)ioVec.iov_base, ioVec.iov_len, isWrite);
+		done += ioVec.iov_len;
+	}
+	return done;
+}
+
+void IOSimulatedDevice::transferRange(uint64_t offset, uint8_t* buffer, uint64_t numBytes, bool isWrite)
+{
+	if (flatStorage)
+	{
+		if (isWrite)
+		{
+			memcpy(flatStorage.get() + offset, buffer, (size_t)numBytes);
+		}
+		else
+		{
+			memcpy(buffer, flatStorage.get() + offset, (size_t)numBytes);
+		}
+		return;
+	}
+
+	uint64_t done = 0;
+	while (done < numBytes)
+	{
+		uint64_t chunkOffset = (offset + done) % SIMULATED_DEVICE_CHUNK_SIZE;
+		size_t length = (size_t)std::min(numBytes - done, SIMULATED_DEVICE_CHUNK_SIZE - chunkOffset);
+
+		// reads of never written chunks see zeros without allocating anything
+		uint8_t* chunk = getChunk(offset + done, isWrite);
+		if (isWrite)
+		{
+			memcpy(chunk + chunkOffset, buffer + done, length);
+		}
+		else if (chunk)
+		{
+			memcpy(buffer + done, chunk + chunkOffset, length);
+		}
+		else
+		{
+			memset(buffer + done, 0, length);
+		}
+
+		done += length;
+	}
+}
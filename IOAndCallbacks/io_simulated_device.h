@@ -0,0 +1,176 @@
+// IO Simulated Device header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+
+#include "io.h"
+#include "io_interval_set.h"
+#include "iorand_engines.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Paths starting with this open a simulated device instead of a real one. The rest of the path is
+//  <name>[,option=value ...]. Options (only used the first time a name is opened):
+//   bs=<bytes> blocks=<count> sparse=<0|1> seed=<n>
+//   latency=<fixed|uniform|exponential> read_ns=<n> write_ns=<n> jitter_ns=<n> per_kib_ns=<n> channels=<n>
+//   error_rate=<0.0 - 1.0>
+#define IO_SIMULATED_DEVICE_PATH_PREFIX "sim:"
+
+#define DEFAULT_SIMULATED_DEVICE_BLOCK_SIZE 512
+
+// 1 GiB at the default block size. Sparse devices only use memory for what is written
+#define DEFAULT_SIMULATED_DEVICE_BLOCK_COUNT (1ULL << 21)
+
+// sparse devices allocate their storage in chunks of this many bytes
+#define SIMULATED_DEVICE_CHUNK_SIZE (64 * 1024)
+
+#ifdef IO_WIN32
+#define IO_SIMULATED_ERROR_MEDIA ERROR_CRC
+#define IO_SIMULATED_ERROR_OUT_OF_RANGE ERROR_SECTOR_NOT_FOUND
+#else
+#include <errno.h>
+#define IO_SIMULATED_ERROR_MEDIA EIO
+#define IO_SIMULATED_ERROR_OUT_OF_RANGE EINVAL
+#endif
+
+// how a simulated IO's service time is picked
+typedef enum _IO_SIMULATED_LATENCY_ENUM
+{
+	IO_SIMULATED_LATENCY_FIXED,        // read/writeNanoseconds every time
+	IO_SIMULATED_LATENCY_UNIFORM,      // read/writeNanoseconds plus up to jitterNanoseconds
+	IO_SIMULATED_LATENCY_EXPONENTIAL,  // exponentially distributed with a mean of read/writeNanoseconds
+	IO_SIMULATED_LATENCY_CUSTOM        // whatever customFunction returns
+} IO_SIMULATED_LATENCY_ENUM, *PIO_SIMULATED_LATENCY_ENUM;
+
+// returns the service time in nanoseconds for ioCallbackStruct. queueDepth is the number of IOs in flight
+//  on the submitting IO object (including this one)
+typedef uint64_t(IO_SIMULATED_LATENCY_FUNCTION)(const IO_CALLBACK_STRUCT* ioCallbackStruct, size_t queueDepth, void* userData);
+
+struct IO_SIMULATED_LATENCY_MODEL
+{
+	IO_SIMULATED_LATENCY_MODEL()
+	{
+		type = IO_SIMULATED_LATENCY_FIXED;
+		readNanoseconds = 0;
+		writeNanoseconds = 0;
+		jitterNanoseconds = 0;
+		nanosecondsPerKiB = 0;
+		channels = 0;
+		customFunction = NULL;
+		customUserData = NULL;
+	}
+
+	IO_SIMULATED_LATENCY_ENUM type;
+	uint64_t readNanoseconds;
+	uint64_t writeNanoseconds;
+	uint64_t jitterNanoseconds;
+
+	// added to the service time for each KiB moved
+	uint64_t nanosecondsPerKiB;
+
+	// IOs the device works on at once. Past that they wait for a free channel, so latency grows
+	//  with queue depth. 0 means every IO starts right away
+	uint32_t channels;
+
+	IO_SIMULATED_LATENCY_FUNCTION* customFunction;
+	void* customUserData;
+};
+
+struct IO_SIMULATED_DEVICE_CONFIG
+{
+	IO_SIMULATED_DEVICE_CONFIG()
+	{
+		blockSize = DEFAULT_SIMULATED_DEVICE_BLOCK_SIZE;
+		blockCount = DEFAULT_SIMULATED_DEVICE_BLOCK_COUNT;
+		sparse = true;
+		seed = 0;
+		errorRate = 0.0;
+	}
+
+	uint32_t blockSize;
+	uint64_t blockCount;
+
+	// if false, all of the storage is allocated up front
+	bool sparse;
+
+	// for the latency and error models
+	uint64_t seed;
+
+	IO_SIMULATED_LATENCY_MODEL latency;
+
+	// chance (0.0 - 1.0) that any IO fails with IO_SIMULATED_ERROR_MEDIA
+	double errorRate;
+};
+
+// A block device in memory. IO objects opened on a simulated path queue to one of these instead of the OS,
+//  and get their completions through the usual poll()/callback path once the latency model says they are done.
+//  Thread safe: IO objects on different threads may share a device
+class IOSimulatedDevice
+{
+public:
+	IOSimulatedDevice(const IO_SIMULATED_DEVICE_CONFIG& config);
+
+	// returns true if path names a simulated device
+	static bool isSimulatedPath(const std::string& path);
+
+	// Returns the device named by path (with or without IO_SIMULATED_DEVICE_PATH_PREFIX), creating it the first time.
+	//  Devices live until the process exits so data written through one IO object can be read through the next.
+	//  Returns NULL if the options are malformed
+	static std::shared_ptr<IOSimulatedDevice> open(const std::string& path);
+
+	// parses the options part of a simulated path into config. Returns false on a bad option
+	static bool parseOptions(const std::string& options, IO_SIMULATED_DEVICE_CONFIG& config);
+
+	uint32_t getBlockSize() const;
+	uint64_t getBlockCount() const;
+
+	void setLatencyModel(const IO_SIMULATED_LATENCY_MODEL& latencyModel);
+	void setErrorRate(double errorRate);
+
+	// IOs that touch [lba, lba + count) fail with IO_SIMULATED_ERROR_MEDIA
+	void addBadBlocks(uint64_t lba, uint64_t count);
+	void clearBadBlocks();
+
+	// Decides when ioCallbackStruct completes (in getTimestampNanoseconds() time) and returns it.
+	//  errorCode is set to what the IO will fail with, or 0
+	uint64_t scheduleIo(const IO_CALLBACK_STRUCT* ioCallbackStruct, uint64_t nowNanoseconds, size_t queueDepth, uint32_t* errorCode);
+
+	// moves the data for a scheduled IO that didn't fail. Returns the number of bytes moved
+	uint64_t transfer(IO_CALLBACK_STRUCT* ioCallbackStruct);
+
+private:
+	// service time before waiting for a channel. Called with lock held
+	uint64_t getServiceTime(const IO_CALLBACK_STRUCT* ioCallbackStruct, size_t queueDepth);
+
+	// copies numBytes between buffer and the device starting at byte offset
+	void transferRange(uint64_t offset, uint8_t* buffer, uint64_t numBytes, bool isWrite);
+
+	// returns the storage for the chunk holding byte offset, or NULL if it was never written (and create is false)
+	uint8_t* getChunk(uint64_t offset, bool create);
+
+	IO_SIMULATED_DEVICE_CONFIG config;
+
+	// guards the latency model, the bad blocks, the channels and the random generator
+	std::mutex lock;
+
+	IOIntervalSet badBlocks;
+
+	// time each channel is next free, kept as a min-heap
+	std::vector<uint64_t> channelFreeTimes;
+
+	IOXoshiro256StarStar random;
+
+	// guards chunks. Chunks are never freed, so the data itself is copied without it
+	std::mutex storageLock;
+
+	// chunk index -> SIMULATED_DEVICE_CHUNK_SIZE bytes. Only used if sparse
+	std::unordered_map<uint64_t, std::unique_ptr<uint8_t[]>> chunks;
+
+	// the whole device. Only used if not sparse
+	std::unique_ptr<uint8_t[]> flatStorage;
+};
@@ -0,0 +1,120 @@
+// IO Stats implementation file for IO
+// (C) - csm10495 - MIT License 2019
+
+#include "io_stats.h"
+
+#if IO_ENABLE_STATS
+
+#include <algorithm>
+
+// each thread gets the next shard index the first time it records stats
+static std::atomic<uint32_t> nextShardIndex(0);
+static thread_local uint32_t threadShardIndex = nextShardIndex++ % IO_STATS_SHARD_COUNT;
+
+void IO_STATS_STRUCT::merge(const IO_STATS_STRUCT& other)
+{
+	// lowest lbas only mean something if there was at least one IO
+	if (other.NumberOfQueuedReads)
+	{
+		LowestQueuedReadLba = NumberOfQueuedReads ? std::min(LowestQueuedReadLba, other.LowestQueuedReadLba) : other.LowestQueuedReadLba;
+	}
+	if (other.NumberOfQueuedWrites)
+	{
+		LowestQueuedWriteLba = NumberOfQueuedWrites ? std::min(LowestQueuedWriteLba, other.LowestQueuedWriteLba) : other.LowestQueuedWriteLba;
+	}
+
+	NumberOfQueuedReads += other.NumberOfQueuedReads;
+	NumberOfQueuedWrites += other.NumberOfQueuedWrites;
+	LargestQueuedReadInSectors = std::max(LargestQueuedReadInSectors, other.LargestQueuedReadInSectors);
+	LargestQueuedWriteInSectors = std::max(LargestQueuedWriteInSectors, other.LargestQueuedWriteInSectors);
+	HighestQueuedReadLba = std::max(HighestQueuedReadLba, other.HighestQueuedReadLba);
+	HighestQueuedWriteLba = std::max(HighestQueuedWriteLba, other.HighestQueuedWriteLba);
+	NumberOfReadQueueFailures += other.NumberOfReadQueueFailures;
+	NumberOfWriteQueueFailures += other.NumberOfWriteQueueFailures;
+	NumberOfRequestPoolExhaustions += other.NumberOfRequestPoolExhaustions;
+	NumberOfMergedIos += other.NumberOfMergedIos;
+
+	NumberOfCompletedReads += other.NumberOfCompletedReads;
+	NumberOfCompletedWrites += other.NumberOfCompletedWrites;
+	NumberOfReadBytesCompleted += other.NumberOfReadBytesCompleted;
+	NumberOfWriteBytesCompleted += other.NumberOfWriteBytesCompleted;
+	NumberOfReadErrors += other.NumberOfReadErrors;
+	NumberOfWriteErrors += other.NumberOfWriteErrors;
+	NumberOfChecksumMismatches += other.NumberOfChecksumMismatches;
+
+	ReadLatencyHistogram.merge(other.ReadLatencyHistogram);
+	WriteLatencyHistogram.merge(other.WriteLatencyHistogram);
+}
+
+IOStats::IOStats()
+{
+	for (size_t i = 0; i < IO_STATS_SHARD_COUNT; i++)
+	{
+		shards[i] = NULL;
+	}
+}
+
+IOStats::~IOStats()
+{
+	for (size_t i = 0; i < IO_STATS_SHARD_COUNT; i++)
+	{
+		delete shards[i].load();
+		shards[i] = NULL;
+	}
+}
+
+IO_STATS_SHARD* IOStats::acquireShard()
+{
+	std::atomic<IO_STATS_SHARD*>& slot = shards[threadShardIndex];
+
+	IO_STATS_SHARD* shard = slot.load(std::memory_order_acquire);
+	if (!shard)
+	{
+		// another thread with the same index may beat us to it. If so, use theirs
+		IO_STATS_SHARD* newShard = new IO_STATS_SHARD();
+		if (slot.compare_exchange_strong(shard, newShard, std::memory_order_acq_rel))
+		{
+			shard = newShard;
+		}
+		else
+		{
+			delete newShard;
+		}
+	}
+
+	shard->acquire();
+	return shard;
+}
+
+IO_STATS_STRUCT IOStats::snapshot()
+{
+	IO_STATS_STRUCT ret;
+	for (size_t i = 0; i < IO_STATS_SHARD_COUNT; i++)
+	{
+		IO_STATS_SHARD* shard = shards[i].load(std::memory_order_acquire);
+		if (shard)
+		{
+			shard->acquire();
+			ret.merge(shard->stats);
+			shard->release();
+		}
+	}
+
+	return ret;
+}
+
+void IOStats::reset()
+{
+	for (size_t i = 0; i < IO_STATS_SHARD_COUNT; i++)
+	{
+		IO_STATS_SHARD* shard = shards[i].load(std::memory_order_acquire);
+		if (shard)
+		{
+			shard->acquire();
+			shard->stats.clear();
+			shard->release();
+		}
+	}
+}
+
+#endif // IO_ENABLE_STATS
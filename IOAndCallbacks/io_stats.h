@@ -0,0 +1,118 @@
+// IO Stats header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+#include "switches.h"
+#include "io_histogram.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string.h>
+
+#if IO_ENABLE_STATS
+
+// Stats shards are padded to this so two threads never share a cache line
+#define IO_CACHE_LINE_SIZE 64
+
+// Max number of threads that get their own stats shard. Past this, threads share shards (still safely)
+#define IO_STATS_SHARD_COUNT 64
+
+// Used to keep track of some stats about this IO Object
+class IO_STATS_STRUCT
+{
+public:
+	IO_STATS_STRUCT()
+	{
+		clear();
+	}
+
+	void clear()
+	{
+		memset((void*)this, 0, sizeof(IO_STATS_STRUCT));
+	}
+
+	// adds other's stats into this one
+	void merge(const IO_STATS_STRUCT& other);
+
+	uint64_t NumberOfQueuedReads;
+	uint64_t NumberOfQueuedWrites;
+	uint64_t LargestQueuedReadInSectors;
+	uint64_t LargestQueuedWriteInSectors;
+	uint64_t LowestQueuedReadLba;
+	uint64_t HighestQueuedReadLba;
+	uint64_t LowestQueuedWriteLba;
+	uint64_t HighestQueuedWriteLba;
+	uint64_t NumberOfReadQueueFailures;
+	uint64_t NumberOfWriteQueueFailures;
+	uint64_t NumberOfRequestPoolExhaustions;
+
+	// IOs that went to the OS as part of a bigger one (see IO::setMaxMergeBytes())
+	uint64_t NumberOfMergedIos;
+
+	// Updated just before each callback
+	uint64_t NumberOfCompletedReads;
+	uint64_t NumberOfCompletedWrites;
+	uint64_t NumberOfReadBytesCompleted;
+	uint64_t NumberOfWriteBytesCompleted;
+	uint64_t NumberOfReadErrors;
+	uint64_t NumberOfWriteErrors;
+
+	// reads that failed the IO's checksum table (also counted in NumberOfReadErrors)
+	uint64_t NumberOfChecksumMismatches;
+
+	// Submit-to-completion latency in nanoseconds
+	IOLatencyHistogram ReadLatencyHistogram;
+	IOLatencyHistogram WriteLatencyHistogram;
+};
+
+// One thread's slice of the stats. The lock is only ever contended by snapshot()/reset()
+class alignas(IO_CACHE_LINE_SIZE) IO_STATS_SHARD
+{
+public:
+	IO_STATS_SHARD()
+	{
+		lock.clear();
+	}
+
+	inline void acquire()
+	{
+		while (lock.test_and_set(std::memory_order_acquire))
+		{
+			// only a monitoring thread can be holding this, and only for a moment
+		}
+	}
+
+	inline void release()
+	{
+		lock.clear(std::memory_order_release);
+	}
+
+	IO_STATS_STRUCT stats;
+
+private:
+	std::atomic_flag lock;
+};
+
+// IOStats keeps an IO_STATS_STRUCT per thread and merges them on request.
+//  Updating never touches another thread's cache lines. snapshot() and reset() are safe from any thread
+class IOStats
+{
+public:
+	IOStats();
+	~IOStats();
+
+	// locks and returns the calling thread's shard (creating it the first time). Follow with release()
+	IO_STATS_SHARD* acquireShard();
+
+	// returns all shards merged together
+	IO_STATS_STRUCT snapshot();
+
+	// clears all shards
+	void reset();
+
+private:
+	// created the first time a thread needs one
+	std::atomic<IO_STATS_SHARD*> shards[IO_STATS_SHARD_COUNT];
+};
+
+#endif // IO_ENABLE_STATS
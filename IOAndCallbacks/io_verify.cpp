@@ -0,0 +1,335 @@
+// IO Verify implementation file for IO
+// (C) - csm10495 - MIT License 2019
+
+#include "io_verify.h"
+#include "io_cpu_features.h"
+#include "iorand_engines.h"
+
+#include <algorithm>
+#include <cassert>
+#include <string.h>
+
+// payload words are fmix32(key + index * PAYLOAD_INDEX_STEP). fmix32 is a bijection, so no two words of a block repeat
+#define PAYLOAD_INDEX_STEP 0x9E3779B9U
+#define PAYLOAD_MIX_1 0x85EBCA6BU
+#define PAYLOAD_MIX_2 0xC2B2AE35U
+
+// the payload starts right after the header
+#define PAYLOAD_FIRST_WORD (sizeof(IO_VERIFY_HEADER) / sizeof(uint32_t))
+
+static inline uint32_t getPayloadWord(uint32_t key, uint32_t index)
+{
+	uint32_t h = key + index * PAYLOAD_INDEX_STEP;
+	h ^= h >> 16;
+	h *= PAYLOAD_MIX_1;
+	h ^= h >> 13;
+	h *= PAYLOAD_MIX_2;
+	h ^= h >> 16;
+	return h;
+}
+
+#if IO_HAS_AVX2
+IO_TARGET_AVX2 static inline __m256i getPayloadWords8(__m256i key, __m256i index)
+{
+	__m256i h = _mm256_add_epi32(key, _mm256_mullo_epi32(index, _mm256_set1_epi32((int)PAYLOAD_INDEX_STEP)));
+	h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+	h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int)PAYLOAD_MIX_1));
+	h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+	h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int)PAYLOAD_MIX_2));
+	return _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+}
+
+// fills words 8 at a time. Returns how many it did (the caller does the rest)
+IO_TARGET_AVX2 static size_t fillPayloadAvx2(uint32_t* words, uint32_t key, uint32_t firstIndex, size_t count)
+{
+	__m256i keys = _mm256_set1_epi32((int)key);
+	__m256i index = _mm256_add_epi32(_mm256_set1_epi32((int)firstIndex), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	const __m256i eight = _mm256_set1_epi32(8);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		_mm256_storeu_si256((__m256i*)(words + i), getPayloadWords8(keys, index));
+		index = _mm256_add_epi32(index, eight);
+	}
+	return i;
+}
+
+// compares words 8 at a time. Returns the start of the first 8 with a mismatch, or how far it got
+IO_TARGET_AVX2 static size_t comparePayloadAvx2(const uint32_t* words, uint32_t key, uint32_t firstIndex, size_t count)
+{
+	__m256i keys = _mm256_set1_epi32((int)key);
+	__m256i index = _mm256_add_epi32(_mm256_set1_epi32((int)firstIndex), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	const __m256i eight = _mm256_set1_epi32(8);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i difference = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(words + i)), getPayloadWords8(keys, index));
+		if (!_mm256_testz_si256(difference, difference))
+		{
+			break;
+		}
+		index = _mm256_add_epi32(index, eight);
+	}
+	return i;
+}
+#endif // IO_HAS_AVX2
+
+// fills count payload words, the first being word firstIndex of its block
+static void fillPayload(uint32_t* words, uint32_t key, uint32_t firstIndex, size_t count)
+{
+	size_t i = 0;
+
+#if IO_HAS_AVX2
+	static const bool hasAvx2 = ioCpuHasAvx2();
+	if (hasAvx2)
+	{
+		i = fillPayloadAvx2(words, key, firstIndex, count);
+	}
+#endif // IO_HAS_AVX2
+
+	for (; i < count; i++)
+	{
+		words[i] = getPayloadWord(key, firstIndex + (uint32_t)i);
+	}
+}
+
+// returns the first of count payload words that doesn't match, or count if they all do
+static size_t comparePayload(const uint32_t* words, uint32_t key, uint32_t firstIndex, size_t count)
+{
+	size_t i = 0;
+
+#if IO_HAS_AVX2
+	static const bool hasAvx2 = ioCpuHasAvx2();
+	if (hasAvx2)
+	{
+		i = comparePayloadAvx2(words, key, firstIndex, count);
+	}
+#endif // IO_HAS_AVX2
+
+	for (; i < count; i++)
+	{
+		if (words[i] != getPayloadWord(key, firstIndex + (uint32_t)i))
+		{
+			break;
+		}
+	}
+	return i;
+}
+
+std::string IO_VERIFY_RESULT::toString() const
+{
+	std::string retString = IOVerifier::getErrorName(error);
+	if (error == IO_VERIFY_OK)
+	{
+		return retString;
+	}
+
+	retString += " at lba " + std::to_string(lba) + " (byte " + std::to_string(byteOffset) + " of the IO)";
+	if (error != IO_VERIFY_NO_HEADER && error != IO_VERIFY_CORRUPT_HEADER)
+	{
+		retString += ": block says lba " + std::to_string(foundLba) + " generation " + std::to_string(foundGeneration) + " seed " + std::to_string(foundSeed);
+	}
+	return retString;
+}
+
+IOVerifier::IOVerifier(uint32_t blockSize, uint64_t seed)
+{
+	assert(blockSize > sizeof(IO_VERIFY_HEADER) && blockSize % sizeof(uint32_t) == 0);
+	this->blockSize = blockSize;
+	this->seed = seed;
+}
+
+uint32_t IOVerifier::getHeaderChecksum(const IO_VERIFY_HEADER& header)
+{
+	uint64_t h = IOSplitMix64::mix(header.magic ^ header.blockSize);
+	h = IOSplitMix64::mix(h ^ header.lba);
+	h = IOSplitMix64::mix(h ^ header.generation);
+	h = IOSplitMix64::mix(h ^ header.seed);
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+uint32_t IOVerifier::getPayloadKey(const IO_VERIFY_HEADER& header)
+{
+	uint64_t h = IOSplitMix64::mix(header.seed + IOSplitMix64::GAMMA);
+	h = IOSplitMix64::mix(h ^ header.lba);
+	h = IOSplitMix64::mix(h ^ header.generation);
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+void IOVerifier::fill(void* buffer, uint64_t lba, uint64_t numBlocks, uint64_t generation) const
+{
+	size_t numPayloadWords = blockSize / sizeof(uint32_t) - PAYLOAD_FIRST_WORD;
+
+	for (uint64_t i = 0; i < numBlocks; i++)
+	{
+		uint8_t* block = (uint8_t*)buffer + i * blockSize;
+
+		IO_VERIFY_HEADER header;
+		memset(&header, 0, sizeof(header));
+		header.magic = IO_VERIFY_MAGIC;
+		header.lba = lba + i;
+		header.generation = generation;
+		header.seed = seed;
+		header.blockSize = blockSize;
+		header.checksum = getHeaderChecksum(header);
+		memcpy(block, &header, sizeof(header));
+
+		fillPayload((uint32_t*)block + PAYLOAD_FIRST_WORD, getPayloadKey(header), PAYLOAD_FIRST_WORD, numPayloadWords);
+	}
+}
+
+IO_VERIFY_ERROR_ENUM IOVerifier::verifyHeader(const uint8_t* block, uint64_t lba, uint64_t expectedGeneration, IO_VERIFY_HEADER* header) const
+{
+	memcpy(header, block, sizeof(IO_VERIFY_HEADER));
+
+	if (header->magic != IO_VERIFY_MAGIC)
+	{
+		return IO_VERIFY_NO_HEADER;
+	}
+
+	if (header->checksum != getHeaderChecksum(*header) || header->blockSize != blockSize)
+	{
+		return IO_VERIFY_CORRUPT_HEADER;
+	}
+
+	if (header->lba != lba)
+	{
+		return IO_VERIFY_MISDIRECTED;
+	}
+
+	if (header->seed != seed || (expectedGeneration != IO_VERIFY_ANY_GENERATION && header->generation != expectedGeneration))
+	{
+		return IO_VERIFY_STALE;
+	}
+
+	return IO_VERIFY_OK;
+}
+
+IO_VERIFY_ERROR_ENUM IOVerifier::verifyBlock(const uint8_t* block, uint64_t lba, uint64_t expectedGeneration, IO_VERIFY_HEADER* header, size_t* mismatchOffset) const
+{
+	*mismatchOffset = 0;
+
+	IO_VERIFY_ERROR_ENUM error = verifyHeader(block, lba, expectedGeneration, header);
+	if (error != IO_VERIFY_OK)
+	{
+		return error;
+	}
+
+	const uint32_t* words = (const uint32_t*)block;
+	size_t numWords = blockSize / sizeof(uint32_t);
+	uint32_t key = getPayloadKey(*header);
+	size_t badWord = PAYLOAD_FIRST_WORD + comparePayload(words + PAYLOAD_FIRST_WORD, key, PAYLOAD_FIRST_WORD, numWords - PAYLOAD_FIRST_WORD);
+	if (badWord == numWords)
+	{
+		return IO_VERIFY_OK;
+	}
+
+	// narrow it down to the byte
+	uint32_t expected = getPayloadWord(key, (uint32_t)badWord);
+	const uint8_t* expectedBytes = (const uint8_t*)&expected;
+	*mismatchOffset = badWord * sizeof(uint32_t);
+	while (block[*mismatchOffset] == expectedBytes[*mismatchOffset % sizeof(uint32_t)])
+	{
+		(*mismatchOffset)++;
+	}
+
+	// a torn write leaves whole sectors of something else. A flipped bit or two leaves most words alone
+	if (*mismatchOffset % IO_VERIFY_SECTOR_SIZE == 0)
+	{
+		size_t sectorEnd = std::min((size_t)blockSize, *mismatchOffset + IO_VERIFY_SECTOR_SIZE) / sizeof(uint32_t);
+		for (size_t w = badWord; w < sectorEnd; w++)
+		{
+			if (words[w] == getPayloadWord(key, (uint32_t)w))
+			{
+				return IO_VERIFY_CORRUPT;
+			}
+		}
+		return IO_VERIFY_TORN;
+	}
+
+	return IO_VERIFY_CORRUPT;
+}
+
+bool IOVerifier::verify(const void* buffer, uint64_t lba, uint64_t numBlocks, uint64_t expectedGeneration, IO_VERIFY_RESULT* result) const
+{
+	for (uint64_t i = 0; i < numBlocks; i++)
+	{
+		const uint8_t* block = (const uint8_t*)buffer + i * blockSize;
+
+		IO_VERIFY_HEADER header;
+		size_t mismatchOffset;
+		IO_VERIFY_ERROR_ENUM error = verifyBlock(block, lba + i, expectedGeneration, &header, &mismatchOffset);
+		if (error == IO_VERIFY_OK)
+		{
+			continue;
+		}
+
+		// an old block next to a new one in the same write means only part of the write landed
+		if (error == IO_VERIFY_STALE && expectedGeneration != IO_VERIFY_ANY_GENERATION && header.seed == seed)
+		{
+			bool anyNew = i > 0;
+			IO_VERIFY_HEADER otherHeader;
+			for (uint64_t j = i + 1; j < numBlocks && !anyNew; j++)
+			{
+				anyNew = verifyHeader((const uint8_t*)buffer + j * blockSize, lba + j, expectedGeneration, &otherHeader) == IO_VERIFY_OK;
+			}
+
+			if (anyNew)
+			{
+				error = IO_VERIFY_TORN;
+			}
+		}
+
+		if (result)
+		{
+			result->error = error;
+			result->lba = lba + i;
+			result->byteOffset = i * blockSize + mismatchOffset;
+			result->foundLba = header.lba;
+			result->foundGeneration = header.generation;
+			result->foundSeed = header.seed;
+		}
+		return false;
+	}
+
+	if (result)
+	{
+		*result = IO_VERIFY_RESULT();
+	}
+	return true;
+}
+
+uint32_t IOVerifier::getBlockSize() const
+{
+	return blockSize;
+}
+
+uint64_t IOVerifier::getSeed() const
+{
+	return seed;
+}
+
+const char* IOVerifier::getErrorName(IO_VERIFY_ERROR_ENUM error)
+{
+	switch (error)
+	{
+	case IO_VERIFY_OK:
+		return "ok";
+	case IO_VERIFY_NO_HEADER:
+		return "no header";
+	case IO_VERIFY_CORRUPT_HEADER:
+		return "corrupt header";
+	case IO_VERIFY_MISDIRECTED:
+		return "misdirected write";
+	case IO_VERIFY_STALE:
+		return "stale data";
+	case IO_VERIFY_TORN:
+		return "torn write";
+	case IO_VERIFY_CORRUPT:
+		return "corrupt data";
+	default:
+		return "unknown";
+	}
+}
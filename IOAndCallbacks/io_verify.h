@@ -0,0 +1,113 @@
+// IO Verify header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// "IOVERIFY" in little endian. Blocks without it were never written by an IOVerifier
+#define IO_VERIFY_MAGIC 0x5946495245564F49ULL
+
+// pass as the expected generation to accept whatever generation a block was last written with
+#define IO_VERIFY_ANY_GENERATION UINT64_MAX
+
+// a payload mismatch that starts on one of these boundaries is reported as a torn write
+#define IO_VERIFY_SECTOR_SIZE 512
+
+// Starts every verified block. The rest of the block is generated from it, so a read can be
+//  checked with nothing but the expected lba, generation and seed
+struct IO_VERIFY_HEADER
+{
+	uint64_t magic;
+	uint64_t lba;
+
+	// bumped by the writer each time it rewrites a block
+	uint64_t generation;
+
+	// ties the block to a run. Blocks from a run with another seed are stale
+	uint64_t seed;
+
+	uint32_t blockSize;
+
+	// over everything above
+	uint32_t checksum;
+};
+
+typedef enum _IO_VERIFY_ERROR_ENUM
+{
+	IO_VERIFY_OK,
+	IO_VERIFY_NO_HEADER,       // no magic: never written, or overwritten by something else
+	IO_VERIFY_CORRUPT_HEADER,  // magic is there but the header doesn't match its checksum
+	IO_VERIFY_MISDIRECTED,     // a good block, but written for another lba
+	IO_VERIFY_STALE,           // a good block for this lba, but from another generation or seed
+	IO_VERIFY_TORN,            // part of the block (or of a multi-block IO) is new and part isn't, split on a sector
+	IO_VERIFY_CORRUPT          // the header is right but the payload doesn't match it
+} IO_VERIFY_ERROR_ENUM, *PIO_VERIFY_ERROR_ENUM;
+
+// what verify() found wrong with the first bad block of an IO
+struct IO_VERIFY_RESULT
+{
+	IO_VERIFY_RESULT()
+	{
+		error = IO_VERIFY_OK;
+		lba = 0;
+		byteOffset = 0;
+		foundLba = 0;
+		foundGeneration = 0;
+		foundSeed = 0;
+	}
+
+	IO_VERIFY_ERROR_ENUM error;
+
+	// the first bad block
+	uint64_t lba;
+
+	// first mismatching byte, from the start of the IO's buffer
+	uint64_t byteOffset;
+
+	// what the bad block's header said, if it had one
+	uint64_t foundLba;
+	uint64_t foundGeneration;
+	uint64_t foundSeed;
+
+	// one line description
+	std::string toString() const;
+};
+
+// Stamps write buffers with self-describing blocks and checks read buffers against them without a golden copy.
+//  Stateless after construction, so one object can be shared by any number of threads
+class IOVerifier
+{
+public:
+	// blockSize must be a multiple of 4 bytes and bigger than IO_VERIFY_HEADER
+	IOVerifier(uint32_t blockSize, uint64_t seed);
+
+	// fills numBlocks blocks starting at lba into buffer
+	void fill(void* buffer, uint64_t lba, uint64_t numBlocks, uint64_t generation) const;
+
+	// Checks numBlocks blocks read from lba. Returns true if they are all what fill() would write.
+	//  Otherwise result (if given) describes the first bad block
+	bool verify(const void* buffer, uint64_t lba, uint64_t numBlocks, uint64_t expectedGeneration, IO_VERIFY_RESULT* result) const;
+
+	uint32_t getBlockSize() const;
+	uint64_t getSeed() const;
+
+	static const char* getErrorName(IO_VERIFY_ERROR_ENUM error);
+
+private:
+	// checks just the header. Returns IO_VERIFY_OK if it is good for lba/expectedGeneration
+	IO_VERIFY_ERROR_ENUM verifyHeader(const uint8_t* block, uint64_t lba, uint64_t expectedGeneration, IO_VERIFY_HEADER* header) const;
+
+	// checks one block. Sets *mismatchOffset to the first bad byte within it
+	IO_VERIFY_ERROR_ENUM verifyBlock(const uint8_t* block, uint64_t lba, uint64_t expectedGeneration, IO_VERIFY_HEADER* header, size_t* mismatchOffset) const;
+
+	static uint32_t getHeaderChecksum(const IO_VERIFY_HEADER& header);
+
+	// the key the payload of a block is generated from
+	static uint32_t getPayloadKey(const IO_VERIFY_HEADER& header);
+
+	uint32_t blockSize;
+	uint64_t seed;
+};
@@ -2,6 +2,10 @@
 // (C) - csm10495 - MIT License 2019
 
 #include "io.h"
+#include "io_simulated_device.h"
+
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 
 #ifdef IO_WIN32
@@ -24,39 +28,56 @@ void CALLBACK overlappedCompletionRoutine(
 	pCbStruct->errorCode = dwErrorCode;
 	pCbStruct->numBytesXferred = dwNumberOfBytesTransfered;
 
-	if (pCbStruct->userCallbackFunction)
-	{
-		pCbStruct->userCallbackFunction(pCbStruct);
-	}
-
-	// free all allocated
-	if (pCbStruct->operation == IO_OPERATION_READ)
-	{
-		// if doing a write, the user owns the buffer. Let them free it.
-		IO::freeAlignedBuffer(pCbStruct->xferBuffer);
-		pCbStruct->xferBuffer = NULL;
-	}
+	// the OVERLAPPED is embedded in pCbStruct so this frees it too
+	pCbStruct->owner->numApcCompletions++;
+	pCbStruct->owner->numIosInFlight--;
+	pCbStruct->owner->completeIo(pCbStruct);
+}
 
-	delete lpOverlapped->hEvent;
-	lpOverlapped->hEvent = NULL;
+IO::IO(std::string path) : IO(path, IO_BACKEND_DEFAULT)
+{
+}
 
-	delete lpOverlapped;
-	lpOverlapped = NULL;
+IO::IO(std::string path, IO_BACKEND_ENUM backend) : IO(path, backend, DEFAULT_REQUEST_POOL_SIZE)
+{
 }
 
-IO::IO(std::string path)
+IO::IO(std::string path, IO_BACKEND_ENUM backend, size_t requestPoolSize)
 {
 	blockSize = 0;
 	blockCount = 0;
 
-	handle = CreateFile(path.c_str(),
-		GENERIC_READ | GENERIC_WRITE,
-		FILE_SHARE_READ | FILE_SHARE_WRITE,
-		NULL,
-		OPEN_EXISTING,
-		FILE_FLAG_OVERLAPPED | FILE_FLAG_NO_BUFFERING,
-		NULL
-	);
+	bool simulated = backend == IO_BACKEND_SIMULATED || IOSimulatedDevice::isSimulatedPath(path);
+	if (!simulated && backend != IO_BACKEND_DEFAULT)
+	{
+		std::cerr << "Only the default (Overlapped IO) backend is supported on Windows" << std::endl;
+	}
+	this->backend = simulated ? IO_BACKEND_SIMULATED : IO_BACKEND_DEFAULT;
+	plugged = false;
+	numIosInFlight = 0;
+	maxMergeBytes = 0;
+	numHeldIos = 0;
+	maxIosInFlight = SIZE_MAX;
+	numExtraMergedCompletions = 0;
+	numApcCompletions = 0;
+	initRequestPool(requestPoolSize);
+
+	if (simulated)
+	{
+		handle = INVALID_HANDLE_VALUE;
+		openSimulatedDevice(path);
+	}
+	else
+	{
+		handle = CreateFile(path.c_str(),
+			GENERIC_READ | GENERIC_WRITE,
+			FILE_SHARE_READ | FILE_SHARE_WRITE,
+			NULL,
+			OPEN_EXISTING,
+			FILE_FLAG_OVERLAPPED | FILE_FLAG_NO_BUFFERING,
+			NULL
+		);
+	}
 
 #if IO_DISABLE_WRITES_TO_DRIVE_WITH_PARTITIONS
 	checkAndSetIfWeShouldAllowWrites();
@@ -65,6 +86,13 @@ IO::IO(std::string path)
 
 IO::~IO()
 {
+	if (backend == IO_BACKEND_SIMULATED)
+	{
+		closeSimulatedDevice();
+		freeReadBufferPool();
+		return;
+	}
+
 	// Try to stop all IO issued by our thread.
 	CancelIo(handle);
 
@@ -73,13 +101,52 @@ IO::~IO()
 		// try to finish all IOs
 	}
 
+	freeReadBufferPool();
+
 	CloseHandle(handle);
 	handle = INVALID_HANDLE_VALUE;
 }
 
-bool IO::poll()
+size_t IO::doPoll(size_t minEvents, size_t maxEvents, int64_t timeoutMicroseconds)
+{
+	if (backend == IO_BACKEND_SIMULATED)
+	{
+		return pollSimulated(minEvents, maxEvents, timeoutMicroseconds);
+	}
+
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(std::max(timeoutMicroseconds, (int64_t)0));
+	size_t numEventsCompleted = 0;
+	while (true)
+	{
+		// only block while we still need completions
+		DWORD waitMilliseconds = 0;
+		if (numEventsCompleted < minEvents && timeoutMicroseconds < 0)
+		{
+			waitMilliseconds = INFINITE;
+		}
+		else if (numEventsCompleted < minEvents)
+		{
+			auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+			waitMilliseconds = (DWORD)std::max(remaining.count(), (long long)0);
+		}
+
+		// completion routines run as APCs inside an alertable wait
+		numApcCompletions = 0;
+		SleepEx(waitMilliseconds, true);
+		numEventsCompleted += numApcCompletions;
+
+		if (numEventsCompleted >= minEvents || (timeoutMicroseconds >= 0 && std::chrono::steady_clock::now() >= deadline))
+		{
+			break;
+		}
+	}
+
+	return numEventsCompleted;
+}
+
+IO_BACKEND_ENUM IO::getBackend() const
 {
-	return (SleepEx(0, true) == WAIT_IO_COMPLETION);
+	return backend;
 }
 
 uint32_t IO::getBlockSize()
@@ -154,18 +221,28 @@ void IO::freeAlignedBuffer(void * buffer)
 	_aligned_free(buffer);
 }
 
-bool IO::doSubmitIo(IO_CALLBACK_STRUCT* ioCallbackStruct)
+// queues a single IO. Returns false if it could not be queued
+static bool doSubmitIo(IO_CALLBACK_STRUCT* ioCallbackStruct, HANDLE handle, uint32_t blockSize)
 {
-	OVERLAPPED* pOverlapped = new OVERLAPPED();                                // free this third
-	pOverlapped->hEvent = ioCallbackStruct;                                    // free this second (allocated upstream)
+	// the OVERLAPPED lives in the IO_CALLBACK_STRUCT so there is nothing to allocate
+	OVERLAPPED* pOverlapped = &ioCallbackStruct->osOverlapped;
+	memset(pOverlapped, 0, sizeof(OVERLAPPED));
+	pOverlapped->hEvent = ioCallbackStruct;
 
-	uint64_t offsetBytes = getBlockSize() * ioCallbackStruct->lba;
+	uint64_t offsetBytes = blockSize * ioCallbackStruct->lba;
 	pOverlapped->Offset = offsetBytes & 0xFFFFFFFF;
 	pOverlapped->OffsetHigh = offsetBytes >> 32;
 
 	WIN32_IO_FUNCTION* ioFunction;
 	std::string ioFunctionName;
-	if (ioCallbackStruct->operation == IO_OPERATION_READ)
+	if (ioCallbackStruct->ioVecs)
+	{
+		// ReadFileScatter()/WriteFileGather() want page sized buffers and don't take a completion routine
+		SetLastError(ERROR_NOT_SUPPORTED);
+		oserror("Vectored IO is only supported by the simulated backend on Windows");
+		goto cleanup;
+	}
+	else if (ioCallbackStruct->operation == IO_OPERATION_READ)
 	{
 		ioFunction = (WIN32_IO_FUNCTION*)ReadFileEx;
 		ioFunctionName = "ReadFileEx";
@@ -197,16 +274,29 @@ bool IO::doSubmitIo(IO_CALLBACK_STRUCT* ioCallbackStruct)
 	return true;
 
 cleanup:
-	// cleanup
-	if (ioCallbackStruct->operation == IO_OPERATION_READ)
+	// ioCallbackStruct is freed upstream
+	return false;
+}
+
+size_t IO::doSubmitIoBatch(IO_CALLBACK_STRUCT** ioCallbackStructs, size_t count)
+{
+	if (backend == IO_BACKEND_SIMULATED)
 	{
-		delete[] ioCallbackStruct->xferBuffer;
+		return doSubmitIoBatchSimulated(ioCallbackStructs, count);
 	}
 
-	delete pOverlapped->hEvent;
-	delete pOverlapped;
+	// Overlapped IO has no batch submission. Queue one at a time, stopping at the first failure
+	size_t numQueued = 0;
+	for (; numQueued < count; numQueued++)
+	{
+		ioCallbackStructs[numQueued]->owner = this;
+		if (!doSubmitIo(ioCallbackStructs[numQueued], handle, getBlockSize()))
+		{
+			break;
+		}
+	}
 
-	return false;
+	return numQueued;
 }
 
 #endif
\ No newline at end of file
@@ -2,50 +2,254 @@
 // (C) - csm10495 - MIT License 2019
 
 #include "switches.h"
+#include "io_cpu_features.h"
 #include "iorand.h"
 
 #include <cassert>
+#include <chrono>
 #include <cstdlib>
 #include <ctime>
+#include <string.h>
 
 #if IO_ENABLE_THREADED_RANDOM_GENERATOR
-#define MAX_READY_RANDOM_NUMBERS 0xFFF
+#define MAX_READY_RANDOM_NUMBERS 0x1000
+
+// the generation thread sleeps when the queue is full and is woken once it drains below this
+#define RANDOM_NUMBER_REFILL_MARK (MAX_READY_RANDOM_NUMBERS / 2)
+
+// the generation thread rechecks the queue this often while parked in case a wakeup was missed
+#define RANDOM_NUMBER_PARK_TIMEOUT_MILLISECONDS 10
 #endif // IO_ENABLE_THREADED_RANDOM_GENERATOR
 
-IORand::IORand()
+// fillBuffer() uses the top half of the Philox stream space so it never repeats getRandomNumber()
+#define FILL_BUFFER_STREAM_FLAG (1ULL << 63)
+
+// bytes in one Philox4x32 block
+#define PHILOX_BLOCK_SIZE 16
+
+IORand::IORand() : IORand(std::chrono::high_resolution_clock::now().time_since_epoch().count())
+{
+}
+
+IORand::IORand(unsigned long long seed) : IORand(seed, IO_RAND_ENGINE_MT19937_64, 0)
 {
-	mtGenerator.seed(std::chrono::high_resolution_clock::now().time_since_epoch().count());
-#if IO_ENABLE_THREADED_RANDOM_GENERATOR
-	fillAndStartGenerationThread();
-#endif // IO_ENABLE_THREADED_RANDOM_GENERATOR
 }
 
-IORand::IORand(unsigned long long seed)
+IORand::IORand(unsigned long long seed, IO_RAND_ENGINE_ENUM engine, uint64_t streamId) :
+	xoshiroGenerator(seed, engine == IO_RAND_ENGINE_XOSHIRO256STARSTAR ? streamId : 0),
+	splitMixGenerator(seed, engine == IO_RAND_ENGINE_SPLITMIX64 ? streamId : 0),
+	philoxGenerator(seed, streamId)
+#if IO_ENABLE_THREADED_RANDOM_GENERATOR
+	, randomNumbers(MAX_READY_RANDOM_NUMBERS)
+#endif // IO_ENABLE_THREADED_RANDOM_GENERATOR
 {
-	mtGenerator.seed(seed);
+	// the top bit is taken by fillBuffer()'s streams
+	assert(streamId < FILL_BUFFER_STREAM_FLAG);
+
+	this->engine = engine;
+	this->seed = seed;
+	this->streamId = streamId;
+	fillBufferBlockIndex = 0;
+
+	if (streamId == 0)
+	{
+		mtGenerator.seed(seed);
+	}
+	else
+	{
+		std::seed_seq seedSeq{ (uint32_t)seed, (uint32_t)(seed >> 32), (uint32_t)streamId, (uint32_t)(streamId >> 32) };
+		mtGenerator.seed(seedSeq);
+	}
+
 #if IO_ENABLE_THREADED_RANDOM_GENERATOR
 	fillAndStartGenerationThread();
 #endif // IO_ENABLE_THREADED_RANDOM_GENERATOR
 }
 
+void IORand::generateNumbers(uint64_t* out, size_t count)
+{
+	// one switch per batch, not per number
+	switch (engine)
+	{
+	case IO_RAND_ENGINE_XOSHIRO256STARSTAR:
+		for (size_t i = 0; i < count; i++)
+		{
+			out[i] = xoshiroGenerator();
+		}
+		break;
+	case IO_RAND_ENGINE_SPLITMIX64:
+		for (size_t i = 0; i < count; i++)
+		{
+			out[i] = splitMixGenerator();
+		}
+		break;
+	case IO_RAND_ENGINE_PHILOX4X32:
+		for (size_t i = 0; i < count; i++)
+		{
+			out[i] = philoxGenerator();
+		}
+		break;
+	default:
+		for (size_t i = 0; i < count; i++)
+		{
+			out[i] = mtGenerator();
+		}
+		break;
+	}
+}
+
+uint64_t IORand::rejectAndRetry(uint64_t range, uint64_t low, uint64_t result)
+{
+	// values of low below 2^64 % range are the ones that would over-represent some results
+	uint64_t threshold = (0 - range) % range;
+	while (low < threshold)
+	{
+		result = multiplyHigh(getRandomNumber<uint64_t>(), range, &low);
+	}
+	return result;
+}
+
+void IORand::getRandomNumbers(uint64_t* out, size_t count, uint64_t start, uint64_t end)
+{
+	uint64_t range = end - start + 1;
+	getRandomNumbers(out, count);
+	if (range == 0)
+	{
+		return;
+	}
+
+	// one division for the whole batch instead of one per number
+	uint64_t threshold = (0 - range) % range;
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t low;
+		uint64_t result = multiplyHigh(out[i], range, &low);
+		while (low < threshold)
+		{
+			result = multiplyHigh(getRandomNumber<uint64_t>(), range, &low);
+		}
+		out[i] = start + result;
+	}
+}
+
+IO_RAND_ENGINE_ENUM IORand::getEngine() const
+{
+	return engine;
+}
+
+#if IO_HAS_AVX2
+// Philox4x32-10 on 8 blocks at a time. Writes 8 * PHILOX_BLOCK_SIZE bytes to out in the same order as the scalar code
+IO_TARGET_AVX2 static void philoxFill8Blocks(uint64_t key, uint64_t streamId, uint64_t firstBlockIndex, char* out)
+{
+	const __m256i m0 = _mm256_set1_epi64x(IOPhilox4x32::PHILOX_M0);
+	const __m256i m1 = _mm256_set1_epi64x(IOPhilox4x32::PHILOX_M1);
+
+	// one lane per block. The counter is (blockIndex, streamId)
+	__m256i c0 = _mm256_add_epi32(_mm256_set1_epi32((int)(uint32_t)firstBlockIndex), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256i c1 = _mm256_set1_epi32((int)(uint32_t)(firstBlockIndex >> 32));
+	__m256i c2 = _mm256_set1_epi32((int)(uint32_t)streamId);
+	__m256i c3 = _mm256_set1_epi32((int)(uint32_t)(streamId >> 32));
+
+	// firstBlockIndex is a multiple of 8 so the low word never carries within the 8
+	uint32_t k0 = (uint32_t)key;
+	uint32_t k1 = (uint32_t)(key >> 32);
+
+	for (int round = 0; round < IOPhilox4x32::PHILOX_ROUNDS; round++)
+	{
+		// _mm256_mul_epu32 only multiplies the even lanes, so do the odd ones shifted down
+		__m256i product0Even = _mm256_mul_epu32(c0, m0);
+		__m256i product0Odd = _mm256_mul_epu32(_mm256_srli_epi64(c0, 32), m0);
+		__m256i product1Even = _mm256_mul_epu32(c2, m1);
+		__m256i product1Odd = _mm256_mul_epu32(_mm256_srli_epi64(c2, 32), m1);
+
+		__m256i lo0 = _mm256_blend_epi32(product0Even, _mm256_slli_epi64(product0Odd, 32), 0xAA);
+		__m256i hi0 = _mm256_blend_epi32(_mm256_srli_epi64(product0Even, 32), product0Odd, 0xAA);
+		__m256i lo1 = _mm256_blend_epi32(product1Even, _mm256_slli_epi64(product1Odd, 32), 0xAA);
+		__m256i hi1 = _mm256_blend_epi32(_mm256_srli_epi64(product1Even, 32), product1Odd, 0xAA);
+
+		c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32((int)k0));
+		c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32((int)k1));
+		c1 = lo1;
+		c3 = lo0;
+
+		k0 += IOPhilox4x32::PHILOX_W0;
+		k1 += IOPhilox4x32::PHILOX_W1;
+	}
+
+	// transpose from one word per register to one block per 16 bytes
+	__m256i t0 = _mm256_unpacklo_epi32(c0, c1);
+	__m256i t1 = _mm256_unpackhi_epi32(c0, c1);
+	__m256i t2 = _mm256_unpacklo_epi32(c2, c3);
+	__m256i t3 = _mm256_unpackhi_epi32(c2, c3);
+	__m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+	__m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+	__m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+	__m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+
+	_mm256_storeu_si256((__m256i*)out, _mm256_permute2x128_si256(u0, u1, 0x20));
+	_mm256_storeu_si256((__m256i*)(out + 32), _mm256_permute2x128_si256(u2, u3, 0x20));
+	_mm256_storeu_si256((__m256i*)(out + 64), _mm256_permute2x128_si256(u0, u1, 0x31));
+	_mm256_storeu_si256((__m256i*)(out + 96), _mm256_permute2x128_si256(u2, u3, 0x31));
+}
+
+#endif // IO_HAS_AVX2
+
 void IORand::fillBuffer(char * buffer, size_t bufferSize)
 {
 	assert(bufferSize % sizeof(uint64_t) == 0);
 
-	uint64_t* buf = (uint64_t*)buffer;
+	// claim our blocks up front so other threads can fill at the same time
+	uint64_t numBlocks = (bufferSize + PHILOX_BLOCK_SIZE - 1) / PHILOX_BLOCK_SIZE;
+	uint64_t blockIndex = fillBufferBlockIndex.fetch_add(numBlocks);
+	uint64_t fillStreamId = streamId | FILL_BUFFER_STREAM_FLAG;
+
+	size_t offset = 0;
 
-	// going 8 at a time is wicked faster than 1 at a time!
-	for (size_t i = 0; i < bufferSize / sizeof(uint64_t); i += sizeof(uint64_t))
+#if IO_HAS_AVX2
+	static const bool hasAvx2 = ioCpuHasAvx2();
+	if (hasAvx2)
 	{
-		*buf = getRandomNumber<uint64_t>();
-		buf++;
+		// scalar until the block index is a multiple of 8
+		while (blockIndex % 8 && offset + PHILOX_BLOCK_SIZE <= bufferSize)
+		{
+			IOPhilox4x32::generateBlock(seed, fillStreamId, blockIndex++, (uint32_t*)(buffer + offset));
+			offset += PHILOX_BLOCK_SIZE;
+		}
+
+		while (offset + 8 * PHILOX_BLOCK_SIZE <= bufferSize)
+		{
+			philoxFill8Blocks(seed, fillStreamId, blockIndex, buffer + offset);
+			blockIndex += 8;
+			offset += 8 * PHILOX_BLOCK_SIZE;
+		}
+	}
+#endif // IO_HAS_AVX2
+
+	while (offset + PHILOX_BLOCK_SIZE <= bufferSize)
+	{
+		uint32_t block[4];
+		IOPhilox4x32::generateBlock(seed, fillStreamId, blockIndex++, block);
+		memcpy(buffer + offset, block, PHILOX_BLOCK_SIZE);
+		offset += PHILOX_BLOCK_SIZE;
+	}
+
+	// the last 8 bytes if bufferSize isn't a multiple of a block
+	if (offset < bufferSize)
+	{
+		uint32_t block[4];
+		IOPhilox4x32::generateBlock(seed, fillStreamId, blockIndex++, block);
+		memcpy(buffer + offset, block, bufferSize - offset);
 	}
 }
 
 IORand::~IORand()
 {
 #if IO_ENABLE_THREADED_RANDOM_GENERATOR
-	shouldGenerationThreadRun = false;
+	{
+		std::lock_guard<std::mutex> lock(generationThreadMutex);
+		shouldGenerationThreadRun = false;
+	}
+	generationThreadCondition.notify_one();
 	randomNumberGenerationThread.join();
 #endif // IO_ENABLE_THREADED_RANDOM_GENERATOR
 }
@@ -53,27 +257,71 @@ IORand::~IORand()
 #if IO_ENABLE_THREADED_RANDOM_GENERATOR
 void IORand::fillAndStartGenerationThread()
 {
-	while (randomNumbers.size() < MAX_READY_RANDOM_NUMBERS)
+	// fill up first so the same seed always hands out numbers in the same order
+	// nobody else is using the queue yet so the size is exact
+	while (randomNumbers.getApproximateSize() < randomNumbers.getCapacity())
 	{
-		randomNumbers.push_back(mtGenerator());
+		uint64_t number;
+		generateNumbers(&number, 1);
+		randomNumbers.tryPush(number);
 	}
 
+	generationThreadParked = false;
 	shouldGenerationThreadRun = true;
 	randomNumberGenerationThread = std::thread(&IORand::generateNumbersThread, this);
 }
 
 void IORand::generateNumbersThread()
 {
+	// the number that didn't fit last time. Must not be dropped or the sequence would change per run
+	uint64_t nextNumber;
+	generateNumbers(&nextNumber, 1);
+
 	while (shouldGenerationThreadRun)
 	{
-		size_t idx = randomNumbers.size();
-		while (idx < MAX_READY_RANDOM_NUMBERS)
+		if (randomNumbers.tryPush(nextNumber))
 		{
-			std::lock_guard<std::mutex>(this->randomNumbersMutex);
+			generateNumbers(&nextNumber, 1);
+			continue;
+		}
+
+		// full. Sleep until consumers have drained it to the refill mark
+		std::unique_lock<std::mutex> lock(generationThreadMutex);
+		generationThreadParked = true;
+		generationThreadCondition.wait_for(lock, std::chrono::milliseconds(RANDOM_NUMBER_PARK_TIMEOUT_MILLISECONDS), [this]() {
+			return !shouldGenerationThreadRun || randomNumbers.getApproximateSize() <= RANDOM_NUMBER_REFILL_MARK;
+		});
+		generationThreadParked = false;
+	}
+}
 
-			randomNumbers.push_back(mtGenerator());
-			idx++;
+void IORand::waitForRandomNumbers(uint64_t* out, size_t count)
+{
+	while (count)
+	{
+		if (generationThreadParked.load(std::memory_order_relaxed))
+		{
+			wakeGenerationThreadIfLow();
+		}
+
+		size_t numPopped = randomNumbers.tryPopBulk(out, count);
+		if (numPopped == 0)
+		{
+			std::this_thread::yield();
 		}
+
+		out += numPopped;
+		count -= numPopped;
+	}
+}
+
+void IORand::wakeGenerationThreadIfLow()
+{
+	if (randomNumbers.getApproximateSize() <= RANDOM_NUMBER_REFILL_MARK)
+	{
+		// taking the lock means the generation thread is either waiting or hasn't checked its condition yet
+		std::lock_guard<std::mutex> lock(generationThreadMutex);
+		generationThreadCondition.notify_one();
 	}
 }
 #endif // IO_ENABLE_THREADED_RANDOM_GENERATOR
@@ -2,14 +2,29 @@
 // (C) - csm10495 - MIT License 2019
 
 #pragma once
+#include "switches.h"
+#include "io_ring_queue.h"
+#include "iorand_engines.h"
 
 #include <atomic>
-#include <list>
+#include <condition_variable>
 #include <random>
 #include <thread>
 #include <mutex>
 
-// IO Rand wraps the included c++11 randomization classes
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// generators IORand can use for getRandomNumber()
+enum IO_RAND_ENGINE_ENUM {
+	IO_RAND_ENGINE_MT19937_64,			// std::mt19937_64. The default. Slowest
+	IO_RAND_ENGINE_XOSHIRO256STARSTAR,	// xoshiro256**
+	IO_RAND_ENGINE_SPLITMIX64,			// SplitMix64
+	IO_RAND_ENGINE_PHILOX4X32,			// Philox4x32-10 (counter-based)
+};
+
+// IO Rand wraps a choice of random number generators
 //  use getRandomNumber() to get an (at most) 64-bit number
 class IORand
 {
@@ -20,58 +35,143 @@ public:
 	// Use the user's given seed to seed number generation
 	IORand(unsigned long long seed);
 
+	// Objects with the same seed and engine but different streamIds give reproducible sequences that don't overlap
+	//  (for mt19937_64 they are only seeded differently). Give each worker thread its own streamId: below
+	//  IO_RAND_MAX_SPLIT_STREAMS for xoshiro256** and SplitMix64, below 2^63 for Philox4x32 and mt19937_64.
+	//  Hash or thread ids need to be mapped to small numbers first
+	IORand(unsigned long long seed, IO_RAND_ENGINE_ENUM engine, uint64_t streamId);
+
 	template <typename T> inline
 	T getRandomNumber()
+	{
+		uint64_t val;
+		getRandomNumbers(&val, 1);
+		return (T)val;
+	}
+
+	// fills out with count random numbers. Thread safe
+	inline void getRandomNumbers(uint64_t* out, size_t count)
 	{
 #if IO_ENABLE_THREADED_RANDOM_GENERATOR
-		while (true)
+		// fast path: everything is already waiting in the queue
+		size_t numPopped = randomNumbers.tryPopBulk(out, count);
+		if (numPopped < count)
 		{
-			std::lock_guard<std::mutex>(this->randomNumbersMutex);
-			if (randomNumbers.size())
-			{
-				auto val = (T)(*randomNumbers.begin());
-				randomNumbers.pop_front();
-				return val;
-			}
-
-			// if we didn't have a num, this loop should go around
+			waitForRandomNumbers(out + numPopped, count - numPopped);
+		}
+		else if (generationThreadParked.load(std::memory_order_relaxed))
+		{
+			wakeGenerationThreadIfLow();
 		}
-
-		//throw std::runtime_error("Did not get a random number... somehow broke the loop");
-		return 0;
 #else
-		return (T)mtGenerator();
+		generateNumbers(out, count);
 #endif
 	}
 
+	// returns a uniformly distributed number in [start, end] (both inclusive)
 	template <typename T> inline
 		T getRandomNumber(T start, T end)
 	{
-		auto r = getRandomNumber<uint64_t>();
-		return (T)(r % (end - start)) + start + 1;
+		// unsigned math so signed ranges can't overflow. A range of 0 means all 64 bits
+		uint64_t range = (uint64_t)end - (uint64_t)start + 1;
+		return (T)((uint64_t)start + getBoundedRandomNumber(range));
+	}
+
+	// returns a uniformly distributed number in [0, range). A range of 0 means any 64-bit number
+	inline uint64_t getBoundedRandomNumber(uint64_t range)
+	{
+		if (range == 0)
+		{
+			return getRandomNumber<uint64_t>();
+		}
+
+		uint64_t low;
+		uint64_t result = multiplyHigh(getRandomNumber<uint64_t>(), range, &low);
+		if (low < range)
+		{
+			// rare: only possible in the first (2^64 % range) values of low
+			result = rejectAndRetry(range, low, result);
+		}
+		return result;
+	}
+
+	// returns a uniformly distributed double in [0, 1)
+	inline double getRandomDouble()
+	{
+		// the top 53 bits fill the mantissa exactly
+		return (getRandomNumber<uint64_t>() >> 11) * (1.0 / 9007199254740992.0);
 	}
 
-	// fill a buffer with random data
+	// fills out with count numbers in [start, end] (both inclusive) in one pass. Thread safe
+	//  Cheaper per number than getRandomNumber(start, end) since the raw numbers come out of the queue in bulk
+	void getRandomNumbers(uint64_t* out, size_t count, uint64_t start, uint64_t end);
+
+	// Fill a buffer with random data. Thread safe and lock-free.
+	//  This is its own Philox4x32 stream (not the one getRandomNumber() uses), vectorized with AVX2 when the CPU has it.
+	//  bufferSize must be a multiple of 8. The nth call on objects with the same seed and streamId gives the same data.
 	void fillBuffer(char* buffer, size_t bufferSize);
 
+	IO_RAND_ENGINE_ENUM getEngine() const;
+
 	~IORand();
 
 private:
-	// C++11 64-bit generator
+	// Lemire's multiply-shift: the high 64 bits of x * range are uniform in [0, range) once
+	//  the few biased values of the low 64 bits are thrown out. No division on the fast path
+	static inline uint64_t multiplyHigh(uint64_t x, uint64_t range, uint64_t* low)
+	{
+#ifdef _MSC_VER
+		uint64_t high;
+		*low = _umul128(x, range, &high);
+		return high;
+#else
+		__uint128_t product = (__uint128_t)x * range;
+		*low = (uint64_t)product;
+		return (uint64_t)(product >> 64);
+#endif
+	}
+
+	// slow path of getBoundedRandomNumber(). low and result came from the first try
+	uint64_t rejectAndRetry(uint64_t range, uint64_t low, uint64_t result);
+
+	// pulls count numbers straight from the selected engine. Not thread safe
+	void generateNumbers(uint64_t* out, size_t count);
+
+	IO_RAND_ENGINE_ENUM engine;
+	uint64_t seed;
+	uint64_t streamId;
+
+	// only the one for engine is used
 	std::mt19937_64 mtGenerator;
+	IOXoshiro256StarStar xoshiroGenerator;
+	IOSplitMix64 splitMixGenerator;
+	IOPhilox4x32 philoxGenerator;
+
+	// next Philox block for fillBuffer(). Claimed a whole buffer at a time
+	std::atomic<uint64_t> fillBufferBlockIndex;
 
 #if IO_ENABLE_THREADED_RANDOM_GENERATOR
 	// Will fill the initial list to fill up then start thread to keep it filled
 	void fillAndStartGenerationThread();
 
-	// To be run in a thread. If we don't have a full list, add one
+	// To be run in a thread. Keeps randomNumbers full, sleeping while it is
 	void generateNumbersThread();
 
-	// List of random numbers. Added to the end and removed from the start
-	std::list<uint64_t> randomNumbers;
+	// slow path of getRandomNumbers(). Wakes the generation thread and waits on it for count numbers
+	void waitForRandomNumbers(uint64_t* out, size_t count);
+
+	// wakes the generation thread if the queue has drained below the refill mark
+	void wakeGenerationThreadIfLow();
+
+	// Lock-free queue of random numbers. Only the generation thread pushes
+	IORingQueue<uint64_t> randomNumbers;
+
+	// set while the generation thread is asleep waiting for randomNumbers to drain
+	std::atomic<bool> generationThreadParked;
 
-	// Mutex for access to randomNumbers list
-	std::mutex randomNumbersMutex;
+	// only used to park/wake the generation thread, never on the fast path
+	std::mutex generationThreadMutex;
+	std::condition_variable generationThreadCondition;
 
 	// Thread to be started by fillAndStartGenerationThread()
 	std::thread randomNumberGenerationThread;
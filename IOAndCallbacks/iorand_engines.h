@@ -0,0 +1,201 @@
+// IO Rand Engines header file for IO
+// (C) - csm10495 - MIT License 2019
+
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+
+// Small, fast 64-bit generators for IORand. Each one is seeded from a single 64-bit seed
+//  and can be split into non-overlapping streams so every worker gets its own reproducible sequence
+
+// SplitMix64 and xoshiro256** streams must be below this. SplitMix64's 2^48 output spacing wraps its
+//  2^64 period past it, and xoshiro256** jumps once per stream so much larger ids would take too long
+#define IO_RAND_MAX_SPLIT_STREAMS (1ULL << 16)
+
+// SplitMix64. Also used to expand a 64-bit seed into the state of the other engines
+class IOSplitMix64
+{
+public:
+	// stream i starts 2^IO_SPLITMIX64_STREAM_BITS outputs after stream i - 1. streamId < IO_RAND_MAX_SPLIT_STREAMS
+	IOSplitMix64(uint64_t seed, uint64_t streamId = 0)
+	{
+		assert(streamId < IO_RAND_MAX_SPLIT_STREAMS);
+		state = seed + (streamId << IO_SPLITMIX64_STREAM_BITS) * GAMMA;
+	}
+
+	inline uint64_t operator()()
+	{
+		return mix(state += GAMMA);
+	}
+
+	// the output function on its own. Counter-based: mix(seed + i * GAMMA) is the i-th output
+	static inline uint64_t mix(uint64_t z)
+	{
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	}
+
+	static const uint64_t GAMMA = 0x9e3779b97f4a7c15ULL;
+	static const uint32_t IO_SPLITMIX64_STREAM_BITS = 48;
+
+private:
+	uint64_t state;
+};
+
+// xoshiro256** (Blackman/Vigna). Streams are 2^128 outputs apart via jump()
+class IOXoshiro256StarStar
+{
+public:
+	// streamId < IO_RAND_MAX_SPLIT_STREAMS
+	IOXoshiro256StarStar(uint64_t seed, uint64_t streamId = 0)
+	{
+		assert(streamId < IO_RAND_MAX_SPLIT_STREAMS);
+		IOSplitMix64 seeder(seed);
+		for (int i = 0; i < 4; i++)
+		{
+			state[i] = seeder();
+		}
+
+		for (uint64_t i = 0; i < streamId; i++)
+		{
+			jump();
+		}
+	}
+
+	// starts from the given state as-is. It must not be all zeros
+	IOXoshiro256StarStar(const uint64_t initialState[4])
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			state[i] = initialState[i];
+		}
+	}
+
+	inline uint64_t operator()()
+	{
+		const uint64_t result = rotl(state[1] * 5, 7) * 9;
+		const uint64_t t = state[1] << 17;
+
+		state[2] ^= state[0];
+		state[3] ^= state[1];
+		state[1] ^= state[2];
+		state[0] ^= state[3];
+		state[2] ^= t;
+		state[3] = rotl(state[3], 45);
+
+		return result;
+	}
+
+	// same as calling operator() 2^128 times
+	void jump()
+	{
+		static const uint64_t JUMP[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+
+		uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			for (int b = 0; b < 64; b++)
+			{
+				if (JUMP[i] & (1ULL << b))
+				{
+					s0 ^= state[0];
+					s1 ^= state[1];
+					s2 ^= state[2];
+					s3 ^= state[3];
+				}
+				(*this)();
+			}
+		}
+
+		state[0] = s0;
+		state[1] = s1;
+		state[2] = s2;
+		state[3] = s3;
+	}
+
+private:
+	static inline uint64_t rotl(const uint64_t x, int k)
+	{
+		return (x << k) | (x >> (64 - k));
+	}
+
+	uint64_t state[4];
+};
+
+// Philox4x32-10 (Salmon et al., Random123). Counter-based: block i of a stream is a pure function of
+//  (key, streamId, i), so any block can be computed independently. That is what lets fillBuffer() go wide
+class IOPhilox4x32
+{
+public:
+	IOPhilox4x32(uint64_t key, uint64_t streamId = 0)
+	{
+		this->key = key;
+		this->streamId = streamId;
+		blockIndex = 0;
+		bufferedIndex = 2;
+	}
+
+	inline uint64_t operator()()
+	{
+		if (bufferedIndex == 2)
+		{
+			uint32_t out[4];
+			generateBlock(key, streamId, blockIndex++, out);
+			buffered[0] = ((uint64_t)out[1] << 32) | out[0];
+			buffered[1] = ((uint64_t)out[3] << 32) | out[2];
+			bufferedIndex = 0;
+		}
+
+		return buffered[bufferedIndex++];
+	}
+
+	// the 128-bit counter is (blockIndex, streamId) and the 64-bit key is key
+	static inline void generateBlock(uint64_t key, uint64_t streamId, uint64_t blockIndex, uint32_t out[4])
+	{
+		uint32_t counter[4] = { (uint32_t)blockIndex, (uint32_t)(blockIndex >> 32), (uint32_t)streamId, (uint32_t)(streamId >> 32) };
+		uint32_t k[2] = { (uint32_t)key, (uint32_t)(key >> 32) };
+		generateBlock(counter, k, out);
+	}
+
+	static inline void generateBlock(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+	{
+		uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+		uint32_t k0 = key[0], k1 = key[1];
+
+		for (int round = 0; round < PHILOX_ROUNDS; round++)
+		{
+			uint64_t product0 = (uint64_t)PHILOX_M0 * c0;
+			uint64_t product1 = (uint64_t)PHILOX_M1 * c2;
+
+			uint32_t n0 = (uint32_t)(product1 >> 32) ^ c1 ^ k0;
+			uint32_t n2 = (uint32_t)(product0 >> 32) ^ c3 ^ k1;
+			c1 = (uint32_t)product1;
+			c3 = (uint32_t)product0;
+			c0 = n0;
+			c2 = n2;
+
+			k0 += PHILOX_W0;
+			k1 += PHILOX_W1;
+		}
+
+		out[0] = c0;
+		out[1] = c1;
+		out[2] = c2;
+		out[3] = c3;
+	}
+
+	static const uint32_t PHILOX_M0 = 0xD2511F53;
+	static const uint32_t PHILOX_M1 = 0xCD9E8D57;
+	static const uint32_t PHILOX_W0 = 0x9E3779B9;
+	static const uint32_t PHILOX_W1 = 0xBB67AE85;
+	static const int PHILOX_ROUNDS = 10;
+
+private:
+	uint64_t key;
+	uint64_t streamId;
+	uint64_t blockIndex;
+	uint64_t buffered[2];
+	int bufferedIndex;
+};
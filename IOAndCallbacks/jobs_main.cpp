@@ -0,0 +1,98 @@
+// Job engine entry file for IOAndCallbacks.
+// (C) - csm10495 - MIT License 2019
+
+#include "io_job.h"
+#include "io_job_file.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if IO_JOBS_BUILD && !TEST_BUILD
+
+static void printUsage(const char* exe)
+{
+	std::cout << "Usage: " << exe << " <job file>" << std::endl;
+	std::cout << "       " << exe << " --filename=<device> [--option=value ...]" << std::endl;
+	std::cout << "  a device of sim:<name>[,option=value ...] runs against an in-memory device (see io_simulated_device.h)" << std::endl;
+	std::cout << "  --name=<name>             name to report the job under" << std::endl;
+	std::cout << "  --rw=<pattern>            read, write, rw, randread, randwrite or randrw" << std::endl;
+	std::cout << "  --rwmixread=<percent>     percent of reads for rw/randrw" << std::endl;
+	std::cout << "  --bs=<size>               block size (4k, 128k, ...)" << std::endl;
+	std::cout << "  --bssplit=<size/weight:>  block size mix (4k/80:64k/20)" << std::endl;
+	std::cout << "  --iodepth=<n>             IOs kept in flight" << std::endl;
+	std::cout << "  --runtime=<seconds>       how long to measure for" << std::endl;
+	std::cout << "  --ramp_time=<seconds>     how long to run before measuring" << std::endl;
+	std::cout << "  --io_size=<size>          stop after this many bytes" << std::endl;
+	std::cout << "  --offset=<size>           start of the range to use" << std::endl;
+	std::cout << "  --size=<size>             length of the range to use" << std::endl;
+	std::cout << "  --random_distribution=<d> random, zipf:<theta>, pareto:<h>, normal:<stddev%>[:<center%>], zoned:<io%>/<range%>:..." << std::endl;
+	std::cout << "  --randseed=<n>            seed for everything random" << std::endl;
+	std::cout << "  --ioengine=<engine>       libaio, io_uring, sim or default" << std::endl;
+	std::cout << "  --verify=<0|1>            stamp writes and check every read against them" << std::endl;
+	std::cout << "  --verify_seed=<n>         jobs only verify each other's writes if this matches" << std::endl;
+	std::cout << "  --checksum=<none|crc32c>  CRC32C every block written and check every read against it" << std::endl;
+	std::cout << "  --checksum_file=<path>    keep the checksums in this file across runs (implies --checksum=crc32c)" << std::endl;
+	std::cout << "  --buffer_compress_percentage=<p>  make written data about p% compressible" << std::endl;
+	std::cout << "  --compress_ratio=<x>      the same as a ratio (2 halves the data)" << std::endl;
+	std::cout << "  --dedupe_percentage=<p>   make about p% of written blocks duplicates" << std::endl;
+	std::cout << "  --merge_bytes=<size>      merge adjacent IOs queued together into ones of up to this size" << std::endl;
+	std::cout << "  --numjobs=<n>             copies of the job to run in parallel" << std::endl;
+	std::cout << "  --rate_iops=<n>           cap on IOs per second (per copy)" << std::endl;
+	std::cout << "  --rate=<size>             cap on bytes per second (per copy)" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<IO_JOB_CONFIG> configs;
+	if (argc == 2 && std::string(argv[1]).compare(0, 2, "--") != 0)
+	{
+		IOJobFile jobFile;
+		if (!jobFile.load(argv[1]))
+		{
+			return EXIT_FAILURE;
+		}
+		configs = jobFile.getJobs();
+	}
+	else
+	{
+		IO_JOB_CONFIG config;
+		for (int i = 1; i < argc; i++)
+		{
+			std::string arg = argv[i];
+			size_t equals = arg.find('=');
+			if (arg.compare(0, 2, "--") != 0 || equals == std::string::npos)
+			{
+				printUsage(argv[0]);
+				return EXIT_FAILURE;
+			}
+
+			if (!IOJob::setOption(config, arg.substr(2, equals - 2), arg.substr(equals + 1)))
+			{
+				return EXIT_FAILURE;
+			}
+		}
+
+		if (config.path.empty())
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		configs.push_back(config);
+	}
+
+	std::vector<IO_JOB_RESULT> results;
+	bool allStarted = IOJob::runAll(configs, results);
+
+	bool anyErrors = false;
+	for (size_t i = 0; i < configs.size(); i++)
+	{
+		std::cout << configs[i].name << ": (" << configs[i].path << ", iodepth=" << configs[i].queueDepth << ", numjobs=" << configs[i].numJobs << ")" << std::endl;
+		std::cout << results[i].toString();
+		anyErrors |= results[i].hasErrors();
+	}
+
+	return allStarted && !anyErrors ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif // IO_JOBS_BUILD && !TEST_BUILD
@@ -7,7 +7,7 @@
 
 #include <iostream>
 
-#if !TEST_BUILD
+#if !TEST_BUILD && !IO_JOBS_BUILD
 
 int numCallbacks = 0;
 
@@ -57,8 +57,4 @@ int main()
 	return EXIT_SUCCESS;
 }
 
-#endif // !TEST_BUILD
-
-// todo: allow ability to give a pointer to place data in for reads.
-// ... if it is NULL, allocate internally.
-// ... if it is passed, do NOT free it for the user
\ No newline at end of file
+#endif // !TEST_BUILD && !IO_JOBS_BUILD
\ No newline at end of file
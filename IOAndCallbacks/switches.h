@@ -8,6 +8,11 @@
 #define TEST_BUILD 0
 #endif // TEST_BUILD
 
+// set to 1 to build the job engine exe (jobs_main.cpp) instead of the example in main.cpp
+#ifndef IO_JOBS_BUILD
+#define IO_JOBS_BUILD 0
+#endif // IO_JOBS_BUILD
+
 // set to 1 to enable the ability for the IO object to keep track of some stats
 #ifndef IO_ENABLE_STATS
 #define IO_ENABLE_STATS 1
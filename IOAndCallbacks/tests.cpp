@@ -2,19 +2,42 @@
 // (C) - csm10495 - MIT License 2019
 
 #include "io.h"
+#include "io_checksum_table.h"
+#include "io_crc32c.h"
+#include "io_interval_set.h"
+#include "io_job.h"
+#include "io_job_file.h"
 #include "io_lba_generator.h"
+#include "io_multi_queue.h"
+#include "io_payload.h"
+#include "io_permutation.h"
+#include "io_simulated_device.h"
+#include "io_verify.h"
 #include "iorand.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <ctime>
 #include <iostream>
+#include <map>
 #include <random>
+#include <set>
+#include <sstream>
 #include <thread>
+#include <vector>
 
 #include <string.h>
 
+#ifdef __linux__
+#include <poll.h>
+#endif
+
 #if TEST_BUILD
 
+#ifndef TEST_PATH
+
 #ifdef IO_WIN32
 #define TEST_PATH "\\\\.\\PHYSICALDRIVE0"
 #endif
@@ -23,6 +46,8 @@
 #define TEST_PATH "/dev/nvme0n1"
 #endif
 
+#endif // TEST_PATH
+
 #define ASSERT(condition, msg) _assert(condition, msg, __func__ , __LINE__)
 #define RUN_TEST(func) std::cout << "Running: " << #func << "..."; func(); std::cout << " Pass" << std::endl;
 
@@ -86,9 +111,9 @@ void test_blocksize_and_blockcount_legit()
 	ASSERT(blockSize > 0, "blockSize should be greater than 0");
 }
 
-void test_write_then_read()
+void write_then_read(IO_BACKEND_ENUM backend)
 {
-	IO io(TEST_PATH);
+	IO io(TEST_PATH, backend);
 
 	g_blockSize = io.getBlockSize();
 	g_blockCount = rand() % 128;
@@ -136,98 +161,2033 @@ void test_write_then_read()
 	g_userCallbackData = NULL;
 }
 
-void test_aligned_memory()
+void test_write_then_read()
+{
+	write_then_read(IO_BACKEND_DEFAULT);
+}
+
+void test_write_then_read_io_uring()
+{
+	write_then_read(IO_BACKEND_IO_URING);
+}
+
+// polls until g_numCallbacks reaches numCallbacks. Gives 1 second at most
+bool waitForCallbacks(IO& io, uint64_t numCallbacks)
+{
+	for (size_t i = 0; i < 1000 && g_numCallbacks < numCallbacks; i++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		io.poll();
+	}
+
+	return g_numCallbacks == numCallbacks;
+}
+
+void batch_then_plugged_reads(IO_BACKEND_ENUM backend)
+{
+	IO io(TEST_PATH, backend);
+
+	const size_t numIos = 32;
+	g_blockSize = io.getBlockSize();
+	g_blockCount = 8;
+	g_bufferDataToCompare = getRandomBuffer((size_t)g_blockSize * (size_t)g_blockCount, &io);
+	g_lba = rand() % (io.getBlockCount() - g_blockCount);
+
+	IO_CALLBACK_STRUCT* ios[numIos];
+	for (size_t i = 0; i < numIos; i++)
+	{
+		ios[i] = new IO_CALLBACK_STRUCT(g_lba, g_blockCount, g_blockCount * g_blockSize, g_bufferDataToCompare, IO_OPERATION_WRITE, testCallback, NULL);
+	}
+
+	auto oldCallbackCount = g_numCallbacks;
+	ASSERT(io.submitIoBatch(ios, numIos) == numIos, "Not all IOs in the batch were queued");
+	ASSERT(waitForCallbacks(io, oldCallbackCount + numIos), "Took more than a second to write the batch");
+
+	// read it back, staged until unplug()
+	io.plug();
+	oldCallbackCount = g_numCallbacks;
+	for (size_t i = 0; i < numIos; i++)
+	{
+		ASSERT(io.read(g_lba, g_blockCount, testCallback), "Failed to stage a read");
+	}
+
+	io.poll();
+	ASSERT(oldCallbackCount == g_numCallbacks, "Staged reads should not complete before unplug()");
+
+	ASSERT(io.unplug() == numIos, "Not all staged reads were queued");
+	ASSERT(!io.isPlugged(), "unplug() should leave the IO object unplugged");
+	ASSERT(waitForCallbacks(io, oldCallbackCount + numIos), "Took more than a second to read the batch");
+
+	io.freeAlignedBuffer(g_bufferDataToCompare);
+	g_bufferDataToCompare = NULL;
+}
+
+void test_batch_then_plugged_reads()
+{
+	batch_then_plugged_reads(IO_BACKEND_DEFAULT);
+}
+
+void test_batch_then_plugged_reads_io_uring()
+{
+	batch_then_plugged_reads(IO_BACKEND_IO_URING);
+}
+
+void test_request_pool_back_pressure()
+{
+	const size_t requestPoolSize = 4;
+	IO io(TEST_PATH, IO_BACKEND_DEFAULT, requestPoolSize);
+
+	g_blockSize = io.getBlockSize();
+	g_blockCount = 1;
+	g_lba = rand() % (io.getBlockCount() - g_blockCount);
+
+	ASSERT(io.getFreeRequestCount() == requestPoolSize, "Request pool should start full");
+
+	// stage so none of these can complete and give back their request
+	io.plug();
+	for (size_t i = 0; i < requestPoolSize; i++)
+	{
+		ASSERT(io.read(g_lba, g_blockCount, testCallback), "Failed to stage a read with a free request");
+	}
+
+	ASSERT(io.getFreeRequestCount() == 0, "Request pool should be empty");
+	ASSERT(!io.read(g_lba, g_blockCount, testCallback), "read() should fail when the request pool is exhausted");
+#if IO_ENABLE_STATS
+	ASSERT(io.snapshotIoStats().NumberOfRequestPoolExhaustions == 1, "Pool exhaustion was not counted");
+#endif // IO_ENABLE_STATS
+
+	auto oldCallbackCount = g_numCallbacks;
+	io.unplug();
+	ASSERT(waitForCallbacks(io, oldCallbackCount + requestPoolSize), "Took more than a second to read");
+	ASSERT(io.getFreeRequestCount() == requestPoolSize, "Requests were not given back to the pool");
+}
+
+void test_read_into_caller_buffer()
 {
 	IO io(TEST_PATH);
-	auto blockSize = io.getBlockSize();
-	void* buffer = io.getAlignedBuffer(1024*128);
-	uint64_t addr = (uint64_t)buffer;
-	ASSERT(addr % blockSize == 0, "Buffer was not aligned");
-	io.freeAlignedBuffer(buffer);
+
+	g_blockSize = io.getBlockSize();
+	g_blockCount = 16;
+	g_lba = rand() % (io.getBlockCount() - g_blockCount);
+
+	size_t size = (size_t)g_blockSize * (size_t)g_blockCount;
+	char* writeBuffer = getRandomBuffer(size, &io);
+	char* readBuffer = (char*)io.getAlignedBuffer(size);
+	memset(readBuffer, 0, size);
+
+	auto oldCallbackCount = g_numCallbacks;
+	ASSERT(io.write(g_lba, g_blockCount, writeBuffer, testCallback), "Failed to queue write");
+	ASSERT(waitForCallbacks(io, oldCallbackCount + 1), "Took more than a second to write");
+
+	ASSERT(io.read(g_lba, g_blockCount, readBuffer, testCallback), "Failed to queue read into caller buffer");
+	ASSERT(waitForCallbacks(io, oldCallbackCount + 2), "Took more than a second to read");
+
+	// the IO object must not have freed it
+	ASSERT(memcmp(readBuffer, writeBuffer, size) == 0, "Caller buffer did not get the read data");
+
+	io.freeAlignedBuffer(writeBuffer);
+	io.freeAlignedBuffer(readBuffer);
 }
 
-void test_iorand()
+void destroy_with_io_in_flight(IO_BACKEND_ENUM backend)
 {
-	// extra braces are to go in / out of scope to kill threads for generation (for test speed only)
+	auto oldCallbackCount = g_numCallbacks;
+	{
+		IO io(TEST_PATH, backend);
+		g_blockSize = io.getBlockSize();
+		g_blockCount = 8;
+		g_lba = rand() % (io.getBlockCount() - g_blockCount);
+		for (size_t i = 0; i < 32; i++)
+		{
+			ASSERT(io.read(g_lba, g_blockCount, testCallback), "Failed to queue read");
+		}
+		ASSERT(io.getNumIosInFlight() == 32, "Reads weren't in flight");
+
+		// the destructor has to wait for these before freeing their pooled buffers
+	}
+#ifdef IO_LINUX
+	// Windows cancels them and calls them back instead
+	ASSERT(g_numCallbacks == oldCallbackCount, "IOs in flight at destruction were called back");
+#endif // IO_LINUX
+}
+
+void test_destroy_with_io_in_flight()
+{
+	destroy_with_io_in_flight(IO_BACKEND_DEFAULT);
+}
+
+void test_destroy_with_io_in_flight_io_uring()
+{
+	destroy_with_io_in_flight(IO_BACKEND_IO_URING);
+}
+
+void poll_min_events_and_timeout(IO_BACKEND_ENUM backend)
+{
+	IO io(TEST_PATH, backend);
+
+	g_blockSize = io.getBlockSize();
+	g_blockCount = 1;
+	g_lba = rand() % (io.getBlockCount() - g_blockCount);
+
+	// nothing in flight, so this should give up after the timeout. Asleep, not spinning
+	auto start = std::chrono::steady_clock::now();
+	std::clock_t startCpu = std::clock();
+	ASSERT(io.poll(1, 1, 10000) == 0, "poll() got a completion with nothing in flight");
+	ASSERT(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(9), "poll() did not wait for the timeout");
+	ASSERT(std::clock() - startCpu < CLOCKS_PER_SEC / 200, "poll() spun while waiting for the timeout");
 
+	const size_t numIos = 8;
+	auto oldCallbackCount = g_numCallbacks;
+	for (size_t i = 0; i < numIos; i++)
 	{
-		IORand i1;
-		IORand i2;
+		ASSERT(io.read(g_lba, g_blockCount, testCallback), "Failed to queue read");
+	}
 
-		ASSERT(i1.getRandomNumber<int>() != i2.getRandomNumber<int>(), "Two IORand objects yielded the same random number to start");
+	// block until all are done, but only reap a couple at a time
+	size_t numCompleted = 0;
+	while (numCompleted < numIos)
+	{
+		size_t numPolled = io.poll(1, 2, 1000000);
+		ASSERT(numPolled >= 1 && numPolled <= 2, "poll() did not honor minEvents/maxEvents");
+		numCompleted += numPolled;
 	}
-	
+
+	ASSERT(g_numCallbacks == oldCallbackCount + numIos, "Number of callbacks did not match number of completions");
+}
+
+void test_poll_min_events_and_timeout()
+{
+	poll_min_events_and_timeout(IO_BACKEND_DEFAULT);
+}
+
+void test_poll_min_events_and_timeout_io_uring()
+{
+	poll_min_events_and_timeout(IO_BACKEND_IO_URING);
+}
+
+#ifdef IO_LINUX
+void completion_fd(IO_BACKEND_ENUM backend)
+{
+	IO io(TEST_PATH, backend);
+	ASSERT(io.getCompletionFd() == -1, "Completion fd should not exist until enabled");
+	ASSERT(io.enableCompletionFd(), "Failed to enable the completion fd");
+	ASSERT(io.getCompletionFd() >= 0, "Completion fd was not created");
+
+	g_blockSize = io.getBlockSize();
+	g_blockCount = 1;
+	g_lba = rand() % (io.getBlockCount() - g_blockCount);
+
+	pollfd pfd;
+	pfd.fd = io.getCompletionFd();
+	pfd.events = POLLIN;
+	ASSERT(::poll(&pfd, 1, 0) == 0, "Completion fd was readable with nothing in flight");
+
+	auto oldCallbackCount = g_numCallbacks;
+	ASSERT(io.read(g_lba, g_blockCount, testCallback), "Failed to queue read");
+
+	// wait on the fd like an event loop would, then reap
+	ASSERT(::poll(&pfd, 1, 1000) == 1, "Completion fd did not become readable");
+	ASSERT(io.poll(), "Completion fd was readable but poll() had nothing");
+	ASSERT(g_numCallbacks == oldCallbackCount + 1, "Callback was not called");
+
+	// poll() should have reset it
+	ASSERT(::poll(&pfd, 1, 0) == 0, "Completion fd was still readable after poll()");
+
+	// reaping only some of what's done leaves it readable for the rest
+	oldCallbackCount = g_numCallbacks;
+	for (size_t i = 0; i < 8; i++)
 	{
-		IORand i3(5);
-		IORand i4(5);
+		ASSERT(io.read(g_lba, g_blockCount, testCallback), "Failed to queue read");
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	ASSERT(io.poll(0, 2, 0) == 2, "Partial poll() didn't reap 2");
+	ASSERT(::poll(&pfd, 1, 0) == 1, "Completion fd wasn't readable with completions left");
+	ASSERT(io.poll(6, 6, IO_POLL_WAIT_FOREVER) == 6 && g_numCallbacks == oldCallbackCount + 8, "The rest weren't called back");
+	ASSERT(::poll(&pfd, 1, 0) == 0, "Completion fd was still readable after reaping everything");
+}
 
-		ASSERT(i3.getRandomNumber<uint64_t>() == i4.getRandomNumber<uint64_t>(), "Same seed did not generate the same numbers");
+void test_completion_fd()
+{
+	completion_fd(IO_BACKEND_DEFAULT);
+}
+
+void test_completion_fd_io_uring()
+{
+	completion_fd(IO_BACKEND_IO_URING);
+}
+#endif // IO_LINUX
+
+void test_simulated_device()
+{
+	IO io("sim:test_simulated_device,bs=4096,blocks=1024");
+	ASSERT(io.getBackend() == IO_BACKEND_SIMULATED, "A sim: path should use the simulated backend");
+	ASSERT(io.getBlockSize() == 4096 && io.getBlockCount() == 1024, "Simulated geometry didn't come from the path");
+
+	g_blockSize = io.getBlockSize();
+	g_blockCount = 20;
+	g_lba = 1000;
+	char* buf = getRandomBuffer((size_t)(g_blockSize * g_blockCount), &io);
+	g_bufferDataToCompare = buf;
+
+	// spans several sparse chunks and ends on the last block
+	auto oldCallbackCount = g_numCallbacks;
+	ASSERT(io.write(g_lba, g_blockCount, buf, testCallback), "Failed to queue simulated write");
+	ASSERT(io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1, "Simulated write did not complete");
+	ASSERT(io.getNumIosInFlight() == 0, "IOs still in flight after the write completed");
+
+	// a second object on the same name sees the same data
+	{
+		IO other("sim:test_simulated_device");
+		ASSERT(other.getBlockSize() == 4096, "Reopening a simulated device by name changed it");
+		ASSERT(other.read(g_lba, g_blockCount, testCallback), "Failed to queue simulated read");
+		ASSERT(other.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1, "Simulated read did not complete");
 	}
+	ASSERT(g_numCallbacks == oldCallbackCount + 2, "Callbacks were not called");
+	g_bufferDataToCompare = NULL;
 
+	// never written blocks read back as zeros
+	char* zeros = (char*)io.getAlignedBuffer(4096);
+	memset(zeros, 0xFF, 4096);
+	ASSERT(io.read(0, 1, zeros, NULL) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1, "Failed to read an unwritten block");
+	for (size_t i = 0; i < 4096; i++)
 	{
-		IORand i5(7);
-		IORand i6(11);
-		ASSERT(i5.getRandomNumber<uint64_t>() != i6.getRandomNumber<uint64_t>(), "Different seeds got the same number");
+		ASSERT(zeros[i] == 0, "Unwritten block was not zeros");
 	}
 
+	// errors come back through the callback
+	std::shared_ptr<IOSimulatedDevice> device = IOSimulatedDevice::open("sim:test_simulated_device");
+	device->addBadBlocks(10, 2);
+	uint32_t errorCode = 0;
+	IO_CALLBACK_FUNCTION* saveError = [](IO_CALLBACK_STRUCT* ioInfo) { *(uint32_t*)ioInfo->userCallbackData = ioInfo->errorCode; };
+	ASSERT(io.read(8, 3, saveError, &errorCode) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1, "Failed to read a bad block");
+	ASSERT(errorCode == IO_SIMULATED_ERROR_MEDIA, "Reading a bad block didn't fail");
+	ASSERT(io.read(12, 3, saveError, &errorCode) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1 && errorCode == 0, "Reading past the bad blocks failed");
+	device->clearBadBlocks();
+
+	ASSERT(io.read(1020, 5, saveError, &errorCode) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1, "Failed to read past the end");
+	ASSERT(errorCode == IO_SIMULATED_ERROR_OUT_OF_RANGE, "Reading past the end didn't fail");
+
+	device->setErrorRate(1.0);
+	ASSERT(io.write(0, 1, zeros, saveError, &errorCode) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1, "Failed to queue a write");
+	ASSERT(errorCode == IO_SIMULATED_ERROR_MEDIA, "An error rate of 1 didn't fail the IO");
+	device->setErrorRate(0.0);
+
+	IO_SIMULATED_DEVICE_CONFIG config;
+	ASSERT(!IOSimulatedDevice::parseOptions("bs=1000", config), "A block size that isn't a power of 2 was taken");
+	ASSERT(!IOSimulatedDevice::parseOptions("latency=sometimes", config), "A bad latency model was taken");
+	ASSERT(IOSimulatedDevice::parseOptions("latency=uniform,read_ns=5,channels=4,error_rate=0.5", config), "Good options were not taken");
+	ASSERT(config.latency.type == IO_SIMULATED_LATENCY_UNIFORM && config.latency.readNanoseconds == 5 && config.latency.channels == 4 && config.errorRate == 0.5, "Options were parsed wrong");
+
+	IO::freeAlignedBuffer(zeros);
+	IO::freeAlignedBuffer(buf);
 }
 
-void test_io_lba_generator()
+uint64_t queueDepthLatency(const IO_CALLBACK_STRUCT*, size_t queueDepth, void* userData)
 {
-	std::shared_ptr<IO> io(new IO(TEST_PATH));
-	for (uint64_t seed = 0; seed < 1000; seed+=50)
+	*(size_t*)userData = std::max(*(size_t*)userData, queueDepth);
+	return 0;
+}
+
+void test_simulated_latency_model()
+{
+	IO io("sim:test_simulated_latency_model,read_ns=20000000");
+	auto start = std::chrono::steady_clock::now();
+	ASSERT(io.read(0, 1, NULL), "Failed to queue simulated read");
+	ASSERT(io.poll(0, 1, 0) == 0, "Simulated read completed before its latency");
+	ASSERT(io.poll(1, 1, 100) == 0, "Simulated read completed before its latency");
+	ASSERT(io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1, "Simulated read did not complete");
+	ASSERT(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20), "Simulated read completed too soon");
+
+	// one channel serves one IO at a time, so the 4th finishes after 4 service times
+	std::shared_ptr<IOSimulatedDevice> device = IOSimulatedDevice::open("sim:test_simulated_latency_model");
+	IO_SIMULATED_LATENCY_MODEL model;
+	model.readNanoseconds = 1000000;
+	model.channels = 1;
+	device->setLatencyModel(model);
+
+	// one batch, so they all have the same submit time
+	start = std::chrono::steady_clock::now();
+#if IO_ENABLE_STATS
+	io.resetIoStats();
+#endif // IO_ENABLE_STATS
+	io.plug();
+	for (int i = 0; i < 4; i++)
 	{
-		std::shared_ptr<IORand> ioRand(new IORand(seed));
+		ASSERT(io.read(i, 1, NULL), "Failed to queue simulated read");
+	}
+	ASSERT(io.unplug() == 4, "Failed to submit simulated reads");
+	ASSERT(io.poll(4, 4, IO_POLL_WAIT_FOREVER) == 4, "Simulated reads did not complete");
+	ASSERT(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(4), "Reads on one channel overlapped");
 
-		uint64_t maxLba = 100;
-		uint64_t numBlocks = 4;
-		IOLBAGenerator ioLbaGenerator(io, ioRand, maxLba);
+#if IO_ENABLE_STATS
+	IO_STATS_STRUCT stats = io.snapshotIoStats();
+	ASSERT(stats.ReadLatencyHistogram.getMax() >= 4000000, "Queueing delay was not part of the latency");
+#endif // IO_ENABLE_STATS
 
-		uint64_t numSeqGenerationsPossible = (uint64_t)floor(maxLba / (double)numBlocks);
+	// a custom model sees the queue depth
+	size_t maxQueueDepth = 0;
+	model.type = IO_SIMULATED_LATENCY_CUSTOM;
+	model.customFunction = queueDepthLatency;
+	model.customUserData = &maxQueueDepth;
+	device->setLatencyModel(model);
+	for (int i = 0; i < 8; i++)
+	{
+		ASSERT(io.read(i, 1, NULL), "Failed to queue simulated read");
+	}
+	ASSERT(io.poll(8, 8, IO_POLL_WAIT_FOREVER) == 8, "Simulated reads did not complete");
+	ASSERT(maxQueueDepth == 8, "Custom latency model got the wrong queue depth");
 
-		for (uint64_t i = 0; i < numSeqGenerationsPossible; i++)
-		{
-			ASSERT(i * numBlocks == ioLbaGenerator.generateSequentialLba(numBlocks), "Sequential LBA not properly generated");
-		}
+#ifdef IO_LINUX
+	// the completion fd goes off at the simulated completion time
+	model = IO_SIMULATED_LATENCY_MODEL();
+	model.readNanoseconds = 1000000;
+	device->setLatencyModel(model);
+	ASSERT(io.enableCompletionFd(), "Failed to enable the completion fd");
 
-		try
-		{
-			ioLbaGenerator.generateSequentialLba(numBlocks);
-			ASSERT(false, "runtime_error was not raised when sequential LBA could not be found");
-		}
-		catch (const std::runtime_error)
+	pollfd pfd;
+	pfd.fd = io.getCompletionFd();
+	pfd.events = POLLIN;
+	ASSERT(::poll(&pfd, 1, 0) == 0, "Completion fd was readable with nothing in flight");
+	ASSERT(io.read(0, 1, NULL), "Failed to queue simulated read");
+	ASSERT(::poll(&pfd, 1, 0) == 0, "Completion fd was readable before the completion time");
+	ASSERT(::poll(&pfd, 1, 1000) == 1, "Completion fd did not become readable");
+	ASSERT(io.poll(), "Completion fd was readable but poll() had nothing");
+	ASSERT(::poll(&pfd, 1, 0) == 0, "Completion fd was still readable after poll()");
+#endif // IO_LINUX
+}
+
+void test_ring_queue()
+{
+	IORingQueue<uint64_t> queue(5);
+	ASSERT(queue.getCapacity() == 8, "Capacity should round up to a power of 2");
+
+	uint64_t value;
+	ASSERT(!queue.tryPop(value), "Popped from an empty queue");
+
+	for (uint64_t i = 0; i < 8; i++)
+	{
+		ASSERT(queue.tryPush(i), "Failed to push to a queue with room");
+	}
+	ASSERT(!queue.tryPush(8), "Pushed to a full queue");
+
+	uint64_t values[16];
+	ASSERT(queue.tryPopBulk(values, 3) == 3, "Bulk pop did not get the requested count");
+	ASSERT(values[0] == 0 && values[1] == 1 && values[2] == 2, "Bulk pop was out of order");
+
+	// wrap around
+	ASSERT(queue.tryPush(8) && queue.tryPush(9), "Failed to push after popping");
+	ASSERT(queue.tryPopBulk(values, 16) == 7, "Bulk pop should stop when the queue is empty");
+	for (uint64_t i = 0; i < 7; i++)
+	{
+		ASSERT(values[i] == i + 3, "Values came out of order after wrapping");
+	}
+}
+
+void test_multi_producer_submission()
+{
+	IO io(TEST_PATH);
+
+	g_blockSize = io.getBlockSize();
+	g_blockCount = 1;
+	g_lba = rand() % (io.getBlockCount() - g_blockCount);
+
+	const size_t numThreads = 4;
+	const size_t numIosPerThread = 64;
+	std::atomic<size_t> numEnqueued(0);
+
+	// producers only touch enqueueIo()
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < numThreads; i++)
+	{
+		threads.push_back(std::thread([&io, &numEnqueued, numIosPerThread]() {
+			for (size_t j = 0; j < numIosPerThread; j++)
+			{
+				IO_CALLBACK_STRUCT* ioCallbackStruct = new IO_CALLBACK_STRUCT(g_lba, g_blockCount, g_blockCount * g_blockSize,
+					io.getAlignedBuffer((size_t)(g_blockCount * g_blockSize)), IO_OPERATION_READ, testCallback, NULL);
+
+				while (!io.enqueueIo(ioCallbackStruct))
+				{
+					std::this_thread::yield();
+				}
+				numEnqueued++;
+			}
+		}));
+	}
+
+	// this thread is the owner
+	auto oldCallbackCount = g_numCallbacks;
+	size_t numQueued = 0;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (g_numCallbacks < oldCallbackCount + numThreads * numIosPerThread && std::chrono::steady_clock::now() < deadline)
+	{
+		numQueued += io.drainSubmissionQueue();
+		io.poll(0, DEFAULT_POLL_MAX_EVENTS, 1000);
+	}
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	ASSERT(numEnqueued == numThreads * numIosPerThread, "Not every producer IO was enqueued");
+	ASSERT(numQueued == numThreads * numIosPerThread, "Not every enqueued IO was queued by the owner");
+	ASSERT(g_numCallbacks == oldCallbackCount + numThreads * numIosPerThread, "Not every enqueued IO was called back");
+}
+
+void submission_queue_backpressure(IO_BACKEND_ENUM backend)
+{
+	// a small request pool keeps the AIO context small too
+	IO io(TEST_PATH, backend, 64);
+	size_t blockSize = io.getBlockSize();
+	uint64_t lba = rand() % io.getBlockCount();
+
+	static size_t numGood;
+	static size_t numFailed;
+	numGood = 0;
+	numFailed = 0;
+	auto callback = [](IO_CALLBACK_STRUCT* ioCallbackStruct) { ioCallbackStruct->succeeded() ? numGood++ : numFailed++; };
+
+	// enqueues until the queue is full or everything has been
+	const size_t numIos = 3 * DEFAULT_SUBMISSION_QUEUE_SIZE;
+	size_t numEnqueued = 0;
+	IO_CALLBACK_STRUCT* next = NULL;
+	auto enqueueMore = [&]() {
+		while (numEnqueued < numIos)
 		{
-			// if we get here, good
+			if (!next)
+			{
+				next = new IO_CALLBACK_STRUCT(lba, 1, blockSize, io.getAlignedBuffer(blockSize), IO_OPERATION_READ, callback, NULL);
+			}
+			if (!io.enqueueIo(next))
+			{
+				break;
+			}
+			next = NULL;
+			numEnqueued++;
 		}
+	};
 
-		ioLbaGenerator.removeInUseLba(maxLba - numBlocks, numBlocks);
-		ASSERT(ioLbaGenerator.generateSequentialLba(numBlocks) == maxLba - numBlocks, "After removal, still couldn't find a max lba");
+	// producers outrun the device: fill and drain a few times without reaping anything
+	for (int i = 0; i < 3; i++)
+	{
+		enqueueMore();
+		io.drainSubmissionQueue();
+	}
+	ASSERT(numFailed == 0, "IOs past what the OS takes were failed instead of held");
+	ASSERT(io.getNumIosInFlight() <= io.getMaxIosInFlight(), "More in flight than the OS takes");
+	ASSERT(numEnqueued > io.getMaxIosInFlight() || io.getMaxIosInFlight() >= numIos, "The producers didn't get ahead of the OS");
 
-		// remove half
-		ioLbaGenerator.removeInUseLba(maxLba / 2, maxLba / 2);
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+	while (numGood + numFailed < numIos && std::chrono::steady_clock::now() < deadline)
+	{
+		enqueueMore();
+		io.drainSubmissionQueue();
+		io.poll(1, DEFAULT_POLL_MAX_EVENTS, 1000);
+	}
+	ASSERT(numGood == numIos && numFailed == 0, "Held IOs weren't all queued and called back: " + std::to_string(numGood) + " good, " + std::to_string(numFailed) + " failed");
+	ASSERT(io.getNumHeldIos() == 0 && io.getNumIosInFlight() == 0, "IOs were left behind");
+}
 
-		// get random lbas
-		uint64_t minRandomGenerationsPossible = (maxLba / 2) / numBlocks / 2;
-		for (uint64_t i = 0; i < minRandomGenerationsPossible; i++)
+void test_submission_queue_backpressure()
+{
+	submission_queue_backpressure(IO_BACKEND_DEFAULT);
+}
+
+void test_submission_queue_backpressure_io_uring()
+{
+	submission_queue_backpressure(IO_BACKEND_IO_URING);
+}
+
+void countingCallback(IO_CALLBACK_STRUCT* ioCallbackStruct)
+{
+	// callbacks come from worker threads so the globals in testCallback can't be used
+	if (ioCallbackStruct->errorCode == 0)
+	{
+		(*(std::atomic<size_t>*)ioCallbackStruct->userCallbackData)++;
+	}
+}
+
+void test_multi_queue()
+{
+	const size_t numQueues = 2;
+	const size_t numIosPerQueue = 64;
+	std::atomic<size_t> numCallbacks(0);
+
+	{
+		IOMultiQueue multiQueue(TEST_PATH, numQueues, IO_BACKEND_DEFAULT, DEFAULT_REQUEST_POOL_SIZE, true);
+		ASSERT(multiQueue.isValid(), "Not every queue opened the device");
+		ASSERT(multiQueue.getNumQueues() == numQueues, "Wrong number of queues");
+		ASSERT(multiQueue.getQueueForCurrentCpu() < numQueues, "Current CPU routed to a queue that doesn't exist");
+
+		uint32_t blockSize = multiQueue.getBlockSize();
+		uint64_t lba = rand() % (multiQueue.getBlockCount() - 1);
+
+		for (size_t i = 0; i < numQueues * numIosPerQueue; i++)
 		{
-			uint64_t lba = ioLbaGenerator.generateRandomLba(numBlocks);
-			ASSERT(lba >= maxLba / 2, "Random lba doesn't seem possible for given parameters");
+			IO_CALLBACK_STRUCT* ioCallbackStruct = new IO_CALLBACK_STRUCT(lba, 1, blockSize,
+				multiQueue.getAlignedBuffer(blockSize), IO_OPERATION_READ, countingCallback, &numCallbacks);
+			while (!multiQueue.enqueueIo(i % numQueues, ioCallbackStruct))
+			{
+				std::this_thread::yield();
+			}
 		}
+
+		// the destructor waits for everything to be called back
 	}
+
+	ASSERT(numCallbacks == numQueues * numIosPerQueue, "Not every IO was called back");
 }
 
-int main()
+void test_aligned_memory()
 {
-	std::cout << "Running tests!" << std::endl;
-	auto seed = time(NULL);
-	std::cout << "Seed: " << seed << std::endl;
-	srand((unsigned)seed);
+	IO io(TEST_PATH);
+	auto blockSize = io.getBlockSize();
+	void* buffer = io.getAlignedBuffer(1024*128);
+	uint64_t addr = (uint64_t)buffer;
+	ASSERT(addr % blockSize == 0, "Buffer was not aligned");
+	io.freeAlignedBuffer(buffer);
+}
+
+void test_latency_histogram()
+{
+	IOLatencyHistogram histogram;
+	ASSERT(histogram.getCount() == 0 && histogram.getPercentile(99) == 0, "New histogram was not empty");
+
+	for (uint64_t i = 1; i <= 100000; i++)
+	{
+		histogram.record(i);
+	}
+
+	ASSERT(histogram.getCount() == 100000, "Histogram count was wrong");
+	ASSERT(histogram.getMin() == 1 && histogram.getMax() == 100000, "Histogram min/max were wrong");
+	ASSERT(histogram.getPercentile(100) == 100000, "p100 should be the max");
+
+	// every answer should be within the bucket error
+	double percentiles[] = { 50, 99, 99.9, 99.99 };
+	for (double percentile : percentiles)
+	{
+		double expected = percentile * 1000;
+		double got = (double)histogram.getPercentile(percentile);
+		ASSERT(got >= expected && got <= expected * 1.02, "Percentile " + std::to_string(percentile) + " was off: " + std::to_string(got));
+	}
+
+	// every value should land in a bucket that covers it
+	for (uint64_t value = 1; value < ((uint64_t)1 << 40); value = value * 3 + 1)
+	{
+		uint64_t highest = IOLatencyHistogram::getBucketHighestValue(IOLatencyHistogram::getBucketIndex(value));
+		ASSERT(highest >= value && highest <= value + value / HISTOGRAM_SUB_BUCKETS, "Bucket for " + std::to_string(value) + " is too coarse");
+	}
+
+	IOLatencyHistogram other;
+	other.record(1000000);
+	histogram.merge(other);
+	ASSERT(histogram.getCount() == 100001 && histogram.getMax() == 1000000, "Merge did not carry over values");
+}
+
+#if IO_ENABLE_STATS
+void test_completion_stats()
+{
+	IO io(TEST_PATH);
+
+	g_blockSize = io.getBlockSize();
+	g_blockCount = 2;
+	g_lba = rand() % (io.getBlockCount() - g_blockCount);
+
+	// the partition check may have done a read already
+	io.resetIoStats();
+
+	const size_t numIos = 16;
+	auto oldCallbackCount = g_numCallbacks;
+	for (size_t i = 0; i < numIos; i++)
+	{
+		ASSERT(io.read(g_lba, g_blockCount, testCallback), "Failed to queue read");
+	}
+	ASSERT(waitForCallbacks(io, oldCallbackCount + numIos), "Took more than a second to read");
+
+	IO_STATS_STRUCT stats = io.snapshotIoStats();
+	ASSERT(stats.NumberOfCompletedReads == numIos, "Completed reads were not counted");
+	ASSERT(stats.NumberOfReadBytesCompleted == numIos * g_blockCount * g_blockSize, "Completed read bytes were wrong");
+	ASSERT(stats.NumberOfReadErrors == 0, "Read errors were counted for good reads");
+	ASSERT(stats.ReadLatencyHistogram.getCount() == numIos, "Read latencies were not recorded");
+	ASSERT(stats.ReadLatencyHistogram.getPercentile(50) > 0, "Read latency should be nonzero");
+	ASSERT(stats.WriteLatencyHistogram.getCount() == 0, "No writes were done but write latencies were recorded");
+
+	// lowest should really be the lowest
+	io.resetIoStats();
+	oldCallbackCount = g_numCallbacks;
+	g_lba = 10;
+	ASSERT(io.read(g_lba, g_blockCount, NULL), "Failed to queue read");
+	g_lba = 5;
+	ASSERT(io.read(g_lba, g_blockCount, NULL), "Failed to queue read");
+	io.poll(2, 2, 1000000);
+
+	stats = io.snapshotIoStats();
+	ASSERT(stats.LowestQueuedReadLba == 5, "LowestQueuedReadLba was not the lowest");
+	ASSERT(stats.HighestQueuedReadLba == 10, "HighestQueuedReadLba was not the highest");
+}
+
+void test_sharded_stats_threads()
+{
+	IOStats ioStats;
+	const size_t numThreads = 4;
+	const uint64_t numIncrements = 100000;
+	std::atomic<bool> done(false);
+
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < numThreads; i++)
+	{
+		threads.push_back(std::thread([&ioStats, numIncrements]() {
+			for (uint64_t j = 0; j < numIncrements; j++)
+			{
+				IO_STATS_SHARD* shard = ioStats.acquireShard();
+				shard->stats.NumberOfCompletedReads++;
+				shard->stats.ReadLatencyHistogram.record(j);
+				shard->release();
+			}
+		}));
+	}
+
+	// snapshots while the threads are going should never see a half-done update
+	std::thread monitor([&ioStats, &done]() {
+		while (!done)
+		{
+			IO_STATS_STRUCT stats = ioStats.snapshot();
+			ASSERT(stats.NumberOfCompletedReads == stats.ReadLatencyHistogram.getCount(), "Snapshot was not consistent");
+		}
+	});
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+	done = true;
+	monitor.join();
+
+	IO_STATS_STRUCT stats = ioStats.snapshot();
+	ASSERT(stats.NumberOfCompletedReads == numThreads * numIncrements, "Updates from some threads were lost");
+	ASSERT(stats.ReadLatencyHistogram.getCount() == numThreads * numIncrements, "Histogram updates from some threads were lost");
+
+	ioStats.reset();
+	ASSERT(ioStats.snapshot().NumberOfCompletedReads == 0, "reset() did not clear the stats");
+}
+#endif // IO_ENABLE_STATS
+
+void test_iorand()
+{
+	// extra braces are to go in / out of scope to kill threads for generation (for test speed only)
+
+	{
+		IORand i1;
+		IORand i2;
+
+		ASSERT(i1.getRandomNumber<int>() != i2.getRandomNumber<int>(), "Two IORand objects yielded the same random number to start");
+	}
+	
+	{
+		IORand i3(5);
+		IORand i4(5);
+
+		ASSERT(i3.getRandomNumber<uint64_t>() == i4.getRandomNumber<uint64_t>(), "Same seed did not generate the same numbers");
+	}
+
+	{
+		IORand i5(7);
+		IORand i6(11);
+		ASSERT(i5.getRandomNumber<uint64_t>() != i6.getRandomNumber<uint64_t>(), "Different seeds got the same number");
+	}
+
+	{
+		// more than the queue holds, so the generation thread has to park and wake up in between
+		const size_t numNumbers = 100000;
+		std::vector<uint64_t> bulk(numNumbers);
+		IORand i7(13);
+		IORand i8(13);
+
+		i7.getRandomNumbers(bulk.data(), numNumbers);
+		for (size_t i = 0; i < numNumbers; i++)
+		{
+			ASSERT(bulk[i] == i8.getRandomNumber<uint64_t>(), "Bulk and single random numbers did not match for the same seed");
+		}
+	}
+
+	{
+		IORand i9(17);
+		const size_t numThreads = 4;
+		const size_t numNumbersPerThread = 50000;
+		std::atomic<uint64_t> xorOfAll(0);
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < numThreads; i++)
+		{
+			threads.push_back(std::thread([&i9, &xorOfAll, numNumbersPerThread]() {
+				uint64_t localXor = 0;
+				for (size_t j = 0; j < numNumbersPerThread; j++)
+				{
+					localXor ^= i9.getRandomNumber<uint64_t>();
+				}
+				xorOfAll ^= localXor;
+			}));
+		}
+
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+
+		// every number must have been handed out exactly once
+		IORand i10(17);
+		uint64_t expectedXor = 0;
+		for (size_t i = 0; i < numThreads * numNumbersPerThread; i++)
+		{
+			expectedXor ^= i10.getRandomNumber<uint64_t>();
+		}
+		ASSERT(xorOfAll == expectedXor, "Random numbers were lost or duplicated across threads");
+	}
+}
+
+void test_iorand_engines()
+{
+	// known answers from the Random123 and xoshiro reference code
+	uint32_t counter[4] = { 0, 0, 0, 0 };
+	uint32_t key[2] = { 0, 0 };
+	uint32_t out[4];
+	IOPhilox4x32::generateBlock(counter, key, out);
+	ASSERT(out[0] == 0x6627e8d5 && out[1] == 0xe169c58d && out[2] == 0xbc57ac4c && out[3] == 0x9b00dbd8, "Philox4x32-10 did not match the known answer");
+
+	const uint64_t xoshiroState[4] = { 1, 2, 3, 4 };
+	IOXoshiro256StarStar xoshiro(xoshiroState);
+	ASSERT(xoshiro() == 11520 && xoshiro() == 0 && xoshiro() == 1509978240, "xoshiro256** did not match the known answer");
+
+	const IO_RAND_ENGINE_ENUM engines[] = { IO_RAND_ENGINE_MT19937_64, IO_RAND_ENGINE_XOSHIRO256STARSTAR, IO_RAND_ENGINE_SPLITMIX64, IO_RAND_ENGINE_PHILOX4X32 };
+	for (auto engine : engines)
+	{
+		IORand r1(21, engine, 0);
+		IORand r2(21, engine, 0);
+		IORand r3(21, engine, 1);
+		ASSERT(r1.getEngine() == engine, "IORand did not use the requested engine");
+
+		bool streamsDiffer = false;
+		for (int i = 0; i < 100; i++)
+		{
+			uint64_t a = r1.getRandomNumber<uint64_t>();
+			ASSERT(a == r2.getRandomNumber<uint64_t>(), "Same seed, engine and stream gave different numbers");
+			streamsDiffer |= a != r3.getRandomNumber<uint64_t>();
+		}
+		ASSERT(streamsDiffer, "Different streams gave the same numbers");
+	}
+
+	// the last split stream still differs from the first, and jumping to it doesn't take long
+	auto start = std::chrono::steady_clock::now();
+	IOSplitMix64 splitMixFirst(21, 0);
+	IOSplitMix64 splitMixLast(21, IO_RAND_MAX_SPLIT_STREAMS - 1);
+	IOXoshiro256StarStar xoshiroFirst(21, 0);
+	IOXoshiro256StarStar xoshiroLast(21, IO_RAND_MAX_SPLIT_STREAMS - 1);
+	ASSERT(splitMixFirst() != splitMixLast() && xoshiroFirst() != xoshiroLast(), "The last split stream gave the first one's numbers");
+	ASSERT(std::chrono::steady_clock::now() - start < std::chrono::seconds(1), "Jumping to the last xoshiro256** stream was too slow");
+}
+
+void test_iorand_fill_buffer()
+{
+	// odd sizes to hit the unaligned start, the wide middle and the 8 byte tail
+	const size_t bufferSize = 8 * 1001;
+	std::vector<char> buffer1(bufferSize, 0);
+	std::vector<char> buffer2(bufferSize, 0);
+
+	IORand r1(99, IO_RAND_ENGINE_XOSHIRO256STARSTAR, 3);
+	IORand r2(99, IO_RAND_ENGINE_XOSHIRO256STARSTAR, 3);
+
+	// throw r1 off by a block so the wide path starts unaligned
+	char smallBuffer[16];
+	r1.fillBuffer(smallBuffer, sizeof(smallBuffer));
+	r1.fillBuffer(buffer1.data(), bufferSize);
+
+	// compare against plain Philox blocks
+	uint64_t blockIndex = 1;
+	for (size_t offset = 0; offset < bufferSize; offset += 16)
+	{
+		uint32_t block[4];
+		IOPhilox4x32::generateBlock(99, 3 | (1ULL << 63), blockIndex++, block);
+		ASSERT(memcmp(buffer1.data() + offset, block, std::min((size_t)16, bufferSize - offset)) == 0, "fillBuffer did not match the Philox stream");
+	}
+
+	r2.fillBuffer(smallBuffer, sizeof(smallBuffer));
+	r2.fillBuffer(buffer2.data(), bufferSize);
+	ASSERT(buffer1 == buffer2, "Same seed and stream filled different buffers");
+
+	// every word should be written (this used to only fill an eighth of the buffer)
+	size_t numZeroWords = 0;
+	for (size_t i = 0; i < bufferSize / sizeof(uint64_t); i++)
+	{
+		numZeroWords += ((uint64_t*)buffer1.data())[i] == 0;
+	}
+	ASSERT(numZeroWords == 0, "fillBuffer left words unfilled");
+}
+
+void test_iorand_bounded()
+{
+	IORand r(31, IO_RAND_ENGINE_XOSHIRO256STARSTAR, 0);
+
+	// both ends must be reachable and every value about equally likely
+	const uint64_t numValues = 10;
+	const uint64_t numSamples = 200000;
+	std::vector<uint64_t> histogram(numValues, 0);
+	for (uint64_t i = 0; i < numSamples; i++)
+	{
+		uint64_t value = r.getRandomNumber<uint64_t>(100, 100 + numValues - 1);
+		ASSERT(value >= 100 && value < 100 + numValues, "Bounded random number was out of range");
+		histogram[value - 100]++;
+	}
+
+	for (uint64_t i = 0; i < numValues; i++)
+	{
+		// expected 20000 each. 5% is many standard deviations
+		ASSERT(histogram[i] > 19000 && histogram[i] < 21000, "Bounded random numbers were not uniform");
+	}
+
+	// signed ranges and single value ranges
+	bool sawNegative = false;
+	for (int i = 0; i < 1000; i++)
+	{
+		int value = r.getRandomNumber<int>(-5, 5);
+		ASSERT(value >= -5 && value <= 5, "Signed bounded random number was out of range");
+		sawNegative |= value < 0;
+	}
+	ASSERT(sawNegative, "Signed bounded random numbers never went negative");
+	ASSERT(r.getRandomNumber<uint64_t>(7, 7) == 7, "Single value range didn't return that value");
+
+	// the full 64-bit range can't be expressed as end - start + 1
+	uint64_t orOfAll = 0;
+	for (int i = 0; i < 100; i++)
+	{
+		orOfAll |= r.getRandomNumber<uint64_t>(0, UINT64_MAX);
+	}
+	ASSERT(orOfAll >> 63, "Full range random numbers never set the top bit");
+
+	// batched. A range that isn't a power of 2 and is large enough that rejection actually happens
+	const uint64_t start = 5;
+	const uint64_t end = (UINT64_MAX / 3) * 2;
+	std::vector<uint64_t> values(100000);
+	r.getRandomNumbers(values.data(), values.size(), start, end);
+	uint64_t numInTopThird = 0;
+	for (auto value : values)
+	{
+		ASSERT(value >= start && value <= end, "Batched bounded random number was out of range");
+		numInTopThird += value > start + (end - start) / 3 * 2;
+	}
+
+	// modulo would put about half of these in the bottom half of the range instead of a third in the top third
+	ASSERT(numInTopThird > values.size() * 31 / 100 && numInTopThird < values.size() * 35 / 100, "Batched bounded random numbers were not uniform");
+}
+
+void test_interval_set()
+{
+	IOIntervalSet intervalSet;
+
+	// a huge range is still one entry
+	intervalSet.insert(1000, 1ULL << 40);
+	ASSERT(intervalSet.getRangeCount() == 1, "A single insert made more than one range");
+	ASSERT(intervalSet.contains(1000) && intervalSet.contains(1000 + (1ULL << 40) - 1), "Inserted range ends were not contained");
+	ASSERT(!intervalSet.contains(999) && !intervalSet.contains(1000 + (1ULL << 40)), "Lbas outside the inserted range were contained");
+
+	// punch a hole in the middle then fill it back in
+	intervalSet.remove(5000, 10);
+	ASSERT(intervalSet.getRangeCount() == 2, "Removing from the middle didn't split the range");
+	uint64_t overlapEnd = 0;
+	ASSERT(intervalSet.overlaps(4990, 20, &overlapEnd) && overlapEnd == 5000, "Overlap didn't report the end of the first overlapping range");
+	ASSERT(!intervalSet.overlaps(5000, 10), "The removed hole still overlapped");
+	intervalSet.insert(5000, 10);
+	ASSERT(intervalSet.getRangeCount() == 1, "Filling the hole didn't merge the ranges");
+	intervalSet.clear();
+
+	// compare against a plain set of lbas
+	std::mt19937 generator(7);
+	std::set<uint64_t> reference;
+	for (int i = 0; i < 20000; i++)
+	{
+		uint64_t start = generator() % 300;
+		uint64_t count = generator() % 16;
+		switch (generator() % 3)
+		{
+		case 0:
+			intervalSet.insert(start, count);
+			for (uint64_t lba = start; lba < start + count; lba++)
+			{
+				reference.insert(lba);
+			}
+			break;
+		case 1:
+			intervalSet.remove(start, count);
+			for (uint64_t lba = start; lba < start + count; lba++)
+			{
+				reference.erase(lba);
+			}
+			break;
+		default:
+			bool expected = false;
+			for (uint64_t lba = start; lba < start + count; lba++)
+			{
+				expected |= reference.count(lba) != 0;
+			}
+			ASSERT(intervalSet.overlaps(start, count) == expected, "Interval set overlap didn't match the reference");
+			break;
+		}
+	}
+}
+
+void test_permutation()
+{
+	// every size from tiny up past a couple of powers of 4 must be a bijection
+	for (uint64_t size = 1; size < 300; size += 7)
+	{
+		IOPermutation permutation(size, size * 31);
+		std::vector<bool> seen((size_t)size, false);
+		for (uint64_t i = 0; i < size; i++)
+		{
+			uint64_t value = permutation.permute(i);
+			ASSERT(value < size, "Permutation went out of range");
+			ASSERT(!seen[(size_t)value], "Permutation gave the same value twice");
+			seen[(size_t)value] = true;
+		}
+	}
+
+	// it should actually shuffle
+	IOPermutation permutation(1000, 5);
+	uint64_t numInPlace = 0;
+	for (uint64_t i = 0; i < 1000; i++)
+	{
+		numInPlace += permutation.permute(i) == i;
+	}
+	ASSERT(numInPlace < 20, "Permutation left too much in place");
+
+	// and the lba generator should cover every slot once per pass
+	std::shared_ptr<IO> io(new IO(TEST_PATH));
+	std::shared_ptr<IORand> ioRand(new IORand(3));
+	// maxLba is inclusive, like getBlockCount() - 1. 128 slots, the last one ending on maxLba
+	const uint64_t maxLba = 1023;
+	const uint64_t blockCount = 8;
+	const uint64_t numSlots = (maxLba + 1) / blockCount;
+	IOLBAGenerator ioLbaGenerator(io, ioRand, maxLba);
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		std::set<uint64_t> lbas;
+		for (uint64_t i = 0; i < numSlots; i++)
+		{
+			uint64_t lba = ioLbaGenerator.generatePermutedLba(blockCount);
+			ASSERT(lba % blockCount == 0 && lba + blockCount <= maxLba + 1, "Permuted lba was not an aligned slot in range");
+			lbas.insert(lba);
+		}
+		ASSERT(lbas.size() == numSlots, "Permuted lbas repeated within a pass");
+		ASSERT(lbas.count(maxLba + 1 - blockCount) == 1, "The last slot was never given");
+		ASSERT(ioLbaGenerator.getPermutationRemaining() == 0, "Pass did not end after every slot was given");
+	}
+}
+
+void test_lba_distributions()
+{
+	std::shared_ptr<IO> io(new IO(TEST_PATH));
+	std::shared_ptr<IORand> ioRand(new IORand(11, IO_RAND_ENGINE_XOSHIRO256STARSTAR, 0));
+	const uint64_t numLbas = 1000000;
+	const int numSamples = 100000;
+
+	// zipf: the hottest lba gets 1/H(n, theta) of the IOs
+	IOLBADistribution zipf;
+	ASSERT(!zipf.setZipf(0), "Zipf took a theta of 0");
+	ASSERT(zipf.setZipf(1.0), "Zipf didn't take a theta of 1");
+	zipf.prepare(numLbas, 1);
+	std::map<uint64_t, int> counts;
+	for (int i = 0; i < numSamples; i++)
+	{
+		uint64_t lba = zipf.sample(*ioRand);
+		ASSERT(lba < numLbas, "Zipf lba was out of range");
+		counts[lba]++;
+	}
+	int hottest = 0;
+	for (auto& count : counts)
+	{
+		hottest = std::max(hottest, count.second);
+	}
+	// H(10^6, 1) is about 14.39 so ~6950 of 100000
+	ASSERT(hottest > 6400 && hottest < 7500, "Zipf's hottest lba wasn't picked as often as expected");
+
+	// pareto 0.2: 80% of IOs to 20% of the lbas. The hot lbas are scattered so count the most popular fifth
+	IOLBADistribution pareto;
+	ASSERT(pareto.setPareto(0.2), "Pareto didn't take an h of 0.2");
+	pareto.prepare(1000, 2);
+	std::vector<int> paretoCounts(1000, 0);
+	for (int i = 0; i < numSamples; i++)
+	{
+		paretoCounts[(size_t)pareto.sample(*ioRand)]++;
+	}
+	std::sort(paretoCounts.rbegin(), paretoCounts.rend());
+	int hotCount = 0;
+	for (int i = 0; i < 200; i++)
+	{
+		hotCount += paretoCounts[i];
+	}
+	ASSERT(hotCount > numSamples * 78 / 100 && hotCount < numSamples * 82 / 100, "Pareto didn't send 80% of IOs to 20% of the lbas");
+
+	// normal: ~68% within one standard deviation
+	IOLBADistribution normal;
+	ASSERT(normal.setNormal(0.5, 0.1), "Normal didn't take its parameters");
+	normal.prepare(numLbas, 3);
+	int withinOneStdDev = 0;
+	for (int i = 0; i < numSamples; i++)
+	{
+		uint64_t lba = normal.sample(*ioRand);
+		withinOneStdDev += lba >= numLbas * 4 / 10 && lba < numLbas * 6 / 10;
+	}
+	ASSERT(withinOneStdDev > numSamples * 66 / 100 && withinOneStdDev < numSamples * 70 / 100, "Normal wasn't normal");
+
+	// zoned: 90% of IOs to the first 10%
+	IOLBADistribution zoned;
+	ASSERT(!zoned.setZoned({ { 90, 10 }, { 20, 90 } }), "Zones that didn't add up to 100 were taken");
+	ASSERT(zoned.setZoned({ { 90, 10 }, { 10, 90 } }), "Zones were not taken");
+	zoned.prepare(numLbas, 4);
+	int inHotZone = 0;
+	for (int i = 0; i < numSamples; i++)
+	{
+		inHotZone += zoned.sample(*ioRand) < numLbas / 10;
+	}
+	ASSERT(inHotZone > numSamples * 89 / 100 && inHotZone < numSamples * 91 / 100, "Zoned didn't send 90% of IOs to the hot zone");
+
+	// and through the lba generator
+	IOLBAGenerator ioLbaGenerator(io, ioRand, numLbas);
+	ioLbaGenerator.setDistribution(zoned);
+	inHotZone = 0;
+	for (int i = 0; i < 1000; i++)
+	{
+		uint64_t lba = ioLbaGenerator.generateRandomLba(1);
+		inHotZone += lba < numLbas / 10;
+		ioLbaGenerator.removeInUseLba(lba);
+	}
+	ASSERT(inHotZone > 850, "The lba generator didn't follow its distribution");
+}
+
+void test_random_lba_range()
+{
+	std::shared_ptr<IO> io(new IO(TEST_PATH));
+	std::shared_ptr<IORand> ioRand(new IORand(23, IO_RAND_ENGINE_XOSHIRO256STARSTAR, 0));
+
+	// uniform over every start that fits in [0, 99]. 93 of them, so each should get about 10000 / 93
+	const uint64_t blockCount = 8;
+	IOLBAGenerator uniform(io, ioRand, 99);
+	std::vector<int> counts(100, 0);
+	for (int i = 0; i < 10000; i++)
+	{
+		uint64_t lba = uniform.generateRandomLba(blockCount);
+		ASSERT(lba + blockCount <= 100, "Random lba went past maxLba");
+		counts[(size_t)lba]++;
+		uniform.removeInUseLba(lba, blockCount);
+	}
+	for (uint64_t lba = 0; lba <= 92; lba++)
+	{
+		ASSERT(counts[(size_t)lba] > 50 && counts[(size_t)lba] < 180, "Uniform lba " + std::to_string(lba) + " was picked " + std::to_string(counts[(size_t)lba]) + " times");
+	}
+
+	// a hotspot at the very end stays there instead of spilling onto lba 0
+	IOLBADistribution normal;
+	ASSERT(normal.setNormal(1.0, 0.001), "Normal didn't take its parameters");
+	IOLBAGenerator skewed(io, ioRand, 99999);
+	skewed.setDistribution(normal);
+	int numAtLastStart = 0;
+	for (int i = 0; i < 10000; i++)
+	{
+		uint64_t lba = skewed.generateRandomLba(blockCount);
+		ASSERT(lba >= 99000 && lba + blockCount <= 100000, "Skewed lba " + std::to_string(lba) + " left the hotspot");
+		numAtLastStart += lba == 100000 - blockCount;
+		skewed.removeInUseLba(lba, blockCount);
+	}
+	ASSERT(numAtLastStart > 0, "The last start lba was never picked");
+}
+
+void test_sequential_streams()
+{
+	std::shared_ptr<IO> io(new IO(TEST_PATH));
+	std::shared_ptr<IORand> ioRand(new IORand(19));
+	const uint64_t maxLba = 1599;
+	IOLBAGenerator ioLbaGenerator(io, ioRand, maxLba);
+
+	uint64_t blockCount = 0;
+	size_t streamIndex = 0;
+	try
+	{
+		ioLbaGenerator.generateStreamLba(&blockCount);
+		ASSERT(false, "runtime_error was not raised without any streams");
+	}
+	catch (const std::runtime_error&)
+	{
+		// if we get here, good
+	}
+
+	// 4 regions of 400 lbas, round robin. The last one ends on maxLba
+	ASSERT(ioLbaGenerator.setSequentialStreams(4, IO_STREAM_LAYOUT_REGIONS, 8, 0), "Couldn't set up region streams");
+	ASSERT(ioLbaGenerator.getNumStreams() == 4, "Wrong number of streams");
+	for (uint64_t i = 0; i < 100; i++)
+	{
+		for (size_t stream = 0; stream < 4; stream++)
+		{
+			uint64_t lba = ioLbaGenerator.generateStreamLba(&blockCount, &streamIndex);
+			ASSERT(streamIndex == stream && blockCount == 8, "Round robin didn't go through the streams in order");
+
+			// each region holds 50 IOs then wraps
+			ASSERT(lba == stream * 400 + (i % 50) * 8, "Region stream lba was not sequential within its region");
+		}
+	}
+
+	// 4 interleaved streams: together they cover the range back to back
+	ASSERT(ioLbaGenerator.setSequentialStreams(4, IO_STREAM_LAYOUT_INTERLEAVED, 8, 0), "Couldn't set up interleaved streams");
+	for (uint64_t i = 0; i < (maxLba + 1) / 8; i++)
+	{
+		ASSERT(ioLbaGenerator.generateStreamLba(&blockCount) == i * 8, "Interleaved streams didn't cover the range in order");
+	}
+
+	// regions of 4 lbas can't hold an 8 block IO. That's an error, not fewer streams
+	ASSERT(!ioLbaGenerator.setSequentialStreams(400, IO_STREAM_LAYOUT_REGIONS, 8, 0), "Took regions too small for an IO");
+	ASSERT(ioLbaGenerator.getNumStreams() == 0, "A failed setSequentialStreams() left streams behind");
+
+	// custom streams with their own sizes, picked at random. Each stays sequential
+	ASSERT(ioLbaGenerator.setSequentialStreams(0, IO_STREAM_LAYOUT_REGIONS, 1, 0), "Couldn't clear the streams");
+	ASSERT(ioLbaGenerator.addSequentialStream(0, 1000, 16, 32), "Couldn't add a stream");
+	ASSERT(ioLbaGenerator.addSequentialStream(1000, 1600, 4, 4), "Couldn't add a stream");
+	ASSERT(!ioLbaGenerator.addSequentialStream(0, 2, 4, 4), "Added a stream that can't fit an IO");
+	ioLbaGenerator.setStreamSelection(IO_STREAM_SELECTION_RANDOM);
+
+	uint64_t expectedLba[2] = { 0, 1000 };
+	size_t numPerStream[2] = { 0, 0 };
+	for (int i = 0; i < 200; i++)
+	{
+		uint64_t lba = ioLbaGenerator.generateStreamLba(&blockCount, &streamIndex);
+		ASSERT(lba == expectedLba[streamIndex], "Random stream selection broke a stream's sequence");
+		ASSERT(blockCount == (streamIndex ? 4u : 16u), "Stream gave the wrong block count");
+		expectedLba[streamIndex] += streamIndex ? 4 : 32;
+		if (streamIndex == 0 && expectedLba[0] + 16 > 1000)
+		{
+			expectedLba[0] = 0;
+		}
+		numPerStream[streamIndex]++;
+	}
+	ASSERT(numPerStream[0] > 50 && numPerStream[1] > 50, "Random stream selection favored one stream");
+}
+
+void test_job()
+{
+	IO_JOB_CONFIG config;
+	ASSERT(IOJob::setOption(config, "filename", TEST_PATH), "filename was not taken");
+	ASSERT(IOJob::setOption(config, "rw", "randrw"), "rw was not taken");
+	ASSERT(IOJob::setOption(config, "rwmixread", "70"), "rwmixread was not taken");
+	ASSERT(IOJob::setOption(config, "bssplit", "4k/3:16k/1"), "bssplit was not taken");
+	ASSERT(IOJob::setOption(config, "iodepth", "8"), "iodepth was not taken");
+	ASSERT(IOJob::setOption(config, "io_size", "4m"), "io_size was not taken");
+	ASSERT(IOJob::setOption(config, "runtime", "0"), "runtime was not taken");
+	ASSERT(IOJob::setOption(config, "random_distribution", "zoned:80/20:20/80"), "random_distribution was not taken");
+	ASSERT(!IOJob::setOption(config, "bs", "4q"), "A bad size was taken");
+	ASSERT(!IOJob::setOption(config, "rw", "sideways"), "A bad rw was taken");
+	ASSERT(!IOJob::setOption(config, "not_an_option", "1"), "An unknown option was taken");
+
+	ASSERT(config.readPercent == 70 && config.pattern == IO_JOB_PATTERN_RANDOM, "rw/rwmixread were not applied");
+	ASSERT(config.blockSizes.size() == 2 && config.blockSizes[1].bytes == 16384 && config.blockSizes[1].weight == 1, "bssplit was not applied");
+	ASSERT(config.queueDepth == 8 && config.byteLimit == 4 * 1024 * 1024, "iodepth/io_size were not applied");
+
+	IOJob job(config);
+	ASSERT(job.run(), "Job did not run");
+
+	const IO_JOB_RESULT& result = job.getResult();
+	ASSERT(result.numErrors == 0, "Job had errors");
+	ASSERT(result.numReadBytes + result.numWriteBytes >= config.byteLimit, "Job stopped before its io_size");
+	ASSERT(result.numReads > result.numWrites, "Job didn't follow its read mix");
+#if IO_ENABLE_STATS
+	ASSERT(result.readLatency.getCount() == result.numReads, "Job didn't record read latencies");
+#endif // IO_ENABLE_STATS
+}
+
+void test_job_queue_depth()
+{
+	// Mixed sizes over a tiny range, so the bigger IOs often find no free range. The depth should recover
+	//  once some complete instead of staying lower for the rest of the run
+	IO_JOB_CONFIG config;
+	config.path = "sim:test_job_queue_depth,bs=4096,blocks=4096,read_ns=1000000,write_ns=1000000";
+	config.runtimeSeconds = 0.5;
+	config.queueDepth = 16;
+	config.lbaCount = 64 * 4096;
+	ASSERT(IOJob::setOption(config, "rw", "randrw") && IOJob::setOption(config, "bssplit", "4k/1:32k/1"), "Options were not taken");
+	IOJob job(config);
+	ASSERT(job.run(), "Job did not run");
+
+	// 1ms per IO at a depth of 16 is 8000 in half a second. Losing slots ends up at well under half that
+	const IO_JOB_RESULT& result = job.getResult();
+	ASSERT(result.numErrors == 0, "Job had errors");
+	ASSERT(result.numReads + result.numWrites >= 4000, "Job didn't hold its queue depth: " + std::to_string(result.numReads + result.numWrites) + " IOs");
+}
+
+void test_job_file()
+{
+	std::stringstream bad("[job]\nbs=4k\nnot an option\n");
+	IOJobFile jobFile;
+	ASSERT(!jobFile.parse(bad, "bad"), "A job file with a bad line was taken");
+
+	std::stringstream noFilename("[job]\nbs=4k\n");
+	ASSERT(!jobFile.parse(noFilename, "noFilename"), "A job without a filename was taken");
+
+	std::stringstream good(
+		"; two tenants sharing a device\n"
+		"[global]\n"
+		"filename=" TEST_PATH "\n"
+		"runtime=0\n"
+		"io_size=1m\n"
+		"\n"
+		"[reader]\n"
+		"rw=randread\n"
+		"iodepth = 4\n"
+		"numjobs=2\n"
+		"\n"
+		"# global changes only apply to later jobs\n"
+		"[global]\n"
+		"bs=8k\n"
+		"\n"
+		"[writer]\n"
+		"rw=write\n"
+		"rate_iops=2000\n"
+		"io_size=512k\n");
+	ASSERT(jobFile.parse(good, "good"), "A good job file was not taken");
+
+	const std::vector<IO_JOB_CONFIG>& jobs = jobFile.getJobs();
+	ASSERT(jobs.size() == 2, "Wrong number of jobs");
+	ASSERT(jobs[0].name == "reader" && jobs[0].queueDepth == 4 && jobs[0].numJobs == 2 && jobs[0].blockSizes[0].bytes == 4096, "First job's options were wrong");
+	ASSERT(jobs[1].name == "writer" && jobs[1].readPercent == 0 && jobs[1].pattern == IO_JOB_PATTERN_SEQUENTIAL && jobs[1].blockSizes[0].bytes == 8192, "Second job's options were wrong");
+	ASSERT(jobs[1].path == TEST_PATH && jobs[1].byteLimit == 512 * 1024, "Global options didn't carry over");
+
+	std::vector<IO_JOB_RESULT> results;
+	auto startTime = std::chrono::steady_clock::now();
+	ASSERT(IOJob::runAll(jobs, results), "Jobs did not all run");
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	ASSERT(results.size() == 2, "Wrong number of results");
+	ASSERT(results[0].numReads * 4096 >= 2 * 1024 * 1024, "Both copies of the reader didn't finish");
+	ASSERT(results[1].numWrites == 64 && results[1].numErrors == 0, "The writer didn't write its io_size");
+
+	// 64 writes at 2000 IOPS can't finish in much under 32ms
+	ASSERT(seconds > 0.025, "The writer's rate cap was ignored");
+}
+
+void test_verify()
+{
+	const uint32_t blockSize = 4096;
+	IOVerifier verifier(blockSize, 1234);
+	std::vector<uint8_t> buffer(blockSize * 4);
+	std::vector<uint8_t> old(blockSize * 4);
+	IO_VERIFY_RESULT result;
+
+	verifier.fill(buffer.data(), 100, 4, 7);
+	ASSERT(verifier.verify(buffer.data(), 100, 4, 7, &result) && result.error == IO_VERIFY_OK, "Freshly filled blocks didn't verify");
+	ASSERT(verifier.verify(buffer.data(), 100, 4, IO_VERIFY_ANY_GENERATION, NULL), "Any generation should take the right one");
+	ASSERT(verifier.verify(buffer.data() + blockSize, 101, 2, 7, NULL), "A block in the middle didn't verify on its own");
+
+	// a flipped bit
+	buffer[blockSize * 2 + 1001] ^= 0x10;
+	ASSERT(!verifier.verify(buffer.data(), 100, 4, 7, &result), "A flipped bit verified");
+	ASSERT(result.error == IO_VERIFY_CORRUPT && result.lba == 102 && result.byteOffset == blockSize * 2 + 1001, "Flipped bit was reported wrong: " + result.toString());
+	buffer[blockSize * 2 + 1001] ^= 0x10;
+
+	// a flipped bit in the header
+	buffer[blockSize + 9] ^= 0x01;
+	ASSERT(!verifier.verify(buffer.data(), 100, 4, 7, &result) && result.error == IO_VERIFY_CORRUPT_HEADER && result.lba == 101, "Corrupt header was reported wrong: " + result.toString());
+	buffer[blockSize + 9] ^= 0x01;
+
+	// never written
+	std::vector<uint8_t> zeros(blockSize);
+	ASSERT(!verifier.verify(zeros.data(), 5, 1, 7, &result) && result.error == IO_VERIFY_NO_HEADER, "Zeros were reported wrong: " + result.toString());
+
+	// lba 101's data read back from lba 100
+	ASSERT(!verifier.verify(buffer.data() + blockSize, 100, 1, 7, &result), "Misdirected block verified");
+	ASSERT(result.error == IO_VERIFY_MISDIRECTED && result.foundLba == 101, "Misdirected block was reported wrong: " + result.toString());
+
+	// an older generation, or another run
+	verifier.fill(old.data(), 100, 4, 6);
+	ASSERT(!verifier.verify(old.data(), 100, 4, 7, &result) && result.error == IO_VERIFY_STALE && result.foundGeneration == 6, "Stale block was reported wrong: " + result.toString());
+	ASSERT(verifier.verify(old.data(), 100, 4, IO_VERIFY_ANY_GENERATION, NULL), "Any generation should take an old one");
+	IOVerifier otherRun(blockSize, 4321);
+	ASSERT(!otherRun.verify(buffer.data(), 100, 4, IO_VERIFY_ANY_GENERATION, &result) && result.error == IO_VERIFY_STALE && result.foundSeed == 1234, "Another run's block was reported wrong");
+
+	// only the first 3 sectors of block 1 made it
+	std::vector<uint8_t> torn = buffer;
+	memcpy(torn.data() + blockSize + 1536, old.data() + blockSize + 1536, blockSize - 1536);
+	ASSERT(!verifier.verify(torn.data(), 100, 4, 7, &result), "Torn block verified");
+	ASSERT(result.error == IO_VERIFY_TORN && result.lba == 101 && result.byteOffset == blockSize + 1536, "Torn block was reported wrong: " + result.toString());
+
+	// only the first 2 blocks of the write made it
+	torn = buffer;
+	memcpy(torn.data() + blockSize * 2, old.data() + blockSize * 2, blockSize * 2);
+	ASSERT(!verifier.verify(torn.data(), 100, 4, 7, &result) && result.error == IO_VERIFY_TORN && result.lba == 102, "Torn write was reported wrong: " + result.toString());
+
+	// every payload length, so both the vector and scalar paths are checked against each other
+	for (uint32_t size = 64; size <= 1024; size += 4)
+	{
+		IOVerifier sized(size, size);
+		std::vector<uint8_t> block(size);
+		sized.fill(block.data(), size, 1, 1);
+		ASSERT(sized.verify(block.data(), size, 1, 1, NULL), "Block size " + std::to_string(size) + " didn't verify");
+		block[size - 1] ^= 0x80;
+		ASSERT(!sized.verify(block.data(), size, 1, 1, &result) && result.byteOffset == size - 1, "Last byte of block size " + std::to_string(size) + " wasn't checked");
+	}
+}
+
+void test_verify_job()
+{
+	IO_JOB_CONFIG config;
+	config.path = "sim:test_verify_job,bs=4096,blocks=4096";
+	config.verify = true;
+	config.runtimeSeconds = 0;
+	config.queueDepth = 32;
+	config.lbaCount = 1024 * 4096;
+
+	// fill the range, then read it back at random
+	ASSERT(IOJob::setOption(config, "rw", "write") && IOJob::setOption(config, "bs", "16k") && IOJob::setOption(config, "io_size", "4m"), "Options were not taken");
+	IOJob writer(config);
+	ASSERT(writer.run(), "Verify write job did not run");
+	ASSERT(writer.getResult().numWrites >= 256 && writer.getResult().numErrors == 0, "Verify write job didn't write everything");
+
+	ASSERT(IOJob::setOption(config, "rw", "randread") && IOJob::setOption(config, "bs", "4k"), "Options were not taken");
+	IOJob reader(config);
+	ASSERT(reader.run(), "Verify read job did not run");
+	ASSERT(reader.getResult().numReads >= 1024 && reader.getResult().numVerifyErrors == 0, "Verify read job found errors: " + reader.getResult().firstVerifyError);
+	ASSERT(!reader.getResult().hasErrors(), "A clean verify read job had errors");
+
+	// clobber a block behind the job's back
+	IO io(config.path);
+	void* zeros = io.getAlignedBuffer(4096);
+	memset(zeros, 0, 4096);
+	ASSERT(io.write(77, 1, zeros, NULL) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1, "Failed to clobber a block");
+	IO::freeAlignedBuffer(zeros);
+
+	ASSERT(IOJob::setOption(config, "rw", "read") && IOJob::setOption(config, "bs", "16k"), "Options were not taken");
+	IOJob checker(config);
+	ASSERT(checker.run(), "Verify read job did not run");
+	// IOs still in flight when io_size is hit count too, and may wrap back around to it
+	ASSERT(checker.getResult().numVerifyErrors >= 1, "The clobbered block wasn't found");
+	ASSERT(checker.getResult().firstVerifyError.find("no header at lba 77") == 0, "The clobbered block was reported wrong: " + checker.getResult().firstVerifyError);
+	// the read itself succeeded, but the job still failed
+	ASSERT(checker.getResult().hasErrors(), "A verify miss didn't count as an error");
+}
+
+// one bit at a time, to check the fast versions against
+static uint32_t referenceCrc32c(const uint8_t* data, size_t length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
+
+void test_crc32c()
+{
+	// check value and the RFC 3720 (iSCSI) vectors
+	ASSERT(ioCrc32c("123456789", 9) == 0xE3069283, "Wrong CRC32C check value");
+	ASSERT(ioCrc32c("", 0) == 0, "Wrong CRC32C of nothing");
+
+	uint8_t vector[32];
+	memset(vector, 0, sizeof(vector));
+	ASSERT(ioCrc32c(vector, sizeof(vector)) == 0x8A9136AA, "Wrong CRC32C of zeros");
+	memset(vector, 0xFF, sizeof(vector));
+	ASSERT(ioCrc32c(vector, sizeof(vector)) == 0x62A8AB43, "Wrong CRC32C of ones");
+	for (uint8_t i = 0; i < sizeof(vector); i++)
+	{
+		vector[i] = i;
+	}
+	ASSERT(ioCrc32c(vector, sizeof(vector)) == 0x46DD794E, "Wrong CRC32C of incrementing bytes");
+
+	// long enough for both stream lengths, at every alignment
+	std::vector<uint8_t> buffer(3 * 8192 * 2 + 3 * 256 + 104);
+	IORand ioRand(99);
+	ioRand.fillBuffer((char*)buffer.data(), buffer.size());
+	std::vector<size_t> lengths = { 1, 7, 8, 9, 63, 767, 768, 769, 1000, 3 * 8192 - 1, 3 * 8192, 3 * 8192 + 3 * 256 + 5, buffer.size() - 8 };
+	for (size_t length : lengths)
+	{
+		for (size_t offset = 0; offset < 8; offset++)
+		{
+			uint32_t expected = referenceCrc32c(buffer.data() + offset, length);
+			ASSERT(ioCrc32c(buffer.data() + offset, length) == expected, "CRC32C doesn't match the reference for length " + std::to_string(length));
+
+			// continuing from a split anywhere gives the same answer
+			size_t split = length / 3;
+			ASSERT(ioCrc32c(buffer.data() + offset + split, length - split, ioCrc32c(buffer.data() + offset, split)) == expected, "Continued CRC32C doesn't match");
+		}
+	}
+
+	// block at a time, including block sizes the interleaved path can't take
+	for (size_t blockSize : { 512, 4096, 520, 13 })
+	{
+		size_t numBlocks = std::min<size_t>(buffer.size() / blockSize, 11);
+		std::vector<uint32_t> crcs(numBlocks);
+		ioCrc32cBlocks(buffer.data() + 1, blockSize, numBlocks, crcs.data());
+		for (size_t i = 0; i < numBlocks; i++)
+		{
+			ASSERT(crcs[i] == referenceCrc32c(buffer.data() + 1 + i * blockSize, blockSize), "Block CRC32C doesn't match for block size " + std::to_string(blockSize));
+		}
+	}
+}
+
+void test_checksum_table()
+{
+	const uint32_t blockSize = 512;
+	IOChecksumTable table(100, blockSize);
+	std::vector<uint8_t> buffer(blockSize * 8);
+	IORand ioRand(7);
+	ioRand.fillBuffer((char*)buffer.data(), buffer.size());
+
+	ASSERT(table.get(10) == IO_CHECKSUM_UNKNOWN, "A new table should know nothing");
+	ASSERT(table.check(buffer.data(), 10, 8) == 8, "Unknown blocks should always match");
+
+	table.update(buffer.data(), 10, 8);
+	ASSERT(table.get(13) == ioCrc32c(buffer.data() + 3 * blockSize, blockSize), "Wrong checksum recorded");
+	ASSERT(table.check(buffer.data(), 10, 8) == 8, "Unchanged blocks didn't match");
+	ASSERT(table.check(buffer.data() + blockSize, 11, 7) == 7, "A sub range didn't match");
+	ASSERT(table.check(buffer.data(), 11, 7) == 0, "Blocks from the wrong lba matched");
+
+	buffer[5 * blockSize + 17] ^= 1;
+	ASSERT(table.check(buffer.data(), 10, 8) == 5, "The changed block wasn't found");
+	table.forget(15, 1);
+	ASSERT(table.check(buffer.data(), 10, 8) == 8, "A forgotten block was checked");
+
+	// past the end is ignored
+	table.update(buffer.data(), 96, 8);
+	ASSERT(table.get(99) != IO_CHECKSUM_UNKNOWN && table.get(100) == IO_CHECKSUM_UNKNOWN, "The end of the table was not respected");
+	ASSERT(table.check(buffer.data(), 96, 8) == 8, "Blocks past the end were checked");
+
+	// a persistent table keeps its entries after the last user lets go
+	const char* path = "test_checksum_table.crc";
+	std::remove(path);
+	{
+		std::shared_ptr<IOChecksumTable> fileTable = IOChecksumTable::open(path, 100, blockSize);
+		ASSERT(fileTable != NULL, "Couldn't create a checksum file");
+		ASSERT(IOChecksumTable::open(path, 100, blockSize) == fileTable, "Opening a file twice should share the table");
+		fileTable->update(buffer.data(), 20, 2);
+		ASSERT(fileTable->sync(), "Couldn't sync the checksum file");
+	}
+	{
+		std::shared_ptr<IOChecksumTable> fileTable = IOChecksumTable::open(path, 100, blockSize);
+		ASSERT(fileTable && fileTable->get(21) == ioCrc32c(buffer.data() + blockSize, blockSize), "The checksum file lost its entries");
+	}
+	ASSERT(!IOChecksumTable::open(path, 200, blockSize), "A checksum file opened for the wrong device");
+	std::remove(path);
+}
+
+void test_checksum_io()
+{
+	const std::string path = "sim:test_checksum_io,bs=4096,blocks=1024";
+	IO io(path);
+	IO clobberer(path);
+	ASSERT(io.setChecksumTable(IOChecksumTable::openShared(path, io.getBlockCount(), io.getBlockSize())), "Couldn't set the checksum table");
+	ASSERT(!io.setChecksumTable(std::make_shared<IOChecksumTable>(1024, 512)), "A table for the wrong block size was taken");
+
+	void* data = io.getAlignedBuffer(4096 * 8);
+	IORand ioRand(1);
+	ioRand.fillBuffer((char*)data, 4096 * 8);
+	ASSERT(io.write(40, 8, data, NULL) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1, "Write failed");
+
+	static uint32_t readErrorCode;
+	auto readCallback = [](IO_CALLBACK_STRUCT* ioCallbackStruct) { readErrorCode = ioCallbackStruct->errorCode; };
+	readErrorCode = 1;
+	ASSERT(io.read(40, 8, readCallback) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1 && readErrorCode == 0, "Checked read of good data failed");
+
+	// change one block behind the table's back
+	((uint8_t*)data)[4096 * 3] ^= 0x80;
+	ASSERT(clobberer.write(40, 8, data, NULL) && clobberer.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1, "Clobbering write failed");
+	ASSERT(io.read(40, 8, readCallback) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1 && readErrorCode == IO_ERROR_CHECKSUM_MISMATCH, "Corruption wasn't caught");
+	ASSERT(io.read(40, 2, readCallback) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1 && readErrorCode == 0, "Blocks before the corruption failed");
+
+#if IO_ENABLE_STATS
+	ASSERT(io.snapshotIoStats().NumberOfChecksumMismatches == 1, "Checksum mismatch wasn't counted");
+#endif // IO_ENABLE_STATS
+
+	// rewriting through the checked object makes it good again
+	ASSERT(io.write(40, 8, data, NULL) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1, "Write failed");
+	ASSERT(io.read(40, 8, readCallback) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1 && readErrorCode == 0, "Rewritten blocks failed");
+	IO::freeAlignedBuffer(data);
+
+	// the same through a job
+	IO_JOB_CONFIG config;
+	config.path = path;
+	config.runtimeSeconds = 0;
+	config.queueDepth = 16;
+	config.lbaCount = 256 * 4096;
+	ASSERT(IOJob::setOption(config, "checksum", "crc32c") && IOJob::setOption(config, "rw", "randrw") && IOJob::setOption(config, "io_size", "4m"), "Options were not taken");
+	ASSERT(!IOJob::setOption(config, "checksum_file", "") && config.checksumFile.empty(), "An empty checksum_file changed the config");
+	IOJob job(config);
+	ASSERT(job.run(), "Checksum job did not run");
+	ASSERT(job.getResult().numErrors == 0 && job.getResult().numChecksumErrors == 0, "Checksum job found errors");
+}
+
+void test_payload_generator()
+{
+	std::shared_ptr<IORand> ioRand(new IORand(5, IO_RAND_ENGINE_XOSHIRO256STARSTAR, 0));
+	const size_t blockSize = DEFAULT_PAYLOAD_BLOCK_SIZE;
+	const size_t numBlocks = 4096;
+	std::vector<uint8_t> buffer(blockSize * numBlocks);
+
+	// returns how many blocks of buffer are copies of an earlier one
+	auto countDuplicates = [&]() {
+		std::vector<uint32_t> crcs(numBlocks);
+		ioCrc32cBlocks(buffer.data(), blockSize, numBlocks, crcs.data());
+		std::set<uint32_t> unique(crcs.begin(), crcs.end());
+		return numBlocks - unique.size();
+	};
+
+	// incompressible and no duplicates, even after the pool wraps
+	IO_PAYLOAD_CONFIG config;
+	IOPayloadGenerator plain(config, ioRand);
+	plain.fill(buffer.data(), buffer.size() / 2);
+	plain.fill(buffer.data() + buffer.size() / 2, buffer.size() / 2);
+	ASSERT(countDuplicates() == 0, "Plain payloads had duplicate blocks");
+	ASSERT((size_t)std::count(buffer.begin(), buffer.end(), 0) < buffer.size() / 128, "Plain payloads had too many zeros");
+
+	// 4:1 leaves a quarter of each chunk random
+	config.compressionRatio = 4;
+	IOPayloadGenerator compressible(config, ioRand);
+	ASSERT(compressible.getRandomBytesPerChunk() == PAYLOAD_CHUNK_SIZE / 4, "Wrong random bytes per chunk");
+	compressible.fill(buffer.data(), buffer.size());
+	size_t zeros = (size_t)std::count(buffer.begin(), buffer.end(), 0);
+	ASSERT(zeros >= buffer.size() * 3 / 4 && zeros < buffer.size() * 3 / 4 + buffer.size() / 64, "4:1 payloads had the wrong number of zeros");
+	ASSERT(countDuplicates() == 0, "Compressible payloads had duplicate blocks");
+
+	// a small pool makes the duplicates collapse to a few blocks, so about half of the blocks are copies
+	config.compressionRatio = 1;
+	config.dedupPercent = 50;
+	config.poolBlocks = 16;
+	IOPayloadGenerator dedupable(config, ioRand);
+	dedupable.fill(buffer.data(), buffer.size());
+	size_t duplicates = countDuplicates();
+	ASSERT(duplicates > numBlocks * 45 / 100 && duplicates < numBlocks * 55 / 100, "Dedup payloads had " + std::to_string(duplicates) + " duplicates");
+
+	config.dedupPercent = 100;
+	IOPayloadGenerator allDuplicates(config, ioRand);
+	allDuplicates.fill(buffer.data(), buffer.size());
+	ASSERT(countDuplicates() == numBlocks - 16, "100% dedup should only use the pool blocks");
+
+	// a partial last block
+	allDuplicates.fill(buffer.data(), 1000);
+
+	// through a job
+	IO_JOB_CONFIG jobConfig;
+	jobConfig.path = "sim:test_payload_generator,bs=4096,blocks=1024";
+	jobConfig.runtimeSeconds = 0;
+	jobConfig.queueDepth = 8;
+	ASSERT(IOJob::setOption(jobConfig, "rw", "randwrite") && IOJob::setOption(jobConfig, "io_size", "1m") &&
+		IOJob::setOption(jobConfig, "buffer_compress_percentage", "75") && IOJob::setOption(jobConfig, "dedupe_percentage", "20"), "Options were not taken");
+	ASSERT(jobConfig.compressionRatio == 4 && jobConfig.dedupPercent == 20, "Payload options were parsed wrong");
+	ASSERT(!IOJob::setOption(jobConfig, "dedupe_percentage", "101") && !IOJob::setOption(jobConfig, "compress_ratio", "0.5"), "Bad payload options were taken");
+	IOJob job(jobConfig);
+	ASSERT(job.run() && job.getResult().numWrites >= 256 && job.getResult().numErrors == 0, "Payload job failed");
+
+	IO io(jobConfig.path);
+	void* data = io.getAlignedBuffer(4096 * 1024);
+	ASSERT(io.read(0, 1024, data, NULL) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1, "Failed to read back the payload job");
+	size_t written = 0;
+	zeros = 0;
+	for (size_t block = 0; block < 1024; block++)
+	{
+		uint8_t* blockData = (uint8_t*)data + block * 4096;
+		if (std::count(blockData, blockData + 4096, 0) < 4096)
+		{
+			written++;
+			zeros += (size_t)std::count(blockData, blockData + 4096, 0);
+		}
+	}
+	ASSERT(written && zeros >= written * 4096 * 3 / 4, "The payload job's writes weren't compressible");
+	IO::freeAlignedBuffer(data);
+}
+
+void vectored_io(IO_BACKEND_ENUM backend)
+{
+	IO io(TEST_PATH, backend);
+	size_t blockSize = io.getBlockSize();
+	const size_t numBlocks = 8;
+	uint64_t lba = rand() % (io.getBlockCount() - numBlocks);
+
+	// gather the write from 3 separate buffers
+	char* expected = getRandomBuffer(blockSize * numBlocks, &io);
+	size_t writeBlocks[] = { 1, 2, 5 };
+	std::vector<void*> buffers;
+	std::vector<IO_IOVEC> writeVecs;
+	size_t offset = 0;
+	for (size_t blocks : writeBlocks)
+	{
+		void* buffer = io.getAlignedBuffer(blocks * blockSize);
+		memcpy(buffer, expected + offset, blocks * blockSize);
+		buffers.push_back(buffer);
+		writeVecs.push_back({ buffer, blocks * blockSize });
+		offset += blocks * blockSize;
+	}
+
+	static uint32_t errorCode;
+	static uint64_t numBytesXferred;
+	auto callback = [](IO_CALLBACK_STRUCT* ioCallbackStruct) {
+		errorCode = ioCallbackStruct->errorCode;
+		numBytesXferred = ioCallbackStruct->numBytesXferred;
+	};
+	errorCode = 1;
+	ASSERT(io.writev(lba, numBlocks, writeVecs.data(), writeVecs.size(), callback, NULL), "Failed to queue a vectored write");
+	ASSERT(io.poll(1, 1, 1000000) == 1 && errorCode == 0 && numBytesXferred == blockSize * numBlocks, "Vectored write failed");
+
+	// the plain read sees it all in order
+	g_blockSize = blockSize;
+	g_blockCount = numBlocks;
+	g_lba = lba;
+	g_bufferDataToCompare = expected;
+	auto oldCallbackCount = g_numCallbacks;
+	ASSERT(io.read(lba, numBlocks, testCallback) && waitForCallbacks(io, oldCallbackCount + 1), "Plain read of the vectored write failed");
+	g_bufferDataToCompare = NULL;
+
+	// scatter it back into 4 other buffers, staged so the list is used after readv() returns
+	size_t readBlocks[] = { 3, 1, 1, 3 };
+	std::vector<IO_IOVEC> readVecs;
+	for (size_t blocks : readBlocks)
+	{
+		void* buffer = io.getAlignedBuffer(blocks * blockSize);
+		memset(buffer, 0, blocks * blockSize);
+		buffers.push_back(buffer);
+		readVecs.push_back({ buffer, blocks * blockSize });
+	}
+
+	errorCode = 1;
+	io.plug();
+	ASSERT(io.readv(lba, numBlocks, readVecs.data(), readVecs.size(), callback, NULL), "Failed to stage a vectored read");
+	ASSERT(io.unplug() == 1 && io.poll(1, 1, 1000000) == 1 && errorCode == 0 && numBytesXferred == blockSize * numBlocks, "Vectored read failed");
+	offset = 0;
+	for (IO_IOVEC& readVec : readVecs)
+	{
+		ASSERT(memcmp(readVec.iov_base, expected + offset, readVec.iov_len) == 0, "Vectored read came back wrong");
+		offset += readVec.iov_len;
+	}
+
+	// bad lists are turned away
+	IO_IOVEC badVecs[] = { { buffers[0], blockSize }, { buffers[1], blockSize / 2 } };
+	ASSERT(!io.readv(lba, 2, badVecs, 2, callback, NULL), "A buffer that isn't whole blocks was taken");
+	ASSERT(!io.readv(lba, 3, writeVecs.data(), 1, callback, NULL), "Buffers that don't add up were taken");
+	ASSERT(!io.writev(lba, 0, NULL, 0, callback, NULL), "An empty list was taken");
+	ASSERT(io.getNumIosInFlight() == 0 && io.getFreeRequestCount() == DEFAULT_REQUEST_POOL_SIZE, "A bad list leaked a request");
+
+	for (void* buffer : buffers)
+	{
+		IO::freeAlignedBuffer(buffer);
+	}
+	IO::freeAlignedBuffer(expected);
+}
+
+void test_vectored_io()
+{
+	vectored_io(IO_BACKEND_DEFAULT);
+}
+
+void test_vectored_io_io_uring()
+{
+	vectored_io(IO_BACKEND_IO_URING);
+}
+
+void test_vectored_io_checksum()
+{
+	const std::string path = "sim:test_vectored_io_checksum,bs=512,blocks=1024";
+	IO io(path);
+	ASSERT(io.setChecksumTable(std::make_shared<IOChecksumTable>(io.getBlockCount(), io.getBlockSize())), "Couldn't set the checksum table");
+
+	std::vector<uint8_t> first(512 * 2);
+	std::vector<uint8_t> second(512 * 3);
+	IORand ioRand(3);
+	ioRand.fillBuffer((char*)first.data(), first.size());
+	ioRand.fillBuffer((char*)second.data(), second.size());
+	IO_IOVEC ioVecs[] = { { first.data(), first.size() }, { second.data(), second.size() } };
+
+	static uint32_t errorCode;
+	auto callback = [](IO_CALLBACK_STRUCT* ioCallbackStruct) { errorCode = ioCallbackStruct->errorCode; };
+	ASSERT(io.writev(10, 5, ioVecs, 2, callback, NULL) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1 && errorCode == 0, "Vectored write failed");
+	ASSERT(io.getChecksumTable()->get(12) == ioCrc32c(second.data(), 512), "Vectored write wasn't checksummed per buffer");
+
+	// split differently on the way back
+	std::vector<uint8_t> readBack(512 * 5);
+	IO_IOVEC readVecs[] = { { readBack.data(), 512 }, { readBack.data() + 512, 512 * 4 } };
+	ASSERT(io.readv(10, 5, readVecs, 2, callback, NULL) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1 && errorCode == 0, "Vectored read failed its checksums");
+
+	// a stale entry for one block in the middle
+	ASSERT(io.writev(20, 5, ioVecs, 2, NULL, NULL) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1, "Vectored write failed");
+	io.getChecksumTable()->update(readBack.data(), 21, 1);
+	ASSERT(io.readv(20, 5, readVecs, 2, callback, NULL) && io.poll(1, 1, IO_POLL_WAIT_FOREVER) == 1 && errorCode == IO_ERROR_CHECKSUM_MISMATCH, "Vectored read missed a bad checksum");
+}
+
+void merge_adjacent_ios(IO_BACKEND_ENUM backend)
+{
+	IO io(TEST_PATH, backend);
+	size_t blockSize = io.getBlockSize();
+	const size_t numIos = 16;
+	const size_t blocksPerIo = 2;
+	uint64_t lba = rand() % (io.getBlockCount() - numIos * blocksPerIo);
+	ASSERT(io.setMaxMergeBytes(numIos * blocksPerIo * blockSize), "Couldn't turn on merging");
+
+	char* expected = getRandomBuffer(numIos * blocksPerIo * blockSize, &io);
+	std::vector<void*> buffers;
+	for (size_t i = 0; i < numIos; i++)
+	{
+		buffers.push_back(io.getAlignedBuffer(blocksPerIo * blockSize));
+	}
+
+	static size_t numGood;
+	numGood = 0;
+	auto callback = [](IO_CALLBACK_STRUCT* ioCallbackStruct) { numGood += ioCallbackStruct->succeeded(); };
+
+	// returns once everything is called back. A second at most
+	auto waitForAll = [&]() {
+		for (size_t i = 0; i < 1000 && io.getNumIosInFlight(); i++)
+		{
+			io.poll(1, DEFAULT_POLL_MAX_EVENTS, 1000);
+		}
+		return io.getNumIosInFlight() == 0;
+	};
+
+	// out of order, so only sorting makes them adjacent
+	std::vector<size_t> order;
+	for (size_t i = 0; i < numIos; i++)
+	{
+		order.push_back((i * 7) % numIos);
+	}
+
+#if IO_ENABLE_STATS
+	io.resetIoStats();
+#endif // IO_ENABLE_STATS
+	io.plug();
+	for (size_t i : order)
+	{
+		memcpy(buffers[i], expected + i * blocksPerIo * blockSize, blocksPerIo * blockSize);
+		ASSERT(io.write(lba + i * blocksPerIo, blocksPerIo, buffers[i], callback), "Failed to stage a write");
+	}
+	// one OS completion, but poll() counts (and waits for) the IOs called back
+	ASSERT(io.unplug() == numIos, "Merged writes weren't queued");
+	ASSERT(io.poll(numIos, numIos, IO_POLL_WAIT_FOREVER) == numIos && io.getNumIosInFlight() == 0 && numGood == numIos, "Merged writes didn't all complete");
+#if IO_ENABLE_STATS
+	ASSERT(io.snapshotIoStats().NumberOfMergedIos == numIos - 1, "The writes weren't merged into one");
+#endif // IO_ENABLE_STATS
+
+	g_blockSize = blockSize;
+	g_blockCount = numIos * blocksPerIo;
+	g_lba = lba;
+	g_bufferDataToCompare = expected;
+	auto oldCallbackCount = g_numCallbacks;
+	ASSERT(io.read(lba, numIos * blocksPerIo, testCallback) && waitForCallbacks(io, oldCallbackCount + 1), "Merged writes didn't land in order");
+	g_bufferDataToCompare = NULL;
+
+	// reads merge too, and a cap splits them up
+	ASSERT(io.setMaxMergeBytes(4 * blocksPerIo * blockSize), "Couldn't change the merge size");
+	numGood = 0;
+#if IO_ENABLE_STATS
+	io.resetIoStats();
+#endif // IO_ENABLE_STATS
+	io.plug();
+	for (size_t i : order)
+	{
+		memset(buffers[i], 0, blocksPerIo * blockSize);
+		ASSERT(io.read(lba + i * blocksPerIo, blocksPerIo, buffers[i], callback), "Failed to stage a read");
+	}
+	ASSERT(io.unplug() == numIos && waitForAll() && numGood == numIos, "Merged reads didn't all complete");
+#if IO_ENABLE_STATS
+	ASSERT(io.snapshotIoStats().NumberOfMergedIos == numIos - numIos / 4, "The reads weren't merged 4 at a time");
+#endif // IO_ENABLE_STATS
+	for (size_t i = 0; i < numIos; i++)
+	{
+		ASSERT(memcmp(buffers[i], expected + i * blocksPerIo * blockSize, blocksPerIo * blockSize) == 0, "A merged read came back wrong");
+	}
+
+	for (void* buffer : buffers)
+	{
+		IO::freeAlignedBuffer(buffer);
+	}
+	IO::freeAlignedBuffer(expected);
+}
+
+void test_merge_adjacent_ios()
+{
+	merge_adjacent_ios(IO_BACKEND_DEFAULT);
+}
+
+void test_merge_adjacent_ios_io_uring()
+{
+	merge_adjacent_ios(IO_BACKEND_IO_URING);
+}
+
+void test_merge_failures()
+{
+	IO io("sim:test_merge_failures,bs=512,blocks=64");
+	io.setMaxMergeBytes(1 << 20);
+
+	static size_t numFailed;
+	static size_t numCallbacks;
+	numFailed = 0;
+	numCallbacks = 0;
+	auto callback = [](IO_CALLBACK_STRUCT* ioCallbackStruct) { numFailed += ioCallbackStruct->failed(); numCallbacks++; };
+
+	// a bad block fails everything merged with it, and nothing else
+	std::shared_ptr<IOSimulatedDevice> device = IOSimulatedDevice::open("sim:test_merge_failures");
+	device->addBadBlocks(10, 1);
+	void* buffer = io.getAlignedBuffer(512 * 8);
+	io.plug();
+	for (uint64_t lba = 8; lba < 16; lba += 2)
+	{
+		ASSERT(io.write(lba, 2, (uint8_t*)buffer + (lba - 8) * 512, callback), "Failed to stage a write");
+	}
+	ASSERT(io.write(40, 1, buffer, callback), "Failed to stage a write");
+	io.unplug();
+	ASSERT(io.getNumIosInFlight() == 5, "Merged IOs should each count as in flight");
+	ASSERT(io.poll(5, 5, IO_POLL_WAIT_FOREVER) == 5 && io.getNumIosInFlight() == 0, "poll() should count each merged IO called back");
+	ASSERT(numCallbacks == 5 && numFailed == 4, "A failed merged IO should fail each IO in it");
+	device->clearBadBlocks();
+
+	// an IO past the end is merged with the ones before it and fails them all before any are queued
+	numCallbacks = 0;
+	numFailed = 0;
+	ASSERT(io.getFreeRequestCount() == DEFAULT_REQUEST_POOL_SIZE, "Merged IOs leaked requests");
+	io.plug();
+	ASSERT(io.write(60, 4, buffer, callback) && io.write(64, 4, buffer, callback), "Failed to stage a write");
+	io.unplug();
+	while (io.getNumIosInFlight())
+	{
+		io.poll(1, 1, IO_POLL_WAIT_FOREVER);
+	}
+	ASSERT(numCallbacks == 2 && numFailed == 2, "An IO past the end should fail its merged IO");
+	ASSERT(io.getFreeRequestCount() == DEFAULT_REQUEST_POOL_SIZE, "Merged IOs leaked requests");
+	IO::freeAlignedBuffer(buffer);
+}
+
+void test_merge_job()
+{
+	IO_JOB_CONFIG config;
+	config.path = "sim:test_merge_job,bs=4096,blocks=4096";
+	config.verify = true;
+	config.runtimeSeconds = 0;
+	config.queueDepth = 32;
+	config.lbaCount = 1024 * 4096;
+	ASSERT(IOJob::setOption(config, "merge_bytes", "256k") && config.maxMergeBytes == 256 * 1024, "merge_bytes was not taken");
+	ASSERT(!IOJob::setOption(config, "merge_bytes", "lots"), "A bad merge_bytes was taken");
+
+	// sequential IOs at depth are all adjacent, so both jobs merge nearly everything
+	ASSERT(IOJob::setOption(config, "rw", "write") && IOJob::setOption(config, "bs", "4k") && IOJob::setOption(config, "io_size", "4m"), "Options were not taken");
+	IOJob writer(config);
+	ASSERT(writer.run(), "Merged write job did not run");
+	ASSERT(writer.getResult().numWrites >= 1024 && writer.getResult().numErrors == 0, "Merged write job didn't write everything");
+
+	ASSERT(IOJob::setOption(config, "rw", "read"), "Options were not taken");
+	IOJob reader(config);
+	ASSERT(reader.run(), "Merged read job did not run");
+	ASSERT(reader.getResult().numReads >= 1024 && reader.getResult().numVerifyErrors == 0, "Merged read job found errors: " + reader.getResult().firstVerifyError);
+}
+
+void test_io_lba_generator()
+{
+	std::shared_ptr<IO> io(new IO(TEST_PATH));
+	for (uint64_t seed = 0; seed < 1000; seed+=50)
+	{
+		std::shared_ptr<IORand> ioRand(new IORand(seed));
+
+		uint64_t maxLba = 100;
+		uint64_t numBlocks = 4;
+		IOLBAGenerator ioLbaGenerator(io, ioRand, maxLba);
+
+		uint64_t numSeqGenerationsPossible = (uint64_t)floor(maxLba / (double)numBlocks);
+
+		for (uint64_t i = 0; i < numSeqGenerationsPossible; i++)
+		{
+			ASSERT(i * numBlocks == ioLbaGenerator.generateSequentialLba(numBlocks), "Sequential LBA not properly generated");
+		}
+
+		try
+		{
+			ioLbaGenerator.generateSequentialLba(numBlocks);
+			ASSERT(false, "runtime_error was not raised when sequential LBA could not be found");
+		}
+		catch (const std::runtime_error&)
+		{
+			// if we get here, good
+		}
+
+		// maxLba is inclusive, so the last IO can start one later than the last one that was given
+		ioLbaGenerator.removeInUseLba(maxLba - numBlocks, numBlocks);
+		ASSERT(ioLbaGenerator.generateSequentialLba(numBlocks) == maxLba + 1 - numBlocks, "After removal, still couldn't find a max lba");
+
+		// remove half
+		ioLbaGenerator.removeInUseLba(maxLba / 2, maxLba / 2);
+
+		// get random lbas
+		uint64_t minRandomGenerationsPossible = (maxLba / 2) / numBlocks / 2;
+		for (uint64_t i = 0; i < minRandomGenerationsPossible; i++)
+		{
+			uint64_t lba = ioLbaGenerator.generateRandomLba(numBlocks);
+			ASSERT(lba >= maxLba / 2, "Random lba doesn't seem possible for given parameters");
+		}
+	}
+}
+
+int main()
+{
+	std::cout << "Running tests!" << std::endl;
+	auto seed = time(NULL);
+	std::cout << "Seed: " << seed << std::endl;
+	srand((unsigned)seed);
 
 	RUN_TEST(test_blocksize_and_blockcount_legit);
 	RUN_TEST(test_write_then_read);
+	RUN_TEST(test_write_then_read_io_uring);
+	RUN_TEST(test_batch_then_plugged_reads);
+	RUN_TEST(test_batch_then_plugged_reads_io_uring);
+	RUN_TEST(test_request_pool_back_pressure);
+	RUN_TEST(test_read_into_caller_buffer);
+	RUN_TEST(test_destroy_with_io_in_flight);
+	RUN_TEST(test_destroy_with_io_in_flight_io_uring);
+	RUN_TEST(test_poll_min_events_and_timeout);
+	RUN_TEST(test_poll_min_events_and_timeout_io_uring);
+#ifdef IO_LINUX
+	RUN_TEST(test_completion_fd);
+	RUN_TEST(test_completion_fd_io_uring);
+#endif // IO_LINUX
+	RUN_TEST(test_simulated_device);
+	RUN_TEST(test_simulated_latency_model);
+	RUN_TEST(test_ring_queue);
+	RUN_TEST(test_multi_producer_submission);
+	RUN_TEST(test_submission_queue_backpressure);
+	RUN_TEST(test_submission_queue_backpressure_io_uring);
+	RUN_TEST(test_multi_queue);
 	RUN_TEST(test_aligned_memory);
+	RUN_TEST(test_latency_histogram);
+#if IO_ENABLE_STATS
+	RUN_TEST(test_completion_stats);
+	RUN_TEST(test_sharded_stats_threads);
+#endif // IO_ENABLE_STATS
 	RUN_TEST(test_iorand);
+	RUN_TEST(test_iorand_engines);
+	RUN_TEST(test_iorand_fill_buffer);
+	RUN_TEST(test_iorand_bounded);
+	RUN_TEST(test_interval_set);
+	RUN_TEST(test_permutation);
+	RUN_TEST(test_lba_distributions);
+	RUN_TEST(test_random_lba_range);
+	RUN_TEST(test_sequential_streams);
 	RUN_TEST(test_io_lba_generator);
+	RUN_TEST(test_job);
+	RUN_TEST(test_job_queue_depth);
+	RUN_TEST(test_job_file);
+	RUN_TEST(test_verify);
+	RUN_TEST(test_verify_job);
+	RUN_TEST(test_crc32c);
+	RUN_TEST(test_checksum_table);
+	RUN_TEST(test_checksum_io);
+	RUN_TEST(test_payload_generator);
+	RUN_TEST(test_vectored_io);
+	RUN_TEST(test_vectored_io_io_uring);
+	RUN_TEST(test_vectored_io_checksum);
+	RUN_TEST(test_merge_adjacent_ios);
+	RUN_TEST(test_merge_adjacent_ios_io_uring);
+	RUN_TEST(test_merge_failures);
+	RUN_TEST(test_merge_job);
 
 	return EXIT_SUCCESS;
 }